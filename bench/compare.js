@@ -0,0 +1,56 @@
+// Compares two bench/index.js result files and fails if anything got slower.
+//
+//   node bench/compare.js baseline.json current.json [--threshold=10]
+
+var fs = require('fs');
+
+function resultKey(result) {
+  return result.name + ' @' + result.sensors;
+}
+
+function percentChange(before, after) {
+  return before > 0 ? 100 * (after - before) / before : 0;
+}
+
+function main() {
+  var files = process.argv.slice(2).filter(function (arg) { return !arg.startsWith('--'); });
+  var thresholdArg = process.argv.find(function (arg) { return arg.startsWith('--threshold='); });
+  var threshold = thresholdArg ? Number(thresholdArg.split('=')[1]) : 10;
+
+  if (files.length != 2) {
+    console.error('usage: node bench/compare.js <baseline.json> <current.json> [--threshold=<percent>]');
+    process.exit(2);
+  }
+
+  var baseline = JSON.parse(fs.readFileSync(files[0]));
+  var current = JSON.parse(fs.readFileSync(files[1]));
+
+  var baselineResults = {};
+  baseline.results.forEach(function (result) {
+    baselineResults[resultKey(result)] = result;
+  });
+
+  var regressions = 0;
+  current.results.forEach(function (result) {
+    var before = baselineResults[resultKey(result)];
+    if (before == null) return;
+
+    var p50Change = percentChange(before.p50Ns, result.p50Ns);
+    var p99Change = percentChange(before.p99Ns, result.p99Ns);
+    var allocChange = percentChange(before.allocBytesPerOp, result.allocBytesPerOp);
+    var bRegressed = p50Change > threshold || allocChange > threshold;
+
+    if (bRegressed) regressions++;
+
+    console.log(
+      (bRegressed ? 'REGRESSED ' : '          ') +
+      resultKey(result).padEnd(48) +
+      ' p50 ' + p50Change.toFixed(1).padStart(7) + '%' +
+      ' p99 ' + p99Change.toFixed(1).padStart(7) + '%' +
+      ' alloc ' + allocChange.toFixed(1).padStart(7) + '%');
+  });
+
+  process.exit(regressions > 0 ? 1 : 0);
+}
+
+main();
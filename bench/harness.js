@@ -0,0 +1,149 @@
+// Timing helpers shared by the benchmarks in this directory
+
+var v8 = require('v8');
+
+// Scavenges run well before new space fills, so keep allocation sampling chunks small
+var ALLOCATION_CHUNK_OPS = 16;
+
+function sleepMs(ms) {
+  Atomics.wait(new Int32Array(new SharedArrayBuffer(4)), 0, 0, ms);
+}
+
+function collectGarbage() {
+  if (typeof global.gc === 'function') {
+    global.gc();
+    global.gc();
+  }
+}
+
+function percentile(sortedValues, fraction) {
+  if (sortedValues.length == 0) {
+    return 0;
+  }
+
+  var index = Math.min(sortedValues.length - 1, Math.floor(fraction * sortedValues.length));
+  return sortedValues[index];
+}
+
+// Runs fn `iterations` times after `warmup` untimed runs. fn returns either nothing or
+// { frames, samples } describing how much sensor data that run moved.
+function measure(name, options, fn) {
+  var warmup = options.warmup || 0;
+  var iterations = options.iterations || 1000;
+  var between = options.between || null;
+
+  for (var i = 0; i < warmup; i++) {
+    if (between) between();
+    fn();
+  }
+
+  collectGarbage();
+  var heapBefore = process.memoryUsage().heapUsed;
+
+  var latenciesNs = new Float64Array(iterations);
+  var frames = 0;
+  var samples = 0;
+  var totalNs = 0;
+
+  // Allocation estimate: heap growth over chunks of ops that didn't see a GC
+  var allocatedBytes = 0;
+  var allocationSampleOps = 0;
+  var chunkOps = 0;
+  var chunkHeapStart = process.memoryUsage().heapUsed;
+
+  for (var i = 0; i < iterations; i++) {
+    if (between) between();
+
+    var start = process.hrtime.bigint();
+    var result = fn();
+    var elapsed = Number(process.hrtime.bigint() - start);
+
+    latenciesNs[i] = elapsed;
+    totalNs += elapsed;
+    if (result) {
+      frames += result.frames || 0;
+      samples += result.samples || 0;
+    }
+
+    chunkOps++;
+    if (chunkOps == ALLOCATION_CHUNK_OPS || i == iterations - 1) {
+      var chunkHeapEnd = process.memoryUsage().heapUsed;
+
+      if (chunkHeapEnd >= chunkHeapStart) {
+        allocatedBytes += chunkHeapEnd - chunkHeapStart;
+        allocationSampleOps += chunkOps;
+      }
+
+      chunkOps = 0;
+      chunkHeapStart = process.memoryUsage().heapUsed;
+    }
+  }
+
+  collectGarbage();
+  var heapAfter = process.memoryUsage().heapUsed;
+
+  var sorted = Array.from(latenciesNs).sort(function (a, b) { return a - b; });
+  var totalSeconds = totalNs / 1e9;
+
+  return {
+    name: name,
+    iterations: iterations,
+    meanNs: totalNs / iterations,
+    p50Ns: percentile(sorted, 0.50),
+    p99Ns: percentile(sorted, 0.99),
+    maxNs: sorted[sorted.length - 1],
+    opsPerSec: totalSeconds > 0 ? iterations / totalSeconds : 0,
+    frames: frames,
+    samples: samples,
+    framesPerSec: totalSeconds > 0 ? frames / totalSeconds : 0,
+    nsPerSample: samples > 0 ? totalNs / samples : 0,
+    allocBytesPerOp: allocationSampleOps > 0 ? allocatedBytes / allocationSampleOps : 0,
+    heapGrowthBytes: heapAfter - heapBefore,
+    gcExposed: typeof global.gc === 'function'
+  };
+}
+
+function formatNs(ns) {
+  if (ns >= 1e6) return (ns / 1e6).toFixed(2) + 'ms';
+  if (ns >= 1e3) return (ns / 1e3).toFixed(2) + 'us';
+  return ns.toFixed(0) + 'ns';
+}
+
+function printResult(result) {
+  var line = result.name.padEnd(40) +
+    ' p50 ' + formatNs(result.p50Ns).padStart(9) +
+    ' p99 ' + formatNs(result.p99Ns).padStart(9);
+
+  if (result.samples > 0) {
+    line += ' ' + formatNs(result.nsPerSample).padStart(8) + '/sample' +
+      ' ' + result.framesPerSec.toFixed(0).padStart(9) + ' frames/s';
+  }
+  else {
+    line += ' ' + result.opsPerSec.toFixed(0).padStart(9) + ' ops/s';
+  }
+
+  line += ' ' + (result.allocBytesPerOp / 1024).toFixed(2).padStart(8) + 'KB/op' +
+    ' heap ' + (result.heapGrowthBytes >= 0 ? '+' : '') + (result.heapGrowthBytes / 1024).toFixed(1) + 'KB';
+
+  console.error(line);
+}
+
+function getEnvironmentInfo() {
+  var heap = v8.getHeapStatistics();
+
+  return {
+    node: process.version,
+    v8: process.versions.v8,
+    platform: process.platform,
+    arch: process.arch,
+    heapSizeLimit: heap.heap_size_limit
+  };
+}
+
+module.exports = {
+  sleepMs: sleepMs,
+  collectGarbage: collectGarbage,
+  measure: measure,
+  printResult: printResult,
+  getEnvironmentInfo: getEnvironmentInfo
+};
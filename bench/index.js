@@ -0,0 +1,306 @@
+// Benchmarks the N-API marshalling hot paths against the HSL simulator build.
+//
+//   npm run build:sim
+//   npm run bench -- --sensors=1,10,100 > results.json
+//
+// Progress and a readable summary go to stderr, machine readable results to stdout
+// (or --out=<file>). Compare two result files with bench/compare.js.
+
+var fs = require('fs');
+var harness = require('./harness');
+var hsl = require('..');
+
+function parseArgs(argv) {
+  var args = {
+    sensors: [1, 10, 100],
+    iterations: 500,
+    duration: 5,
+    sseClients: 4,
+    only: null,
+    out: null
+  };
+
+  argv.forEach(function (arg) {
+    var match = /^--([^=]+)=(.*)$/.exec(arg);
+    if (match == null) return;
+
+    var key = match[1];
+    var value = match[2];
+    if (key == 'sensors') args.sensors = value.split(',').map(Number);
+    else if (key == 'iterations') args.iterations = Number(value);
+    else if (key == 'duration') args.duration = Number(value);
+    else if (key == 'sse-clients') args.sseClients = Number(value);
+    else if (key == 'only') args.only = new RegExp(value);
+    else if (key == 'out') args.out = value;
+  });
+
+  return args;
+}
+
+var ALL_DATA_STREAMS = [
+  hsl.Sensor.StreamFlags_HRData,
+  hsl.Sensor.StreamFlags_ECGData,
+  hsl.Sensor.StreamFlags_PPGData,
+  hsl.Sensor.StreamFlags_PPIData,
+  hsl.Sensor.StreamFlags_AccData
+];
+
+var BUFFER_GETTERS = [
+  { name: 'getHRData', buffer: function (s) { return s.getHeartRateBuffer(); }, read: function (it) { return it.getHRData().RRIntervals.length; } },
+  { name: 'getECGData', buffer: function (s) { return s.getHeartECGBuffer(); }, read: function (it) { return it.getECGData().ecgValues.length; } },
+  { name: 'getPPGData', buffer: function (s) { return s.getHeartPPGBuffer(); }, read: function (it) { return it.getPPGData().ppgSamples.length; } },
+  { name: 'getPPGColumns', buffer: function (s) { return s.getHeartPPGBuffer(); }, read: function (it) { return it.getPPGColumns().ambient.length; } },
+  { name: 'getPPIData', buffer: function (s) { return s.getHeartPPIBuffer(); }, read: function (it) { return it.getPPIData().ppiSamples.length; } },
+  { name: 'getAccData', buffer: function (s) { return s.getHeartAccBuffer(); }, read: function (it) { return it.getAccData().accSamples.length; } },
+  { name: 'getAccColumns', buffer: function (s) { return s.getHeartAccBuffer(); }, read: function (it) { return it.getAccColumns().x.length; } },
+  { name: 'getHrvData', buffer: function (s) { return s.getHeartHrvBuffer(hsl.Sensor.HRVFilter_RMSSD); }, read: function (it) { it.getHrvData(); return 1; } }
+];
+
+function getSensors() {
+  var sensorList = hsl.getSensorList();
+  var sensors = [];
+
+  for (var i = 0; i < sensorList.getSensorCount(); i++) {
+    var sensor = sensorList.getSensor(i);
+    if (sensor != null) sensors.push(sensor);
+  }
+
+  return sensors;
+}
+
+function startAllStreams(sensors) {
+  sensors.forEach(function (sensor) {
+    ALL_DATA_STREAMS.forEach(function (stream) {
+      if (sensor.hasCapability(stream)) sensor.setDataStreamActive(stream, true);
+    });
+    sensor.setFilterStreamActive(hsl.Sensor.HRVFilter_RMSSD, true);
+  });
+}
+
+function flushAllBuffers(sensors) {
+  sensors.forEach(function (sensor) {
+    sensor.flushHeartRateBuffer();
+    sensor.flushHeartECGBuffer();
+    sensor.flushHeartPPGBuffer();
+    sensor.flushHeartPPIBuffer();
+    sensor.flushHeartAccBuffer();
+    sensor.flushHeartHrvBuffer(hsl.Sensor.HRVFilter_RMSSD);
+  });
+}
+
+function runUpdates(seconds) {
+  var end = Date.now() + seconds * 1000;
+
+  while (Date.now() < end) {
+    hsl.update();
+    harness.sleepMs(10);
+  }
+}
+
+// Leaves every HSL buffer holding frames so the getters have something to walk
+function fillBuffers(sensors) {
+  if (hsl.isSimulator) {
+    // Crank the simulated rates up so the buffers fill in a second rather than minutes
+    var settings = hsl.getSimulatorSettings();
+
+    hsl.setSimulatorSettings({ ecgSampleRate: 13000, ppgSampleRate: 13500, accSampleRate: 5000, hrFrameRate: 100 });
+    runUpdates(1.5);
+    hsl.setSimulatorSettings(settings);
+  }
+  else {
+    runUpdates(10);
+  }
+}
+
+function benchBufferGetters(args, sensors, results) {
+  BUFFER_GETTERS.forEach(function (getter) {
+    var name = 'BufferIterator.' + getter.name;
+    if (args.only && !args.only.test(name)) return;
+
+    results.push(harness.measure(name, { warmup: 20, iterations: args.iterations }, function () {
+      var frames = 0;
+      var samples = 0;
+
+      for (var i = 0; i < sensors.length; i++) {
+        for (var it = getter.buffer(sensors[i]); it.isValid(); it.next()) {
+          samples += getter.read(it);
+          frames++;
+        }
+      }
+
+      return { frames: frames, samples: samples };
+    }));
+  });
+}
+
+function benchSensorList(args, results) {
+  var name = 'getSensorList';
+  if (args.only && !args.only.test(name)) return;
+
+  results.push(harness.measure(name, { warmup: 20, iterations: args.iterations }, function () {
+    var sensorList = hsl.getSensorList();
+
+    for (var i = 0; i < sensorList.getSensorCount(); i++) {
+      sensorList.getSensor(i);
+    }
+  }));
+}
+
+function benchPollNextMessage(args, sensorCount, results) {
+  if (!args.only || args.only.test('pollNextMessage (empty)')) {
+    results.push(harness.measure('pollNextMessage (empty)', { warmup: 100, iterations: args.iterations * 10 }, function () {
+      hsl.pollNextMessage();
+    }));
+  }
+
+  // Queue a pair of sensor list events before each run by adding and removing a virtual sensor
+  var queuedNames = ['pollNextMessage (queued)', 'pollAllMessages (queued)'];
+  if (hsl.isSimulator && (!args.only || queuedNames.some(function (name) { return args.only.test(name); }))) {
+    var queueEvents = function () {
+      hsl.setSimulatorSettings({ sensorCount: sensorCount + 1 });
+      hsl.updateNoPollEvents();
+      hsl.setSimulatorSettings({ sensorCount: sensorCount });
+      hsl.updateNoPollEvents();
+    };
+
+    if (!args.only || args.only.test('pollNextMessage (queued)')) {
+      results.push(harness.measure('pollNextMessage (queued)', { warmup: 10, iterations: args.iterations, between: queueEvents }, function () {
+        var count = 0;
+
+        while (hsl.pollNextMessage() != null) {
+          count++;
+        }
+
+        return { frames: count, samples: count };
+      }));
+    }
+
+    if (!args.only || args.only.test('pollAllMessages (queued)')) {
+      results.push(harness.measure('pollAllMessages (queued)', { warmup: 10, iterations: args.iterations, between: queueEvents }, function () {
+        var count = hsl.pollAllMessages().length;
+
+        return { frames: count, samples: count };
+      }));
+    }
+
+    // Let HSLSensorClient users see a consistent list again
+    hsl.update();
+  }
+}
+
+// HSLSensorClient.update() drains every sensor and pushes each batch through
+// HSLHttpServer.handleSensorData, which serializes it once and shares it across clients.
+// transport is "sse" (JSON text) or "websocket" (delta encoded binary frames).
+function benchEndToEnd(args, sensors, results, transport) {
+  var name = 'HSLSensorClient.update -> ' + (transport == "websocket" ? 'WebSocket' : 'SSE');
+  if (args.only && !args.only.test(name)) return;
+
+  var server = new hsl.HSLHttpServer(0, { nativePolling: false });
+  var client = server.hslClient;
+  var bytesWritten = 0;
+  var frames = 0;
+  var samples = 0;
+
+  for (var i = 0; i < args.sseClients; i++) {
+    server.addClient({
+      write: function (str) { bytesWritten += str.length; return true; },
+      end: function () { }
+    }, transport);
+  }
+
+  client.addListener(server, server.handleSensorData);
+  client.addListener(null, function (sensorData) {
+    frames += sensorData.stream.frameCount;
+    samples += sensorData.stream.sampleCount;
+  });
+
+  client.refreshSensorList();
+  startAllStreams(client.sensors);
+  flushAllBuffers(client.sensors);
+
+  var tickMs = client.updateIntervalMs;
+  var nextTick = Date.now() + tickMs;
+  var waitForTick = function () {
+    harness.sleepMs(Math.max(nextTick - Date.now(), 0));
+    nextTick += tickMs;
+  };
+
+  var result = harness.measure(name, { warmup: 5, iterations: Math.max(Math.round(args.duration * 1000 / tickMs), 1), between: waitForTick }, function () {
+    frames = 0;
+    samples = 0;
+    client.update();
+
+    return { frames: frames, samples: samples };
+  });
+
+  result.sseClients = args.sseClients;
+  result.sseBytesPerUpdate = bytesWritten / result.iterations;
+  results.push(result);
+
+  client.sensors.forEach(function (sensor) { sensor.stopAllStreams(); });
+}
+
+function runSuite(args, sensorCount) {
+  if (hsl.isSimulator) {
+    hsl.setSimulatorSettings({ sensorCount: sensorCount });
+    hsl.update();
+  }
+
+  var sensors = getSensors();
+  console.error('\n== ' + sensors.length + ' sensor(s)');
+
+  startAllStreams(sensors);
+  fillBuffers(sensors);
+
+  var results = [];
+  benchBufferGetters(args, sensors, results);
+  benchSensorList(args, results);
+  benchPollNextMessage(args, sensors.length, results);
+  benchEndToEnd(args, sensors, results, "sse");
+  benchEndToEnd(args, sensors, results, "websocket");
+
+  sensors.forEach(function (sensor) { sensor.stopAllStreams(); });
+  flushAllBuffers(sensors);
+
+  results.forEach(function (result) {
+    result.sensors = sensors.length;
+    harness.printResult(result);
+  });
+
+  return results;
+}
+
+function main() {
+  var args = parseArgs(process.argv.slice(2));
+
+  if (!hsl.isSimulator) {
+    console.error('[WARNING] Addon not built with the simulator (npm run build:sim), benchmarking connected sensors only');
+    args.sensors = [0];
+  }
+  if (typeof global.gc !== 'function') {
+    console.error('[WARNING] Run node with --expose-gc for accurate heap growth numbers');
+  }
+
+  var report = {
+    timestamp: new Date().toISOString(),
+    hslVersion: hsl.getVersionString(),
+    simulator: hsl.isSimulator,
+    environment: harness.getEnvironmentInfo(),
+    config: { iterations: args.iterations, duration: args.duration, sseClients: args.sseClients },
+    results: []
+  };
+
+  args.sensors.forEach(function (sensorCount) {
+    report.results = report.results.concat(runSuite(args, sensorCount));
+  });
+
+  var json = JSON.stringify(report, null, 2);
+  if (args.out) {
+    fs.writeFileSync(args.out, json);
+  }
+  else {
+    process.stdout.write(json + '\n');
+  }
+}
+
+main();
@@ -8,6 +8,7 @@
 #  HSL_INCLUDE_DIR
 #  HSL_BINARIES_DIR
 #  HSL_LIBRARIES
+#  HSL_SIMULATOR_SOURCES (only when HSL_USE_SIMULATOR is ON)
 #
 # Requires these CMake modules:
 #  FindPackageHandleStandardArgs (known included with CMake >=2.6.2)
@@ -17,7 +18,17 @@
 
 message(STATUS "Finding HeartSensorLibrary, CMAKE_CURRENT_LIST_DIR=${CMAKE_CURRENT_LIST_DIR}/../../../deps/HeartSensorLibrary/src/HeartSensorLibrary")
 
-IF (HSL_INCLUDE_DIR AND HSL_LIBRARIES AND HSL_BINARIES_DIR)
+IF (HSL_USE_SIMULATOR)
+    # Compile the in-tree simulator into the addon instead of linking the SDK
+    set(HSL_SIMULATOR_DIR ${CMAKE_CURRENT_LIST_DIR}/../src/simulator)
+    set(HSL_INCLUDE_DIR ${HSL_SIMULATOR_DIR}/include ${HSL_SIMULATOR_DIR})
+    file(GLOB HSL_SIMULATOR_SOURCES "${HSL_SIMULATOR_DIR}/*.cpp" "${HSL_SIMULATOR_DIR}/*.h")
+    set(HSL_LIBRARIES "")
+    set(HSL_BINARIES_DIR "")
+    set(HSL_FOUND TRUE)
+    message(STATUS "Using the HeartSensorLibrary simulator")
+
+ELSEIF (HSL_INCLUDE_DIR AND HSL_LIBRARIES AND HSL_BINARIES_DIR)
     # in cache already
     set(HSL_FOUND TRUE)
 
@@ -101,4 +112,4 @@ ELSE (HSL_INCLUDE_DIR AND HSL_LIBRARIES AND HSL_BINARIES_DIR)
 
     MARK_AS_ADVANCED(HSL_INCLUDE_DIR HSL_LIBRARIES)           
      
-ENDIF (HSL_INCLUDE_DIR AND HSL_LIBRARIES AND HSL_BINARIES_DIR)
\ No newline at end of file
+ENDIF (HSL_USE_SIMULATOR)
\ No newline at end of file
@@ -7,92 +7,509 @@ var path = require('path');
 var baseDirectory = path.join(__dirname, "public");
 var net = require('net');
 var http = require('http');
+var crypto = require('crypto');
 // .extend adds a .withShutdown prototype method to the Server object
 require('http-shutdown').extend();
 
+// Typed arrays from the drain API serialize as plain JSON arrays
+function sensorDataReplacer(key, value) {
+  return ArrayBuffer.isView(value) ? Array.from(value) : value;
+}
+
+// Stream names used when publishing, keyed by HSLSensorBufferType
+var streamTypeNames = {};
+streamTypeNames[hsl.BufferIterator.BufferType_HRData] = "hr";
+streamTypeNames[hsl.BufferIterator.BufferType_ECGData] = "ecg";
+streamTypeNames[hsl.BufferIterator.BufferType_PPGData] = "ppg";
+streamTypeNames[hsl.BufferIterator.BufferType_PPIData] = "ppi";
+streamTypeNames[hsl.BufferIterator.BufferType_AccData] = "acc";
+streamTypeNames[hsl.BufferIterator.BufferType_HRVData] = "hrv";
+
+// Streams made of evenly spaced samples, the only ones a target sample rate or chart applies to
+var waveformStreamTypes = ["ecg", "ppg", "acc"];
+
+// Channels per sample of each waveform stream (ECG: value, PPG: ppgValue0-2 + ambient, Acc: x/y/z)
+var waveformChannelCounts = { ecg: 1, ppg: 4, acc: 3 };
+
+var ChartMode = {
+  Envelope: "envelope", // Min and max of each point's time slice
+  LTTB: "lttb"          // Largest-Triangle-Three-Buckets, a subset of the samples
+};
+
+// Stream names back to HSLSensorBufferType
+var streamBufferTypes = {};
+Object.keys(streamTypeNames).forEach(function (bufferType) {
+  streamBufferTypes[streamTypeNames[bufferType]] = Number(bufferType);
+});
+
+// Resolutions accepted by getRange and /history
+var HistoryResolution = {
+  Auto: "auto",     // The finest resolution whose history reaches back to the start of the range
+  Raw: "raw",       // Frames, shaped like a drained batch
+  Second: "second", // Mean, min and max per second
+  Minute: "minute"  // Mean, min and max per minute
+};
+
+var historyResolutionValues = {};
+historyResolutionValues[HistoryResolution.Auto] = hsl.HistoryStore.Resolution_Auto;
+historyResolutionValues[HistoryResolution.Raw] = hsl.HistoryStore.Resolution_Raw;
+historyResolutionValues[HistoryResolution.Second] = hsl.HistoryStore.Resolution_Second;
+historyResolutionValues[HistoryResolution.Minute] = hsl.HistoryStore.Resolution_Minute;
+
+var maxChartWidth = 4096;
+var maxChartSpanSeconds = 600;
+
+// What one client asked for in the query string of /data or /stream, e.g.
+// /stream?sensor=0,2&type=ecg,ppg&rate=50. Missing parameters match everything.
+// width=N asks for waveform streams as N point charts instead (span, mode and channel).
+class StreamSubscription {
+  constructor(sensorIds, streamTypes, sampleRate, chart) {
+    this.sensorIds = sensorIds;     // Array of sensor ids, or null for every sensor
+    this.streamTypes = streamTypes; // Array of stream names (see streamTypeNames), or null for every stream
+    this.sampleRate = sampleRate;   // Target rate in Hz for ECG/PPG/Acc, 0 for the sensor's own rate
+    this.chart = chart || null;     // {width, spanSeconds, mode, channel} for ECG/PPG/Acc, or null for batches
+  }
+
+  // Returns null if any parameter is malformed
+  static fromSearchParams(searchParams) {
+    var sensorIds = null;
+    var streamTypes = null;
+    var sampleRate = 0;
+
+    if (searchParams.has('sensor')) {
+      sensorIds = searchParams.get('sensor').split(',').map(Number);
+      if (sensorIds.some(function (id) { return !Number.isInteger(id); })) {
+        return null;
+      }
+    }
+
+    if (searchParams.has('type')) {
+      var knownTypes = Object.values(streamTypeNames);
+
+      streamTypes = searchParams.get('type').split(',');
+      if (streamTypes.some(function (type) { return knownTypes.indexOf(type) < 0; })) {
+        return null;
+      }
+    }
+
+    if (searchParams.has('rate')) {
+      sampleRate = Number(searchParams.get('rate'));
+      if (!(sampleRate > 0)) {
+        return null;
+      }
+    }
+
+    var chart = null;
+    if (searchParams.has('width')) {
+      chart = {
+        width: Number(searchParams.get('width')),
+        spanSeconds: searchParams.has('span') ? Number(searchParams.get('span')) : 10,
+        mode: searchParams.get('mode') || ChartMode.Envelope,
+        channel: searchParams.has('channel') ? Number(searchParams.get('channel')) : 0
+      };
+
+      if (!Number.isInteger(chart.width) || chart.width < 1 || chart.width > maxChartWidth ||
+        !(chart.spanSeconds > 0) || chart.spanSeconds > maxChartSpanSeconds ||
+        Object.values(ChartMode).indexOf(chart.mode) < 0 ||
+        !Number.isInteger(chart.channel) || chart.channel < 0) {
+        return null;
+      }
+    }
+
+    return new StreamSubscription(sensorIds, streamTypes, sampleRate, chart);
+  }
+
+  // How this subscriber wants one stream delivered; subscribers with equal keys share payloads
+  getDeliveryKey(type) {
+    if (waveformStreamTypes.indexOf(type) < 0) {
+      return "batch";
+    }
+
+    if (this.chart != null) {
+      return "chart:" + this.chart.mode + ":" + this.chart.width + ":" + this.chart.spanSeconds + ":" + this.getChartChannel(type);
+    }
+
+    return "batch@" + this.sampleRate;
+  }
+
+  // Channels a stream doesn't have fall back to channel 0
+  getChartChannel(type) {
+    return this.chart.channel < waveformChannelCounts[type] ? this.chart.channel : 0;
+  }
+
+  matches(sensorId, type) {
+    return (this.sensorIds == null || this.sensorIds.indexOf(sensorId) >= 0) &&
+      (this.streamTypes == null || this.streamTypes.indexOf(type) >= 0);
+  }
+}
+
+var subscribeToEverything = new StreamSubscription(null, null, 0);
+
+// Reads a hsl.SharedSampleRing from any thread, given the SharedArrayBuffer from its getBuffer().
+// acquire() returns typed array views straight into the shared memory, nothing is copied;
+// release() moves this reader's tail past them. Each reader takes one of the ring's reader
+// slots until close(). options.fromOldest starts at the oldest sample still in the ring
+// instead of the newest.
+class SharedSampleReader {
+  constructor(buffer, options) {
+    options = options || {};
+
+    var Ring = hsl.SharedSampleRing;
+    this.header = new Int32Array(buffer, 0, Ring.Field_COUNT);
+    this.capacity = this.header[Ring.Field_Capacity];
+    this.channelCount = this.header[Ring.Field_ChannelCount];
+    this.sensorId = this.header[Ring.Field_SensorID];
+    this.bufferType = this.header[Ring.Field_BufferType];
+    this.dropOldest = this.header[Ring.Field_Overflow] == Ring.Overflow_DropOldest;
+    this.times = new Float64Array(buffer, this.header[Ring.Field_TimesOffset], this.capacity);
+    this.values = new Float32Array(buffer, this.header[Ring.Field_ValuesOffset], this.capacity * this.channelCount);
+    this.pending = 0;
+    this.lostSamples = 0;
+
+    this.slot = -1;
+    for (var slot = 0; slot < this.header[Ring.Field_MaxReaders]; ++slot) {
+      if (Atomics.compareExchange(this.header, Ring.Field_ReaderStates + slot, Ring.ReaderState_Free, Ring.ReaderState_Claiming) == Ring.ReaderState_Free) {
+        this.slot = slot;
+        break;
+      }
+    }
+    if (this.slot < 0) {
+      throw new Error("Every reader slot of the ring is taken");
+    }
+
+    // Publish the tail before going active, the writer only looks at active readers
+    var head = Atomics.load(this.header, Ring.Field_Head);
+    this.tail = options.fromOldest ? (head - Math.min(head >>> 0, this.capacity)) | 0 : head;
+    Atomics.store(this.header, Ring.Field_ReaderTails + this.slot, this.tail);
+    Atomics.store(this.header, Ring.Field_ReaderStates + this.slot, Ring.ReaderState_Active);
+  }
+
+  // Samples written since this reader's tail, more than the capacity if it was lapped
+  available() {
+    return (Atomics.load(this.header, hsl.SharedSampleRing.Field_Head) - this.tail) >>> 0;
+  }
+
+  isClosed() {
+    return Atomics.load(this.header, hsl.SharedSampleRing.Field_Closed) != 0;
+  }
+
+  // Up to maxSamples unread samples as {timeInSeconds, values, count, channelCount, lost}, or null
+  // if there are none. values is interleaved, channelCount floats per sample. The views stop at the
+  // end of the ring, so unread samples that wrap around come back over two calls. lost counts the
+  // samples a drop-oldest writer overwrote before this reader got to them.
+  acquire(maxSamples) {
+    var Ring = hsl.SharedSampleRing;
+    var head = Atomics.load(this.header, Ring.Field_Head);
+    var unread = (head - this.tail) >>> 0;
+    var lost = 0;
+
+    if (unread > this.capacity) {
+      lost = unread - this.capacity;
+      this.tail = (head - this.capacity) | 0;
+      unread = this.capacity;
+      this.lostSamples += lost;
+    }
+
+    var start = this.tail & (this.capacity - 1);
+    var count = Math.min(unread, this.capacity - start, maxSamples > 0 ? maxSamples : Infinity);
+    this.pending = count;
+
+    if (count == 0) {
+      return null;
+    }
+
+    return {
+      timeInSeconds: this.times.subarray(start, start + count),
+      values: this.values.subarray(start * this.channelCount, (start + count) * this.channelCount),
+      count: count,
+      channelCount: this.channelCount,
+      lost: lost
+    };
+  }
+
+  // Hands the samples from the last acquire() back to the writer. For a drop-oldest ring, returns
+  // false if the writer overwrote some of them while they were in use; drop-newest rings never do.
+  release() {
+    var Ring = hsl.SharedSampleRing;
+    var intact = !this.dropOldest ||
+      ((Atomics.load(this.header, Ring.Field_Reserved) - this.tail) >>> 0) <= this.capacity;
+
+    this.tail = (this.tail + this.pending) | 0;
+    this.pending = 0;
+    Atomics.store(this.header, Ring.Field_ReaderTails + this.slot, this.tail);
+
+    return intact;
+  }
+
+  // Gives the reader slot back. A drop-newest writer waits on every open reader, so close readers you are done with.
+  close() {
+    if (this.slot >= 0) {
+      Atomics.store(this.header, hsl.SharedSampleRing.Field_ReaderStates + this.slot, hsl.SharedSampleRing.ReaderState_Free);
+      this.slot = -1;
+    }
+  }
+}
+
 class HSLSensorClient {
-  constructor() {
+  // By default the HSL update loop runs on a native background thread that only calls back
+  // when a stream crosses its threshold or the sensor list changes. options.streamThresholds
+  // sets {minSamples, maxAgeMs} per stream name (see startPolling), e.g. {acc: {minSamples: 200, maxAgeMs: 500}};
+  // streams without one are handed over on the tick they are drained. options.updateIntervalMs is the
+  // native tick, options.idleIntervalMs the tick while no sensors are connected.
+  // options.nativePolling = false polls from a JS timer every updateIntervalMs instead.
+  // options.history configures the rolling history of every streamed sensor
+  // (see hsl.HistoryStore), false turns it off. options.alertRules sets the alert rules, see setAlertRules.
+  constructor(options) {
+    options = options || {};
+
     this.updateInternal = null;
+    this.nativePolling = options.nativePolling !== false;
+    this.updateIntervalMs = options.updateIntervalMs || (this.nativePolling ? 10 : 100);
+    this.idleIntervalMs = options.idleIntervalMs || 250;
+    this.streamThresholds = options.streamThresholds || {};
     this.sensors = [];
     this.listenerCallbacks = [];
+    this.history = (options.history !== false) ? new hsl.HistoryStore(options.history || {}) : null;
+    this.sharedRings = {}; // hsl.SharedSampleRing by "sensorId:stream"
+    this.alerts = null;
+    this.alertCallbacks = [];
+
+    if (options.alertRules) {
+      this.setAlertRules(options.alertRules);
+    }
   }
 
-  refreshSensorList() {
-    let sensorList = hsl.getSensorList();
+  // Replaces the alert rules evaluated natively on every frame (see hsl.AlertEngine). A rule may
+  // name the stream a noData rule watches, e.g. {name: "hrLost", metric: "noData", stream: "hr", timeoutMs: 5000}
+  // or {name: "tachycardia", metric: "heartRate", above: 120, clear: 110, forSeconds: 10}.
+  // Alert listeners only run when an alert is raised or clears.
+  setAlertRules(rules) {
+    if (this.alerts != null) {
+      this.alerts.close();
+      this.alerts = null;
+    }
 
-    this.sensors = [];
-    for (var i = 0; i < sensorList.getSensorCount(); i++) {
-      let sensor = sensorList.getSensor(i);
-
-      if (sensor != null) {
-        this.sensors.push(sensor);
-        if (sensor.hasCapability(hsl.Sensor.StreamFlags_ECGData))
-          sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true)
-        else if (sensor.hasCapability(hsl.Sensor.StreamFlags_PPGData))
-          sensor.setDataStreamActive(hsl.Sensor.StreamFlags_PPGData, true)
-        else if (sensor.hasCapability(hsl.Sensor.StreamFlags_HRData))
-          sensor.setDataStreamActive(hsl.Sensor.StreamFlags_HRData, true)
+    var compiled = rules.map(function (rule) {
+      var entry = Object.assign({}, rule);
+
+      if (entry.stream !== undefined) {
+        entry.bufferType = streamBufferTypes[entry.stream];
+        delete entry.stream;
       }
+
+      return entry;
+    });
+
+    if (compiled.length > 0) {
+      this.alerts = new hsl.AlertEngine(compiled);
     }
   }
 
-  addListener(_this, callback_fn) {
-    this.listenerCallbacks.push(callback_fn.bind(_this));
+  // The alerts raised now, see AlertEngine.getActive
+  getActiveAlerts() {
+    return (this.alerts != null) ? this.alerts.getActive() : [];
   }
 
-  removeListener(callback_fn) {
-    var index = this.listenerCallbacks.indexOf(callback_fn);
-    if (index >= 0) {
-      this.listenerCallbacks.splice(index, 1);
+  // streamThresholds keyed by buffer type, as startPolling takes them
+  getPollingThresholds() {
+    var thresholds = {};
+
+    Object.keys(this.streamThresholds).forEach(function (stream) {
+      if (streamBufferTypes[stream] !== undefined) {
+        thresholds[streamBufferTypes[stream]] = this.streamThresholds[stream];
+      }
+    }, this);
+
+    return thresholds;
+  }
+
+  // Applies the sensor list changes since the last refresh. Sensors that stay connected keep their
+  // Sensor objects and stream state; only added sensors, or ones whose device information changed,
+  // have their streams turned on, all in one hsl.configureStreams call. Returns the changes,
+  // see hsl.getSensorChanges.
+  refreshSensorList() {
+    var changes = hsl.getSensorChanges();
+
+    this.sensors = changes.sensors;
+    var configs = changes.added.concat(changes.changed).map(function (sensor) {
+      return this.startSensorStreams(sensor);
+    }, this).filter(function (config) { return config != null; });
+
+    if (configs.length > 0) {
+      hsl.configureStreams(configs);
     }
+
+    return changes;
   }
 
-  publishSensorECGStream(sensor) {
-    var ecgBufferIter = sensor.getHeartECGBuffer();
+  // Picks the stream a sensor publishes and returns the hsl.configureStreams config turning it on
+  startSensorStreams(sensor) {
+    var choices = [
+      [hsl.Sensor.StreamFlags_ECGData, hsl.BufferIterator.BufferType_ECGData],
+      [hsl.Sensor.StreamFlags_PPGData, hsl.BufferIterator.BufferType_PPGData],
+      [hsl.Sensor.StreamFlags_HRData, hsl.BufferIterator.BufferType_HRData]
+    ];
+    var choice = choices.find(function (entry) { return sensor.hasCapability(entry[0]); });
 
-    var ecgArray = [];
-    while (ecgBufferIter.isValid()) {
-      ecgArray.push(ecgBufferIter.getECGData());
-      ecgBufferIter.next();
+    if (choice === undefined) {
+      return null;
     }
 
-    if (ecgArray.length > 0) {
-      sensor.flushHeartECGBuffer();
+    this.trackSensorHistory(sensor, choice[1]);
 
-      publishData({ id: sensor.getSensorID(), type: "ecg", stream: ecgArray });
+    return { sensorId: sensor.getSensorID(), data: [choice[0]], mode: "enable" };
+  }
+
+  // Keeps the history of a stream the client publishes, tracking a stream again keeps what it has
+  trackSensorHistory(sensor, bufferType) {
+    if (this.history != null) {
+      this.history.track(sensor.getSensorID(), bufferType);
     }
   }
 
-  publishSensorPPGStream(sensor) {
-    var ppgBufferIter = sensor.getHeartPPGBuffer();
+  // History of one stream between t0 and t1 (sensor timeInSeconds), see hsl.HistoryStore.getRange.
+  // stream is a stream name such as "ecg", resolution one of HistoryResolution.
+  // Returns null if the stream has no history.
+  getRange(sensorId, stream, t0, t1, resolution) {
+    var bufferType = streamBufferTypes[stream];
+    var resolutionValue = historyResolutionValues[resolution || HistoryResolution.Auto];
 
-    var ppgArray = [];
-    while (ppgBufferIter.isValid()) {
-      ppgArray.push(ppgBufferIter.getPPGData());
-      ppgBufferIter.next();
+    if (this.history == null || bufferType === undefined || resolutionValue === undefined) {
+      return null;
     }
 
-    if (ppgArray.length > 0) {
-      sensor.flushHeartPPGBuffer();
+    return this.history.getRange(sensorId, bufferType, t0, t1, resolutionValue);
+  }
+
+  // SharedArrayBuffer that the samples of one stream are written to natively, for worker threads
+  // to read with SharedSampleReader. Sharing a stream again returns the same buffer.
+  // options are those of hsl.SharedSampleRing. Returns null for an unknown stream name.
+  shareSensorStream(sensorId, stream, options) {
+    var bufferType = streamBufferTypes[stream];
+    if (bufferType === undefined) {
+      return null;
+    }
 
-      this.publishData({ id: sensor.getSensorID(), type: "ppg", stream: ppgArray });
+    var key = sensorId + ":" + stream;
+    if (this.sharedRings[key] == null) {
+      this.sharedRings[key] = new hsl.SharedSampleRing(sensorId, bufferType, options || {});
     }
+
+    return this.sharedRings[key].getBuffer();
   }
 
-  publishSensorHRStream(sensor) {
-    var hrBufferIter = sensor.getHeartRateBuffer();
+  // Stops writing a shared stream. Readers keep what is already in the buffer and see isClosed().
+  unshareSensorStream(sensorId, stream) {
+    var key = sensorId + ":" + stream;
+    if (this.sharedRings[key] != null) {
+      this.sharedRings[key].close();
+      delete this.sharedRings[key];
+    }
+  }
 
-    var hrArray = [];
-    while (hrBufferIter.isValid()) {
-      hrArray.push(hrBufferIter.getHRData());
-      hrBufferIter.next();
+  // hsl.SensorAligner resampling streams such as [{sensorId: 0, stream: "ecg"}, {sensorId: 1, stream: "ppg"}]
+  // onto one timeline in the clock of the first. Returns null for an unknown stream name.
+  alignSensorStreams(streams, options) {
+    var selection = streams.map(function (entry) {
+      return { sensorId: entry.sensorId, bufferType: streamBufferTypes[entry.stream] };
+    });
+
+    if (selection.some(function (entry) { return entry.bufferType === undefined; })) {
+      return null;
     }
 
-    if (hrArray.length > 0) {
-      sensor.flushHeartRateBuffer();
+    return new hsl.SensorAligner(selection, options || {});
+  }
+
+  // Filter graph over one waveform stream by name (see hsl.SensorFilterGraph), or null if the
+  // stream is not ECG, PPG or Acc
+  filterSensorStream(sensorId, stream, stages, options) {
+    var bufferType = streamBufferTypes[stream];
+
+    if (waveformStreamTypes.indexOf(stream) < 0) {
+      return null;
+    }
+
+    return new hsl.SensorFilterGraph(sensorId, bufferType, stages, options || {});
+  }
+
+  // Native pipeline counters and latencies (see hsl.getStats) with streams keyed by name.
+  // options.reset clears the native counters once they have been read.
+  getStats(options) {
+    var stats = hsl.getStats(options || {});
 
-      publishData({ id: sensor.getSensorID(), type: "hr", stream: hrArray });
+    stats.streams.forEach(function (stream) {
+      stream.type = streamTypeNames[stream.bufferType];
+    });
+
+    return stats;
+  }
+
+  // Time of the newest frame recorded for a stream, or null
+  getLatestHistoryTime(sensorId, stream) {
+    if (this.history == null) {
+      return null;
     }
+
+    var bufferType = streamBufferTypes[stream];
+    var entry = this.history.getStats().streams.find(function (streamStats) {
+      return streamStats.sensorId == sensorId && streamStats.bufferType == bufferType;
+    });
+
+    return (entry != null && entry.latestTime > 0) ? entry.latestTime : null;
+  }
+
+  addListener(_this, callback_fn) {
+    this.listenerCallbacks.push(callback_fn.bind(_this));
+  }
+
+  removeListener(callback_fn) {
+    var index = this.listenerCallbacks.indexOf(callback_fn);
+    if (index >= 0) {
+      this.listenerCallbacks.splice(index, 1);
+    }
+  }
+
+  addAlertListener(_this, callback_fn) {
+    this.alertCallbacks.push(callback_fn.bind(_this));
+  }
+
+  removeAlertListener(callback_fn) {
+    var index = this.alertCallbacks.indexOf(callback_fn);
+    if (index >= 0) {
+      this.alertCallbacks.splice(index, 1);
+    }
+  }
+
+  // Hands every queued alert event to the alert listeners
+  publishAlerts() {
+    var events = (this.alerts != null) ? this.alerts.read() : null;
+
+    if (events != null) {
+      this.alertCallbacks.forEach(function (callback_fn) {
+        events.forEach(callback_fn);
+      });
+    }
+  }
+
+  // Each stream is drained natively in one call: the frames come back packed into
+  // typed arrays (see Sensor.drain*) and the HSL buffer is already flushed
+  publishSensorStream(sensor, type, batch) {
+    if (batch != null) {
+      this.publishData({ id: sensor.getSensorID(), type: type, stream: batch });
+    }
+  }
+
+  publishSensorECGStream(sensor) {
+    this.publishSensorStream(sensor, "ecg", sensor.drainECG());
+  }
+
+  publishSensorPPGStream(sensor) {
+    this.publishSensorStream(sensor, "ppg", sensor.drainPPG());
+  }
+
+  publishSensorHRStream(sensor) {
+    this.publishSensorStream(sensor, "hr", sensor.drainHR());
   }
 
   publishData(sensorData) {
@@ -101,10 +518,12 @@ class HSLSensorClient {
     });
   }
 
+  // One HSL tick: updates, drains the event queue and publishes every sensor's new data.
+  // Returns the events drained, see hsl.pollAllMessages.
   update() {
-    hsl.update();
+    var events = hsl.update(true) || [];
 
-    if (hsl.hasSensorListChanged()) {
+    if (events.some(function (event) { return event.type == hsl.Event_SensorListUpdated; })) {
       this.refreshSensorList();
     }
 
@@ -114,31 +533,332 @@ class HSLSensorClient {
       _this.publishSensorPPGStream(sensor);
       _this.publishSensorHRStream(sensor);
     });
+    this.publishAlerts();
+
+    return events;
+  }
+
+  // Called on the JS thread with every batch the native poller drained since the last call
+  handlePolledBatches(batches, sensorListChanged, alertsQueued) {
+    if (sensorListChanged) {
+      this.refreshSensorList();
+    }
+
+    var _this = this;
+    batches.forEach(function (batch) {
+      _this.publishData({ id: batch.sensorId, type: streamTypeNames[batch.bufferType], stream: batch });
+    });
+
+    if (alertsQueued) {
+      this.publishAlerts();
+    }
   }
 
   start() {
-    if (this.updateInternal == null) {
+    if (this.updateInternal == null && !hsl.isPolling()) {
       console.log("HSL " + hsl.getVersionString());
 
       var _this = this;
-      this.updateInternal = setInterval(function () { _this.update(); }, 100);
+      if (this.nativePolling) {
+        var pollingOptions = {
+          intervalMs: this.updateIntervalMs,
+          idleIntervalMs: this.idleIntervalMs,
+          thresholds: this.getPollingThresholds()
+        };
+
+        hsl.startPolling(pollingOptions, function (batches, sensorListChanged, alertsQueued) {
+          _this.handlePolledBatches(batches, sensorListChanged, alertsQueued);
+        });
+      }
+      else {
+        this.updateInternal = setInterval(function () { _this.update(); }, this.updateIntervalMs);
+      }
     }
   }
 
   stop() {
-    if (this.updateInternal != null) {
+    if (this.updateInternal != null || hsl.isPolling()) {
+      hsl.stopPolling();
+
       this.sensors.forEach(function (sensor) {
         sensor.stopAllStreams();
       });
 
-      clearInterval(this.updateInternal);
-      this.updateInternal = null;
+      if (this.updateInternal != null) {
+        clearInterval(this.updateInternal);
+        this.updateInternal = null;
+      }
     }
   }
 }
 
+// What to do with a streaming client whose queue would grow past maxQueuedBytes
+var SlowClientPolicy = {
+  DropOldest: "drop-oldest", // Drop the oldest queued messages until the new one fits
+  Coalesce: "coalesce",      // Keep only the newest queued message of each sensor stream
+  Disconnect: "disconnect"   // Close the connection
+};
+
+// One SSE response or WebSocket stream. write() returning false only means the socket
+// buffer is full, so messages queue up here until the connection emits 'drain'.
+class StreamClient {
+  constructor(connection, transport, subscription, options) {
+    this.connection = connection;
+    this.transport = transport;
+    this.subscription = subscription;
+    this.maxQueuedBytes = options.maxQueuedBytes;
+    this.slowClientPolicy = options.slowClientPolicy;
+
+    this.queue = [];         // {payload, key, enqueueTime}
+    this.queuedBytes = 0;
+    this.blocked = false;
+    this.closed = false;
+
+    this.messagesSent = 0;
+    this.bytesSent = 0;
+    this.messagesDropped = 0;
+    this.messagesCoalesced = 0;
+    this.blockedCount = 0;
+    this.maxLagMs = 0;
+    this.connectedTime = Date.now();
+
+    var _this = this;
+    if (typeof connection.on == 'function') {
+      connection.on('drain', function () { _this.handleDrain(); });
+    }
+  }
+
+  // Returns false if the client has to be disconnected
+  send(payload, key) {
+    if (this.closed) {
+      return false;
+    }
+
+    if (!this.blocked) {
+      this.writePayload(payload);
+      return true;
+    }
+
+    if (this.queuedBytes + payload.length > this.maxQueuedBytes) {
+      if (this.slowClientPolicy == SlowClientPolicy.Disconnect) {
+        return false;
+      }
+      else if (this.slowClientPolicy == SlowClientPolicy.Coalesce) {
+        this.coalesce(key);
+      }
+
+      while (this.queue.length > 0 && this.queuedBytes + payload.length > this.maxQueuedBytes) {
+        this.queuedBytes -= this.queue.shift().payload.length;
+        this.messagesDropped++;
+      }
+    }
+
+    this.queue.push({ payload: payload, key: key, enqueueTime: Date.now() });
+    this.queuedBytes += payload.length;
+    return true;
+  }
+
+  // Drops queued messages for the same sensor stream, the new one supersedes them
+  coalesce(key) {
+    var kept = [];
+    var queuedBytes = 0;
+
+    for (var i = 0; i < this.queue.length; i++) {
+      if (this.queue[i].key == key) {
+        this.messagesCoalesced++;
+      }
+      else {
+        kept.push(this.queue[i]);
+        queuedBytes += this.queue[i].payload.length;
+      }
+    }
+
+    this.queue = kept;
+    this.queuedBytes = queuedBytes;
+  }
+
+  writePayload(payload) {
+    this.messagesSent++;
+    this.bytesSent += payload.length;
+
+    if (!this.connection.write(payload)) {
+      this.blocked = true;
+      this.blockedCount++;
+    }
+  }
+
+  handleDrain() {
+    this.blocked = false;
+
+    var now = Date.now();
+    while (this.queue.length > 0 && !this.blocked && !this.closed) {
+      let message = this.queue.shift();
+
+      this.queuedBytes -= message.payload.length;
+      this.maxLagMs = Math.max(this.maxLagMs, now - message.enqueueTime);
+      this.writePayload(message.payload);
+    }
+  }
+
+  // trailer, e.g. a WebSocket close frame, is written after anything still queued is dropped
+  close(trailer) {
+    if (!this.closed) {
+      this.closed = true;
+      this.queue = [];
+      this.queuedBytes = 0;
+      this.connection.end(trailer);
+    }
+  }
+
+  getStats() {
+    return {
+      transport: this.transport,
+      sensorIds: this.subscription.sensorIds,
+      streamTypes: this.subscription.streamTypes,
+      sampleRate: this.subscription.sampleRate,
+      chart: this.subscription.chart,
+      connectedMs: Date.now() - this.connectedTime,
+      blocked: this.blocked,
+      queuedMessages: this.queue.length,
+      queuedBytes: this.queuedBytes,
+      lagMs: this.queue.length > 0 ? Date.now() - this.queue[0].enqueueTime : 0,
+      maxLagMs: this.maxLagMs,
+      messagesSent: this.messagesSent,
+      bytesSent: this.bytesSent,
+      messagesDropped: this.messagesDropped,
+      messagesCoalesced: this.messagesCoalesced,
+      blockedCount: this.blockedCount
+    };
+  }
+}
+
+var WebSocketOpcode = {
+  Binary: 0x2,
+  Close: 0x8,
+  Ping: 0x9,
+  Pong: 0xA
+};
+
+// GUID every WebSocket server appends to Sec-WebSocket-Key (RFC 6455 section 1.3)
+var webSocketAcceptGUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Clients only ever send us control frames, anything bigger is not a client we want
+var maxWebSocketClientFrameBytes = 64 * 1024;
+
+// Wraps a payload in a single unmasked, final server frame
+function createWebSocketFrame(opcode, payload) {
+  var length = payload.length;
+  var headerLength = length < 126 ? 2 : (length < 65536 ? 4 : 10);
+  var frame = Buffer.allocUnsafe(headerLength + length);
+
+  frame[0] = 0x80 | opcode;
+  if (length < 126) {
+    frame[1] = length;
+  }
+  else if (length < 65536) {
+    frame[1] = 126;
+    frame.writeUInt16BE(length, 2);
+  }
+  else {
+    frame[1] = 127;
+    frame.writeUInt32BE(Math.floor(length / 0x100000000), 2);
+    frame.writeUInt32BE(length >>> 0, 6);
+  }
+  payload.copy(frame, headerLength);
+
+  return frame;
+}
+
+// Splits complete, unmasked client frames off the front of buffer.
+// Returns {frames: [{opcode, payload}], remainder}, or null if the client broke the protocol.
+function parseWebSocketFrames(buffer) {
+  var frames = [];
+  var offset = 0;
+
+  while (buffer.length - offset >= 2) {
+    let opcode = buffer[offset] & 0x0F;
+    let masked = (buffer[offset + 1] & 0x80) != 0;
+    let length = buffer[offset + 1] & 0x7F;
+    let headerLength = 2;
+
+    if (!masked) {
+      return null;
+    }
+
+    if (length == 126) {
+      if (buffer.length - offset < 4) break;
+      length = buffer.readUInt16BE(offset + 2);
+      headerLength = 4;
+    }
+    else if (length == 127) {
+      if (buffer.length - offset < 10) break;
+      length = buffer.readUInt32BE(offset + 2) * 0x100000000 + buffer.readUInt32BE(offset + 6);
+      headerLength = 10;
+    }
+
+    if (length > maxWebSocketClientFrameBytes) {
+      return null;
+    }
+
+    if (buffer.length - offset < headerLength + 4 + length) break;
+
+    let mask = buffer.subarray(offset + headerLength, offset + headerLength + 4);
+    let payload = Buffer.from(buffer.subarray(offset + headerLength + 4, offset + headerLength + 4 + length));
+    for (var i = 0; i < payload.length; i++) {
+      payload[i] ^= mask[i & 3];
+    }
+
+    frames.push({ opcode: opcode, payload: payload });
+    offset += headerLength + 4 + length;
+  }
+
+  return { frames: frames, remainder: buffer.subarray(offset) };
+}
+
+// Binary chart message sent over /stream in place of a batch, little endian:
+//   uint8   magic 'H', 'C', version 1, mode (0 envelope, 1 lttb)
+//   int32   sensorId
+//   uint8   bufferType, channel, 2 bytes padding
+//   uint32  pointCount
+//   float64 startTime, endTime
+// then for an envelope float32 min[pointCount], float32 max[pointCount] (NaN where empty)
+// or for lttb float64 timeInSeconds[pointCount], float32 values[pointCount]
+var chartMessageHeaderSize = 32;
+
+function encodeChartMessage(sensorId, bufferType, channel, chart) {
+  var lttb = chart.values !== undefined;
+  var pointCount = lttb ? chart.values.length : chart.min.length;
+  var message = Buffer.alloc(chartMessageHeaderSize + pointCount * (lttb ? 12 : 8));
+
+  message.write('HC', 0, 'latin1');
+  message.writeUInt8(1, 2);
+  message.writeUInt8(lttb ? 1 : 0, 3);
+  message.writeInt32LE(sensorId, 4);
+  message.writeUInt8(bufferType, 8);
+  message.writeUInt8(channel, 9);
+  message.writeUInt32LE(pointCount, 12);
+  message.writeDoubleLE(chart.startTime, 16);
+  message.writeDoubleLE(chart.endTime, 24);
+
+  if (lttb) {
+    Buffer.from(chart.timeInSeconds.buffer, chart.timeInSeconds.byteOffset, pointCount * 8).copy(message, chartMessageHeaderSize);
+    Buffer.from(chart.values.buffer, chart.values.byteOffset, pointCount * 4).copy(message, chartMessageHeaderSize + pointCount * 8);
+  }
+  else {
+    Buffer.from(chart.min.buffer, chart.min.byteOffset, pointCount * 4).copy(message, chartMessageHeaderSize);
+    Buffer.from(chart.max.buffer, chart.max.byteOffset, pointCount * 4).copy(message, chartMessageHeaderSize + pointCount * 4);
+  }
+
+  return message;
+}
+
 class HSLHttpServer {
-  constructor(port) {
+  // sseOptions.maxQueuedBytes bounds what is held back for each slow SSE or WebSocket client,
+  // sseOptions.slowClientPolicy (see SlowClientPolicy) says what happens past that.
+  // sseOptions.chartIntervalMs is the shortest time between two charts of the same stream.
+  constructor(port, clientOptions, sseOptions) {
+    sseOptions = sseOptions || {};
+
     //  For the static files we server out of the 
     this.contentTypeByExtension = {
       '.css': 'text/css',
@@ -151,13 +871,33 @@ class HSLHttpServer {
 
     this.httpServer = null;
     this.httpPort = port;
-    this.hslClient = new HSLSensorClient();
+    this.hslClient = new HSLSensorClient(clientOptions);
 
-    // This array holds the clients (actually http server response objects) to send data to over SSE
+    // This array holds the StreamClients wrapping the http server responses (SSE /data)
+    // and upgraded sockets (WebSocket /stream) to send data to
     this.clients = [];
+    this.sseOptions = {
+      maxQueuedBytes: sseOptions.maxQueuedBytes || (1024 * 1024),
+      slowClientPolicy: sseOptions.slowClientPolicy || SlowClientPolicy.DropOldest,
+      chartIntervalMs: sseOptions.chartIntervalMs !== undefined ? sseOptions.chartIntervalMs : 100
+    };
+
+    // "sensorId:type" -> [{deliveryKey, sampleRate, chart, clients}], the subscribed clients grouped by
+    // how they want the stream delivered. Filled in on first publish and thrown away whenever a client
+    // comes or goes.
+    this.routes = new Map();
+
+    // "sensorId:type:channel" -> {downsampler, historySeconds}, native history for chart subscribers
+    this.downsamplers = new Map();
+
+    // "sensorId:type" -> {lastFrameTime, sampleRate}, measured from the batches themselves
+    this.streamRates = new Map();
+
+    // "sensorId:type@rate" -> decimation phase carried from one batch to the next
+    this.decimationPhases = new Map();
   }
 
-  handleServerStreamEventRequest(request, response) {
+  handleServerStreamEventRequest(request, response, subscription) {
     // Return Server-Stream-Event data
     // http://www.html5rocks.com/en/tutorials/eventsource/basics/
     var headers = {
@@ -167,7 +907,7 @@ class HSLHttpServer {
     };
     response.writeHead(200, headers);
 
-    this.addClient(response);
+    this.addClient(response, "sse", subscription);
   }
 
   handleStaticContentRequest(request, response) {
@@ -206,6 +946,35 @@ class HSLHttpServer {
     });
   }
 
+  // /history?sensor=0&type=ecg&span=600&resolution=second returns one getRange result as JSON.
+  // The range is either from/to in sensor time or the last span seconds, to defaults to the newest frame.
+  handleHistoryRequest(request, response, searchParams) {
+    var sensorId = searchParams.has('sensor') ? Number(searchParams.get('sensor')) : NaN;
+    var stream = searchParams.get('type');
+    var resolution = searchParams.get('resolution') || HistoryResolution.Auto;
+
+    if (!Number.isInteger(sensorId) || streamBufferTypes[stream] === undefined || historyResolutionValues[resolution] === undefined) {
+      response.writeHead(400);
+      response.end();
+      return;
+    }
+
+    // The range end is exclusive, so without a 'to' it is nudged past the newest frame to include it
+    var latestTime = this.hslClient.getLatestHistoryTime(sensorId, stream);
+    var t1 = searchParams.has('to') ? Number(searchParams.get('to')) : (latestTime != null ? latestTime + 1e-6 : NaN);
+    var t0 = searchParams.has('from') ? Number(searchParams.get('from')) : t1 - Number(searchParams.get('span') || 60);
+    var range = (Number.isFinite(t0) && Number.isFinite(t1)) ? this.hslClient.getRange(sensorId, stream, t0, t1, resolution) : null;
+
+    if (range == null) {
+      response.writeHead(404);
+      response.end();
+      return;
+    }
+
+    response.writeHead(200, { 'Content-Type': 'application/json', 'Cache-Control': 'no-cache' });
+    response.end(JSON.stringify(range, sensorDataReplacer));
+  }
+
   handleRequest(request, response) {
     try {
       // Technique modified from this:
@@ -217,7 +986,34 @@ class HSLHttpServer {
       var pathname = path.normalize(requestUrl.pathname);
 
       if (pathname == '/data' || pathname == '\\data') {
-        this.handleServerStreamEventRequest(request, response)
+        var subscription = StreamSubscription.fromSearchParams(requestUrl.searchParams);
+
+        if (subscription != null) {
+          this.handleServerStreamEventRequest(request, response, subscription);
+        }
+        else {
+          response.writeHead(400);
+          response.end();
+        }
+      }
+      else if (pathname == '/sensors' || pathname == '\\sensors') {
+        response.writeHead(200, { 'Content-Type': 'application/json', 'Cache-Control': 'no-cache' });
+        response.end(JSON.stringify(this.hslClient.sensors.map(function (sensor) { return sensor.getDeviceInfo(); })));
+      }
+      else if (pathname == '/history' || pathname == '\\history') {
+        this.handleHistoryRequest(request, response, requestUrl.searchParams);
+      }
+      else if (pathname == '/metrics' || pathname == '\\metrics') {
+        response.writeHead(200, { 'Content-Type': 'text/plain; version=0.0.4', 'Cache-Control': 'no-cache' });
+        response.end(this.getMetricsText());
+      }
+      else if (pathname == '/stats' || pathname == '\\stats') {
+        response.writeHead(200, { 'Content-Type': 'application/json', 'Cache-Control': 'no-cache' });
+        response.end(JSON.stringify(this.getStats()));
+      }
+      else if (pathname == '/alerts' || pathname == '\\alerts') {
+        response.writeHead(200, { 'Content-Type': 'application/json', 'Cache-Control': 'no-cache' });
+        response.end(JSON.stringify(this.hslClient.getActiveAlerts()));
       }
       else {
         this.handleStaticContentRequest(request, response)
@@ -229,33 +1025,420 @@ class HSLHttpServer {
     }
   }
 
-  addClient(client) {
+  // Binary streaming endpoint: a WebSocket carrying one delta encoded message per batch
+  // (see hsl.encodeSensorFrameBatch). Implemented on the raw upgrade to avoid a dependency.
+  handleUpgradeRequest(request, socket, head) {
+    const baseURL = 'http://' + request.headers.host + '/';
+    const requestUrl = new URL(request.url, baseURL);
+    var pathname = path.normalize(requestUrl.pathname);
+    var key = request.headers['sec-websocket-key'];
+    var upgrade = request.headers['upgrade'] || '';
+    var subscription = StreamSubscription.fromSearchParams(requestUrl.searchParams);
+
+    if ((pathname != '/stream' && pathname != '\\stream') || upgrade.toLowerCase() != 'websocket' || !key || subscription == null) {
+      socket.end('HTTP/1.1 400 Bad Request\r\n\r\n');
+      return;
+    }
+
+    var accept = crypto.createHash('sha1').update(key + webSocketAcceptGUID).digest('base64');
+    socket.write(
+      'HTTP/1.1 101 Switching Protocols\r\n' +
+      'Upgrade: websocket\r\n' +
+      'Connection: Upgrade\r\n' +
+      'Sec-WebSocket-Accept: ' + accept + '\r\n\r\n');
+    socket.setNoDelay(true);
+
+    var client = this.addClient(socket, "websocket", subscription);
+    var pending = head && head.length > 0 ? Buffer.from(head) : Buffer.alloc(0);
+    var _this = this;
+
+    socket.on('data', function (chunk) {
+      let parsed = parseWebSocketFrames(pending.length > 0 ? Buffer.concat([pending, chunk]) : chunk);
+
+      if (parsed == null) {
+        _this.removeClient(client);
+        socket.destroy();
+        return;
+      }
+
+      pending = Buffer.from(parsed.remainder);
+      parsed.frames.forEach(function (frame) {
+        if (frame.opcode == WebSocketOpcode.Close) {
+          _this.removeClient(client);
+          client.close(createWebSocketFrame(WebSocketOpcode.Close, frame.payload.subarray(0, 2)));
+        }
+        else if (frame.opcode == WebSocketOpcode.Ping && !client.closed) {
+          socket.write(createWebSocketFrame(WebSocketOpcode.Pong, frame.payload));
+        }
+      });
+    });
+    socket.on('error', function () {
+      _this.removeClient(client);
+    });
+  }
+
+  addClient(connection, transport, subscription) {
+    var client = new StreamClient(connection, transport || "sse", subscription || subscribeToEverything, this.sseOptions);
     this.clients.push(client);
+    this.routes.clear();
+
+    var _this = this;
+    if (typeof connection.on == 'function') {
+      connection.on('close', function () { _this.removeClient(client); });
+    }
+
+    return client;
   }
 
   removeClient(client) {
     var index = this.clients.indexOf(client);
     if (index >= 0) {
       this.clients.splice(index, 1);
+      this.routes.clear();
+      this.releaseUnusedDownsamplers();
+    }
+  }
+
+  // Native history for one channel of a waveform stream, long enough for spanSeconds
+  getDownsampler(sensorId, type, channel, spanSeconds) {
+    var key = sensorId + ':' + type + ':' + channel;
+    var entry = this.downsamplers.get(key);
+
+    if (entry === undefined || entry.historySeconds < spanSeconds) {
+      let historySeconds = Math.max(spanSeconds, entry !== undefined ? entry.historySeconds : 60);
+      let bufferType = Number(Object.keys(streamTypeNames).find(function (bufferType) { return streamTypeNames[bufferType] == type; }));
+
+      if (entry !== undefined) {
+        entry.downsampler.close();
+      }
+
+      entry = {
+        downsampler: new hsl.WaveformDownsampler(sensorId, bufferType, { channel: channel, historySeconds: historySeconds }),
+        historySeconds: historySeconds
+      };
+      this.downsamplers.set(key, entry);
+    }
+
+    return entry.downsampler;
+  }
+
+  releaseUnusedDownsamplers() {
+    var _this = this;
+
+    this.downsamplers.forEach(function (entry, key) {
+      let parts = key.split(':');
+      let sensorId = Number(parts[0]);
+      let type = parts[1];
+      let channel = Number(parts[2]);
+      let inUse = _this.clients.some(function (client) {
+        return client.subscription.chart != null &&
+          client.subscription.matches(sensorId, type) &&
+          client.subscription.getChartChannel(type) == channel;
+      });
+
+      if (!inUse) {
+        entry.downsampler.close();
+        _this.downsamplers.delete(key);
+      }
+    });
+  }
+
+  // Clients subscribed to one sensor stream, grouped by target sample rate
+  getRoute(sensorId, type) {
+    var key = sensorId + ':' + type;
+    var route = this.routes.get(key);
+
+    if (route === undefined) {
+      var _this = this;
+
+      route = [];
+      this.clients.forEach(function (client) {
+        if (!client.subscription.matches(sensorId, type)) {
+          return;
+        }
+
+        let deliveryKey = client.subscription.getDeliveryKey(type);
+        let group = route.find(function (group) { return group.deliveryKey == deliveryKey; });
+        if (group === undefined) {
+          let chart = null;
+
+          // A target rate or chart means nothing for beat and interval streams
+          if (deliveryKey.startsWith("chart") && client.subscription.chart != null) {
+            chart = Object.assign({}, client.subscription.chart, { channel: client.subscription.getChartChannel(type) });
+            chart.lastSendTime = 0;
+
+            // Start collecting history now, the first chart goes out on a later publish
+            _this.getDownsampler(sensorId, type, chart.channel, chart.spanSeconds);
+          }
+
+          group = {
+            deliveryKey: deliveryKey,
+            sampleRate: deliveryKey.startsWith("batch@") ? client.subscription.sampleRate : 0,
+            chart: chart,
+            clients: []
+          };
+          route.push(group);
+        }
+        group.clients.push(client);
+      });
+
+      this.routes.set(key, route);
     }
+
+    return route;
   }
 
-  // Send data to all SSE web browser clients. data must be a string.
+  // Tracks the rate a waveform stream is actually delivering samples at
+  updateStreamRate(key, batch) {
+    if (batch.frameCount == 0) {
+      return;
+    }
+
+    var lastFrameTime = batch.timeInSeconds[batch.frameCount - 1];
+    var rate = this.streamRates.get(key);
+    var measuredRate = 0;
+
+    if (rate !== undefined && lastFrameTime > rate.lastFrameTime) {
+      measuredRate = batch.sampleCount / (lastFrameTime - rate.lastFrameTime);
+    }
+    else if (batch.frameCount > 1 && lastFrameTime > batch.timeInSeconds[0]) {
+      measuredRate = (batch.sampleCount - batch.frameOffsets[1]) / (lastFrameTime - batch.timeInSeconds[0]);
+    }
+
+    if (rate === undefined) {
+      rate = { lastFrameTime: lastFrameTime, sampleRate: measuredRate };
+      this.streamRates.set(key, rate);
+    }
+    else {
+      // Smooth over batches that happen to end mid frame period
+      rate.sampleRate = rate.sampleRate > 0 && measuredRate > 0 ? 0.9 * rate.sampleRate + 0.1 * measuredRate : (measuredRate || rate.sampleRate);
+      rate.lastFrameTime = lastFrameTime;
+    }
+  }
+
+  // The batch as a client asking for sampleRate should see it
+  decimateBatch(key, batch, sampleRate) {
+    var rate = this.streamRates.get(key);
+    if (rate === undefined || !(rate.sampleRate > sampleRate)) {
+      return batch;
+    }
+
+    var step = Math.max(Math.round(rate.sampleRate / sampleRate), 1);
+    var phaseKey = key + '@' + sampleRate;
+    var phase = (this.decimationPhases.get(phaseKey) || 0) % step;
+
+    this.decimationPhases.set(phaseKey, (phase + batch.sampleCount) % step);
+
+    return step > 1 ? hsl.decimateSensorFrameBatch(batch, step, phase) : batch;
+  }
+
+  // Lag and queue metrics for every connected SSE and WebSocket client
+  getClientStats() {
+    return this.clients.map(function (client) { return client.getStats(); });
+  }
+
+  // The native pipeline stats of the sensor client together with the stats of every stream client
+  getStats(options) {
+    var stats = this.hslClient.getStats(options);
+    stats.clients = this.getClientStats();
+
+    return stats;
+  }
+
+  // Everything getStats reports in the Prometheus text exposition format
+  getMetricsText() {
+    var stats = this.getStats();
+    var lines = [];
+
+    function addSummary(name, help, labelSets) {
+      lines.push('# HELP ' + name + ' ' + help);
+      lines.push('# TYPE ' + name + ' summary');
+      labelSets.forEach(function (entry) {
+        let labels = entry.labels;
+        let summary = entry.summary;
+        let sep = labels.length > 0 ? ',' : '';
+
+        lines.push(name + '{' + labels + sep + 'quantile="0.5"} ' + summary.p50Ms / 1000);
+        lines.push(name + '{' + labels + sep + 'quantile="0.9"} ' + summary.p90Ms / 1000);
+        lines.push(name + '{' + labels + sep + 'quantile="0.99"} ' + summary.p99Ms / 1000);
+        lines.push(name + '_sum' + (labels.length > 0 ? '{' + labels + '}' : '') + ' ' + summary.sumMs / 1000);
+        lines.push(name + '_count' + (labels.length > 0 ? '{' + labels + '}' : '') + ' ' + summary.count);
+      });
+    }
+
+    function addCounter(name, help, values) {
+      lines.push('# HELP ' + name + ' ' + help);
+      lines.push('# TYPE ' + name + ' counter');
+      values.forEach(function (entry) {
+        lines.push(name + '{' + entry.labels + '} ' + entry.value);
+      });
+    }
+
+    function addGauge(name, help, values) {
+      lines.push('# HELP ' + name + ' ' + help);
+      lines.push('# TYPE ' + name + ' gauge');
+      values.forEach(function (entry) {
+        lines.push(name + (entry.labels.length > 0 ? '{' + entry.labels + '}' : '') + ' ' + entry.value);
+      });
+    }
+
+    function streamLabels(stream) {
+      return 'sensor="' + stream.sensorId + '",stream="' + (stream.type || stream.bufferType) + '"';
+    }
+
+    function streamCounter(field) {
+      return stats.streams.map(function (stream) { return { labels: streamLabels(stream), value: stream[field] }; });
+    }
+
+    function clientLabels(client, index) {
+      return 'client="' + index + '",transport="' + client.transport + '"';
+    }
+
+    function clientValue(field) {
+      return stats.clients.map(function (client, index) { return { labels: clientLabels(client, index), value: Number(client[field]) }; });
+    }
+
+    addGauge('hsl_uptime_seconds', 'Seconds since the addon was loaded.', [{ labels: '', value: stats.uptimeSeconds }]);
+
+    addSummary('hsl_pipeline_duration_seconds', 'Time spent in each hot path of the sensor pipeline.',
+      Object.keys(stats.timings).map(function (name) { return { labels: 'stage="' + name + '"', summary: stats.timings[name] }; }));
+    addSummary('hsl_frame_age_seconds', 'Age of the newest frame of each drain, above the fastest delivery seen.',
+      stats.streams.map(function (stream) { return { labels: streamLabels(stream), summary: stream.frameAge }; }));
+    addSummary('hsl_end_to_end_seconds', 'Time from a frame reaching the host to it being written to the clients.',
+      stats.streams.map(function (stream) { return { labels: streamLabels(stream), summary: stream.endToEnd }; }));
+
+    addCounter('hsl_stream_drains_total', 'Drains that returned frames.', streamCounter('drains'));
+    addCounter('hsl_stream_frames_total', 'Frames drained.', streamCounter('frames'));
+    addCounter('hsl_stream_samples_total', 'Samples drained.', streamCounter('samples'));
+    addCounter('hsl_stream_duplicate_frames_total', 'Frames no newer than the one before.', streamCounter('duplicateFrames'));
+    addCounter('hsl_stream_dropped_frames_total', 'Frames missing from gaps in the stream.', streamCounter('droppedFrames'));
+    addCounter('hsl_stream_gaps_total', 'Gaps in the stream.', streamCounter('gaps'));
+
+    addGauge('hsl_client_queued_bytes', 'Bytes held back for a slow client.', clientValue('queuedBytes'));
+    addGauge('hsl_client_lag_seconds', 'Age of the oldest message queued for a client.',
+      stats.clients.map(function (client, index) { return { labels: clientLabels(client, index), value: client.lagMs / 1000 }; }));
+    addCounter('hsl_client_messages_sent_total', 'Messages written to a client.', clientValue('messagesSent'));
+    addCounter('hsl_client_bytes_sent_total', 'Bytes written to a client.', clientValue('bytesSent'));
+    addCounter('hsl_client_messages_dropped_total', 'Messages dropped for a slow client.', clientValue('messagesDropped'));
+    addCounter('hsl_client_messages_coalesced_total', 'Messages replaced by a newer one for a slow client.', clientValue('messagesCoalesced'));
+
+    return lines.join('\n') + '\n';
+  }
+
+  // Send data to the web browser clients subscribed to its stream. It is decimated at most
+  // once per requested sample rate and serialized at most once per rate and transport, and
+  // the same encoded buffer is shared by every client in that group.
   handleSensorData(data) {
+    if (this.clients.length == 0) {
+      return;
+    }
+
+    var key = data.id + ':' + data.type;
+    var route = this.getRoute(data.id, data.type);
     var failures = [];
+    var _this = this;
 
-    this.clients.forEach(function (client) {
-      let dataStr = JSON.stringify(data)
-      if (!client.write('data: ' + dataStr + '\n\n')) {
-        failures.push(client);
+    if (waveformStreamTypes.indexOf(data.type) >= 0) {
+      this.updateStreamRate(key, data.stream);
+    }
+
+    route.forEach(function (group) {
+      if (group.chart != null) {
+        _this.sendChart(data, key, group, failures);
+        return;
+      }
+
+      let groupData = data;
+      let ssePayload = null;
+      let webSocketPayload = null;
+
+      if (group.sampleRate > 0) {
+        let batch = _this.decimateBatch(key, data.stream, group.sampleRate);
+
+        if (batch !== data.stream) {
+          groupData = { id: data.id, type: data.type, stream: batch };
+        }
       }
+
+      group.clients.forEach(function (client) {
+        let payload;
+
+        if (client.transport == "websocket") {
+          if (webSocketPayload == null) {
+            webSocketPayload = createWebSocketFrame(WebSocketOpcode.Binary, hsl.encodeSensorFrameBatch(groupData.stream));
+          }
+          payload = webSocketPayload;
+        }
+        else {
+          if (ssePayload == null) {
+            ssePayload = Buffer.from('data: ' + JSON.stringify(groupData, sensorDataReplacer) + '\n\n');
+          }
+          payload = ssePayload;
+        }
+
+        if (!client.send(payload, key)) {
+          failures.push(client);
+        }
+      });
     });
 
-    var _this = this;
     failures.forEach(function (client) {
-      console.log("[ERROR] Stopping server stream event");
+      console.log("[ERROR] Disconnecting slow " + client.transport + " stream client");
       _this.removeClient(client);
-      client.end();
+      client.close();
+    });
+
+    // Drained batches carry how old their newest frame was and when it was drained
+    if (data.stream.drainedAt !== undefined) {
+      hsl.recordDelivery(data.id, data.stream.bufferType, data.stream.frameAgeMs + (Date.now() - data.stream.drainedAt));
+    }
+  }
+
+  // Sends the chart a group of subscribers asked for, at most once per chartIntervalMs.
+  // The payload is the same size however many samples the stream delivers.
+  sendChart(data, key, group, failures) {
+    var chart = group.chart;
+    var now = Date.now();
+    if (now - chart.lastSendTime < this.sseOptions.chartIntervalMs) {
+      return;
+    }
+
+    // Looked up every time, a longer span elsewhere may have replaced the downsampler
+    var downsampler = this.getDownsampler(data.id, data.type, chart.channel, chart.spanSeconds);
+    var points = chart.mode == ChartMode.LTTB
+      ? downsampler.getLTTB(chart.width, chart.spanSeconds)
+      : downsampler.getEnvelope(chart.width, chart.spanSeconds);
+    if (points == null) {
+      return;
+    }
+    chart.lastSendTime = now;
+
+    var ssePayload = null;
+    var webSocketPayload = null;
+    var chartKey = key + ':' + group.deliveryKey;
+
+    group.clients.forEach(function (client) {
+      let payload;
+
+      if (client.transport == "websocket") {
+        if (webSocketPayload == null) {
+          webSocketPayload = createWebSocketFrame(WebSocketOpcode.Binary,
+            encodeChartMessage(data.id, data.stream.bufferType, chart.channel, points));
+        }
+        payload = webSocketPayload;
+      }
+      else {
+        if (ssePayload == null) {
+          points.mode = chart.mode;
+          points.channel = chart.channel;
+          ssePayload = Buffer.from('data: ' + JSON.stringify({ id: data.id, type: data.type, chart: points }, sensorDataReplacer) + '\n\n');
+        }
+        payload = ssePayload;
+      }
+
+      if (!client.send(payload, chartKey)) {
+        failures.push(client);
+      }
     });
   }
 
@@ -264,6 +1447,9 @@ class HSLHttpServer {
     this.httpServer = http.createServer(function (request, response) {
       _this.handleRequest(request, response);
     }).withShutdown();
+    this.httpServer.on('upgrade', function (request, socket, head) {
+      _this.handleUpgradeRequest(request, socket, head);
+    });
     this.httpServer.listen(this.httpPort);
 
     this.hslClient.addListener(this, this.handleSensorData);
@@ -271,6 +1457,12 @@ class HSLHttpServer {
   }
 
   stop() {
+    // Upgraded sockets are no longer tracked by the http server, so close them here
+    this.clients.filter(function (client) { return client.transport == "websocket"; }).forEach(function (client) {
+      this.removeClient(client);
+      client.close(createWebSocketFrame(WebSocketOpcode.Close, Buffer.alloc(0)));
+    }, this);
+
     var _this = this;
     this.httpServer.shutdown(function () {
       _this.hslClient.stop();
@@ -279,6 +1471,17 @@ class HSLHttpServer {
   }
 }
 
-console.log('Started server at http://localhost:8090');
-let hslHttpServer = new HSLHttpServer(8090);
-hslHttpServer.start()
\ No newline at end of file
+module.exports.HSLSensorClient = HSLSensorClient;
+module.exports.HSLHttpServer = HSLHttpServer;
+module.exports.SlowClientPolicy = SlowClientPolicy;
+module.exports.StreamSubscription = StreamSubscription;
+module.exports.ChartMode = ChartMode;
+module.exports.HistoryResolution = HistoryResolution;
+module.exports.SharedSampleReader = SharedSampleReader;
+
+// Only run the demo server when started directly, not when required (e.g. by bench/)
+if (require.main === module) {
+  console.log('Started server at http://localhost:8090');
+  let hslHttpServer = new HSLHttpServer(8090, { nativePolling: process.argv.indexOf('--timer-polling') < 0 });
+  hslHttpServer.start()
+}
\ No newline at end of file
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "ECGBeatDetector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Seconds of signal used to seed the signal and noise levels before detection starts
+static const double k_learningSeconds = 2.0;
+
+// Beats closer than this to the previous one might be T waves
+static const double k_tWaveSeconds = 0.36;
+
+// How far before the integrated peak the R peak can be, on top of the integration window.
+// Covers the delay through the bandpass and derivative.
+static const double k_filterDelaySeconds = 0.05;
+
+// A missed beat is searched for once this many mean RR intervals pass without one
+static const float k_searchbackRR = 1.66f;
+
+// Frames further than this from where the previous frame ended restart detection
+static const double k_maxTimeGap = 0.5;
+
+ECGBeatDetectorSettings::ECGBeatDetectorSettings()
+	: sampleRate(130.0)
+	, lowCutoffHz(5.0)
+	, highCutoffHz(15.0)
+	, integrationSeconds(0.15)
+	, refractorySeconds(0.2)
+	, beatBufferCapacity(1024)
+{
+}
+
+// RBJ cookbook biquads, Q = 1/sqrt(2) for a Butterworth response
+static void DesignBiquad(double sample_rate, double cutoff_hz, bool high_pass, float &b0, float &b1, float &b2, float &a1, float &a2)
+{
+	const double omega = 2.0 * M_PI * cutoff_hz / sample_rate;
+	const double cosOmega = std::cos(omega);
+	const double alpha = std::sin(omega) / std::sqrt(2.0);
+	const double a0 = 1.0 + alpha;
+
+	if (high_pass)
+	{
+		b0 = (float)(0.5 * (1.0 + cosOmega) / a0);
+		b1 = (float)(-(1.0 + cosOmega) / a0);
+	}
+	else
+	{
+		b0 = (float)(0.5 * (1.0 - cosOmega) / a0);
+		b1 = (float)((1.0 - cosOmega) / a0);
+	}
+	b2 = b0;
+	a1 = (float)(-2.0 * cosOmega / a0);
+	a2 = (float)((1.0 - alpha) / a0);
+}
+
+void ECGBeatDetector::Biquad::Process(const float *in, float *out, int count)
+{
+	// Transposed direct form II, in and out may be the same array
+	for (int i = 0; i < count; ++i)
+	{
+		const float x = in[i];
+		const float y = b0 * x + z1;
+
+		z1 = b1 * x - a1 * y + z2;
+		z2 = b2 * x - a2 * y;
+		out[i] = y;
+	}
+}
+
+ECGBeatDetector::ECGBeatDetector(HSLSensorID sensor_id, const ECGBeatDetectorSettings &settings)
+	: m_sensorID(sensor_id)
+	, m_settings(settings)
+	, m_watcher(sensor_id, HSLBufferType_ECGData)
+{
+	const double sampleRate = m_settings.sampleRate;
+	const double nyquist = 0.5 * sampleRate;
+	const double highCutoff = std::min(m_settings.highCutoffHz, 0.9 * nyquist);
+	const double lowCutoff = std::min(m_settings.lowCutoffHz, 0.5 * highCutoff);
+
+	m_integrationLength = std::max((int)std::lround(m_settings.integrationSeconds * sampleRate), 1);
+	m_refractoryLength = std::max((int)std::lround(m_settings.refractorySeconds * sampleRate), 1);
+	m_learningLength = std::max((int)std::lround(k_learningSeconds * sampleRate), 1);
+	m_tWaveLength = (int)std::lround(k_tWaveSeconds * sampleRate);
+	m_searchWindowLength = m_integrationLength + (int)std::lround(k_filterDelaySeconds * sampleRate);
+
+	memset(&m_highPass, 0, sizeof(m_highPass));
+	memset(&m_lowPass, 0, sizeof(m_lowPass));
+	DesignBiquad(sampleRate, lowCutoff, true, m_highPass.b0, m_highPass.b1, m_highPass.b2, m_highPass.a1, m_highPass.a2);
+	DesignBiquad(sampleRate, highCutoff, false, m_lowPass.b0, m_lowPass.b1, m_lowPass.b2, m_lowPass.a1, m_lowPass.a2);
+
+	m_integratorWindow.resize(m_integrationLength);
+
+	size_t historySize = 64;
+	while (historySize < (size_t)m_searchWindowLength + 8)
+	{
+		historySize *= 2;
+	}
+	m_rawHistory.resize(historySize);
+	m_slopeHistory.resize(historySize);
+	m_timeHistory.resize(historySize);
+	m_historyMask = historySize - 1;
+
+	Reset();
+}
+
+ECGBeatDetectorStats ECGBeatDetector::GetStats() const
+{
+	ECGBeatDetectorStats stats = m_stats;
+
+	stats.signalLevel = m_signalLevel;
+	stats.noiseLevel = m_noiseLevel;
+	stats.threshold = m_noiseLevel + 0.25f * (m_signalLevel - m_noiseLevel);
+
+	return stats;
+}
+
+void ECGBeatDetector::OnSensorSourceUpdated(SensorSource &source)
+{
+	m_watcher.CollectNewFrames(source, m_newFrames);
+
+	for (const void *frame_ptr : m_newFrames)
+	{
+		const HSLHeartECGFrame *frame = static_cast<const HSLHeartECGFrame *>(frame_ptr);
+		const int count = std::min(frame->ecgValueCount, (int)MAX_HSL_ECG_SAMPLES);
+
+		AddSamples(frame->ecgValues, count, frame->timeInSeconds);
+	}
+}
+
+void ECGBeatDetector::AddSamples(const int *values, int count, double last_sample_time)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	// Frames only carry the time of their last sample
+	const double samplePeriod = 1.0 / m_settings.sampleRate;
+	const double firstSampleTime = last_sample_time - (count - 1) * samplePeriod;
+
+	if (m_bHasSampleTime && std::fabs(firstSampleTime - (m_lastSampleTime + samplePeriod)) > k_maxTimeGap)
+	{
+		RestartDetection();
+		m_stats.resets++;
+	}
+
+	ProcessBlock(values, count, firstSampleTime);
+
+	m_lastSampleTime = last_sample_time;
+	m_bHasSampleTime = true;
+}
+
+void ECGBeatDetector::Reset()
+{
+	RestartDetection();
+
+	m_beats.clear();
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void ECGBeatDetector::FlushBeatBuffer()
+{
+	m_beats.clear();
+}
+
+void ECGBeatDetector::RestartDetection()
+{
+	m_highPass.z1 = m_highPass.z2 = 0.f;
+	m_lowPass.z1 = m_lowPass.z2 = 0.f;
+	std::fill(m_derivativeHistory, m_derivativeHistory + 4, 0.f);
+	std::fill(m_integratorWindow.begin(), m_integratorWindow.end(), 0.f);
+	m_integratorIndex = 0;
+	m_integratorSum = 0.0;
+	m_integrated[0] = m_integrated[1] = 0.f;
+
+	m_sampleIndex = 0;
+	m_lastSampleTime = 0.0;
+	m_bHasSampleTime = false;
+	m_learningPeak = 0.f;
+	m_learningSum = 0.0;
+	m_signalLevel = 0.f;
+	m_noiseLevel = 0.f;
+	m_bHasLastBeat = false;
+	m_lastBeatIndex = 0;
+	m_lastQRSIndex = 0;
+	m_lastBeatTime = 0.0;
+	m_lastBeatSlope = 0.f;
+	m_searchbackCandidate.bValid = false;
+	m_rrHistoryCount = 0;
+	m_rrHistoryNext = 0;
+}
+
+void ECGBeatDetector::ProcessBlock(const int *values, int count, double first_sample_time)
+{
+	const double samplePeriod = 1.0 / m_settings.sampleRate;
+	const float derivativeScale = (float)(m_settings.sampleRate / 8.0);
+
+	m_input.resize(count);
+	m_filtered.resize(count + 4);
+	m_slope.resize(count);
+	m_energy.resize(count);
+
+	float *input = m_input.data();
+	float *filtered = m_filtered.data();
+	float *slope = m_slope.data();
+	float *energy = m_energy.data();
+
+	// The stages that do not feed back on themselves are kept as separate straight
+	// loops over contiguous arrays so the compiler can vectorize them
+	for (int i = 0; i < count; ++i)
+	{
+		input[i] = (float)values[i];
+	}
+
+	// Start the high pass as if it had been settled on the first sample for a while,
+	// otherwise the DC offset of the raw signal rings through the first second
+	if (m_sampleIndex == 0)
+	{
+		m_highPass.z2 = m_highPass.b2 * input[0];
+		m_highPass.z1 = (m_highPass.b1 + m_highPass.b2) * input[0];
+	}
+
+	memcpy(filtered, m_derivativeHistory, sizeof(m_derivativeHistory));
+	m_highPass.Process(input, filtered + 4, count);
+	m_lowPass.Process(filtered + 4, filtered + 4, count);
+
+	// Five point derivative, then squared
+	for (int i = 0; i < count; ++i)
+	{
+		const float d = (2.f * filtered[i + 4] + filtered[i + 3] - filtered[i + 1] - 2.f * filtered[i]) * derivativeScale;
+
+		slope[i] = std::fabs(d);
+		energy[i] = d * d;
+	}
+	memcpy(m_derivativeHistory, filtered + count, sizeof(m_derivativeHistory));
+
+	const float threshold2Scale = 0.5f;
+	for (int i = 0; i < count; ++i)
+	{
+		const uint64_t sampleIndex = m_sampleIndex;
+		const size_t historySlot = (size_t)(sampleIndex & m_historyMask);
+
+		m_rawHistory[historySlot] = values[i];
+		m_slopeHistory[historySlot] = slope[i];
+		m_timeHistory[historySlot] = first_sample_time + i * samplePeriod;
+
+		// Moving window integrator
+		m_integratorSum += energy[i] - m_integratorWindow[m_integratorIndex];
+		m_integratorWindow[m_integratorIndex] = energy[i];
+		m_integratorIndex = (m_integratorIndex + 1 < m_integratorWindow.size()) ? m_integratorIndex + 1 : 0;
+
+		const float integrated = (float)(std::max(m_integratorSum, 0.0) / m_integrationLength);
+
+		if (sampleIndex < (uint64_t)m_learningLength)
+		{
+			m_learningPeak = std::max(m_learningPeak, integrated);
+			m_learningSum += integrated;
+
+			if (sampleIndex + 1 == (uint64_t)m_learningLength)
+			{
+				m_signalLevel = m_learningPeak / 3.f;
+				m_noiseLevel = (float)(0.5 * m_learningSum / m_learningLength);
+			}
+		}
+		else
+		{
+			// Local maximum of the integrated signal one sample back
+			if (m_integrated[0] > integrated && m_integrated[0] >= m_integrated[1])
+			{
+				ProcessIntegratedPeak(sampleIndex - 1, m_integrated[0]);
+			}
+
+			// Nothing for too long, take the best peak seen above the lower threshold
+			if (m_bHasLastBeat && m_rrHistoryCount > 0 && m_searchbackCandidate.bValid &&
+				(float)(sampleIndex - m_lastBeatIndex) > k_searchbackRR * GetMeanRRSamples())
+			{
+				const PeakCandidate candidate = m_searchbackCandidate;
+				const float threshold1 = m_noiseLevel + 0.25f * (m_signalLevel - m_noiseLevel);
+
+				if (candidate.peak > threshold2Scale * threshold1)
+				{
+					m_signalLevel = 0.25f * candidate.peak + 0.75f * m_signalLevel;
+					AcceptBeat(candidate, true);
+				}
+				m_searchbackCandidate.bValid = false;
+			}
+		}
+
+		m_integrated[1] = m_integrated[0];
+		m_integrated[0] = integrated;
+		m_sampleIndex++;
+	}
+
+	m_stats.samplesProcessed += count;
+}
+
+void ECGBeatDetector::ProcessIntegratedPeak(uint64_t peak_index, float peak)
+{
+	if (m_bHasLastBeat && peak_index < m_lastQRSIndex + m_refractoryLength)
+	{
+		return;
+	}
+
+	PeakCandidate candidate;
+	LocateRPeak(peak_index, peak, candidate);
+
+	const float threshold1 = m_noiseLevel + 0.25f * (m_signalLevel - m_noiseLevel);
+	const bool bMaybeTWave = m_bHasLastBeat && candidate.rIndex < m_lastBeatIndex + m_tWaveLength;
+
+	// A T wave shortly after a beat has a much gentler slope than the QRS before it
+	if (bMaybeTWave && candidate.slope < 0.5f * m_lastBeatSlope)
+	{
+		m_noiseLevel = 0.125f * peak + 0.875f * m_noiseLevel;
+		return;
+	}
+
+	if (peak > threshold1)
+	{
+		m_signalLevel = 0.125f * peak + 0.875f * m_signalLevel;
+		AcceptBeat(candidate, false);
+		return;
+	}
+
+	m_noiseLevel = 0.125f * peak + 0.875f * m_noiseLevel;
+
+	if (!m_searchbackCandidate.bValid || peak > m_searchbackCandidate.peak)
+	{
+		m_searchbackCandidate = candidate;
+	}
+}
+
+void ECGBeatDetector::LocateRPeak(uint64_t peak_index, float peak, PeakCandidate &out_candidate) const
+{
+	// The QRS that produced an integrated peak lies in the window before it.
+	// Never look further back than the history holds or into the last beat's refractory period.
+	const uint64_t historySize = m_historyMask + 1;
+	uint64_t first = (peak_index >= (uint64_t)m_searchWindowLength) ? peak_index - m_searchWindowLength : 0;
+
+	if (m_sampleIndex > historySize)
+	{
+		first = std::max(first, m_sampleIndex - historySize);
+	}
+	if (m_bHasLastBeat)
+	{
+		first = std::max(first, m_lastBeatIndex + m_refractoryLength);
+	}
+	first = std::min(first, peak_index);
+
+	uint64_t rIndex = first;
+	int32_t rValue = m_rawHistory[first & m_historyMask];
+	float maxSlope = 0.f;
+
+	for (uint64_t index = first; index <= peak_index; ++index)
+	{
+		const size_t slot = (size_t)(index & m_historyMask);
+
+		if (m_rawHistory[slot] > rValue)
+		{
+			rValue = m_rawHistory[slot];
+			rIndex = index;
+		}
+		maxSlope = std::max(maxSlope, m_slopeHistory[slot]);
+	}
+
+	out_candidate.bValid = true;
+	out_candidate.peak = peak;
+	out_candidate.slope = maxSlope;
+	out_candidate.qrsIndex = peak_index;
+	out_candidate.rIndex = rIndex;
+	out_candidate.time = m_timeHistory[rIndex & m_historyMask];
+	out_candidate.amplitude = rValue;
+}
+
+void ECGBeatDetector::AcceptBeat(const PeakCandidate &candidate, bool searchback)
+{
+	ECGBeat beat;
+	beat.timeInSeconds = candidate.time;
+	beat.amplitude = candidate.amplitude;
+	beat.flags = searchback ? ECGBeatFlag_Searchback : 0;
+
+	if (m_bHasLastBeat)
+	{
+		beat.rrInterval = (int32_t)std::lround((candidate.time - m_lastBeatTime) * 1000.0);
+
+		m_rrHistory[m_rrHistoryNext] = (float)(candidate.rIndex - m_lastBeatIndex);
+		m_rrHistoryNext = (m_rrHistoryNext + 1) % 8;
+		m_rrHistoryCount = std::min(m_rrHistoryCount + 1, 8);
+	}
+	else
+	{
+		beat.rrInterval = 0;
+		beat.flags |= ECGBeatFlag_AfterGap;
+	}
+
+	m_bHasLastBeat = true;
+	m_lastBeatIndex = candidate.rIndex;
+	m_lastQRSIndex = candidate.qrsIndex;
+	m_lastBeatTime = candidate.time;
+	m_lastBeatSlope = candidate.slope;
+	m_searchbackCandidate.bValid = false;
+
+	m_beats.push_back(beat);
+	if (m_beats.size() > m_settings.beatBufferCapacity)
+	{
+		m_beats.pop_front();
+		m_stats.beatsDropped++;
+	}
+
+	m_stats.beatsDetected++;
+	if (searchback)
+	{
+		m_stats.searchbackBeats++;
+	}
+}
+
+float ECGBeatDetector::GetMeanRRSamples() const
+{
+	float sum = 0.f;
+
+	for (int i = 0; i < m_rrHistoryCount; ++i)
+	{
+		sum += m_rrHistory[i];
+	}
+
+	return (m_rrHistoryCount > 0) ? sum / m_rrHistoryCount : 0.f;
+}
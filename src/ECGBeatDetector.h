@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef ECG_BEAT_DETECTOR_H
+#define ECG_BEAT_DETECTOR_H
+
+#include "SensorSource.h"
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+enum ECGBeatFlags
+{
+	ECGBeatFlag_Searchback = 1 << 0, // Found by searching back with the lower threshold after a missed beat
+	ECGBeatFlag_AfterGap = 1 << 1,   // First beat after a reset or a gap in the ECG stream, rrInterval is 0
+};
+
+// One detected R peak
+struct ECGBeat
+{
+	double timeInSeconds; // Time of the R peak sample
+	int32_t rrInterval;   // Milliseconds since the previous R peak, 0 if unknown
+	int32_t amplitude;    // Raw ECG value at the R peak, in microvolts
+	int32_t flags;        // ECGBeatFlags
+};
+
+struct ECGBeatDetectorSettings
+{
+	ECGBeatDetectorSettings();
+
+	double sampleRate;           // ECG samples per second (130 on a Polar H10)
+	double lowCutoffHz;          // Bandpass that keeps the QRS energy and drops baseline wander and T waves
+	double highCutoffHz;
+	double integrationSeconds;   // Length of the moving window integrator, about one QRS wide
+	double refractorySeconds;    // No second beat is accepted this soon after a beat
+	size_t beatBufferCapacity;   // Oldest beats are dropped once this many are waiting to be read
+};
+
+struct ECGBeatDetectorStats
+{
+	uint64_t beatsDetected;
+	uint64_t searchbackBeats;
+	uint64_t beatsDropped;   // Overwritten in the beat buffer before anyone read them
+	uint64_t samplesProcessed;
+	uint64_t resets;         // Gaps or time jumps in the stream that restarted detection
+	double signalLevel;      // Running peak estimates of the integrated signal (SPKI, NPKI)
+	double noiseLevel;
+	double threshold;
+};
+
+// Streaming Pan-Tompkins QRS detector for the ECG stream of one sensor.
+//
+// Each ECG frame runs through a pipeline: bandpass (two biquads), five point
+// derivative, squaring, then a moving window integrator. R peaks are picked from
+// the integrated signal with adaptive signal and noise thresholds. T waves are
+// rejected on slope, and missed beats are recovered by searching back with the
+// lower threshold. All filter state carries over from one frame to the next, so a
+// frame costs O(samples) no matter how long the stream has been running.
+//
+// Attached as a SensorSourceListener; it watches the ECG buffer without flushing it,
+// so the raw samples are still there for everyone else.
+class ECGBeatDetector : public SensorSourceListener
+{
+public:
+	ECGBeatDetector(HSLSensorID sensor_id, const ECGBeatDetectorSettings &settings);
+
+	HSLSensorID GetSensorID() const { return m_sensorID; }
+	const ECGBeatDetectorSettings &GetSettings() const { return m_settings; }
+	ECGBeatDetectorStats GetStats() const;
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	// Runs count samples through the detector. last_sample_time is the time of values[count - 1].
+	void AddSamples(const int *values, int count, double last_sample_time);
+	void Reset();
+
+	// Beats detected since the buffer was last flushed, oldest first
+	const std::deque<ECGBeat> &GetBeatBuffer() const { return m_beats; }
+	void FlushBeatBuffer();
+
+private:
+	struct Biquad
+	{
+		float b0, b1, b2, a1, a2;
+		float z1, z2;
+
+		void Process(const float *in, float *out, int count);
+	};
+
+	// A peak of the integrated signal and where its R peak is
+	struct PeakCandidate
+	{
+		bool bValid;
+		float peak;
+		float slope;
+		uint64_t qrsIndex;    // Sample index of the integrated peak
+		uint64_t rIndex;      // Sample index of the R peak
+		double time;          // Copied out of the history, which may have moved on by the time a searchback uses it
+		int32_t amplitude;
+	};
+
+	void RestartDetection();
+	void ProcessBlock(const int *values, int count, double first_sample_time);
+	void ProcessIntegratedPeak(uint64_t peak_index, float peak);
+	void LocateRPeak(uint64_t peak_index, float peak, PeakCandidate &out_candidate) const;
+	void AcceptBeat(const PeakCandidate &candidate, bool searchback);
+	float GetMeanRRSamples() const;
+
+	const HSLSensorID m_sensorID;
+	const ECGBeatDetectorSettings m_settings;
+	SensorBufferWatcher m_watcher;
+	std::vector<const void *> m_newFrames;
+
+	// Derived from the settings
+	int m_integrationLength;
+	int m_refractoryLength;
+	int m_learningLength;
+	int m_tWaveLength;  // Beats closer than this to the last one get the T wave slope test
+	int m_searchWindowLength;
+
+	// Filter state, kept across frames
+	Biquad m_highPass;
+	Biquad m_lowPass;
+	float m_derivativeHistory[4]; // Last four bandpassed samples of the previous block
+	std::vector<float> m_integratorWindow;
+	size_t m_integratorIndex;
+	double m_integratorSum;
+	float m_integrated[2];      // The two integrated values before the current one
+
+	// Per block scratch, each stage is one pass over contiguous memory
+	std::vector<float> m_input;
+	std::vector<float> m_filtered; // Four samples of history followed by the block
+	std::vector<float> m_slope;
+	std::vector<float> m_energy;
+
+	// Recent samples for locating R peaks, indexed by sample index & m_historyMask
+	std::vector<int32_t> m_rawHistory;
+	std::vector<float> m_slopeHistory;
+	std::vector<double> m_timeHistory;
+	uint64_t m_historyMask;
+
+	// Detection state
+	uint64_t m_sampleIndex;        // Index of the next sample
+	double m_lastSampleTime;
+	bool m_bHasSampleTime;
+	float m_learningPeak;
+	double m_learningSum;
+	float m_signalLevel;
+	float m_noiseLevel;
+	bool m_bHasLastBeat;
+	uint64_t m_lastBeatIndex;      // Sample index of the last R peak
+	uint64_t m_lastQRSIndex;       // Sample index of the integrated peak of the last beat
+	double m_lastBeatTime;
+	float m_lastBeatSlope;
+	PeakCandidate m_searchbackCandidate;
+	float m_rrHistory[8];          // Recent RR intervals in samples
+	int m_rrHistoryCount;
+	int m_rrHistoryNext;
+
+	std::deque<ECGBeat> m_beats;
+	ECGBeatDetectorStats m_stats;
+};
+
+#endif // ECG_BEAT_DETECTOR_H
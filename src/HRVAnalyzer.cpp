@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "HRVAnalyzer.h"
+#include "SensorFrameBatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Periodogram frequencies are k_spectrumStep, 2*k_spectrumStep, ... up to the top of the HF band
+static const double k_spectrumStep = 0.0025;
+static const size_t k_spectrumBinCount = 160;
+static const size_t k_minSpectrumBeats = 16;
+
+// Band edges in Hz, each band is (lower, upper]
+static const double k_vlfBand[2] = {0.0033, 0.04};
+static const double k_lfBand[2] = {0.04, 0.15};
+static const double k_hfBand[2] = {0.15, 0.4};
+
+// A beat this much older than the newest one means the source jumped back in time (e.g. a replay seek)
+static const double k_maxTimeRewind = 2.0;
+
+enum HRVBand
+{
+	HRVBand_VLF,
+	HRVBand_LF,
+	HRVBand_HF,
+	HRVBand_Total,
+
+	HRVBand_COUNT
+};
+
+HRVAnalyzerSettings::HRVAnalyzerSettings()
+	: beatSource(HRVBeatSource_HRData)
+	, windowSeconds(300.0)
+	, spectrumIntervalSeconds(5.0)
+	, minRRInterval(300)
+	, maxRRInterval(2000)
+	, maxRRChange(0.2)
+{
+}
+
+HRVAnalyzer::HRVAnalyzer(HSLSensorID sensor_id, const HRVAnalyzerSettings &settings)
+	: m_sensorID(sensor_id)
+	, m_settings(settings)
+	, m_watcher(
+		sensor_id,
+		settings.beatSource == HRVBeatSource_PPIData ? HSLBufferType_PPIData : HSLBufferType_HRData)
+{
+	m_spectrumFrequencies.resize(k_spectrumBinCount);
+	for (size_t bin = 0; bin < k_spectrumBinCount; ++bin)
+	{
+		m_spectrumFrequencies[bin] = (double)(bin + 1) * k_spectrumStep;
+	}
+
+	Reset();
+}
+
+void HRVAnalyzer::OnSensorSourceUpdated(SensorSource &source)
+{
+	m_watcher.CollectNewFrames(source, m_newFrames);
+
+	for (const void *frame : m_newFrames)
+	{
+		AddBeatsFromFrame(frame);
+	}
+}
+
+void HRVAnalyzer::AddBeatsFromFrame(const void *frame_ptr)
+{
+	// Frames only carry their own time, which is when the last beat in them ended.
+	// Earlier beats are placed by walking back through the intervals.
+	if (m_watcher.GetBufferType() == HSLBufferType_HRData)
+	{
+		const HSLHeartRateFrame *frame = static_cast<const HSLHeartRateFrame *>(frame_ptr);
+		const int count = std::min(frame->RRIntervalCount, (int)MAX_HSL_RR_INTERVALS);
+
+		double beatTime = frame->timeInSeconds;
+		for (int i = count - 1; i > 0; --i)
+		{
+			beatTime -= frame->RRIntervals[i] / 1000.0;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			AddBeat(beatTime, frame->RRIntervals[i]);
+
+			if (i + 1 < count)
+			{
+				beatTime += frame->RRIntervals[i + 1] / 1000.0;
+			}
+		}
+	}
+	else
+	{
+		const HSLHeartPPIFrame *frame = static_cast<const HSLHeartPPIFrame *>(frame_ptr);
+		const int count = std::min(frame->ppiSampleCount, (int)MAX_HSL_PPI_SAMPLES);
+
+		double beatTime = frame->timeInSeconds;
+		for (int i = count - 1; i > 0; --i)
+		{
+			beatTime -= frame->ppiSamples[i].pulseDuration / 1000.0;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			const HSLHeartPPISample &sample = frame->ppiSamples[i];
+			const bool bLostContact = sample.supportsSkinContactBit != 0 && sample.skinContactBit == 0;
+
+			// The sensor flags pulses it could not measure reliably, e.g. while moving
+			if (sample.blockerBit != 0 || bLostContact)
+			{
+				m_rejectedBeatCount++;
+				m_bLastBeatAccepted = false;
+			}
+			else
+			{
+				AddBeat(beatTime, sample.pulseDuration);
+			}
+
+			if (i + 1 < count)
+			{
+				beatTime += frame->ppiSamples[i + 1].pulseDuration / 1000.0;
+			}
+		}
+	}
+}
+
+bool HRVAnalyzer::AddBeat(double time, int rr_interval)
+{
+	if (!m_window.empty() && time < m_window.back().time - k_maxTimeRewind)
+	{
+		Reset();
+	}
+
+	if (rr_interval < m_settings.minRRInterval || rr_interval > m_settings.maxRRInterval)
+	{
+		m_rejectedBeatCount++;
+		m_bLastBeatAccepted = false;
+		return false;
+	}
+
+	// Compared against the previous in range interval, accepted or not, so a lasting
+	// change in heart rate only costs one beat while an ectopic beat and the
+	// compensatory pause after it are both dropped
+	const int32_t previousInterval = m_lastInterval;
+	m_lastInterval = rr_interval;
+
+	if (previousInterval > 0 &&
+		std::abs(rr_interval - previousInterval) > m_settings.maxRRChange * previousInterval)
+	{
+		m_rejectedBeatCount++;
+		m_bLastBeatAccepted = false;
+		return false;
+	}
+
+	Beat beat;
+	beat.time = time;
+	beat.rrInterval = rr_interval;
+	beat.bHasDifference = m_bLastBeatAccepted && !m_window.empty();
+	beat.rrDifference = beat.bHasDifference ? rr_interval - m_window.back().rrInterval : 0;
+
+	PushBeat(beat);
+	m_bLastBeatAccepted = true;
+	m_acceptedBeatCount++;
+
+	while (m_window.size() > 1 && m_window.back().time - m_window.front().time > m_settings.windowSeconds)
+	{
+		PopOldestBeat();
+	}
+
+	if (m_window.size() >= k_minSpectrumBeats &&
+		(m_lastSpectrumTime < 0.0 || time - m_lastSpectrumTime >= m_settings.spectrumIntervalSeconds || time < m_lastSpectrumTime))
+	{
+		UpdateSpectrum();
+	}
+
+	return true;
+}
+
+void HRVAnalyzer::Reset()
+{
+	m_window.clear();
+	m_lastInterval = 0;
+	m_bLastBeatAccepted = false;
+	m_acceptedBeatCount = 0;
+	m_rejectedBeatCount = 0;
+
+	m_rrSum = 0;
+	m_rrSquaredSum = 0;
+	m_differenceCount = 0;
+	m_differenceSum = 0;
+	m_differenceSquaredSum = 0;
+	m_nn50Count = 0;
+	m_nn20Count = 0;
+
+	m_lastSpectrumTime = -1.0;
+	std::fill(m_bandPower, m_bandPower + HRVBand_COUNT, std::numeric_limits<double>::quiet_NaN());
+	m_spectrumPower.assign(k_spectrumBinCount, 0.0);
+}
+
+void HRVAnalyzer::PushBeat(const Beat &beat)
+{
+	m_rrSum += beat.rrInterval;
+	m_rrSquaredSum += (int64_t)beat.rrInterval * beat.rrInterval;
+
+	if (beat.bHasDifference)
+	{
+		const int32_t absDifference = std::abs(beat.rrDifference);
+
+		m_differenceCount++;
+		m_differenceSum += beat.rrDifference;
+		m_differenceSquaredSum += (int64_t)beat.rrDifference * beat.rrDifference;
+		m_nn50Count += (absDifference > 50) ? 1 : 0;
+		m_nn20Count += (absDifference > 20) ? 1 : 0;
+	}
+
+	m_window.push_back(beat);
+}
+
+void HRVAnalyzer::PopOldestBeat()
+{
+	const Beat &oldest = m_window.front();
+
+	m_rrSum -= oldest.rrInterval;
+	m_rrSquaredSum -= (int64_t)oldest.rrInterval * oldest.rrInterval;
+	m_window.pop_front();
+
+	// The new oldest beat's difference was taken against the beat just removed
+	if (!m_window.empty() && m_window.front().bHasDifference)
+	{
+		Beat &front = m_window.front();
+		const int32_t absDifference = std::abs(front.rrDifference);
+
+		m_differenceCount--;
+		m_differenceSum -= front.rrDifference;
+		m_differenceSquaredSum -= (int64_t)front.rrDifference * front.rrDifference;
+		m_nn50Count -= (absDifference > 50) ? 1 : 0;
+		m_nn20Count -= (absDifference > 20) ? 1 : 0;
+
+		front.bHasDifference = false;
+		front.rrDifference = 0;
+	}
+}
+
+void HRVAnalyzer::GetMetrics(double *out_metrics) const
+{
+	const double nan = std::numeric_limits<double>::quiet_NaN();
+	const int64_t n = (int64_t)m_window.size();
+	const int64_t m = m_differenceCount;
+
+	std::fill(out_metrics, out_metrics + HRVMetric_COUNT, nan);
+
+	out_metrics[HRVMetric_BeatCount] = (double)n;
+	out_metrics[HRVMetric_NN50] = (double)m_nn50Count;
+	out_metrics[HRVMetric_NN20] = (double)m_nn20Count;
+
+	if (n > 0)
+	{
+		const double meanRR = (double)m_rrSum / (double)n;
+
+		out_metrics[HRVMetric_MeanRR] = meanRR;
+		out_metrics[HRVMetric_MeanHR] = 60000.0 / meanRR;
+		out_metrics[HRVMetric_WindowSeconds] =
+			m_window.back().time - m_window.front().time + m_window.front().rrInterval / 1000.0;
+	}
+
+	// Sample variances, numerators kept exact in integers
+	if (n > 1)
+	{
+		const double numerator = (double)(n * m_rrSquaredSum - m_rrSum * m_rrSum);
+
+		out_metrics[HRVMetric_SDNN] = std::sqrt(std::max(numerator, 0.0) / (double)(n * (n - 1)));
+	}
+
+	if (m > 0)
+	{
+		out_metrics[HRVMetric_RMSSD] = std::sqrt((double)m_differenceSquaredSum / (double)m);
+		out_metrics[HRVMetric_pNN50] = 100.0 * (double)m_nn50Count / (double)m;
+		out_metrics[HRVMetric_pNN20] = 100.0 * (double)m_nn20Count / (double)m;
+	}
+
+	if (m > 1)
+	{
+		const double numerator = (double)(m * m_differenceSquaredSum - m_differenceSum * m_differenceSum);
+
+		out_metrics[HRVMetric_SDSD] = std::sqrt(std::max(numerator, 0.0) / (double)(m * (m - 1)));
+	}
+
+	if (m_lastSpectrumTime >= 0.0)
+	{
+		out_metrics[HRVMetric_VLFPower] = m_bandPower[HRVBand_VLF];
+		out_metrics[HRVMetric_LFPower] = m_bandPower[HRVBand_LF];
+		out_metrics[HRVMetric_HFPower] = m_bandPower[HRVBand_HF];
+		out_metrics[HRVMetric_TotalPower] = m_bandPower[HRVBand_Total];
+		out_metrics[HRVMetric_LFHFRatio] =
+			(m_bandPower[HRVBand_HF] > 0.0) ? m_bandPower[HRVBand_LF] / m_bandPower[HRVBand_HF] : nan;
+		out_metrics[HRVMetric_SpectrumTime] = m_lastSpectrumTime;
+	}
+}
+
+void HRVAnalyzer::GetWindowBeats(std::vector<double> &out_times, std::vector<double> &out_rr_intervals) const
+{
+	out_times.resize(m_window.size());
+	out_rr_intervals.resize(m_window.size());
+
+	for (size_t i = 0; i < m_window.size(); ++i)
+	{
+		out_times[i] = m_window[i].time;
+		out_rr_intervals[i] = m_window[i].rrInterval;
+	}
+}
+
+void HRVAnalyzer::UpdateSpectrum()
+{
+	const size_t n = m_window.size();
+	const double firstTime = m_window.front().time;
+	const double mean = (double)m_rrSum / (double)n;
+	const double stepOmega = 2.0 * M_PI * k_spectrumStep;
+
+	// Contiguous arrays so the per frequency loop below is a straight run over memory.
+	// cos/sin(w*t) for each beat is advanced from one frequency to the next by a
+	// rotation instead of calling cos and sin n times per frequency.
+	m_times.resize(n);
+	m_values.resize(n);
+	m_cos.resize(n);
+	m_sin.resize(n);
+	m_cosStep.resize(n);
+	m_sinStep.resize(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		m_times[i] = m_window[i].time - firstTime;
+		m_values[i] = m_window[i].rrInterval - mean;
+		m_cosStep[i] = m_cos[i] = std::cos(stepOmega * m_times[i]);
+		m_sinStep[i] = m_sin[i] = std::sin(stepOmega * m_times[i]);
+	}
+
+	const double *values = m_values.data();
+	double *cosWT = m_cos.data();
+	double *sinWT = m_sin.data();
+	const double *cosStep = m_cosStep.data();
+	const double *sinStep = m_sinStep.data();
+
+	// Lomb-Scargle, scaled to a one sided PSD so the bins sum to the variance
+	const double span = std::max(m_times[n - 1], 1e-3);
+	const double psdScale = 2.0 * span / (double)n;
+
+	std::fill(m_bandPower, m_bandPower + HRVBand_COUNT, 0.0);
+	for (size_t bin = 0; bin < k_spectrumBinCount; ++bin)
+	{
+		double yc = 0.0, ys = 0.0, c2 = 0.0, s2 = 0.0;
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const double c = cosWT[i];
+			const double s = sinWT[i];
+
+			yc += values[i] * c;
+			ys += values[i] * s;
+			c2 += c * c - s * s;
+			s2 += 2.0 * c * s;
+
+			cosWT[i] = c * cosStep[i] - s * sinStep[i];
+			sinWT[i] = s * cosStep[i] + c * sinStep[i];
+		}
+
+		// Time shift tau makes the sine and cosine terms orthogonal: tan(2 w tau) = s2 / c2
+		const double twoOmegaTau = std::atan2(s2, c2);
+		const double cosTau = std::cos(0.5 * twoOmegaTau);
+		const double sinTau = std::sin(0.5 * twoOmegaTau);
+		const double r = std::sqrt(c2 * c2 + s2 * s2);
+		const double cosNorm = 0.5 * ((double)n + r);
+		const double sinNorm = 0.5 * ((double)n - r);
+		const double ycTau = yc * cosTau + ys * sinTau;
+		const double ysTau = ys * cosTau - yc * sinTau;
+
+		double power = (cosNorm > 1e-9) ? ycTau * ycTau / cosNorm : 0.0;
+		power += (sinNorm > 1e-9) ? ysTau * ysTau / sinNorm : 0.0;
+
+		const double psd = 0.5 * power * psdScale;
+		const double frequency = m_spectrumFrequencies[bin];
+		m_spectrumPower[bin] = psd;
+
+		const double binPower = psd * k_spectrumStep;
+		if (frequency > k_vlfBand[0] && frequency <= k_vlfBand[1])
+			m_bandPower[HRVBand_VLF] += binPower;
+		else if (frequency > k_lfBand[0] && frequency <= k_lfBand[1])
+			m_bandPower[HRVBand_LF] += binPower;
+		else if (frequency > k_hfBand[0] && frequency <= k_hfBand[1])
+			m_bandPower[HRVBand_HF] += binPower;
+
+		if (frequency > k_vlfBand[0])
+			m_bandPower[HRVBand_Total] += binPower;
+	}
+
+	m_lastSpectrumTime = m_window.back().time;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HRV_ANALYZER_H
+#define HRV_ANALYZER_H
+
+#include "SensorSource.h"
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+// Values reported by HRVAnalyzer::GetMetrics, in this order.
+// Intervals are in milliseconds, band powers in ms^2.
+enum HRVMetric
+{
+	HRVMetric_MeanRR,
+	HRVMetric_SDNN,
+	HRVMetric_RMSSD,
+	HRVMetric_SDSD,
+	HRVMetric_NN50,
+	HRVMetric_pNN50,
+	HRVMetric_NN20,
+	HRVMetric_pNN20,
+	HRVMetric_MeanHR,
+	HRVMetric_BeatCount,
+	HRVMetric_WindowSeconds, // Time actually covered by the beats in the window
+	HRVMetric_VLFPower,      // 0.0033 - 0.04 Hz
+	HRVMetric_LFPower,       // 0.04 - 0.15 Hz
+	HRVMetric_HFPower,       // 0.15 - 0.4 Hz
+	HRVMetric_LFHFRatio,
+	HRVMetric_TotalPower,
+	HRVMetric_SpectrumTime,  // Time of the newest beat the band powers were computed with
+
+	HRVMetric_COUNT
+};
+
+// Where beat to beat intervals are taken from
+enum HRVBeatSource
+{
+	HRVBeatSource_HRData,  // RRIntervals of heart rate frames (chest straps)
+	HRVBeatSource_PPIData, // Pulse durations of PPI frames (optical sensors)
+};
+
+struct HRVAnalyzerSettings
+{
+	HRVAnalyzerSettings();
+
+	HRVBeatSource beatSource;
+	double windowSeconds;           // Length of the sliding window
+	double spectrumIntervalSeconds; // How often band powers are recomputed, in beat time
+	int minRRInterval;              // Intervals outside [min, max] ms are rejected as artifacts
+	int maxRRInterval;
+	double maxRRChange;             // Intervals differing from the last accepted one by more than this fraction are rejected
+};
+
+// Time and frequency domain HRV over a sliding window of beats from one sensor.
+//
+// Time domain metrics are kept as running integer sums that are updated as beats enter
+// and leave the window, so each beat costs O(1) no matter how long the window is.
+// Band powers come from a Lomb-Scargle periodogram of the unevenly spaced intervals,
+// which avoids resampling the RR series. That costs O(beats x frequency bins), so it
+// only runs every spectrumIntervalSeconds.
+//
+// Attached as a SensorSourceListener; it watches the HR or PPI buffer without flushing it.
+class HRVAnalyzer : public SensorSourceListener
+{
+public:
+	HRVAnalyzer(HSLSensorID sensor_id, const HRVAnalyzerSettings &settings);
+
+	HSLSensorID GetSensorID() const { return m_sensorID; }
+	const HRVAnalyzerSettings &GetSettings() const { return m_settings; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	// Adds one beat to beat interval ending at the given time.
+	// Returns false if it was rejected as an artifact.
+	bool AddBeat(double time, int rr_interval);
+	void Reset();
+
+	// Writes HRVMetric_COUNT values
+	void GetMetrics(double *out_metrics) const;
+
+	// Periodogram from the last spectrum update, in ms^2/Hz
+	const std::vector<double> &GetSpectrumFrequencies() const { return m_spectrumFrequencies; }
+	const std::vector<double> &GetSpectrumPower() const { return m_spectrumPower; }
+
+	size_t GetWindowBeatCount() const { return m_window.size(); }
+	void GetWindowBeats(std::vector<double> &out_times, std::vector<double> &out_rr_intervals) const;
+
+	uint64_t GetAcceptedBeatCount() const { return m_acceptedBeatCount; }
+	uint64_t GetRejectedBeatCount() const { return m_rejectedBeatCount; }
+
+private:
+	struct Beat
+	{
+		double time;
+		int32_t rrInterval;
+		int32_t rrDifference;   // To the previous beat, if bHasDifference
+		bool bHasDifference;    // False after a rejected beat, the interval before it is unknown
+	};
+
+	void AddBeatsFromFrame(const void *frame);
+	void PushBeat(const Beat &beat);
+	void PopOldestBeat();
+	void UpdateSpectrum();
+
+	const HSLSensorID m_sensorID;
+	const HRVAnalyzerSettings m_settings;
+	SensorBufferWatcher m_watcher;
+	std::vector<const void *> m_newFrames;
+
+	std::deque<Beat> m_window;
+	int32_t m_lastInterval;
+	bool m_bLastBeatAccepted;
+	uint64_t m_acceptedBeatCount;
+	uint64_t m_rejectedBeatCount;
+
+	// Running sums over the window
+	int64_t m_rrSum;
+	int64_t m_rrSquaredSum;
+	int64_t m_differenceCount;
+	int64_t m_differenceSum;
+	int64_t m_differenceSquaredSum;
+	int64_t m_nn50Count;
+	int64_t m_nn20Count;
+
+	// Band powers, see UpdateSpectrum
+	double m_lastSpectrumTime;
+	double m_bandPower[4]; // VLF, LF, HF, total
+	std::vector<double> m_spectrumFrequencies;
+	std::vector<double> m_spectrumPower;
+
+	// Scratch space for the periodogram, one entry per beat
+	std::vector<double> m_times;
+	std::vector<double> m_values;
+	std::vector<double> m_cos;
+	std::vector<double> m_sin;
+	std::vector<double> m_cosStep;
+	std::vector<double> m_sinStep;
+};
+
+#endif // HRV_ANALYZER_H
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HSL_LOCK_H
+#define HSL_LOCK_H
+
+#include <mutex>
+
+// The HSL client API is not thread safe. Every call into it from either the
+// JS thread or the background poller thread must hold this mutex.
+inline std::mutex &GetHSLMutex()
+{
+	static std::mutex s_hslMutex;
+
+	return s_hslMutex;
+}
+
+class HSLScopedLock
+{
+public:
+	HSLScopedLock() : m_lock(GetHSLMutex()) {}
+
+private:
+	std::lock_guard<std::mutex> m_lock;
+};
+
+#endif // HSL_LOCK_H
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "PipelineStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// An interval this many times the usual one is a gap in the stream
+static const double k_gapIntervalRatio = 2.5;
+
+// Weight of each new frame interval in the smoothed one
+static const double k_intervalSmoothing = 0.1;
+
+// Frames more than this far back in time restart the stream (e.g. a replay seek) rather than count as duplicates
+static const double k_restartSeconds = 1.0;
+
+const char *GetPipelineTimingName(PipelineTiming timing)
+{
+	switch (timing)
+	{
+	case PipelineTiming_SourceUpdate:
+		return "sourceUpdate";
+	case PipelineTiming_Listeners:
+		return "listeners";
+	case PipelineTiming_Drain:
+		return "drain";
+	case PipelineTiming_DeliverPolled:
+		return "deliverPolled";
+	case PipelineTiming_PollEvents:
+		return "pollEvents";
+	case PipelineTiming_SensorChanges:
+		return "sensorChanges";
+	case PipelineTiming_Encode:
+		return "encode";
+	case PipelineTiming_HistoryRange:
+		return "historyRange";
+	default:
+		return "";
+	}
+}
+
+//-- LatencyHistogram -----
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Record(double microseconds)
+{
+	const uint64_t value = (microseconds > 0.0) ? (uint64_t)microseconds : 0;
+
+	// Bucket 0 holds [0, 1) us, bucket i holds [2^(i-1), 2^i) us
+	int bucket = 0;
+	for (uint64_t remaining = value; remaining != 0 && bucket < k_bucketCount - 1; remaining >>= 1)
+	{
+		++bucket;
+	}
+
+	m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	m_sumMicroseconds.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t previousMax = m_maxMicroseconds.load(std::memory_order_relaxed);
+	while (value > previousMax &&
+		!m_maxMicroseconds.compare_exchange_weak(previousMax, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+void LatencyHistogram::Reset()
+{
+	for (int bucket = 0; bucket < k_bucketCount; ++bucket)
+	{
+		m_buckets[bucket].store(0, std::memory_order_relaxed);
+	}
+
+	m_count.store(0, std::memory_order_relaxed);
+	m_sumMicroseconds.store(0, std::memory_order_relaxed);
+	m_maxMicroseconds.store(0, std::memory_order_relaxed);
+}
+
+LatencySummary LatencyHistogram::GetSummary() const
+{
+	uint64_t buckets[k_bucketCount];
+	uint64_t count = 0;
+
+	// Counted from the buckets themselves so percentiles agree with them mid-update
+	for (int bucket = 0; bucket < k_bucketCount; ++bucket)
+	{
+		buckets[bucket] = m_buckets[bucket].load(std::memory_order_relaxed);
+		count += buckets[bucket];
+	}
+
+	const double maxMs = m_maxMicroseconds.load(std::memory_order_relaxed) / 1000.0;
+
+	// Upper bound of the bucket holding the given fraction of the samples, capped at the max
+	auto percentile = [&](double fraction) {
+		const uint64_t rank = (uint64_t)std::ceil(fraction * (double)count);
+		uint64_t seen = 0;
+
+		for (int bucket = 0; bucket < k_bucketCount; ++bucket)
+		{
+			seen += buckets[bucket];
+			if (seen >= rank && seen > 0)
+			{
+				return std::min(std::ldexp(1.0, bucket) / 1000.0, maxMs);
+			}
+		}
+
+		return maxMs;
+	};
+
+	LatencySummary summary;
+	summary.count = count;
+	summary.sum = m_sumMicroseconds.load(std::memory_order_relaxed) / 1000.0;
+	summary.mean = (count > 0) ? summary.sum / (double)count : 0.0;
+	summary.p50 = percentile(0.5);
+	summary.p90 = percentile(0.9);
+	summary.p99 = percentile(0.99);
+	summary.max = maxMs;
+
+	return summary;
+}
+
+//-- PipelineStats -----
+PipelineStats::StreamStats::StreamStats()
+	: drains(0)
+	, frames(0)
+	, samples(0)
+	, duplicateFrames(0)
+	, droppedFrames(0)
+	, gaps(0)
+	, lastFrameTime(0.0)
+	, frameInterval(0.0)
+	, minDelay(std::numeric_limits<double>::infinity())
+{
+}
+
+PipelineStats::PipelineStats()
+	: m_bEnabled(true)
+	, m_startTime(std::chrono::steady_clock::now())
+{
+}
+
+double PipelineStats::GetUptimeSeconds() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+}
+
+void PipelineStats::RecordTiming(PipelineTiming timing, double microseconds)
+{
+	m_timings[timing].Record(microseconds);
+}
+
+PipelineStats::StreamStats &PipelineStats::FindStream(HSLSensorID sensor_id, HSLSensorBufferType buffer_type)
+{
+	const uint64_t key = ((uint64_t)(uint32_t)sensor_id << 8) | (uint64_t)buffer_type;
+	std::unique_ptr<StreamStats> &stream = m_streams[key];
+
+	if (!stream)
+	{
+		stream.reset(new StreamStats());
+	}
+
+	return *stream;
+}
+
+double PipelineStats::RecordDrain(HSLSensorID sensor_id, const SensorFrameLayout &layout, const uint8_t *data)
+{
+	if (!IsEnabled() || layout.frameCount == 0)
+	{
+		return 0.0;
+	}
+
+	const double hostTime = GetUptimeSeconds();
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+
+	std::lock_guard<std::mutex> lock(m_streamMutex);
+	StreamStats &stream = FindStream(sensor_id, layout.bufferType);
+
+	stream.drains++;
+	stream.frames += layout.frameCount;
+	stream.samples += layout.sampleCount;
+
+	for (size_t frame = 0; frame < layout.frameCount; ++frame)
+	{
+		const double frameTime = frameTimes[frame];
+
+		if (stream.lastFrameTime > 0.0)
+		{
+			const double interval = frameTime - stream.lastFrameTime;
+
+			if (interval < -k_restartSeconds)
+			{
+				stream.frameInterval = 0.0;
+				stream.minDelay = std::numeric_limits<double>::infinity();
+			}
+			else if (interval <= 0.0)
+			{
+				stream.duplicateFrames++;
+				continue;
+			}
+			else if (stream.frameInterval > 0.0 && interval > k_gapIntervalRatio * stream.frameInterval)
+			{
+				stream.gaps++;
+				stream.droppedFrames += (uint64_t)std::max(std::round(interval / stream.frameInterval) - 1.0, 0.0);
+			}
+			else
+			{
+				stream.frameInterval = (stream.frameInterval > 0.0)
+					? stream.frameInterval + (interval - stream.frameInterval) * k_intervalSmoothing
+					: interval;
+			}
+		}
+
+		stream.lastFrameTime = frameTime;
+	}
+
+	const double delay = hostTime - frameTimes[layout.frameCount - 1];
+	stream.minDelay = std::min(stream.minDelay, delay);
+
+	const double ageMs = (delay - stream.minDelay) * 1000.0;
+	stream.frameAge.Record(ageMs * 1000.0);
+
+	return ageMs;
+}
+
+void PipelineStats::RecordDelivery(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, double milliseconds)
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_streamMutex);
+	FindStream(sensor_id, buffer_type).endToEnd.Record(milliseconds * 1000.0);
+}
+
+void PipelineStats::GetStreams(std::vector<PipelineStreamSnapshot> &out_streams) const
+{
+	std::lock_guard<std::mutex> lock(m_streamMutex);
+
+	out_streams.clear();
+	for (const auto &entry : m_streams)
+	{
+		const StreamStats &stream = *entry.second;
+		PipelineStreamSnapshot snapshot;
+
+		snapshot.sensorID = (HSLSensorID)(int32_t)(uint32_t)(entry.first >> 8);
+		snapshot.bufferType = (HSLSensorBufferType)(entry.first & 0xFF);
+		snapshot.drains = stream.drains;
+		snapshot.frames = stream.frames;
+		snapshot.samples = stream.samples;
+		snapshot.duplicateFrames = stream.duplicateFrames;
+		snapshot.droppedFrames = stream.droppedFrames;
+		snapshot.gaps = stream.gaps;
+		snapshot.frameAge = stream.frameAge.GetSummary();
+		snapshot.endToEnd = stream.endToEnd.GetSummary();
+
+		out_streams.push_back(snapshot);
+	}
+}
+
+void PipelineStats::Reset()
+{
+	for (int timing = 0; timing < PipelineTiming_COUNT; ++timing)
+	{
+		m_timings[timing].Reset();
+	}
+
+	std::lock_guard<std::mutex> lock(m_streamMutex);
+	m_streams.clear();
+}
+
+PipelineStats &GetPipelineStats()
+{
+	static PipelineStats s_stats;
+
+	return s_stats;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include "SensorFrameBatch.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+// Hot paths timed by PipelineScopedTimer
+enum PipelineTiming
+{
+	PipelineTiming_SourceUpdate,  // HSL_Update(), or stepping a replayed session
+	PipelineTiming_Listeners,     // Feeding history, analyzers and rings after each update
+	PipelineTiming_Drain,         // Copying and packing one sensor buffer
+	PipelineTiming_DeliverPolled, // Wrapping the poller's staged batches in JS objects
+	PipelineTiming_PollEvents,    // update(true) and pollAllMessages() building their records
+	PipelineTiming_SensorChanges, // getSensorChanges()
+	PipelineTiming_Encode,        // encodeSensorFrameBatch()
+	PipelineTiming_HistoryRange,  // HistoryStore.getRange()
+
+	PipelineTiming_COUNT
+};
+
+const char *GetPipelineTimingName(PipelineTiming timing);
+
+struct LatencySummary
+{
+	uint64_t count;
+	double sum; // Everything below is in milliseconds
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+};
+
+// Latencies in power of two microsecond buckets. Recording is a few relaxed atomic adds,
+// so it can be done from any thread without a lock. Percentiles are accurate to their bucket.
+class LatencyHistogram
+{
+public:
+	static const int k_bucketCount = 40; // The last bucket takes everything from about 3 days up
+
+	LatencyHistogram();
+
+	void Record(double microseconds);
+	void Reset();
+	LatencySummary GetSummary() const;
+
+private:
+	std::atomic<uint64_t> m_buckets[k_bucketCount];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sumMicroseconds;
+	std::atomic<uint64_t> m_maxMicroseconds;
+};
+
+struct PipelineStreamSnapshot
+{
+	HSLSensorID sensorID;
+	HSLSensorBufferType bufferType;
+	uint64_t drains;          // Drains that returned frames
+	uint64_t frames;
+	uint64_t samples;
+	uint64_t duplicateFrames; // Frames no newer than the one before
+	uint64_t droppedFrames;   // Estimated from gaps, see PipelineStats::RecordDrain
+	uint64_t gaps;
+	LatencySummary frameAge;  // Newest frame of each drain, see PipelineStats::RecordDrain
+	LatencySummary endToEnd;  // Frame to socket, reported by the server through RecordDelivery
+};
+
+// Counters and latency histograms for the sensor pipeline, shared by every thread and env.
+// All of it can be switched off, which leaves one relaxed load per call site.
+class PipelineStats
+{
+public:
+	PipelineStats();
+
+	bool IsEnabled() const { return m_bEnabled.load(std::memory_order_relaxed); }
+	void SetEnabled(bool enabled) { m_bEnabled.store(enabled, std::memory_order_relaxed); }
+	double GetUptimeSeconds() const;
+
+	void RecordTiming(PipelineTiming timing, double microseconds);
+	const LatencyHistogram &GetTiming(PipelineTiming timing) const { return m_timings[timing]; }
+
+	// Counts the frames of a freshly drained block and returns how old its newest frame is, in
+	// milliseconds. Sensor time has no fixed relation to the host clock, so the age is measured
+	// above the smallest host-minus-sensor time difference seen on the stream: the fastest
+	// delivery counts as zero. A frame interval more than 2.5 times the usual one is a gap,
+	// and the frames that would have fit in it count as dropped.
+	double RecordDrain(HSLSensorID sensor_id, const SensorFrameLayout &layout, const uint8_t *data);
+
+	// Time from a frame reaching the host to the server writing it out, plus its frame age
+	void RecordDelivery(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, double milliseconds);
+
+	void GetStreams(std::vector<PipelineStreamSnapshot> &out_streams) const;
+	void Reset();
+
+private:
+	struct StreamStats
+	{
+		StreamStats();
+
+		uint64_t drains;
+		uint64_t frames;
+		uint64_t samples;
+		uint64_t duplicateFrames;
+		uint64_t droppedFrames;
+		uint64_t gaps;
+		double lastFrameTime;
+		double frameInterval; // Smoothed, 0 until measured
+		double minDelay;      // Smallest host minus sensor time seen
+		LatencyHistogram frameAge;
+		LatencyHistogram endToEnd;
+	};
+
+	StreamStats &FindStream(HSLSensorID sensor_id, HSLSensorBufferType buffer_type);
+
+	std::atomic<bool> m_bEnabled;
+	const std::chrono::steady_clock::time_point m_startTime;
+	LatencyHistogram m_timings[PipelineTiming_COUNT];
+
+	mutable std::mutex m_streamMutex;
+	std::map<uint64_t, std::unique_ptr<StreamStats>> m_streams; // Keyed by sensor id << 8 | buffer type
+};
+
+PipelineStats &GetPipelineStats();
+
+// Records the time until the end of the scope
+class PipelineScopedTimer
+{
+public:
+	PipelineScopedTimer(PipelineTiming timing)
+		: m_timing(timing)
+		, m_bEnabled(GetPipelineStats().IsEnabled())
+	{
+		if (m_bEnabled)
+		{
+			m_startTime = std::chrono::steady_clock::now();
+		}
+	}
+
+	~PipelineScopedTimer()
+	{
+		if (m_bEnabled)
+		{
+			const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - m_startTime;
+			GetPipelineStats().RecordTiming(m_timing, elapsed.count());
+		}
+	}
+
+private:
+	PipelineTiming m_timing;
+	bool m_bEnabled;
+	std::chrono::steady_clock::time_point m_startTime;
+};
+
+#endif // PIPELINE_STATS_H
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorAlertEngine.h"
+#include "SensorFrameBatch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+// Frames more than this far back in time restart the stream (e.g. a replay seek), so a
+// condition that was building up starts over
+static const double k_restartSeconds = 1.0;
+
+static std::atomic<uint64_t> g_alertSequence(0);
+
+uint64_t GetSensorAlertSequence()
+{
+	return g_alertSequence.load(std::memory_order_relaxed);
+}
+
+static HSLSensorBufferType GetAlertMetricBufferType(const SensorAlertRule &rule)
+{
+	switch (rule.metric)
+	{
+	case SensorAlertMetric_PulseInterval:
+		return HSLBufferType_PPIData;
+	case SensorAlertMetric_HRV:
+		return HSLBufferType_HRVData;
+	case SensorAlertMetric_NoData:
+		return rule.bufferType;
+	default:
+		return HSLBufferType_HRData;
+	}
+}
+
+SensorAlertRule::SensorAlertRule()
+	: sensorID(-1)
+	, metric(SensorAlertMetric_HeartRate)
+	, comparison(SensorAlertComparison_Above)
+	, threshold(0.0)
+	, clearThreshold(0.0)
+	, forSeconds(0.0)
+	, hrvFilter(HRVFilter_SDNN)
+	, bufferType(HSLBufferType_HRData)
+	, timeoutMs(0.0)
+{
+}
+
+bool IsSensorAlertRuleValid(const SensorAlertRule &rule)
+{
+	if (rule.metric < 0 || rule.metric >= SensorAlertMetric_COUNT ||
+		rule.hrvFilter < 0 || rule.hrvFilter >= HRVFilter_COUNT ||
+		!std::isfinite(rule.threshold) || !std::isfinite(rule.clearThreshold) ||
+		!(rule.forSeconds >= 0.0))
+	{
+		return false;
+	}
+
+	// A clear threshold on the wrong side would clear the alert on the value that raised it
+	if ((rule.comparison == SensorAlertComparison_Above && rule.clearThreshold > rule.threshold) ||
+		(rule.comparison == SensorAlertComparison_Below && rule.clearThreshold < rule.threshold))
+	{
+		return false;
+	}
+
+	if (rule.metric == SensorAlertMetric_NoData)
+	{
+		return rule.bufferType >= 0 && rule.bufferType < HSLBufferType_COUNT && rule.timeoutMs > 0.0;
+	}
+
+	return true;
+}
+
+SensorAlertEngineSettings::SensorAlertEngineSettings()
+	: maxQueuedEvents(1024)
+{
+}
+
+SensorAlertEngine::RuleState::RuleState()
+	: bActive(false)
+	, pendingSince(std::numeric_limits<double>::quiet_NaN())
+	, lastTime(0.0)
+	, raisedEvent()
+{
+}
+
+SensorAlertEngine::WatchedBuffer::WatchedBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+	: watcher(sensor_id, buffer_type, hrv_filter)
+	, lastFrameTime(0.0)
+{
+}
+
+SensorAlertEngine::SensorAlertEngine(
+	SensorSource &source,
+	const std::vector<SensorAlertRule> &rules,
+	const SensorAlertEngineSettings &settings)
+	: m_rules(rules)
+	, m_settings(settings)
+	, m_evaluatedCount(0)
+	, m_raisedCount(0)
+	, m_clearedCount(0)
+	, m_droppedCount(0)
+{
+	UpdateSensorList(source, std::chrono::steady_clock::now());
+}
+
+void SensorAlertEngine::OnSensorSourceUpdated(SensorSource &source)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	if (HasSensorSourceListChanged())
+	{
+		UpdateSensorList(source, now);
+	}
+
+	for (auto &entry : m_sensors)
+	{
+		const HSLSensorID sensor_id = entry.first;
+		SensorState &sensor = entry.second;
+
+		for (WatchedBuffer &buffer : sensor.buffers)
+		{
+			buffer.watcher.CollectNewFrames(source, m_newFrames);
+
+			for (const void *frame : m_newFrames)
+			{
+				buffer.lastFrameTime = GetSensorFrameTime(buffer.watcher.GetBufferType(), frame);
+				EvaluateFrame(sensor_id, sensor, buffer, frame);
+			}
+
+			EvaluateNoData(sensor_id, sensor, buffer, !m_newFrames.empty(), now);
+		}
+	}
+}
+
+size_t SensorAlertEngine::Read(size_t max_events, std::vector<SensorAlertEvent> &out_events)
+{
+	const size_t count = std::min(max_events, m_events.size());
+
+	out_events.assign(m_events.begin(), m_events.begin() + count);
+	m_events.erase(m_events.begin(), m_events.begin() + count);
+
+	return count;
+}
+
+void SensorAlertEngine::GetActiveAlerts(std::vector<SensorAlertEvent> &out_alerts) const
+{
+	out_alerts.clear();
+
+	for (const auto &entry : m_sensors)
+	{
+		for (const RuleState &state : entry.second.rules)
+		{
+			if (state.bActive)
+			{
+				out_alerts.push_back(state.raisedEvent);
+			}
+		}
+	}
+}
+
+void SensorAlertEngine::Reset()
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	for (auto &entry : m_sensors)
+	{
+		for (RuleState &state : entry.second.rules)
+		{
+			state = RuleState();
+		}
+
+		for (WatchedBuffer &buffer : entry.second.buffers)
+		{
+			buffer.lastFrameHostTime = now;
+		}
+	}
+
+	m_events.clear();
+}
+
+void SensorAlertEngine::AddSensor(HSLSensorID sensor_id, std::chrono::steady_clock::time_point now)
+{
+	SensorState &sensor = m_sensors[sensor_id];
+	sensor.rules.assign(m_rules.size(), RuleState());
+
+	for (int rule_index = 0; rule_index < (int)m_rules.size(); ++rule_index)
+	{
+		const SensorAlertRule &rule = m_rules[rule_index];
+		if (rule.sensorID != -1 && rule.sensorID != sensor_id)
+			continue;
+
+		const HSLSensorBufferType buffer_type = GetAlertMetricBufferType(rule);
+		auto it = std::find_if(sensor.buffers.begin(), sensor.buffers.end(), [&](const WatchedBuffer &buffer) {
+			return
+				buffer.watcher.GetBufferType() == buffer_type &&
+				(buffer_type != HSLBufferType_HRVData || buffer.watcher.GetHrvFilter() == rule.hrvFilter);
+		});
+
+		if (it == sensor.buffers.end())
+		{
+			sensor.buffers.push_back(WatchedBuffer(sensor_id, buffer_type, rule.hrvFilter));
+			sensor.buffers.back().lastFrameHostTime = now;
+			it = sensor.buffers.end() - 1;
+		}
+
+		it->ruleIndices.push_back(rule_index);
+	}
+}
+
+void SensorAlertEngine::RemoveSensor(HSLSensorID sensor_id)
+{
+	auto it = m_sensors.find(sensor_id);
+	if (it == m_sensors.end())
+	{
+		return;
+	}
+
+	// Nothing can clear an alert of a sensor that is gone, so it clears now
+	for (int rule_index = 0; rule_index < (int)it->second.rules.size(); ++rule_index)
+	{
+		RuleState &state = it->second.rules[rule_index];
+		if (state.bActive)
+		{
+			SetActive(sensor_id, state, rule_index, false, state.raisedEvent.value, state.lastTime);
+		}
+	}
+
+	m_sensors.erase(it);
+}
+
+void SensorAlertEngine::UpdateSensorList(SensorSource &source, std::chrono::steady_clock::time_point now)
+{
+	m_connectedSensors.clear();
+
+	HSLSensorList sensorList;
+	if (source.GetSensorList(&sensorList))
+	{
+		for (int list_index = 0; list_index < sensorList.count; ++list_index)
+		{
+			m_connectedSensors.push_back(sensorList.sensors[list_index].sensorID);
+		}
+	}
+
+	std::vector<HSLSensorID> removedSensors;
+	for (const auto &entry : m_sensors)
+	{
+		if (std::find(m_connectedSensors.begin(), m_connectedSensors.end(), entry.first) == m_connectedSensors.end())
+		{
+			removedSensors.push_back(entry.first);
+		}
+	}
+
+	for (HSLSensorID sensor_id : removedSensors)
+	{
+		RemoveSensor(sensor_id);
+	}
+
+	for (HSLSensorID sensor_id : m_connectedSensors)
+	{
+		if (m_sensors.find(sensor_id) == m_sensors.end())
+		{
+			AddSensor(sensor_id, now);
+		}
+	}
+}
+
+void SensorAlertEngine::EvaluateFrame(
+	HSLSensorID sensor_id,
+	SensorState &sensor,
+	const WatchedBuffer &buffer,
+	const void *frame)
+{
+	const double time = buffer.lastFrameTime;
+
+	for (int rule_index : buffer.ruleIndices)
+	{
+		switch (m_rules[rule_index].metric)
+		{
+		case SensorAlertMetric_HeartRate:
+			{
+				const HSLHeartRateFrame *hrFrame = static_cast<const HSLHeartRateFrame *>(frame);
+				EvaluateValue(sensor_id, sensor, rule_index, hrFrame->beatsPerMinute, time);
+			} break;
+		case SensorAlertMetric_RRInterval:
+			{
+				const HSLHeartRateFrame *hrFrame = static_cast<const HSLHeartRateFrame *>(frame);
+				const int count = std::min(std::max(hrFrame->RRIntervalCount, 0), (int)MAX_HSL_RR_INTERVALS);
+
+				for (int i = 0; i < count; ++i)
+				{
+					EvaluateValue(sensor_id, sensor, rule_index, hrFrame->RRIntervals[i], time);
+				}
+			} break;
+		case SensorAlertMetric_PulseInterval:
+			{
+				const HSLHeartPPIFrame *ppiFrame = static_cast<const HSLHeartPPIFrame *>(frame);
+				const int count = std::min(std::max(ppiFrame->ppiSampleCount, 0), (int)MAX_HSL_PPI_SAMPLES);
+
+				for (int i = 0; i < count; ++i)
+				{
+					EvaluateValue(sensor_id, sensor, rule_index, ppiFrame->ppiSamples[i].pulseDuration, time);
+				}
+			} break;
+		case SensorAlertMetric_Contact:
+			{
+				const HSLHeartRateFrame *hrFrame = static_cast<const HSLHeartRateFrame *>(frame);
+
+				if (hrFrame->contactStatus != HSLContactStatus_Invalid)
+				{
+					const double contact = (hrFrame->contactStatus == HSLContactStatus_Contact) ? 1.0 : 0.0;
+					EvaluateValue(sensor_id, sensor, rule_index, contact, time);
+				}
+			} break;
+		case SensorAlertMetric_HRV:
+			{
+				const HSLHeartVariabilityFrame *hrvFrame = static_cast<const HSLHeartVariabilityFrame *>(frame);
+				EvaluateValue(sensor_id, sensor, rule_index, hrvFrame->hrvValue, time);
+			} break;
+		default:
+			break;
+		}
+	}
+}
+
+void SensorAlertEngine::EvaluateValue(
+	HSLSensorID sensor_id,
+	SensorState &sensor,
+	int rule_index,
+	double value,
+	double time)
+{
+	const SensorAlertRule &rule = m_rules[rule_index];
+	RuleState &state = sensor.rules[rule_index];
+
+	++m_evaluatedCount;
+
+	if (time < state.lastTime - k_restartSeconds)
+	{
+		state.pendingSince = std::numeric_limits<double>::quiet_NaN();
+	}
+	state.lastTime = time;
+
+	const bool bAbove = (rule.comparison == SensorAlertComparison_Above);
+
+	if (state.bActive)
+	{
+		if (bAbove ? value <= rule.clearThreshold : value >= rule.clearThreshold)
+		{
+			SetActive(sensor_id, state, rule_index, false, value, time);
+		}
+	}
+	else if (bAbove ? value > rule.threshold : value < rule.threshold)
+	{
+		if (std::isnan(state.pendingSince))
+		{
+			state.pendingSince = time;
+		}
+
+		if (time - state.pendingSince >= rule.forSeconds)
+		{
+			SetActive(sensor_id, state, rule_index, true, value, time);
+		}
+	}
+	else
+	{
+		state.pendingSince = std::numeric_limits<double>::quiet_NaN();
+	}
+}
+
+void SensorAlertEngine::EvaluateNoData(
+	HSLSensorID sensor_id,
+	SensorState &sensor,
+	WatchedBuffer &buffer,
+	bool has_new_frames,
+	std::chrono::steady_clock::time_point now)
+{
+	// How long the stream had been silent, up to the frames that just came in
+	const std::chrono::duration<double, std::milli> silence = now - buffer.lastFrameHostTime;
+
+	if (has_new_frames)
+	{
+		buffer.lastFrameHostTime = now;
+	}
+
+	for (int rule_index : buffer.ruleIndices)
+	{
+		const SensorAlertRule &rule = m_rules[rule_index];
+		if (rule.metric != SensorAlertMetric_NoData)
+			continue;
+
+		RuleState &state = sensor.rules[rule_index];
+
+		if (state.bActive && has_new_frames)
+		{
+			SetActive(sensor_id, state, rule_index, false, silence.count(), buffer.lastFrameTime);
+		}
+		else if (!state.bActive && !has_new_frames && silence.count() >= rule.timeoutMs)
+		{
+			SetActive(sensor_id, state, rule_index, true, silence.count(), buffer.lastFrameTime);
+		}
+	}
+}
+
+void SensorAlertEngine::SetActive(
+	HSLSensorID sensor_id,
+	RuleState &state,
+	int rule_index,
+	bool active,
+	double value,
+	double time)
+{
+	SensorAlertEvent event;
+	event.ruleIndex = rule_index;
+	event.sensorID = sensor_id;
+	event.bRaised = active;
+	event.value = value;
+	event.timeInSeconds = time;
+	event.timestamp = (double)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	state.bActive = active;
+	state.pendingSince = std::numeric_limits<double>::quiet_NaN();
+
+	if (active)
+	{
+		state.raisedEvent = event;
+		++m_raisedCount;
+	}
+	else
+	{
+		++m_clearedCount;
+	}
+
+	if (m_settings.maxQueuedEvents == 0)
+	{
+		++m_droppedCount;
+		return;
+	}
+
+	while (m_events.size() >= m_settings.maxQueuedEvents)
+	{
+		m_events.pop_front();
+		++m_droppedCount;
+	}
+
+	m_events.push_back(event);
+	g_alertSequence.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_ALERT_ENGINE_H
+#define SENSOR_ALERT_ENGINE_H
+
+#include "SensorSource.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// What a rule looks at, and the buffer the values come from
+enum SensorAlertMetric
+{
+	SensorAlertMetric_HeartRate,     // beatsPerMinute of HR frames
+	SensorAlertMetric_RRInterval,    // Each RR interval of HR frames, in ms
+	SensorAlertMetric_PulseInterval, // pulseDuration of PPI samples, in ms
+	SensorAlertMetric_Contact,       // 1 while an HR frame reports skin contact, 0 without. Frames that can't tell are skipped
+	SensorAlertMetric_HRV,           // hrvValue of the HRV buffer for hrvFilter
+	SensorAlertMetric_NoData,        // Milliseconds since a frame last arrived in bufferType
+
+	SensorAlertMetric_COUNT
+};
+
+enum SensorAlertComparison
+{
+	SensorAlertComparison_Above, // Raised while the value is above threshold
+	SensorAlertComparison_Below, // Raised while the value is below threshold
+};
+
+struct SensorAlertRule
+{
+	SensorAlertRule();
+
+	std::string name;
+	HSLSensorID sensorID; // -1 for every connected sensor
+	SensorAlertMetric metric;
+	SensorAlertComparison comparison;
+	double threshold;
+	double clearThreshold; // Where a raised alert clears again, as hysteresis. Same as threshold by default
+	double forSeconds;     // How long the condition has to hold, in sensor time, before the alert is raised
+	HSLHeartRateVariabityFilterType hrvFilter;
+	HSLSensorBufferType bufferType; // Stream watched by NoData
+	double timeoutMs;               // NoData raises after this long without a frame
+};
+
+// False if the rule can't work, e.g. a NoData rule without a timeout
+bool IsSensorAlertRuleValid(const SensorAlertRule &rule);
+
+struct SensorAlertEvent
+{
+	int ruleIndex;
+	HSLSensorID sensorID;
+	bool bRaised;         // Otherwise the alert cleared
+	double value;         // The value that raised or cleared it
+	double timeInSeconds; // Sensor time of that value, 0 if there was none
+	double timestamp;     // Host time in milliseconds since the epoch
+};
+
+struct SensorAlertEngineSettings
+{
+	SensorAlertEngineSettings();
+
+	size_t maxQueuedEvents; // Events kept until read, the oldest go first
+};
+
+// Bumped whenever any engine queues an event, so a poller can tell that it has something to hand over
+uint64_t GetSensorAlertSequence();
+
+// Evaluates a fixed set of rules against every sensor's HR, PPI and HRV frames as they land and
+// queues an event only when an alert is raised or clears. Each buffer a rule needs is watched
+// once per sensor, however many rules read it. Attached as a SensorSourceListener; it watches
+// the buffers without flushing them.
+class SensorAlertEngine : public SensorSourceListener
+{
+public:
+	SensorAlertEngine(SensorSource &source, const std::vector<SensorAlertRule> &rules, const SensorAlertEngineSettings &settings);
+
+	const std::vector<SensorAlertRule> &GetRules() const { return m_rules; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	size_t GetQueuedEventCount() const { return m_events.size(); }
+	size_t Read(size_t max_events, std::vector<SensorAlertEvent> &out_events);
+
+	// The alerts raised now, as the events that raised them
+	void GetActiveAlerts(std::vector<SensorAlertEvent> &out_alerts) const;
+
+	uint64_t GetEvaluatedCount() const { return m_evaluatedCount; }
+	uint64_t GetRaisedCount() const { return m_raisedCount; }
+	uint64_t GetClearedCount() const { return m_clearedCount; }
+	uint64_t GetDroppedCount() const { return m_droppedCount; }
+
+	// Clears every alert without events and forgets the queued ones
+	void Reset();
+
+private:
+	// One rule on one sensor
+	struct RuleState
+	{
+		RuleState();
+
+		bool bActive;
+		double pendingSince; // Sensor time the condition started holding, NaN while it doesn't
+		double lastTime;
+		SensorAlertEvent raisedEvent;
+	};
+
+	// One watched buffer of one sensor, with the rules reading it
+	struct WatchedBuffer
+	{
+		WatchedBuffer(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, HSLHeartRateVariabityFilterType hrv_filter);
+
+		SensorBufferWatcher watcher;
+		std::vector<int> ruleIndices;
+		std::chrono::steady_clock::time_point lastFrameHostTime;
+		double lastFrameTime;
+	};
+
+	struct SensorState
+	{
+		std::vector<RuleState> rules; // By rule index
+		std::vector<WatchedBuffer> buffers;
+	};
+
+	void AddSensor(HSLSensorID sensor_id, std::chrono::steady_clock::time_point now);
+	void RemoveSensor(HSLSensorID sensor_id);
+	void UpdateSensorList(SensorSource &source, std::chrono::steady_clock::time_point now);
+
+	void EvaluateFrame(HSLSensorID sensor_id, SensorState &sensor, const WatchedBuffer &buffer, const void *frame);
+	void EvaluateValue(HSLSensorID sensor_id, SensorState &sensor, int rule_index, double value, double time);
+	void EvaluateNoData(HSLSensorID sensor_id, SensorState &sensor, WatchedBuffer &buffer, bool has_new_frames, std::chrono::steady_clock::time_point now);
+	void SetActive(HSLSensorID sensor_id, RuleState &state, int rule_index, bool active, double value, double time);
+
+	const std::vector<SensorAlertRule> m_rules;
+	const SensorAlertEngineSettings m_settings;
+
+	std::map<HSLSensorID, SensorState> m_sensors;
+	std::vector<HSLSensorID> m_connectedSensors;
+
+	std::deque<SensorAlertEvent> m_events;
+	uint64_t m_evaluatedCount;
+	uint64_t m_raisedCount;
+	uint64_t m_clearedCount;
+	uint64_t m_droppedCount;
+
+	// Scratch
+	std::vector<const void *> m_newFrames;
+};
+
+#endif // SENSOR_ALERT_ENGINE_H
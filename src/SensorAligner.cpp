@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorAligner.h"
+#include "SharedSampleRing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Each second of sensor time contributes its fastest arrival to the clock fit
+static const double k_clockBucketSeconds = 1.0;
+
+// Below this much sensor time the fit is a fixed offset, a slope would be mostly noise
+static const double k_minFitSpanSeconds = 30.0;
+
+// Crystal clocks are well within this, anything beyond is a bad fit
+static const double k_maxDrift = 1e-3;
+
+// Frames more than this far back in time restart the stream (e.g. a replay seek or a reconnect)
+static const double k_restartSeconds = 1.0;
+
+SensorAlignerSettings::SensorAlignerSettings()
+	: sampleRate(100.0)
+	, clockWindowSeconds(120.0)
+	, maxGapSeconds(2.0)
+	, maxWaitSeconds(1.0)
+	, maxBufferedSeconds(10.0)
+{
+}
+
+SensorAligner::Stream::Stream(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, int first_channel)
+	: watcher(sensor_id, buffer_type)
+	, firstChannel(first_channel)
+	, channelCount(SharedSampleRing::GetChannelCount(buffer_type))
+	, bOpenPoint(false)
+	, openBucketStart(0.0)
+	, offset(0.0)
+	, scale(1.0)
+	, bFitted(false)
+	, lastFrameTime(0.0)
+	, lastArrival(0.0)
+{
+	openPoint.sensorTime = 0.0;
+	openPoint.hostTime = 0.0;
+}
+
+SensorAligner::SensorAligner(
+	const std::vector<std::pair<HSLSensorID, HSLSensorBufferType>> &streams,
+	const SensorAlignerSettings &settings)
+	: m_settings(settings)
+	, m_startTime(std::chrono::steady_clock::now())
+	, m_channelCount(0)
+	, m_bStarted(false)
+	, m_nextIndex(0)
+	, m_droppedCount(0)
+{
+	for (const auto &stream : streams)
+	{
+		m_streams.push_back(std::unique_ptr<Stream>(new Stream(stream.first, stream.second, m_channelCount)));
+		m_channelCount += m_streams.back()->channelCount;
+	}
+
+	m_outChannels.resize(m_channelCount);
+}
+
+SensorAlignerStreamInfo SensorAligner::GetStreamInfo(size_t stream_index) const
+{
+	const Stream &stream = *m_streams[stream_index];
+
+	SensorAlignerStreamInfo info;
+	info.sensorID = stream.watcher.GetSensorID();
+	info.bufferType = stream.watcher.GetBufferType();
+	info.firstChannel = stream.firstChannel;
+	info.channelCount = stream.channelCount;
+
+	return info;
+}
+
+SensorAlignerClock SensorAligner::GetClock(size_t stream_index) const
+{
+	const Stream &stream = *m_streams[stream_index];
+	const Stream &reference = *m_streams[0];
+
+	SensorAlignerClock clock;
+	clock.offsetSeconds = 0.0;
+	clock.driftPpm = 0.0;
+	clock.hostDriftPpm = stream.bFitted ? (1.0 / stream.scale - 1.0) * 1e6 : 0.0;
+	clock.fitPoints = stream.clockPoints.size() + (stream.bOpenPoint ? 1 : 0);
+	clock.bStalled = GetHostTime() - stream.lastArrival > m_settings.maxWaitSeconds;
+
+	if (stream.bFitted && reference.bFitted)
+	{
+		clock.offsetSeconds = ToReference(stream, stream.lastFrameTime) - stream.lastFrameTime;
+		clock.driftPpm = (reference.scale / stream.scale - 1.0) * 1e6;
+	}
+
+	return clock;
+}
+
+void SensorAligner::OnSensorSourceUpdated(SensorSource &source)
+{
+	const double hostTime = GetHostTime();
+
+	for (auto &stream : m_streams)
+	{
+		if (stream->watcher.CollectNewFrames(source, m_newFrames) == 0)
+		{
+			continue;
+		}
+
+		AddFrames(*stream, m_newFrames);
+
+		// Only the newest frame of an update says anything about the delay, the rest were queued
+		AddClockPoint(*stream, stream->lastFrameTime, hostTime);
+		FitClock(*stream);
+		stream->lastArrival = hostTime;
+	}
+
+	Resample(hostTime);
+
+	const double nextTime = m_bStarted ? GetNextTime() : -std::numeric_limits<double>::infinity();
+	for (auto &stream : m_streams)
+	{
+		TrimStream(*stream, nextTime);
+	}
+}
+
+size_t SensorAligner::Read(size_t max_count, double *out_times, float *out_values)
+{
+	const size_t count = std::min(max_count, m_outTimes.size());
+
+	std::copy(m_outTimes.begin(), m_outTimes.begin() + count, out_times);
+	m_outTimes.erase(m_outTimes.begin(), m_outTimes.begin() + count);
+
+	for (int channel = 0; channel < m_channelCount; ++channel)
+	{
+		std::deque<float> &column = m_outChannels[channel];
+
+		std::copy(column.begin(), column.begin() + count, out_values + channel * count);
+		column.erase(column.begin(), column.begin() + count);
+	}
+
+	return count;
+}
+
+void SensorAligner::Reset()
+{
+	for (auto &stream : m_streams)
+	{
+		ResetStream(*stream);
+	}
+
+	m_bStarted = false;
+	m_nextIndex = 0;
+	m_outTimes.clear();
+	for (std::deque<float> &column : m_outChannels)
+	{
+		column.clear();
+	}
+	m_droppedCount = 0;
+}
+
+double SensorAligner::GetHostTime() const
+{
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_startTime;
+
+	return elapsed.count();
+}
+
+// Forgets the samples and the clock fit, but not which frames were seen
+void SensorAligner::ResetStream(Stream &stream)
+{
+	stream.sampleClock.Reset();
+	stream.times.clear();
+	stream.values.clear();
+	stream.clockPoints.clear();
+	stream.bOpenPoint = false;
+	stream.offset = 0.0;
+	stream.scale = 1.0;
+	stream.bFitted = false;
+	stream.lastFrameTime = 0.0;
+
+	// The timeline is in the reference clock, which just went away
+	if (&stream == m_streams[0].get())
+	{
+		m_bStarted = false;
+	}
+}
+
+void SensorAligner::AddFrames(Stream &stream, const std::vector<const void *> &frames)
+{
+	const HSLSensorBufferType bufferType = stream.watcher.GetBufferType();
+
+	SensorFrameLayout layout;
+	if (!MeasureSensorFrames(bufferType, frames.data(), frames.size(), layout))
+	{
+		return;
+	}
+	m_packed.resize(layout.byteLength);
+	PackSensorFrames(frames.data(), layout, m_packed.data());
+
+	const uint8_t *data = m_packed.data();
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	const int32_t *frameValues = reinterpret_cast<const int32_t *>(data + layout.frameValuesOffset);
+	const int32_t *intSamples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	const float *floatSamples = reinterpret_cast<const float *>(data + layout.samplesOffset);
+
+	for (size_t frame = 0; frame < layout.frameCount; ++frame)
+	{
+		const double frameTime = frameTimes[frame];
+
+		if (stream.lastFrameTime > 0.0 && frameTime < stream.lastFrameTime - k_restartSeconds)
+		{
+			ResetStream(stream);
+		}
+		stream.lastFrameTime = std::max(stream.lastFrameTime, frameTime);
+
+		if (bufferType == HSLBufferType_HRData)
+		{
+			stream.sampleClock.AddFrame(frameTime, 0);
+
+			if (stream.times.empty() || frameTime > stream.times.back())
+			{
+				stream.times.push_back(frameTime);
+				stream.values.push_back((float)frameValues[HRFrameValue_BeatsPerMinute * layout.frameCount + frame]);
+			}
+			continue;
+		}
+
+		const size_t firstSample = frameOffsets[frame];
+		const size_t sampleCount = frameOffsets[frame + 1] - firstSample;
+
+		stream.sampleClock.AddFrame(frameTime, sampleCount);
+
+		// Until the sample period is known every sample of a frame would get the frame's time
+		if (sampleCount > 1 && stream.sampleClock.GetSamplePeriod() <= 0.0)
+		{
+			continue;
+		}
+
+		for (size_t sample = 0; sample < sampleCount; ++sample)
+		{
+			const double sampleTime = stream.sampleClock.GetSampleTime(sample);
+			if (!stream.times.empty() && sampleTime <= stream.times.back())
+			{
+				continue;
+			}
+
+			const size_t base = (firstSample + sample) * layout.sampleWidth;
+
+			stream.times.push_back(sampleTime);
+			for (int channel = 0; channel < stream.channelCount; ++channel)
+			{
+				stream.values.push_back(layout.bFloatSamples
+					? floatSamples[base + channel]
+					: (float)intSamples[base + channel]);
+			}
+		}
+	}
+}
+
+void SensorAligner::AddClockPoint(Stream &stream, double sensor_time, double host_time)
+{
+	if (stream.bOpenPoint && sensor_time >= stream.openBucketStart + k_clockBucketSeconds)
+	{
+		stream.clockPoints.push_back(stream.openPoint);
+		stream.bOpenPoint = false;
+
+		while (!stream.clockPoints.empty() &&
+			stream.clockPoints.front().sensorTime < sensor_time - m_settings.clockWindowSeconds)
+		{
+			stream.clockPoints.pop_front();
+		}
+	}
+
+	if (!stream.bOpenPoint)
+	{
+		stream.openBucketStart = sensor_time;
+	}
+
+	if (!stream.bOpenPoint ||
+		host_time - sensor_time < stream.openPoint.hostTime - stream.openPoint.sensorTime)
+	{
+		stream.openPoint.sensorTime = sensor_time;
+		stream.openPoint.hostTime = host_time;
+		stream.bOpenPoint = true;
+	}
+}
+
+// Least squares line through the fastest arrivals, moved down so that none of them
+// arrives before it: host = offset + scale * sensor
+void SensorAligner::FitClock(Stream &stream)
+{
+	const size_t pointCount = stream.clockPoints.size() + (stream.bOpenPoint ? 1 : 0);
+	if (pointCount == 0)
+	{
+		return;
+	}
+
+	auto point = [&stream](size_t index) -> const ClockPoint & {
+		return index < stream.clockPoints.size() ? stream.clockPoints[index] : stream.openPoint;
+	};
+
+	double drift = 0.0;
+	const double span = point(pointCount - 1).sensorTime - point(0).sensorTime;
+
+	if (pointCount >= 3 && span >= k_minFitSpanSeconds)
+	{
+		// Fitted as delay against centered sensor time, which keeps the sums small
+		double meanTime = 0.0;
+		double meanDelay = 0.0;
+		for (size_t i = 0; i < pointCount; ++i)
+		{
+			meanTime += point(i).sensorTime;
+			meanDelay += point(i).hostTime - point(i).sensorTime;
+		}
+		meanTime /= pointCount;
+		meanDelay /= pointCount;
+
+		double sxx = 0.0;
+		double sxy = 0.0;
+		for (size_t i = 0; i < pointCount; ++i)
+		{
+			const double dx = point(i).sensorTime - meanTime;
+			const double dy = point(i).hostTime - point(i).sensorTime - meanDelay;
+
+			sxx += dx * dx;
+			sxy += dx * dy;
+		}
+
+		if (sxx > 0.0)
+		{
+			drift = std::max(std::min(sxy / sxx, k_maxDrift), -k_maxDrift);
+		}
+	}
+
+	double offset = std::numeric_limits<double>::infinity();
+	for (size_t i = 0; i < pointCount; ++i)
+	{
+		offset = std::min(offset, point(i).hostTime - (1.0 + drift) * point(i).sensorTime);
+	}
+
+	stream.offset = offset;
+	stream.scale = 1.0 + drift;
+	stream.bFitted = true;
+}
+
+double SensorAligner::ToReference(const Stream &stream, double sensor_time) const
+{
+	const Stream &reference = *m_streams[0];
+	const double hostTime = stream.offset + stream.scale * sensor_time;
+
+	return (hostTime - reference.offset) / reference.scale;
+}
+
+void SensorAligner::Resample(double host_time)
+{
+	if (m_streams.empty() || !m_streams[0]->bFitted)
+	{
+		return;
+	}
+
+	// Streams that stopped delivering don't hold the timeline back, they get NaN past their last sample
+	double startTime = -std::numeric_limits<double>::infinity();
+	double endTime = std::numeric_limits<double>::infinity();
+	bool bAnyLive = false;
+
+	for (const auto &stream : m_streams)
+	{
+		if (host_time - stream->lastArrival > m_settings.maxWaitSeconds)
+		{
+			continue;
+		}
+
+		if (!stream->bFitted || stream->times.empty())
+		{
+			return;
+		}
+
+		startTime = std::max(startTime, ToReference(*stream, stream->times.front()));
+		endTime = std::min(endTime, ToReference(*stream, stream->times.back()));
+		bAnyLive = true;
+	}
+
+	if (!bAnyLive)
+	{
+		return;
+	}
+
+	const double rate = m_settings.sampleRate;
+	const int64_t lastIndex = (int64_t)std::floor(endTime * rate);
+
+	if (!m_bStarted)
+	{
+		m_nextIndex = (int64_t)std::ceil(startTime * rate);
+		m_bStarted = true;
+	}
+
+	if (lastIndex < m_nextIndex)
+	{
+		return;
+	}
+
+	const size_t maxCount = std::max((size_t)(m_settings.maxBufferedSeconds * rate), (size_t)1);
+	size_t count = (size_t)(lastIndex - m_nextIndex + 1);
+
+	if (count > maxCount)
+	{
+		m_droppedCount += count - maxCount;
+		m_nextIndex = lastIndex - (int64_t)maxCount + 1;
+		count = maxCount;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		m_outTimes.push_back((double)(m_nextIndex + (int64_t)i) / rate);
+	}
+
+	for (const auto &stream : m_streams)
+	{
+		InterpolateStream(*stream, m_nextIndex, count);
+	}
+
+	m_nextIndex += (int64_t)count;
+
+	while (m_outTimes.size() > maxCount)
+	{
+		m_outTimes.pop_front();
+		for (std::deque<float> &column : m_outChannels)
+		{
+			column.pop_front();
+		}
+		++m_droppedCount;
+	}
+}
+
+// The bracketing samples and weight of every output time are found once, then every channel is
+// one branch free pass over them. NaN weights mark output times with nothing to interpolate.
+void SensorAligner::InterpolateStream(const Stream &stream, int64_t first_index, size_t count)
+{
+	const size_t sampleCount = stream.times.size();
+	const int channelCount = stream.channelCount;
+
+	if (!stream.bFitted || sampleCount == 0)
+	{
+		for (int channel = 0; channel < channelCount; ++channel)
+		{
+			std::deque<float> &column = m_outChannels[stream.firstChannel + channel];
+
+			column.insert(column.end(), count, std::numeric_limits<float>::quiet_NaN());
+		}
+		return;
+	}
+
+	m_mapped.resize(sampleCount);
+	for (size_t i = 0; i < sampleCount; ++i)
+	{
+		m_mapped[i] = ToReference(stream, stream.times[i]);
+	}
+
+	m_sampleIndex.resize(2 * count);
+	m_sampleWeight.resize(count);
+
+	size_t left = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const double time = (double)(first_index + (int64_t)i) / m_settings.sampleRate;
+
+		while (left + 1 < sampleCount && m_mapped[left + 1] <= time)
+		{
+			++left;
+		}
+
+		const size_t right = std::min(left + 1, sampleCount - 1);
+		float weight = std::numeric_limits<float>::quiet_NaN();
+
+		if (time >= m_mapped[0] && time <= m_mapped[sampleCount - 1] &&
+			m_mapped[right] - m_mapped[left] <= m_settings.maxGapSeconds)
+		{
+			weight = (right > left) ? (float)((time - m_mapped[left]) / (m_mapped[right] - m_mapped[left])) : 0.f;
+		}
+
+		m_sampleIndex[2 * i] = (int32_t)left * channelCount;
+		m_sampleIndex[2 * i + 1] = (int32_t)right * channelCount;
+		m_sampleWeight[i] = weight;
+	}
+
+	m_column.resize(count);
+	for (int channel = 0; channel < channelCount; ++channel)
+	{
+		const float *values = stream.values.data() + channel;
+		const int32_t *indices = m_sampleIndex.data();
+		const float *weights = m_sampleWeight.data();
+		float *column = m_column.data();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const float a = values[indices[2 * i]];
+			const float b = values[indices[2 * i + 1]];
+
+			column[i] = a + weights[i] * (b - a);
+		}
+
+		std::deque<float> &out = m_outChannels[stream.firstChannel + channel];
+		out.insert(out.end(), m_column.begin(), m_column.end());
+	}
+}
+
+// Drops the samples the timeline has moved past, keeping the one before reference_time to
+// interpolate from, and anything more than maxBufferedSeconds older than the newest sample
+void SensorAligner::TrimStream(Stream &stream, double reference_time)
+{
+	const size_t sampleCount = stream.times.size();
+	if (sampleCount == 0)
+	{
+		return;
+	}
+
+	const double oldestTime = stream.times.back() - m_settings.maxBufferedSeconds;
+	size_t dropCount = 0;
+
+	while (dropCount + 1 < sampleCount &&
+		(stream.times[dropCount] < oldestTime ||
+		 (stream.bFitted && ToReference(stream, stream.times[dropCount + 1]) <= reference_time)))
+	{
+		++dropCount;
+	}
+
+	if (dropCount > 0)
+	{
+		stream.times.erase(stream.times.begin(), stream.times.begin() + dropCount);
+		stream.values.erase(stream.values.begin(), stream.values.begin() + dropCount * stream.channelCount);
+	}
+}
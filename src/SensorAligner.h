@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_ALIGNER_H
+#define SENSOR_ALIGNER_H
+
+#include "SensorFrameBatch.h"
+#include "SensorSource.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+struct SensorAlignerSettings
+{
+	SensorAlignerSettings();
+
+	double sampleRate;         // Rate of the common timeline, in Hz
+	double clockWindowSeconds; // Sensor time the clock fit of each stream looks back over
+	double maxGapSeconds;      // Samples further apart than this are not interpolated across
+	double maxWaitSeconds;     // How long a stream that stopped delivering may hold back the others
+	double maxBufferedSeconds; // Aligned samples kept until read, the oldest go first
+};
+
+struct SensorAlignerStreamInfo
+{
+	HSLSensorID sensorID;
+	HSLSensorBufferType bufferType;
+	int firstChannel; // Of the aligned output
+	int channelCount;
+};
+
+// Where a stream's clock stands against the reference stream, the first one
+struct SensorAlignerClock
+{
+	double offsetSeconds;  // Reference time minus stream time, at the stream's newest sample
+	double driftPpm;       // How much faster the stream's clock runs than the reference clock
+	double hostDriftPpm;   // The same against the host clock
+	size_t fitPoints;      // Points behind the fit, fewer than 2 means a fixed offset
+	bool bStalled;         // No new frames for maxWaitSeconds
+};
+
+// Resamples several sensor streams onto one evenly spaced timeline, in the clock of the first
+// stream, so features can be computed across sensors sample by sample.
+//
+// Every sensor stamps its frames with its own clock. The relation of each clock to the host
+// clock is fitted from the frame times and the host time they arrive at: the fastest arrival in
+// each second of sensor time, with a least squares line through them over clockWindowSeconds,
+// moved down onto the fastest arrival seen. Stream clocks are then mapped onto the reference
+// through the host clock. Transport delays common to both sensors cancel out; the difference
+// between their fastest deliveries does not, and shows up as a constant offset.
+//
+// Every output sample is linearly interpolated from the samples either side of it. NaN is
+// written where a stream has no sample within maxGapSeconds either side. Output is only produced
+// up to the newest time every stream has reached, except for streams that stopped delivering.
+//
+// Attached as a SensorSourceListener; it watches the stream buffers without flushing them.
+class SensorAligner : public SensorSourceListener
+{
+public:
+	SensorAligner(
+		const std::vector<std::pair<HSLSensorID, HSLSensorBufferType>> &streams,
+		const SensorAlignerSettings &settings);
+
+	const SensorAlignerSettings &GetSettings() const { return m_settings; }
+	size_t GetStreamCount() const { return m_streams.size(); }
+	SensorAlignerStreamInfo GetStreamInfo(size_t stream_index) const;
+	SensorAlignerClock GetClock(size_t stream_index) const;
+	int GetChannelCount() const { return m_channelCount; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	size_t GetPendingCount() const { return m_outTimes.size(); }
+	uint64_t GetDroppedCount() const { return m_droppedCount; } // Aligned samples never read
+	double GetNextTime() const { return m_bStarted ? (double)m_nextIndex / m_settings.sampleRate : 0.0; }
+
+	// Moves up to max_count aligned samples out. out_values is planar, channel by channel:
+	// out_values[channel * count + sample]. Both must have room for max_count samples.
+	size_t Read(size_t max_count, double *out_times, float *out_values);
+	void Reset();
+
+private:
+	struct ClockPoint
+	{
+		double sensorTime;
+		double hostTime;
+	};
+
+	struct Stream
+	{
+		Stream(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, int first_channel);
+
+		SensorBufferWatcher watcher;
+		SensorSampleClock sampleClock;
+		const int firstChannel;
+		const int channelCount;
+
+		// Samples in sensor time, values interleaved. Kept until the timeline has passed them.
+		std::vector<double> times;
+		std::vector<float> values;
+
+		// host = offset + scale * sensor, fitted from clockPoints plus the open bucket
+		std::deque<ClockPoint> clockPoints;
+		ClockPoint openPoint; // Fastest arrival of the bucket still open
+		bool bOpenPoint;
+		double openBucketStart;
+		double offset;
+		double scale;
+		bool bFitted;
+
+		double lastFrameTime;
+		double lastArrival; // Host time of the newest frame
+	};
+
+	double GetHostTime() const;
+	void ResetStream(Stream &stream);
+	void AddFrames(Stream &stream, const std::vector<const void *> &frames);
+	void AddClockPoint(Stream &stream, double sensor_time, double host_time);
+	void FitClock(Stream &stream);
+	double ToReference(const Stream &stream, double sensor_time) const;
+	void Resample(double host_time);
+	void InterpolateStream(const Stream &stream, int64_t first_index, size_t count);
+	void TrimStream(Stream &stream, double reference_time);
+
+	const SensorAlignerSettings m_settings;
+	const std::chrono::steady_clock::time_point m_startTime;
+	std::vector<std::unique_ptr<Stream>> m_streams;
+	int m_channelCount;
+
+	// The timeline is every whole multiple of the sample period, m_nextIndex is the next one due
+	bool m_bStarted;
+	int64_t m_nextIndex;
+
+	// Aligned samples waiting to be read, one column per channel
+	std::deque<double> m_outTimes;
+	std::vector<std::deque<float>> m_outChannels;
+	uint64_t m_droppedCount;
+
+	// Scratch
+	std::vector<const void *> m_newFrames;
+	std::vector<uint8_t> m_packed;
+	std::vector<double> m_mapped;
+	std::vector<int32_t> m_sampleIndex;
+	std::vector<float> m_sampleWeight;
+	std::vector<float> m_column;
+};
+
+#endif // SENSOR_ALIGNER_H
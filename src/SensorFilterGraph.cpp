@@ -0,0 +1,598 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorFilterGraph.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Frames more than this far back in time restart the stream (e.g. a replay seek), filter state included
+static const double k_restartSeconds = 1.0;
+
+static const size_t k_maxFIRTaps = 1024;
+static const int k_maxMovingAverageLength = 65536;
+
+//-- Kernels --
+// Each kernel filters one channel and carries its own state across blocks.
+// Process() is a straight loop over contiguous samples.
+
+class DCBlockKernel
+{
+public:
+	DCBlockKernel(double sample_rate, double frequency)
+		: m_pole(std::exp(-2.0 * M_PI * frequency / sample_rate))
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_lastIn = 0.0;
+		m_lastOut = 0.0;
+		m_bPrimed = false;
+	}
+
+	void Process(const float *in, size_t count, float *out)
+	{
+		// Starts from the first sample rather than from zero, or the DC level rings through
+		if (!m_bPrimed && count > 0)
+		{
+			m_lastIn = in[0];
+			m_bPrimed = true;
+		}
+
+		double lastIn = m_lastIn;
+		double lastOut = m_lastOut;
+		for (size_t i = 0; i < count; ++i)
+		{
+			lastOut = in[i] - lastIn + m_pole * lastOut;
+			lastIn = in[i];
+			out[i] = (float)lastOut;
+		}
+		m_lastIn = lastIn;
+		m_lastOut = lastOut;
+	}
+
+private:
+	const double m_pole;
+	double m_lastIn;
+	double m_lastOut;
+	bool m_bPrimed;
+};
+
+// Second order section with the Audio EQ Cookbook coefficients, transposed direct form II
+class BiquadKernel
+{
+public:
+	BiquadKernel(SensorFilterStageType type, double sample_rate, double frequency, double q)
+	{
+		const double w0 = 2.0 * M_PI * frequency / sample_rate;
+		const double cosW0 = std::cos(w0);
+		const double alpha = std::sin(w0) / (2.0 * q);
+		double b0, b1, b2;
+
+		switch (type)
+		{
+		case SensorFilterStage_Highpass:
+			b0 = (1.0 + cosW0) / 2.0;
+			b1 = -(1.0 + cosW0);
+			b2 = (1.0 + cosW0) / 2.0;
+			break;
+		case SensorFilterStage_Bandpass:
+			b0 = alpha;
+			b1 = 0.0;
+			b2 = -alpha;
+			break;
+		case SensorFilterStage_Notch:
+			b0 = 1.0;
+			b1 = -2.0 * cosW0;
+			b2 = 1.0;
+			break;
+		default:
+			b0 = (1.0 - cosW0) / 2.0;
+			b1 = 1.0 - cosW0;
+			b2 = (1.0 - cosW0) / 2.0;
+			break;
+		}
+
+		const double a0 = 1.0 + alpha;
+		m_b0 = b0 / a0;
+		m_b1 = b1 / a0;
+		m_b2 = b2 / a0;
+		m_a1 = -2.0 * cosW0 / a0;
+		m_a2 = (1.0 - alpha) / a0;
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_z1 = 0.0;
+		m_z2 = 0.0;
+	}
+
+	void Process(const float *in, size_t count, float *out)
+	{
+		double z1 = m_z1;
+		double z2 = m_z2;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const double x = in[i];
+			const double y = m_b0 * x + z1;
+
+			z1 = m_b1 * x - m_a1 * y + z2;
+			z2 = m_b2 * x - m_a2 * y;
+			out[i] = (float)y;
+		}
+		m_z1 = z1;
+		m_z2 = z2;
+	}
+
+private:
+	double m_b0, m_b1, m_b2, m_a1, m_a2;
+	double m_z1, m_z2;
+};
+
+// The last taps - 1 inputs are kept in front of each block, so every output is one dot product
+// over contiguous memory with the taps stored reversed
+class FIRKernel
+{
+public:
+	FIRKernel(const std::vector<float> &taps)
+		: m_reversedTaps(taps.rbegin(), taps.rend())
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_line.assign(m_reversedTaps.size() - 1, 0.f);
+	}
+
+	void Process(const float *in, size_t count, float *out)
+	{
+		const size_t tapCount = m_reversedTaps.size();
+		const size_t historyCount = tapCount - 1;
+
+		m_line.resize(historyCount + count);
+		std::copy(in, in + count, m_line.begin() + historyCount);
+
+		const float *taps = m_reversedTaps.data();
+		for (size_t i = 0; i < count; ++i)
+		{
+			const float *window = m_line.data() + i;
+			float sum = 0.f;
+
+			for (size_t k = 0; k < tapCount; ++k)
+			{
+				sum += taps[k] * window[k];
+			}
+			out[i] = sum;
+		}
+
+		m_line.erase(m_line.begin(), m_line.begin() + count);
+	}
+
+private:
+	const std::vector<float> m_reversedTaps;
+	std::vector<float> m_line;
+};
+
+// Mean of the last length samples, or of all of them until there are that many
+class MovingAverageKernel
+{
+public:
+	MovingAverageKernel(int length)
+		: m_window(length)
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		std::fill(m_window.begin(), m_window.end(), 0.f);
+		m_sum = 0.0;
+		m_head = 0;
+		m_count = 0;
+	}
+
+	void Process(const float *in, size_t count, float *out)
+	{
+		const size_t length = m_window.size();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_sum += in[i] - m_window[m_head];
+			m_window[m_head] = in[i];
+			m_head = (m_head + 1 == length) ? 0 : m_head + 1;
+			m_count = std::min(m_count + 1, length);
+
+			out[i] = (float)(m_sum / m_count);
+		}
+	}
+
+private:
+	std::vector<float> m_window;
+	double m_sum;
+	size_t m_head;
+	size_t m_count;
+};
+
+//-- Stages --
+
+// Runs one kernel per channel, each over its own column of the block
+template <typename Kernel>
+class PerChannelStage : public SensorFilterStage
+{
+public:
+	PerChannelStage(int channel_count, const Kernel &prototype)
+		: m_kernels(channel_count, prototype)
+	{
+	}
+
+	int GetOutputChannelCount() const override { return (int)m_kernels.size(); }
+
+	void Process(const float *in, size_t count, float *out) override
+	{
+		for (size_t channel = 0; channel < m_kernels.size(); ++channel)
+		{
+			m_kernels[channel].Process(in + channel * count, count, out + channel * count);
+		}
+	}
+
+	void Reset() override
+	{
+		for (Kernel &kernel : m_kernels)
+		{
+			kernel.Reset();
+		}
+	}
+
+private:
+	std::vector<Kernel> m_kernels;
+};
+
+class MagnitudeStage : public SensorFilterStage
+{
+public:
+	MagnitudeStage(int input_channel_count)
+		: m_inputChannelCount(input_channel_count)
+	{
+	}
+
+	int GetOutputChannelCount() const override { return 1; }
+
+	void Process(const float *in, size_t count, float *out) override
+	{
+		std::fill(out, out + count, 0.f);
+		for (int channel = 0; channel < m_inputChannelCount; ++channel)
+		{
+			const float *column = in + channel * count;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				out[i] += column[i] * column[i];
+			}
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			out[i] = std::sqrt(out[i]);
+		}
+	}
+
+	void Reset() override {}
+
+private:
+	const int m_inputChannelCount;
+};
+
+class SelectStage : public SensorFilterStage
+{
+public:
+	SelectStage(const std::vector<int> &channels)
+		: m_channels(channels)
+	{
+	}
+
+	int GetOutputChannelCount() const override { return (int)m_channels.size(); }
+
+	void Process(const float *in, size_t count, float *out) override
+	{
+		for (size_t i = 0; i < m_channels.size(); ++i)
+		{
+			std::copy(in + m_channels[i] * count, in + (m_channels[i] + 1) * count, out + i * count);
+		}
+	}
+
+	void Reset() override {}
+
+private:
+	const std::vector<int> m_channels;
+};
+
+SensorFilterStageDesc::SensorFilterStageDesc()
+	: type(SensorFilterStage_DCBlock)
+	, frequency(0.0)
+	, q(M_SQRT1_2)
+	, length(0)
+{
+}
+
+std::unique_ptr<SensorFilterStage> CreateSensorFilterStage(
+	const SensorFilterStageDesc &desc,
+	double sample_rate,
+	int input_channel_count)
+{
+	const bool bValidFrequency = desc.frequency > 0.0 && desc.frequency < sample_rate / 2.0;
+
+	switch (desc.type)
+	{
+	case SensorFilterStage_DCBlock:
+		if (!bValidFrequency)
+			return nullptr;
+		return std::unique_ptr<SensorFilterStage>(
+			new PerChannelStage<DCBlockKernel>(input_channel_count, DCBlockKernel(sample_rate, desc.frequency)));
+	case SensorFilterStage_Lowpass:
+	case SensorFilterStage_Highpass:
+	case SensorFilterStage_Bandpass:
+	case SensorFilterStage_Notch:
+		if (!bValidFrequency || !(desc.q > 0.0))
+			return nullptr;
+		return std::unique_ptr<SensorFilterStage>(
+			new PerChannelStage<BiquadKernel>(input_channel_count, BiquadKernel(desc.type, sample_rate, desc.frequency, desc.q)));
+	case SensorFilterStage_FIR:
+		if (desc.taps.empty() || desc.taps.size() > k_maxFIRTaps)
+			return nullptr;
+		return std::unique_ptr<SensorFilterStage>(
+			new PerChannelStage<FIRKernel>(input_channel_count, FIRKernel(desc.taps)));
+	case SensorFilterStage_MovingAverage:
+		if (desc.length < 1 || desc.length > k_maxMovingAverageLength)
+			return nullptr;
+		return std::unique_ptr<SensorFilterStage>(
+			new PerChannelStage<MovingAverageKernel>(input_channel_count, MovingAverageKernel(desc.length)));
+	case SensorFilterStage_Magnitude:
+		return std::unique_ptr<SensorFilterStage>(new MagnitudeStage(input_channel_count));
+	case SensorFilterStage_Select:
+		if (desc.channels.empty())
+			return nullptr;
+		for (int channel : desc.channels)
+		{
+			if (channel < 0 || channel >= input_channel_count)
+				return nullptr;
+		}
+		return std::unique_ptr<SensorFilterStage>(new SelectStage(desc.channels));
+	default:
+		return nullptr;
+	}
+}
+
+SensorFilterGraphSettings::SensorFilterGraphSettings()
+	: sampleRate(0.0)
+	, maxBufferedSeconds(10.0)
+{
+}
+
+static int GetSampleWidth(HSLSensorBufferType buffer_type)
+{
+	int sampleWidth = 0;
+	int frameValueWidth = 0;
+	bool bFloatSamples = false;
+
+	return GetSensorBufferFormat(buffer_type, sampleWidth, frameValueWidth, bFloatSamples) ? sampleWidth : 0;
+}
+
+SensorFilterGraph::SensorFilterGraph(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	const SensorFilterGraphSettings &settings)
+	: m_settings(settings)
+	, m_watcher(sensor_id, buffer_type)
+	, m_sampleRate(settings.sampleRate > 0.0 ? settings.sampleRate : GetSensorNominalSampleRate(buffer_type))
+	, m_inputChannelCount(GetSampleWidth(buffer_type))
+	, m_outRaw(m_inputChannelCount)
+	, m_outFiltered(m_inputChannelCount)
+	, m_processedCount(0)
+	, m_droppedCount(0)
+{
+}
+
+int SensorFilterGraph::GetOutputChannelCount() const
+{
+	return m_stages.empty() ? m_inputChannelCount : m_stages.back()->GetOutputChannelCount();
+}
+
+bool SensorFilterGraph::AddStage(const SensorFilterStageDesc &desc)
+{
+	std::unique_ptr<SensorFilterStage> stage = CreateSensorFilterStage(desc, m_sampleRate, GetOutputChannelCount());
+	if (!stage)
+	{
+		return false;
+	}
+
+	m_stages.push_back(std::move(stage));
+	m_outFiltered.resize(GetOutputChannelCount());
+
+	return true;
+}
+
+void SensorFilterGraph::OnSensorSourceUpdated(SensorSource &source)
+{
+	if (m_watcher.CollectNewFrames(source, m_newFrames) == 0)
+	{
+		return;
+	}
+
+	SensorFrameLayout layout;
+	if (!MeasureSensorFrames(GetBufferType(), m_newFrames.data(), m_newFrames.size(), layout, true))
+	{
+		return;
+	}
+	m_packed.resize(layout.byteLength);
+	PackSensorFrames(m_newFrames.data(), layout, m_packed.data());
+
+	const uint8_t *data = m_packed.data();
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	const int32_t *intSamples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	const float *floatSamples = reinterpret_cast<const float *>(data + layout.samplesOffset);
+	const size_t sampleCount = layout.sampleCount;
+
+	m_times.resize(sampleCount);
+	m_raw.resize(sampleCount * m_inputChannelCount);
+
+	// Samples from restartSample on follow a jump back in time (e.g. a replay seek), the filter
+	// state from before it would bleed into them
+	size_t restartSample = 0;
+	bool bRestart = false;
+
+	for (size_t frame = 0; frame < layout.frameCount; ++frame)
+	{
+		const double frameTime = frameTimes[frame];
+		const size_t firstSample = frameOffsets[frame];
+		const size_t frameSampleCount = frameOffsets[frame + 1] - firstSample;
+
+		if (m_clock.GetFrameTime() > 0.0 && frameTime < m_clock.GetFrameTime() - k_restartSeconds)
+		{
+			m_clock.Reset();
+			restartSample = firstSample;
+			bRestart = true;
+		}
+
+		m_clock.AddFrame(frameTime, frameSampleCount);
+		for (size_t sample = 0; sample < frameSampleCount; ++sample)
+		{
+			m_times[firstSample + sample] = m_clock.GetSampleTime(sample);
+		}
+	}
+
+	for (int channel = 0; channel < m_inputChannelCount; ++channel)
+	{
+		const size_t base = channel * sampleCount;
+
+		for (size_t i = 0; i < sampleCount; ++i)
+		{
+			m_raw[base + i] = layout.bFloatSamples ? floatSamples[base + i] : (float)intSamples[base + i];
+		}
+	}
+
+	if (bRestart)
+	{
+		AddSamples(m_times.data(), m_raw.data(), restartSample, sampleCount);
+		ResetStages();
+	}
+
+	AddSamples(m_times.data() + restartSample, m_raw.data() + restartSample, sampleCount - restartSample, sampleCount);
+}
+
+void SensorFilterGraph::AddSamples(const double *times, const float *raw, size_t count, size_t raw_stride)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// The chain's input is the raw block packed down to count samples per channel
+	std::vector<float> *in = &m_stageBlocks[0];
+	std::vector<float> *out = &m_stageBlocks[1];
+
+	in->resize(count * m_inputChannelCount);
+	for (int channel = 0; channel < m_inputChannelCount; ++channel)
+	{
+		const float *column = raw + channel * raw_stride;
+
+		std::copy(column, column + count, in->begin() + channel * count);
+		m_outRaw[channel].insert(m_outRaw[channel].end(), column, column + count);
+	}
+
+	for (const std::unique_ptr<SensorFilterStage> &stage : m_stages)
+	{
+		out->resize(count * stage->GetOutputChannelCount());
+		stage->Process(in->data(), count, out->data());
+		std::swap(in, out);
+	}
+
+	for (size_t channel = 0; channel < m_outFiltered.size(); ++channel)
+	{
+		const float *column = in->data() + channel * count;
+
+		m_outFiltered[channel].insert(m_outFiltered[channel].end(), column, column + count);
+	}
+
+	m_outTimes.insert(m_outTimes.end(), times, times + count);
+	m_processedCount += count;
+
+	const size_t maxCount = std::max((size_t)(m_settings.maxBufferedSeconds * m_sampleRate), (size_t)1);
+	if (m_outTimes.size() > maxCount)
+	{
+		const size_t dropCount = m_outTimes.size() - maxCount;
+
+		PopOldest(dropCount);
+		m_droppedCount += dropCount;
+	}
+}
+
+size_t SensorFilterGraph::Read(size_t max_count, double *out_times, float *out_raw, float *out_filtered)
+{
+	const size_t count = std::min(max_count, m_outTimes.size());
+
+	std::copy(m_outTimes.begin(), m_outTimes.begin() + count, out_times);
+	for (size_t channel = 0; channel < m_outRaw.size(); ++channel)
+	{
+		std::copy(m_outRaw[channel].begin(), m_outRaw[channel].begin() + count, out_raw + channel * count);
+	}
+	for (size_t channel = 0; channel < m_outFiltered.size(); ++channel)
+	{
+		std::copy(m_outFiltered[channel].begin(), m_outFiltered[channel].begin() + count, out_filtered + channel * count);
+	}
+
+	PopOldest(count);
+
+	return count;
+}
+
+void SensorFilterGraph::Reset()
+{
+	m_clock.Reset();
+	ResetStages();
+	PopOldest(m_outTimes.size());
+	m_processedCount = 0;
+	m_droppedCount = 0;
+}
+
+void SensorFilterGraph::ResetStages()
+{
+	for (const std::unique_ptr<SensorFilterStage> &stage : m_stages)
+	{
+		stage->Reset();
+	}
+}
+
+void SensorFilterGraph::PopOldest(size_t count)
+{
+	m_outTimes.erase(m_outTimes.begin(), m_outTimes.begin() + count);
+	for (std::deque<float> &column : m_outRaw)
+	{
+		column.erase(column.begin(), column.begin() + count);
+	}
+	for (std::deque<float> &column : m_outFiltered)
+	{
+		column.erase(column.begin(), column.begin() + count);
+	}
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_FILTER_GRAPH_H
+#define SENSOR_FILTER_GRAPH_H
+
+#include "SensorFrameBatch.h"
+#include "SensorSource.h"
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+enum SensorFilterStageType
+{
+	SensorFilterStage_DCBlock,       // One pole high pass at frequency
+	SensorFilterStage_Lowpass,       // Biquads, frequency and q
+	SensorFilterStage_Highpass,
+	SensorFilterStage_Bandpass,
+	SensorFilterStage_Notch,
+	SensorFilterStage_FIR,           // taps
+	SensorFilterStage_MovingAverage, // length samples
+	SensorFilterStage_Magnitude,     // Euclidean norm of all channels, one channel out
+	SensorFilterStage_Select,        // Keeps the channels listed in channels
+
+	SensorFilterStage_COUNT
+};
+
+struct SensorFilterStageDesc
+{
+	SensorFilterStageDesc();
+
+	SensorFilterStageType type;
+	double frequency; // Hz, the cutoff or the center
+	double q;
+	int length;
+	std::vector<float> taps;
+	std::vector<int> channels;
+};
+
+// One step of a filter chain. Blocks are planar, block[channel * count + sample], and every
+// stage keeps its state from one block to the next so a stream can be fed in any batch sizes.
+class SensorFilterStage
+{
+public:
+	virtual ~SensorFilterStage() {}
+
+	virtual int GetOutputChannelCount() const = 0;
+	virtual void Process(const float *in, size_t count, float *out) = 0;
+	virtual void Reset() = 0;
+};
+
+// nullptr if the description doesn't make sense for the rate and channels, e.g. a cutoff
+// above Nyquist or a channel that isn't there
+std::unique_ptr<SensorFilterStage> CreateSensorFilterStage(
+	const SensorFilterStageDesc &desc,
+	double sample_rate,
+	int input_channel_count);
+
+struct SensorFilterGraphSettings
+{
+	SensorFilterGraphSettings();
+
+	double sampleRate;         // Rate the filters are designed for, 0 picks the stream's usual rate
+	double maxBufferedSeconds; // Samples kept until read, the oldest go first
+};
+
+// Runs a chain of filter stages over every sample of one ECG, PPG or Acc stream as it lands,
+// wherever HSL is updated, and keeps the raw and the filtered samples until they are read.
+//
+// Attached as a SensorSourceListener; it watches the stream's buffer without flushing it.
+class SensorFilterGraph : public SensorSourceListener
+{
+public:
+	SensorFilterGraph(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, const SensorFilterGraphSettings &settings);
+
+	HSLSensorID GetSensorID() const { return m_watcher.GetSensorID(); }
+	HSLSensorBufferType GetBufferType() const { return m_watcher.GetBufferType(); }
+	double GetSampleRate() const { return m_sampleRate; }
+	int GetInputChannelCount() const { return m_inputChannelCount; }
+	int GetOutputChannelCount() const;
+	size_t GetStageCount() const { return m_stages.size(); }
+
+	// Appends a stage to the chain, only before the graph is attached.
+	// Returns false if the stage can't follow the ones before it.
+	bool AddStage(const SensorFilterStageDesc &desc);
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	// Runs count samples through the chain and queues them. raw is planar with raw_stride
+	// floats from one channel to the next: raw[channel * raw_stride + sample].
+	void AddSamples(const double *times, const float *raw, size_t count, size_t raw_stride);
+
+	size_t GetPendingCount() const { return m_outTimes.size(); }
+	uint64_t GetProcessedCount() const { return m_processedCount; }
+	uint64_t GetDroppedCount() const { return m_droppedCount; } // Samples never read
+
+	// Moves up to max_count samples out, both blocks planar:
+	// out_raw[channel * count + sample] and out_filtered the same with the output channels
+	size_t Read(size_t max_count, double *out_times, float *out_raw, float *out_filtered);
+	void Reset();
+
+private:
+	void ResetStages();
+	void PopOldest(size_t count);
+
+	const SensorFilterGraphSettings m_settings;
+	SensorBufferWatcher m_watcher;
+	SensorSampleClock m_clock;
+	const double m_sampleRate;
+	const int m_inputChannelCount;
+	std::vector<std::unique_ptr<SensorFilterStage>> m_stages;
+
+	std::deque<double> m_outTimes;
+	std::vector<std::deque<float>> m_outRaw;
+	std::vector<std::deque<float>> m_outFiltered;
+	uint64_t m_processedCount;
+	uint64_t m_droppedCount;
+
+	// Scratch
+	std::vector<const void *> m_newFrames;
+	std::vector<uint8_t> m_packed;
+	std::vector<double> m_times;
+	std::vector<float> m_raw;
+	std::vector<float> m_stageBlocks[2];
+};
+
+#endif // SENSOR_FILTER_GRAPH_H
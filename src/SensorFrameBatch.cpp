@@ -0,0 +1,826 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorFrameBatch.h"
+#include "PipelineStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+static_assert(sizeof(HSLVector3f) == 3 * sizeof(float), "HSLVector3f expected to be tightly packed");
+
+static size_t AlignUp(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// in_out_offset += count * element_size, false instead of wrapping around
+static bool AddLayoutBytes(size_t &in_out_offset, size_t count, size_t element_size)
+{
+	if (element_size != 0 && count > (SIZE_MAX - in_out_offset) / element_size)
+	{
+		return false;
+	}
+
+	in_out_offset += count * element_size;
+	return true;
+}
+
+const char *GetSensorSampleChannelName(HSLSensorBufferType buffer_type, int channel)
+{
+	static const char *k_ppgChannelNames[] = {"ppgValue0", "ppgValue1", "ppgValue2", "ambient"};
+	static const char *k_ppiChannelNames[] = {"beatsPerMinute", "pulseDuration", "pulseDurationErrorEst", "flags"};
+	static const char *k_accChannelNames[] = {"x", "y", "z"};
+
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		return (channel == 0) ? "RRIntervals" : nullptr;
+	case HSLBufferType_ECGData:
+		return (channel == 0) ? "ecgValues" : nullptr;
+	case HSLBufferType_PPGData:
+		return (channel >= 0 && channel < 4) ? k_ppgChannelNames[channel] : nullptr;
+	case HSLBufferType_PPIData:
+		return (channel >= 0 && channel < 4) ? k_ppiChannelNames[channel] : nullptr;
+	case HSLBufferType_AccData:
+		return (channel >= 0 && channel < 3) ? k_accChannelNames[channel] : nullptr;
+	case HSLBufferType_HRVData:
+		return (channel == 0) ? "hrvValue" : nullptr;
+	default:
+		return nullptr;
+	}
+}
+
+bool GetSensorBufferFormat(
+	HSLSensorBufferType buffer_type,
+	int &out_sample_width,
+	int &out_frame_value_width,
+	bool &out_float_samples)
+{
+	out_frame_value_width = 0;
+	out_float_samples = false;
+
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		out_sample_width = 1;
+		out_frame_value_width = HRFrameValue_COUNT;
+		return true;
+	case HSLBufferType_ECGData:
+		out_sample_width = 1;
+		return true;
+	case HSLBufferType_PPGData:
+		out_sample_width = 4;
+		return true;
+	case HSLBufferType_PPIData:
+		out_sample_width = 4;
+		return true;
+	case HSLBufferType_AccData:
+		out_sample_width = 3;
+		out_float_samples = true;
+		return true;
+	case HSLBufferType_HRVData:
+		out_sample_width = 1;
+		out_float_samples = true;
+		return true;
+	default:
+		out_sample_width = 0;
+		return false;
+	}
+}
+
+size_t GetSensorFrameSize(HSLSensorBufferType buffer_type)
+{
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		return sizeof(HSLHeartRateFrame);
+	case HSLBufferType_ECGData:
+		return sizeof(HSLHeartECGFrame);
+	case HSLBufferType_PPGData:
+		return sizeof(HSLHeartPPGFrame);
+	case HSLBufferType_PPIData:
+		return sizeof(HSLHeartPPIFrame);
+	case HSLBufferType_AccData:
+		return sizeof(HSLAccelerometerFrame);
+	case HSLBufferType_HRVData:
+		return sizeof(HSLHeartVariabilityFrame);
+	default:
+		return 0;
+	}
+}
+
+double GetSensorFrameTime(HSLSensorBufferType buffer_type, const void *frame)
+{
+	if (frame == nullptr)
+		return 0.0;
+
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		return static_cast<const HSLHeartRateFrame *>(frame)->timeInSeconds;
+	case HSLBufferType_ECGData:
+		return static_cast<const HSLHeartECGFrame *>(frame)->timeInSeconds;
+	case HSLBufferType_PPGData:
+		return static_cast<const HSLHeartPPGFrame *>(frame)->timeInSeconds;
+	case HSLBufferType_PPIData:
+		return static_cast<const HSLHeartPPIFrame *>(frame)->timeInSeconds;
+	case HSLBufferType_AccData:
+		return static_cast<const HSLAccelerometerFrame *>(frame)->timeInSeconds;
+	case HSLBufferType_HRVData:
+		return static_cast<const HSLHeartVariabilityFrame *>(frame)->timeInSeconds;
+	default:
+		return 0.0;
+	}
+}
+
+int GetSensorFrameSampleCount(HSLSensorBufferType buffer_type, const void *frame)
+{
+	if (frame == nullptr)
+		return 0;
+
+	int sampleCount = 0;
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		sampleCount = static_cast<const HSLHeartRateFrame *>(frame)->RRIntervalCount;
+		break;
+	case HSLBufferType_ECGData:
+		sampleCount = static_cast<const HSLHeartECGFrame *>(frame)->ecgValueCount;
+		break;
+	case HSLBufferType_PPGData:
+		sampleCount = static_cast<const HSLHeartPPGFrame *>(frame)->ppgSampleCount;
+		break;
+	case HSLBufferType_PPIData:
+		sampleCount = static_cast<const HSLHeartPPIFrame *>(frame)->ppiSampleCount;
+		break;
+	case HSLBufferType_AccData:
+		sampleCount = static_cast<const HSLAccelerometerFrame *>(frame)->accSampleCount;
+		break;
+	case HSLBufferType_HRVData:
+		sampleCount = 1;
+		break;
+	default:
+		return 0;
+	}
+
+	return std::max(sampleCount, 0);
+}
+
+static bool BeginSensorLayout(HSLSensorBufferType buffer_type, bool planar_samples, SensorFrameLayout &out_layout)
+{
+	memset(&out_layout, 0, sizeof(out_layout));
+	out_layout.bufferType = buffer_type;
+	out_layout.bPlanarSamples = planar_samples;
+
+	return GetSensorBufferFormat(
+		buffer_type,
+		out_layout.sampleWidth,
+		out_layout.frameValueWidth,
+		out_layout.bFloatSamples);
+}
+
+// Counts can come from a JS batch object or a session file, so every size is checked
+// rather than allowed to wrap into a small byteLength. Frame offsets are 32 bit.
+static bool EndSensorLayout(SensorFrameLayout &layout)
+{
+	const size_t frameCount = layout.frameCount;
+	size_t offset = 0;
+
+	if (frameCount >= UINT32_MAX || layout.sampleCount > UINT32_MAX)
+	{
+		return false;
+	}
+
+	layout.frameTimesOffset = offset;
+	if (!AddLayoutBytes(offset, frameCount, sizeof(double)))
+		return false;
+
+	layout.frameOffsetsOffset = offset;
+	if (!AddLayoutBytes(offset, frameCount + 1, sizeof(uint32_t)))
+		return false;
+
+	layout.frameValuesOffset = offset;
+	if (!AddLayoutBytes(offset, frameCount, layout.frameValueWidth * sizeof(int32_t)))
+		return false;
+
+	// int32_t and float samples share the same 4 byte alignment
+	layout.samplesOffset = offset;
+	if (!AddLayoutBytes(offset, layout.sampleCount, layout.sampleWidth * sizeof(int32_t)) ||
+		offset > SIZE_MAX - sizeof(double))
+		return false;
+
+	layout.byteLength = AlignUp(offset, sizeof(double));
+
+	return true;
+}
+
+bool MeasureSensorBuffer(SensorBufferIterator iterator, SensorFrameLayout &out_layout, bool planar_samples)
+{
+	if (!BeginSensorLayout(iterator.bufferType, planar_samples, out_layout))
+	{
+		return false;
+	}
+
+	while (IsSensorBufferIteratorValid(iterator))
+	{
+		out_layout.sampleCount += GetSensorFrameSampleCount(iterator.bufferType, GetSensorBufferFrame(iterator));
+		out_layout.frameCount++;
+		SensorBufferIteratorNext(iterator);
+	}
+
+	return EndSensorLayout(out_layout);
+}
+
+bool MeasureSensorFrames(
+	HSLSensorBufferType buffer_type,
+	const void *const *frames,
+	size_t frame_count,
+	SensorFrameLayout &out_layout,
+	bool planar_samples)
+{
+	if (!BeginSensorLayout(buffer_type, planar_samples, out_layout))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < frame_count; ++i)
+	{
+		out_layout.sampleCount += GetSensorFrameSampleCount(buffer_type, frames[i]);
+	}
+	out_layout.frameCount = frame_count;
+
+	return EndSensorLayout(out_layout);
+}
+
+bool ComputeSensorFrameLayout(
+	HSLSensorBufferType buffer_type,
+	size_t frame_count,
+	size_t sample_count,
+	SensorFrameLayout &out_layout,
+	bool planar_samples)
+{
+	if (!BeginSensorLayout(buffer_type, planar_samples, out_layout))
+	{
+		return false;
+	}
+
+	out_layout.frameCount = frame_count;
+	out_layout.sampleCount = sample_count;
+
+	return EndSensorLayout(out_layout);
+}
+
+// Writes the packed output of sensor frames one at a time
+class SensorFramePacker
+{
+public:
+	SensorFramePacker(const SensorFrameLayout &layout, uint8_t *dest)
+		: m_layout(layout)
+		, m_frameTimes(reinterpret_cast<double *>(dest + layout.frameTimesOffset))
+		, m_frameOffsets(reinterpret_cast<uint32_t *>(dest + layout.frameOffsetsOffset))
+		, m_frameValues(reinterpret_cast<int32_t *>(dest + layout.frameValuesOffset))
+		, m_intSamples(reinterpret_cast<int32_t *>(dest + layout.samplesOffset))
+		, m_floatSamples(reinterpret_cast<float *>(dest + layout.samplesOffset))
+		// Distance between consecutive samples and between the channels of one sample
+		, m_sampleStride(layout.bPlanarSamples ? 1 : layout.sampleWidth)
+		, m_channelStride(layout.bPlanarSamples ? layout.sampleCount : 1)
+		, m_frameIndex(0)
+		, m_sampleIndex(0)
+	{
+	}
+
+	bool IsFull() const { return m_frameIndex >= m_layout.frameCount; }
+
+	void PackFrame(const void *frame_ptr);
+	void Finish();
+
+private:
+	const SensorFrameLayout &m_layout;
+	double *m_frameTimes;
+	uint32_t *m_frameOffsets;
+	int32_t *m_frameValues;
+	int32_t *m_intSamples;
+	float *m_floatSamples;
+	const size_t m_sampleStride;
+	const size_t m_channelStride;
+	size_t m_frameIndex;
+	size_t m_sampleIndex;
+};
+
+void SensorFramePacker::PackFrame(const void *frame_ptr)
+{
+	const size_t frameCount = m_layout.frameCount;
+	const size_t frameIndex = m_frameIndex;
+	const size_t sampleIndex = m_sampleIndex;
+
+	// Never write past the block if the buffer grew since it was measured
+	const size_t frameSampleCount =
+		std::min((size_t)GetSensorFrameSampleCount(m_layout.bufferType, frame_ptr), m_layout.sampleCount - sampleIndex);
+
+	m_frameOffsets[frameIndex] = (uint32_t)sampleIndex;
+	m_frameTimes[frameIndex] = GetSensorFrameTime(m_layout.bufferType, frame_ptr);
+
+	if (frame_ptr != nullptr)
+	{
+		switch (m_layout.bufferType)
+		{
+		case HSLBufferType_HRData:
+			{
+				const HSLHeartRateFrame *frame = static_cast<const HSLHeartRateFrame *>(frame_ptr);
+				int32_t *rrIntervals = m_intSamples + sampleIndex;
+
+				std::copy(frame->RRIntervals, frame->RRIntervals + frameSampleCount, rrIntervals);
+				m_frameValues[HRFrameValue_BeatsPerMinute * frameCount + frameIndex] = frame->beatsPerMinute;
+				m_frameValues[HRFrameValue_ContactStatus * frameCount + frameIndex] = (int32_t)frame->contactStatus;
+				m_frameValues[HRFrameValue_EnergyExpended * frameCount + frameIndex] = frame->energyExpended;
+			} break;
+		case HSLBufferType_ECGData:
+			{
+				const HSLHeartECGFrame *frame = static_cast<const HSLHeartECGFrame *>(frame_ptr);
+				int32_t *ecgValues = m_intSamples + sampleIndex;
+
+				std::copy(frame->ecgValues, frame->ecgValues + frameSampleCount, ecgValues);
+			} break;
+		case HSLBufferType_PPGData:
+			{
+				const HSLHeartPPGFrame *frame = static_cast<const HSLHeartPPGFrame *>(frame_ptr);
+				int32_t *ppgValues = m_intSamples + sampleIndex * m_sampleStride;
+
+				for (size_t i = 0; i < frameSampleCount; ++i)
+				{
+					const HSLHeartPPGSample &ppgSample = frame->ppgSamples[i];
+
+					ppgValues[0] = ppgSample.ppgValue0;
+					ppgValues[m_channelStride] = ppgSample.ppgValue1;
+					ppgValues[2 * m_channelStride] = ppgSample.ppgValue2;
+					ppgValues[3 * m_channelStride] = ppgSample.ambient;
+					ppgValues += m_sampleStride;
+				}
+			} break;
+		case HSLBufferType_PPIData:
+			{
+				const HSLHeartPPIFrame *frame = static_cast<const HSLHeartPPIFrame *>(frame_ptr);
+				int32_t *ppiValues = m_intSamples + sampleIndex * m_sampleStride;
+
+				for (size_t i = 0; i < frameSampleCount; ++i)
+				{
+					const HSLHeartPPISample &ppiSample = frame->ppiSamples[i];
+
+					ppiValues[0] = ppiSample.beatsPerMinute;
+					ppiValues[m_channelStride] = ppiSample.pulseDuration;
+					ppiValues[2 * m_channelStride] = ppiSample.pulseDurationErrorEst;
+					ppiValues[3 * m_channelStride] =
+						(ppiSample.blockerBit != 0 ? PPISampleFlag_Blocker : 0) |
+						(ppiSample.skinContactBit != 0 ? PPISampleFlag_SkinContact : 0) |
+						(ppiSample.supportsSkinContactBit != 0 ? PPISampleFlag_SupportsSkinContact : 0);
+					ppiValues += m_sampleStride;
+				}
+			} break;
+		case HSLBufferType_AccData:
+			{
+				const HSLAccelerometerFrame *frame = static_cast<const HSLAccelerometerFrame *>(frame_ptr);
+
+				if (m_layout.bPlanarSamples)
+				{
+					float *xValues = m_floatSamples + sampleIndex;
+					float *yValues = xValues + m_channelStride;
+					float *zValues = yValues + m_channelStride;
+
+					for (size_t i = 0; i < frameSampleCount; ++i)
+					{
+						xValues[i] = frame->accSamples[i].x;
+						yValues[i] = frame->accSamples[i].y;
+						zValues[i] = frame->accSamples[i].z;
+					}
+				}
+				else
+				{
+					memcpy(m_floatSamples + sampleIndex * 3, frame->accSamples, frameSampleCount * sizeof(HSLVector3f));
+				}
+			} break;
+		case HSLBufferType_HRVData:
+			{
+				const HSLHeartVariabilityFrame *frame = static_cast<const HSLHeartVariabilityFrame *>(frame_ptr);
+
+				if (frameSampleCount > 0)
+				{
+					m_floatSamples[sampleIndex] = (float)frame->hrvValue;
+				}
+			} break;
+		default:
+			break;
+		}
+	}
+	else
+	{
+		for (int value_index = 0; value_index < m_layout.frameValueWidth; ++value_index)
+		{
+			m_frameValues[value_index * frameCount + frameIndex] = 0;
+		}
+	}
+
+	m_sampleIndex += frameSampleCount;
+	m_frameIndex++;
+}
+
+void SensorFramePacker::Finish()
+{
+	// Zero out any frames that disappeared since the buffer was measured
+	while (!IsFull())
+	{
+		PackFrame(nullptr);
+	}
+	m_frameOffsets[m_layout.frameCount] = (uint32_t)m_sampleIndex;
+}
+
+void PackSensorBuffer(SensorBufferIterator iterator, const SensorFrameLayout &layout, uint8_t *dest)
+{
+	SensorFramePacker packer(layout, dest);
+
+	while (!packer.IsFull() && IsSensorBufferIteratorValid(iterator))
+	{
+		packer.PackFrame(GetSensorBufferFrame(iterator));
+		SensorBufferIteratorNext(iterator);
+	}
+
+	packer.Finish();
+}
+
+void PackSensorFrames(const void *const *frames, const SensorFrameLayout &layout, uint8_t *dest)
+{
+	SensorFramePacker packer(layout, dest);
+
+	for (size_t i = 0; i < layout.frameCount; ++i)
+	{
+		packer.PackFrame(frames[i]);
+	}
+
+	packer.Finish();
+}
+
+bool UnpackSensorFrame(const SensorFrameLayout &layout, const uint8_t *data, size_t frame_index, void *out_frame)
+{
+	if (frame_index >= layout.frameCount)
+	{
+		return false;
+	}
+
+	const size_t frameCount = layout.frameCount;
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	const int32_t *frameValues = reinterpret_cast<const int32_t *>(data + layout.frameValuesOffset);
+	const int32_t *intSamples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	const float *floatSamples = reinterpret_cast<const float *>(data + layout.samplesOffset);
+	const size_t sampleStride = layout.bPlanarSamples ? 1 : layout.sampleWidth;
+	const size_t channelStride = layout.bPlanarSamples ? layout.sampleCount : 1;
+
+	const size_t sampleIndex = frameOffsets[frame_index];
+	const size_t sampleEnd = std::min((size_t)frameOffsets[frame_index + 1], layout.sampleCount);
+	const size_t packedSampleCount = (sampleEnd > sampleIndex) ? sampleEnd - sampleIndex : 0;
+
+	memset(out_frame, 0, GetSensorFrameSize(layout.bufferType));
+
+	switch (layout.bufferType)
+	{
+	case HSLBufferType_HRData:
+		{
+			HSLHeartRateFrame *frame = static_cast<HSLHeartRateFrame *>(out_frame);
+			const size_t sampleCount = std::min(packedSampleCount, (size_t)MAX_HSL_RR_INTERVALS);
+
+			for (size_t i = 0; i < sampleCount; ++i)
+			{
+				frame->RRIntervals[i] = (uint16_t)intSamples[sampleIndex + i];
+			}
+			frame->RRIntervalCount = (int)sampleCount;
+			frame->beatsPerMinute = (uint16_t)frameValues[HRFrameValue_BeatsPerMinute * frameCount + frame_index];
+			frame->contactStatus = (HSLContactSensorStatus)frameValues[HRFrameValue_ContactStatus * frameCount + frame_index];
+			frame->energyExpended = (uint16_t)frameValues[HRFrameValue_EnergyExpended * frameCount + frame_index];
+			frame->timeInSeconds = frameTimes[frame_index];
+		} break;
+	case HSLBufferType_ECGData:
+		{
+			HSLHeartECGFrame *frame = static_cast<HSLHeartECGFrame *>(out_frame);
+			const size_t sampleCount = std::min(packedSampleCount, (size_t)MAX_HSL_ECG_SAMPLES);
+
+			std::copy(intSamples + sampleIndex, intSamples + sampleIndex + sampleCount, frame->ecgValues);
+			frame->ecgValueCount = (int)sampleCount;
+			frame->timeInSeconds = frameTimes[frame_index];
+		} break;
+	case HSLBufferType_PPGData:
+		{
+			HSLHeartPPGFrame *frame = static_cast<HSLHeartPPGFrame *>(out_frame);
+			const size_t sampleCount = std::min(packedSampleCount, (size_t)MAX_HSL_PPG_SAMPLES);
+			const int32_t *ppgValues = intSamples + sampleIndex * sampleStride;
+
+			for (size_t i = 0; i < sampleCount; ++i)
+			{
+				HSLHeartPPGSample &ppgSample = frame->ppgSamples[i];
+
+				ppgSample.ppgValue0 = ppgValues[0];
+				ppgSample.ppgValue1 = ppgValues[channelStride];
+				ppgSample.ppgValue2 = ppgValues[2 * channelStride];
+				ppgSample.ambient = ppgValues[3 * channelStride];
+				ppgValues += sampleStride;
+			}
+			frame->ppgSampleCount = (int)sampleCount;
+			frame->timeInSeconds = frameTimes[frame_index];
+		} break;
+	case HSLBufferType_PPIData:
+		{
+			HSLHeartPPIFrame *frame = static_cast<HSLHeartPPIFrame *>(out_frame);
+			const size_t sampleCount = std::min(packedSampleCount, (size_t)MAX_HSL_PPI_SAMPLES);
+			const int32_t *ppiValues = intSamples + sampleIndex * sampleStride;
+
+			for (size_t i = 0; i < sampleCount; ++i)
+			{
+				HSLHeartPPISample &ppiSample = frame->ppiSamples[i];
+				const int32_t flags = ppiValues[3 * channelStride];
+
+				ppiSample.beatsPerMinute = (uint16_t)ppiValues[0];
+				ppiSample.pulseDuration = (uint16_t)ppiValues[channelStride];
+				ppiSample.pulseDurationErrorEst = (uint16_t)ppiValues[2 * channelStride];
+				ppiSample.blockerBit = (flags & PPISampleFlag_Blocker) ? 1 : 0;
+				ppiSample.skinContactBit = (flags & PPISampleFlag_SkinContact) ? 1 : 0;
+				ppiSample.supportsSkinContactBit = (flags & PPISampleFlag_SupportsSkinContact) ? 1 : 0;
+				ppiValues += sampleStride;
+			}
+			frame->ppiSampleCount = (int)sampleCount;
+			frame->timeInSeconds = frameTimes[frame_index];
+		} break;
+	case HSLBufferType_AccData:
+		{
+			HSLAccelerometerFrame *frame = static_cast<HSLAccelerometerFrame *>(out_frame);
+			const size_t sampleCount = std::min(packedSampleCount, (size_t)MAX_HSL_ACC_SAMPLES);
+			const float *accValues = floatSamples + sampleIndex * sampleStride;
+
+			for (size_t i = 0; i < sampleCount; ++i)
+			{
+				frame->accSamples[i].x = accValues[0];
+				frame->accSamples[i].y = accValues[channelStride];
+				frame->accSamples[i].z = accValues[2 * channelStride];
+				accValues += sampleStride;
+			}
+			frame->accSampleCount = (int)sampleCount;
+			frame->timeInSeconds = frameTimes[frame_index];
+		} break;
+	case HSLBufferType_HRVData:
+		{
+			HSLHeartVariabilityFrame *frame = static_cast<HSLHeartVariabilityFrame *>(out_frame);
+
+			frame->hrvValue = (packedSampleCount > 0) ? floatSamples[sampleIndex] : 0.f;
+			frame->timeInSeconds = frameTimes[frame_index];
+		} break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+bool IsSensorWaveformBuffer(HSLSensorBufferType buffer_type)
+{
+	return
+		buffer_type == HSLBufferType_ECGData ||
+		buffer_type == HSLBufferType_PPGData ||
+		buffer_type == HSLBufferType_AccData;
+}
+
+double GetSensorNominalSampleRate(HSLSensorBufferType buffer_type)
+{
+	switch (buffer_type)
+	{
+	case HSLBufferType_ECGData:
+		return 130.0;
+	case HSLBufferType_PPGData:
+		return 135.0;
+	case HSLBufferType_AccData:
+		return 200.0;
+	default:
+		return 100.0;
+	}
+}
+
+// Number of samples in [begin, end) where (phase + i) % step == 0
+static size_t CountDecimatedSamples(size_t begin, size_t end, int step, int phase)
+{
+	if (end <= begin)
+	{
+		return 0;
+	}
+
+	// Index of the first kept sample at or after begin
+	const size_t first = begin + (size_t)((step - (int)((phase + begin) % step)) % step);
+
+	return (first < end) ? (end - first + step - 1) / step : 0;
+}
+
+void MeasureDecimatedSensorFrames(const SensorFrameLayout &layout, int step, int phase, SensorFrameLayout &out_layout)
+{
+	BeginSensorLayout(layout.bufferType, layout.bPlanarSamples, out_layout);
+	out_layout.frameCount = layout.frameCount;
+	out_layout.sampleCount = CountDecimatedSamples(0, layout.sampleCount, std::max(step, 1), phase);
+	EndSensorLayout(out_layout);
+}
+
+void DecimateSensorFrames(
+	const SensorFrameLayout &layout,
+	const uint8_t *data,
+	int step,
+	int phase,
+	const SensorFrameLayout &out_layout,
+	uint8_t *dest)
+{
+	step = std::max(step, 1);
+
+	const size_t frameCount = layout.frameCount;
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	uint32_t *outFrameOffsets = reinterpret_cast<uint32_t *>(dest + out_layout.frameOffsetsOffset);
+
+	memcpy(dest + out_layout.frameTimesOffset, data + layout.frameTimesOffset, frameCount * sizeof(double));
+	memcpy(dest + out_layout.frameValuesOffset, data + layout.frameValuesOffset, frameCount * layout.frameValueWidth * sizeof(int32_t));
+
+	outFrameOffsets[0] = 0;
+	for (size_t frame = 0; frame < frameCount; ++frame)
+	{
+		const size_t frameSamples = CountDecimatedSamples(frameOffsets[frame], frameOffsets[frame + 1], step, phase);
+
+		outFrameOffsets[frame + 1] = outFrameOffsets[frame] + (uint32_t)frameSamples;
+	}
+
+	// int32_t and float samples are both moved as 4 byte values
+	const int32_t *samples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	int32_t *outSamples = reinterpret_cast<int32_t *>(dest + out_layout.samplesOffset);
+	const size_t sampleWidth = layout.sampleWidth;
+	const size_t first = (size_t)((step - phase % step) % step);
+
+	if (layout.bPlanarSamples)
+	{
+		for (size_t channel = 0; channel < sampleWidth; ++channel)
+		{
+			const int32_t *channelSamples = samples + channel * layout.sampleCount;
+			int32_t *outChannelSamples = outSamples + channel * out_layout.sampleCount;
+
+			for (size_t in = first, out = 0; in < layout.sampleCount; in += step, ++out)
+			{
+				outChannelSamples[out] = channelSamples[in];
+			}
+		}
+	}
+	else
+	{
+		int32_t *out = outSamples;
+
+		for (size_t in = first; in < layout.sampleCount; in += step)
+		{
+			memcpy(out, samples + in * sampleWidth, sampleWidth * sizeof(int32_t));
+			out += sampleWidth;
+		}
+	}
+}
+
+// Sample periods longer than this, or than twice the current estimate, are gaps in the stream
+static const double k_maxSamplePeriod = 0.5;
+
+// Weight of each new frame in the measured sample period
+static const double k_periodSmoothing = 0.1;
+
+SensorSampleClock::SensorSampleClock()
+	: m_samplePeriod(0.0)
+	, m_frameTime(0.0)
+	, m_frameSampleCount(0)
+{
+}
+
+void SensorSampleClock::AddFrame(double frame_time, size_t sample_count)
+{
+	if (m_frameTime > 0.0 && sample_count > 0)
+	{
+		const double measured = (frame_time - m_frameTime) / sample_count;
+
+		if (m_samplePeriod <= 0.0)
+		{
+			if (measured > 0.0 && measured < k_maxSamplePeriod)
+			{
+				m_samplePeriod = measured;
+			}
+		}
+		else if (measured > 0.0 && measured < 2.0 * m_samplePeriod)
+		{
+			m_samplePeriod += (measured - m_samplePeriod) * k_periodSmoothing;
+		}
+	}
+
+	m_frameTime = frame_time;
+	m_frameSampleCount = sample_count;
+}
+
+void SensorSampleClock::Reset()
+{
+	m_samplePeriod = 0.0;
+	m_frameTime = 0.0;
+	m_frameSampleCount = 0;
+}
+
+SensorFrameBatch::SensorFrameBatch()
+	: m_sensorID(-1)
+	, m_hrvFilter(HRVFilter_SDNN)
+	, m_data(nullptr)
+	, m_frameAgeMs(0.0)
+	, m_drainedAt(0.0)
+{
+	memset(&m_layout, 0, sizeof(m_layout));
+}
+
+SensorFrameBatch::SensorFrameBatch(SensorFrameBatch &&other)
+	: m_sensorID(other.m_sensorID)
+	, m_hrvFilter(other.m_hrvFilter)
+	, m_layout(other.m_layout)
+	, m_data(other.m_data)
+	, m_frameAgeMs(other.m_frameAgeMs)
+	, m_drainedAt(other.m_drainedAt)
+{
+	other.m_data = nullptr;
+}
+
+SensorFrameBatch &SensorFrameBatch::operator=(SensorFrameBatch &&other)
+{
+	if (this != &other)
+	{
+		free(m_data);
+
+		m_sensorID = other.m_sensorID;
+		m_hrvFilter = other.m_hrvFilter;
+		m_layout = other.m_layout;
+		m_data = other.m_data;
+		m_frameAgeMs = other.m_frameAgeMs;
+		m_drainedAt = other.m_drainedAt;
+		other.m_data = nullptr;
+	}
+
+	return *this;
+}
+
+SensorFrameBatch::~SensorFrameBatch()
+{
+	free(m_data);
+}
+
+bool SensorFrameBatch::Drain(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	bool planar_samples,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	PipelineScopedTimer timer(PipelineTiming_Drain);
+
+	free(m_data);
+	m_data = nullptr;
+	m_sensorID = sensor_id;
+	m_hrvFilter = hrv_filter;
+	m_frameAgeMs = 0.0;
+
+	SensorBufferIterator iter = GetSensorBufferIterator(sensor_id, buffer_type, hrv_filter);
+	if (!MeasureSensorBuffer(iter, m_layout, planar_samples) || m_layout.frameCount == 0)
+	{
+		return false;
+	}
+
+	m_data = static_cast<uint8_t *>(malloc(m_layout.byteLength));
+	if (m_data == nullptr)
+	{
+		return false;
+	}
+
+	PackSensorBuffer(iter, m_layout, m_data);
+	FlushSensorBuffer(sensor_id, buffer_type, hrv_filter);
+
+	m_frameAgeMs = GetPipelineStats().RecordDrain(sensor_id, m_layout, m_data);
+	m_drainedAt = (double)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	return true;
+}
+
+uint8_t *SensorFrameBatch::ReleaseData()
+{
+	uint8_t *data = m_data;
+
+	m_data = nullptr;
+
+	return data;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_FRAME_BATCH_H
+#define SENSOR_FRAME_BATCH_H
+
+#include "HSLClient_CAPI.h"
+#include "SensorSource.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bits packed into the last value of each PPI sample
+enum PPISampleFlags
+{
+	PPISampleFlag_Blocker = 1 << 0,
+	PPISampleFlag_SkinContact = 1 << 1,
+	PPISampleFlag_SupportsSkinContact = 1 << 2,
+};
+
+// Per-frame values stored for HR frames, one column per value
+enum HRFrameValue
+{
+	HRFrameValue_BeatsPerMinute,
+	HRFrameValue_ContactStatus,
+	HRFrameValue_EnergyExpended,
+
+	HRFrameValue_COUNT
+};
+
+// Describes a block holding every frame of one sensor buffer packed back to back:
+//   double        frameTimes[frameCount]
+//   uint32_t      frameOffsets[frameCount + 1]   index of the first sample of each frame
+//   int32_t       frameValues[frameValueWidth][frameCount]
+//   int32_t|float samples[sampleCount * sampleWidth]
+// Samples are interleaved by default (ECG: value, PPG: ppgValue0-2 + ambient,
+// PPI: bpm, duration, error estimate, flags, Acc: x/y/z, HR: RR intervals, HRV: value).
+// Planar layouts store each of those channels as its own contiguous column instead.
+struct SensorFrameLayout
+{
+	HSLSensorBufferType bufferType;
+	bool bFloatSamples;
+	bool bPlanarSamples;
+	int sampleWidth;
+	int frameValueWidth;
+	size_t frameCount;
+	size_t sampleCount;
+	size_t frameTimesOffset;
+	size_t frameOffsetsOffset;
+	size_t frameValuesOffset;
+	size_t samplesOffset;
+	size_t byteLength;
+};
+
+// Name of one channel of a sample, e.g. "ppgValue0" or "x"
+const char *GetSensorSampleChannelName(HSLSensorBufferType buffer_type, int channel);
+
+bool GetSensorBufferFormat(
+	HSLSensorBufferType buffer_type,
+	int &out_sample_width,
+	int &out_frame_value_width,
+	bool &out_float_samples);
+
+// Size of the HSL frame struct stored in a buffer of the given type, e.g. sizeof(HSLHeartECGFrame)
+size_t GetSensorFrameSize(HSLSensorBufferType buffer_type);
+
+double GetSensorFrameTime(HSLSensorBufferType buffer_type, const void *frame);
+int GetSensorFrameSampleCount(HSLSensorBufferType buffer_type, const void *frame);
+
+// Walks a copy of the iterator to size the packed block.
+// Returns false if the buffer type has no packed format or the counts overflow a block.
+bool MeasureSensorBuffer(SensorBufferIterator iterator, SensorFrameLayout &out_layout, bool planar_samples = false);
+
+// Copies every frame the iterator points at into dest, which must hold layout.byteLength bytes
+void PackSensorBuffer(SensorBufferIterator iterator, const SensorFrameLayout &layout, uint8_t *dest);
+
+// Same as above for HSL frame structs that have already been copied out of HSL
+bool MeasureSensorFrames(
+	HSLSensorBufferType buffer_type,
+	const void *const *frames,
+	size_t frame_count,
+	SensorFrameLayout &out_layout,
+	bool planar_samples = false);
+void PackSensorFrames(const void *const *frames, const SensorFrameLayout &layout, uint8_t *dest);
+
+// Layout of an already packed block with the given frame and sample counts.
+// Returns false for counts whose block size would overflow, callers still have to
+// check the block fits the memory they were given.
+bool ComputeSensorFrameLayout(
+	HSLSensorBufferType buffer_type,
+	size_t frame_count,
+	size_t sample_count,
+	SensorFrameLayout &out_layout,
+	bool planar_samples = false);
+
+// True for streams of evenly spaced waveform samples (ECG, PPG, Acc) that can be decimated.
+// HR, PPI and HRV samples are individual beats and intervals, dropping any of them changes their meaning.
+bool IsSensorWaveformBuffer(HSLSensorBufferType buffer_type);
+
+// Sample rate a waveform stream usually runs at, for when it can't be measured yet
+double GetSensorNominalSampleRate(HSLSensorBufferType buffer_type);
+
+// Layout of a packed block after keeping only the samples i where (phase + i) % step == 0.
+// Frames, frame times and frame values are all kept. Carrying (phase + sampleCount) % step
+// over to the next block keeps the output evenly spaced across blocks.
+void MeasureDecimatedSensorFrames(const SensorFrameLayout &layout, int step, int phase, SensorFrameLayout &out_layout);
+
+// Writes the decimated copy of a packed block, see MeasureDecimatedSensorFrames
+void DecimateSensorFrames(
+	const SensorFrameLayout &layout,
+	const uint8_t *data,
+	int step,
+	int phase,
+	const SensorFrameLayout &out_layout,
+	uint8_t *dest);
+
+// Rebuilds the HSL frame struct for one frame of a packed block.
+// out_frame must hold GetSensorFrameSize(layout.bufferType) bytes.
+bool UnpackSensorFrame(const SensorFrameLayout &layout, const uint8_t *data, size_t frame_index, void *out_frame);
+
+// Frames only carry the time of their last sample. Spreads the other samples of a frame back
+// from it, using the sample period measured across frames. Gaps in the stream don't count
+// towards the period.
+class SensorSampleClock
+{
+public:
+	SensorSampleClock();
+
+	double GetSamplePeriod() const { return m_samplePeriod; } // 0 until two frames have been seen
+	double GetFrameTime() const { return m_frameTime; }
+
+	// Call once per frame, in time order, before asking for the times of its samples
+	void AddFrame(double frame_time, size_t sample_count);
+
+	// Time of one sample of the frame added last
+	double GetSampleTime(size_t sample_index) const
+	{
+		return m_frameTime - (double)(m_frameSampleCount - 1 - sample_index) * m_samplePeriod;
+	}
+
+	void Reset();
+
+private:
+	double m_samplePeriod;
+	double m_frameTime;
+	size_t m_frameSampleCount;
+};
+
+// A packed sensor buffer staged in native memory, e.g. by the background poller,
+// until the JS thread is ready to take ownership of it
+class SensorFrameBatch
+{
+public:
+	SensorFrameBatch();
+	SensorFrameBatch(SensorFrameBatch &&other);
+	SensorFrameBatch &operator=(SensorFrameBatch &&other);
+	~SensorFrameBatch();
+
+	// Copies and flushes an HSL sensor buffer. Returns false if it held no frames.
+	bool Drain(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		bool planar_samples = false,
+		HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN);
+
+	HSLSensorID GetSensorID() const { return m_sensorID; }
+	HSLHeartRateVariabityFilterType GetHrvFilter() const { return m_hrvFilter; }
+	const SensorFrameLayout &GetLayout() const { return m_layout; }
+	const uint8_t *GetData() const { return m_data; }
+	double GetFrameAgeMs() const { return m_frameAgeMs; } // See PipelineStats::RecordDrain
+	double GetDrainedAt() const { return m_drainedAt; }   // Milliseconds since the epoch, like Date.now()
+
+	// Hands the packed block (allocated with malloc) over to the caller
+	uint8_t *ReleaseData();
+
+private:
+	SensorFrameBatch(const SensorFrameBatch &) = delete;
+	SensorFrameBatch &operator=(const SensorFrameBatch &) = delete;
+
+	HSLSensorID m_sensorID;
+	HSLHeartRateVariabityFilterType m_hrvFilter;
+	SensorFrameLayout m_layout;
+	uint8_t *m_data;
+	double m_frameAgeMs;
+	double m_drainedAt;
+};
+
+#endif // SENSOR_FRAME_BATCH_H
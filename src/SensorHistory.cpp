@@ -0,0 +1,657 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorHistory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+
+// Pending frames are packed into a block once there are this many, or they span this long
+static const size_t k_blockFrames = 64;
+static const double k_blockSeconds = 10.0;
+
+// Frames this much older than the newest one mean the source jumped back in time (e.g. a replay seek),
+// anything less is frame jitter and is kept
+static const double k_maxTimeRewind = 1.0;
+
+// HR streams are aggregated on their beats per minute, everything else on its sample channels
+static int GetAggregateChannelCount(HSLSensorBufferType buffer_type)
+{
+	int sampleWidth = 0;
+	int frameValueWidth = 0;
+	bool floatSamples = false;
+
+	if (buffer_type == HSLBufferType_HRData ||
+		!GetSensorBufferFormat(buffer_type, sampleWidth, frameValueWidth, floatSamples))
+	{
+		return 1;
+	}
+
+	return sampleWidth;
+}
+
+SensorHistorySettings::SensorHistorySettings()
+	: rawSeconds(600.0)
+	, secondBuckets(3600)
+	, minuteBuckets(1440)
+	, maxBytes(64 * 1024 * 1024)
+{
+}
+
+//-- SensorHistoryAggregates -----
+SensorHistoryAggregates::SensorHistoryAggregates(double bucket_seconds, size_t capacity, int channel_count)
+	: m_bucketSeconds(bucket_seconds)
+	, m_channelCount(channel_count)
+{
+	capacity = std::max(capacity, (size_t)1);
+
+	m_startTimes.resize(capacity);
+	m_counts.resize(capacity);
+	m_mean.resize(capacity * channel_count);
+	m_min.resize(capacity * channel_count);
+	m_max.resize(capacity * channel_count);
+	m_openSum.resize(channel_count);
+	m_openMin.resize(channel_count);
+	m_openMax.resize(channel_count);
+
+	Clear();
+}
+
+size_t SensorHistoryAggregates::GetByteSize() const
+{
+	return
+		m_startTimes.size() * (sizeof(double) + sizeof(uint32_t)) +
+		m_mean.size() * sizeof(float) * 3 +
+		m_openSum.size() * (sizeof(double) + sizeof(float) * 2);
+}
+
+double SensorHistoryAggregates::GetOldestTime() const
+{
+	if (m_count > 0)
+	{
+		return m_startTimes[GetSlot(0)];
+	}
+
+	return (m_openCount > 0) ? m_openStartTime : 0.0;
+}
+
+void SensorHistoryAggregates::Clear()
+{
+	m_head = 0;
+	m_count = 0;
+	m_openStartTime = 0.0;
+	m_openCount = 0;
+}
+
+void SensorHistoryAggregates::AddSample(double time, const float *values)
+{
+	const double startTime = std::floor(time / m_bucketSeconds) * m_bucketSeconds;
+
+	// Samples spread back from a frame time can land just before the open bucket,
+	// they are folded into it rather than reopening an older bucket
+	if (m_openCount > 0 && startTime > m_openStartTime)
+	{
+		CloseOpenBucket();
+	}
+
+	if (m_openCount == 0)
+	{
+		m_openStartTime = startTime;
+		for (int channel = 0; channel < m_channelCount; ++channel)
+		{
+			m_openSum[channel] = 0.0;
+			m_openMin[channel] = std::numeric_limits<float>::infinity();
+			m_openMax[channel] = -std::numeric_limits<float>::infinity();
+		}
+	}
+
+	for (int channel = 0; channel < m_channelCount; ++channel)
+	{
+		const float value = values[channel];
+
+		m_openSum[channel] += value;
+		m_openMin[channel] = std::min(m_openMin[channel], value);
+		m_openMax[channel] = std::max(m_openMax[channel], value);
+	}
+	++m_openCount;
+}
+
+void SensorHistoryAggregates::CloseOpenBucket()
+{
+	const size_t slot = m_head;
+	const size_t base = slot * m_channelCount;
+
+	m_startTimes[slot] = m_openStartTime;
+	m_counts[slot] = m_openCount;
+	for (int channel = 0; channel < m_channelCount; ++channel)
+	{
+		m_mean[base + channel] = (float)(m_openSum[channel] / m_openCount);
+		m_min[base + channel] = m_openMin[channel];
+		m_max[base + channel] = m_openMax[channel];
+	}
+
+	m_head = (m_head + 1) % m_startTimes.size();
+	m_count = std::min(m_count + 1, m_startTimes.size());
+	m_openCount = 0;
+}
+
+size_t SensorHistoryAggregates::GetRange(
+	double start_time,
+	double end_time,
+	std::vector<double> &out_start_times,
+	std::vector<uint32_t> &out_counts,
+	std::vector<float> &out_mean,
+	std::vector<float> &out_min,
+	std::vector<float> &out_max) const
+{
+	// First closed bucket ending after start_time, then the first one starting at or after end_time
+	size_t low = 0;
+	size_t high = m_count;
+	while (low < high)
+	{
+		const size_t mid = (low + high) / 2;
+
+		if (m_startTimes[GetSlot(mid)] + m_bucketSeconds <= start_time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	const size_t first = low;
+
+	high = m_count;
+	while (low < high)
+	{
+		const size_t mid = (low + high) / 2;
+
+		if (m_startTimes[GetSlot(mid)] < end_time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	const size_t last = low;
+
+	const bool includeOpen =
+		m_openCount > 0 &&
+		m_openStartTime + m_bucketSeconds > start_time &&
+		m_openStartTime < end_time;
+	const size_t bucketCount = (last - first) + (includeOpen ? 1 : 0);
+
+	out_start_times.resize(bucketCount);
+	out_counts.resize(bucketCount);
+	out_mean.resize(bucketCount * m_channelCount);
+	out_min.resize(bucketCount * m_channelCount);
+	out_max.resize(bucketCount * m_channelCount);
+
+	for (size_t index = first; index < last; ++index)
+	{
+		const size_t bucket = index - first;
+		const size_t slot = GetSlot(index);
+
+		out_start_times[bucket] = m_startTimes[slot];
+		out_counts[bucket] = m_counts[slot];
+		for (int channel = 0; channel < m_channelCount; ++channel)
+		{
+			out_mean[channel * bucketCount + bucket] = m_mean[slot * m_channelCount + channel];
+			out_min[channel * bucketCount + bucket] = m_min[slot * m_channelCount + channel];
+			out_max[channel * bucketCount + bucket] = m_max[slot * m_channelCount + channel];
+		}
+	}
+
+	if (includeOpen)
+	{
+		const size_t bucket = bucketCount - 1;
+
+		out_start_times[bucket] = m_openStartTime;
+		out_counts[bucket] = m_openCount;
+		for (int channel = 0; channel < m_channelCount; ++channel)
+		{
+			out_mean[channel * bucketCount + bucket] = (float)(m_openSum[channel] / m_openCount);
+			out_min[channel * bucketCount + bucket] = m_openMin[channel];
+			out_max[channel * bucketCount + bucket] = m_openMax[channel];
+		}
+	}
+
+	return bucketCount;
+}
+
+//-- SensorHistoryStream -----
+SensorHistoryStream::SensorHistoryStream(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter,
+	const SensorHistorySettings &settings)
+	: m_settings(settings)
+	, m_watcher(sensor_id, buffer_type, hrv_filter)
+	, m_frameSize(GetSensorFrameSize(buffer_type))
+	, m_blockBytes(0)
+	, m_pendingCount(0)
+	, m_seconds(1.0, settings.secondBuckets, GetAggregateChannelCount(buffer_type))
+	, m_minutes(60.0, settings.minuteBuckets, GetAggregateChannelCount(buffer_type))
+{
+}
+
+const SensorHistoryAggregates &SensorHistoryStream::GetAggregates(SensorHistoryResolution resolution) const
+{
+	return (resolution == SensorHistoryResolution_Minute) ? m_minutes : m_seconds;
+}
+
+void SensorHistoryStream::Clear()
+{
+	m_blocks.clear();
+	m_blockBytes = 0;
+	m_pendingFrames.clear();
+	m_pendingCount = 0;
+	m_seconds.Clear();
+	m_minutes.Clear();
+	m_clock.Reset();
+}
+
+void SensorHistoryStream::Update(SensorSource &source)
+{
+	if (m_watcher.CollectNewFrames(source, m_newFrames) == 0)
+	{
+		return;
+	}
+
+	// Time going well backwards means a replayed session was restarted or seeked,
+	// the history no longer lines up with what comes next
+	const double firstTime = GetSensorFrameTime(GetBufferType(), m_newFrames.front());
+	if (GetLatestTime() > 0.0 && firstTime < GetLatestTime() - k_maxTimeRewind)
+	{
+		Clear();
+	}
+
+	AddFrames(m_newFrames);
+	EvictExpiredBlocks();
+}
+
+void SensorHistoryStream::AddFrames(const std::vector<const void *> &frames)
+{
+	const HSLSensorBufferType bufferType = GetBufferType();
+
+	// Raw history, copied as frame structs until there are enough to pack into a block
+	for (const void *frame : frames)
+	{
+		const uint8_t *bytes = static_cast<const uint8_t *>(frame);
+
+		m_pendingFrames.insert(m_pendingFrames.end(), bytes, bytes + m_frameSize);
+		++m_pendingCount;
+
+		const double pendingStart = GetSensorFrameTime(bufferType, m_pendingFrames.data());
+		if (m_pendingCount >= k_blockFrames ||
+			GetSensorFrameTime(bufferType, frame) - pendingStart >= k_blockSeconds)
+		{
+			SealPendingFrames();
+		}
+	}
+
+	// Aggregates, read from an interleaved packed copy so every stream type looks the same
+	SensorFrameLayout layout;
+	if (!MeasureSensorFrames(bufferType, frames.data(), frames.size(), layout))
+	{
+		return;
+	}
+	m_packed.resize(layout.byteLength);
+	PackSensorFrames(frames.data(), layout, m_packed.data());
+
+	const uint8_t *data = m_packed.data();
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	const int32_t *frameValues = reinterpret_cast<const int32_t *>(data + layout.frameValuesOffset);
+	const int32_t *intSamples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	const float *floatSamples = reinterpret_cast<const float *>(data + layout.samplesOffset);
+	const int channelCount = m_seconds.GetChannelCount();
+
+	m_channelValues.resize(channelCount);
+
+	for (size_t frame = 0; frame < layout.frameCount; ++frame)
+	{
+		const double frameTime = frameTimes[frame];
+
+		if (bufferType == HSLBufferType_HRData)
+		{
+			m_clock.AddFrame(frameTime, 0);
+
+			m_channelValues[0] = (float)frameValues[HRFrameValue_BeatsPerMinute * layout.frameCount + frame];
+			m_seconds.AddSample(frameTime, m_channelValues.data());
+			m_minutes.AddSample(frameTime, m_channelValues.data());
+		}
+		else
+		{
+			const size_t firstSample = frameOffsets[frame];
+			const size_t sampleCount = frameOffsets[frame + 1] - firstSample;
+
+			m_clock.AddFrame(frameTime, sampleCount);
+
+			for (size_t sample = 0; sample < sampleCount; ++sample)
+			{
+				const size_t base = (firstSample + sample) * layout.sampleWidth;
+				const double sampleTime = m_clock.GetSampleTime(sample);
+
+				for (int channel = 0; channel < channelCount; ++channel)
+				{
+					m_channelValues[channel] = layout.bFloatSamples
+						? floatSamples[base + channel]
+						: (float)intSamples[base + channel];
+				}
+
+				m_seconds.AddSample(sampleTime, m_channelValues.data());
+				m_minutes.AddSample(sampleTime, m_channelValues.data());
+			}
+		}
+	}
+}
+
+void SensorHistoryStream::SealPendingFrames()
+{
+	if (m_pendingCount == 0)
+	{
+		return;
+	}
+
+	std::vector<const void *> frames(m_pendingCount);
+	for (size_t i = 0; i < m_pendingCount; ++i)
+	{
+		frames[i] = m_pendingFrames.data() + i * m_frameSize;
+	}
+
+	Block block;
+	if (MeasureSensorFrames(GetBufferType(), frames.data(), frames.size(), block.layout))
+	{
+		block.data.resize(block.layout.byteLength);
+		PackSensorFrames(frames.data(), block.layout, block.data.data());
+		block.startTime = GetSensorFrameTime(GetBufferType(), frames.front());
+		block.endTime = GetSensorFrameTime(GetBufferType(), frames.back());
+
+		m_blockBytes += block.data.size();
+		m_blocks.push_back(std::move(block));
+	}
+
+	m_pendingFrames.clear();
+	m_pendingCount = 0;
+}
+
+void SensorHistoryStream::EvictExpiredBlocks()
+{
+	const double oldestKept = GetLatestTime() - m_settings.rawSeconds;
+
+	while (!m_blocks.empty() && m_blocks.front().endTime < oldestKept)
+	{
+		EvictOldestBlock();
+	}
+}
+
+bool SensorHistoryStream::EvictOldestBlock()
+{
+	if (m_blocks.empty())
+	{
+		return false;
+	}
+
+	m_blockBytes -= m_blocks.front().data.size();
+	m_blocks.pop_front();
+
+	return true;
+}
+
+double SensorHistoryStream::GetOldestBlockTime() const
+{
+	return m_blocks.empty() ? std::numeric_limits<double>::infinity() : m_blocks.front().startTime;
+}
+
+double SensorHistoryStream::GetOldestRawTime() const
+{
+	if (!m_blocks.empty())
+	{
+		return m_blocks.front().startTime;
+	}
+
+	return (m_pendingCount > 0) ? GetSensorFrameTime(GetBufferType(), m_pendingFrames.data()) : 0.0;
+}
+
+double SensorHistoryStream::GetOldestTime() const
+{
+	const double oldestRaw = GetOldestRawTime();
+	const double oldestAggregate = m_minutes.GetOldestTime();
+
+	if (oldestAggregate > 0.0 && (oldestRaw == 0.0 || oldestAggregate < oldestRaw))
+	{
+		return oldestAggregate;
+	}
+
+	return oldestRaw;
+}
+
+size_t SensorHistoryStream::GetRawFrameCount() const
+{
+	size_t frameCount = m_pendingCount;
+	for (const Block &block : m_blocks)
+	{
+		frameCount += block.layout.frameCount;
+	}
+
+	return frameCount;
+}
+
+size_t SensorHistoryStream::GetByteSize() const
+{
+	return
+		sizeof(*this) +
+		m_blockBytes + m_blocks.size() * sizeof(Block) +
+		m_pendingFrames.capacity() +
+		m_seconds.GetByteSize() +
+		m_minutes.GetByteSize();
+}
+
+bool SensorHistoryStream::GetRawRange(
+	double start_time,
+	double end_time,
+	SensorFrameLayout &out_layout,
+	std::vector<uint8_t> &out_data,
+	bool planar_samples) const
+{
+	const HSLSensorBufferType bufferType = GetBufferType();
+
+	// Blocks are in time order, so the first one that can overlap is found with a binary search
+	auto firstBlock = std::partition_point(
+		m_blocks.begin(), m_blocks.end(),
+		[start_time](const Block &block) { return block.endTime < start_time; });
+
+	// Frame ranges within each overlapping block, counted first so the unpacked
+	// frames can live in one allocation
+	struct BlockRange
+	{
+		const Block *block;
+		size_t first;
+		size_t last;
+	};
+	std::vector<BlockRange> ranges;
+	size_t unpackedCount = 0;
+
+	for (auto it = firstBlock; it != m_blocks.end() && it->startTime < end_time; ++it)
+	{
+		const double *frameTimes = reinterpret_cast<const double *>(it->data.data() + it->layout.frameTimesOffset);
+		const double *frameTimesEnd = frameTimes + it->layout.frameCount;
+		const size_t first = std::lower_bound(frameTimes, frameTimesEnd, start_time) - frameTimes;
+		const size_t last = std::lower_bound(frameTimes, frameTimesEnd, end_time) - frameTimes;
+
+		if (last > first)
+		{
+			ranges.push_back({ &*it, first, last });
+			unpackedCount += last - first;
+		}
+	}
+
+	std::vector<uint8_t> unpacked(unpackedCount * m_frameSize);
+	std::vector<const void *> frames;
+	frames.reserve(unpackedCount + m_pendingCount);
+
+	for (const BlockRange &range : ranges)
+	{
+		for (size_t frame = range.first; frame < range.last; ++frame)
+		{
+			uint8_t *dest = unpacked.data() + frames.size() * m_frameSize;
+
+			if (UnpackSensorFrame(range.block->layout, range.block->data.data(), frame, dest))
+			{
+				frames.push_back(dest);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < m_pendingCount; ++i)
+	{
+		const uint8_t *frame = m_pendingFrames.data() + i * m_frameSize;
+		const double frameTime = GetSensorFrameTime(bufferType, frame);
+
+		if (frameTime >= start_time && frameTime < end_time)
+		{
+			frames.push_back(frame);
+		}
+	}
+
+	if (!MeasureSensorFrames(bufferType, frames.data(), frames.size(), out_layout, planar_samples))
+	{
+		return false;
+	}
+
+	out_data.resize(out_layout.byteLength);
+	PackSensorFrames(frames.data(), out_layout, out_data.data());
+
+	return true;
+}
+
+//-- SensorHistoryStore -----
+SensorHistoryStore::SensorHistoryStore(const SensorHistorySettings &settings)
+	: m_settings(settings)
+{
+}
+
+void SensorHistoryStore::OnSensorSourceUpdated(SensorSource &source)
+{
+	for (std::unique_ptr<SensorHistoryStream> &stream : m_streams)
+	{
+		stream->Update(source);
+	}
+
+	EnforceBudget();
+}
+
+bool SensorHistoryStore::Track(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	int sampleWidth = 0;
+	int frameValueWidth = 0;
+	bool floatSamples = false;
+	if (!GetSensorBufferFormat(buffer_type, sampleWidth, frameValueWidth, floatSamples))
+	{
+		return false;
+	}
+
+	if (FindStream(sensor_id, buffer_type, hrv_filter) == nullptr)
+	{
+		m_streams.emplace_back(new SensorHistoryStream(sensor_id, buffer_type, hrv_filter, m_settings));
+	}
+
+	return true;
+}
+
+bool SensorHistoryStore::Untrack(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	const SensorHistoryStream *stream = FindStream(sensor_id, buffer_type, hrv_filter);
+	auto it = std::find_if(
+		m_streams.begin(), m_streams.end(),
+		[stream](const std::unique_ptr<SensorHistoryStream> &other) { return other.get() == stream; });
+
+	if (it == m_streams.end())
+	{
+		return false;
+	}
+
+	m_streams.erase(it);
+
+	return true;
+}
+
+void SensorHistoryStore::Clear()
+{
+	for (std::unique_ptr<SensorHistoryStream> &stream : m_streams)
+	{
+		stream->Clear();
+	}
+}
+
+const SensorHistoryStream *SensorHistoryStore::FindStream(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter) const
+{
+	for (const std::unique_ptr<SensorHistoryStream> &stream : m_streams)
+	{
+		if (stream->GetSensorID() == sensor_id &&
+			stream->GetBufferType() == buffer_type &&
+			(buffer_type != HSLBufferType_HRVData || stream->GetHrvFilter() == hrv_filter))
+		{
+			return stream.get();
+		}
+	}
+
+	return nullptr;
+}
+
+size_t SensorHistoryStore::GetByteSize() const
+{
+	size_t byteSize = sizeof(*this);
+	for (const std::unique_ptr<SensorHistoryStream> &stream : m_streams)
+	{
+		byteSize += stream->GetByteSize();
+	}
+
+	return byteSize;
+}
+
+void SensorHistoryStore::EnforceBudget()
+{
+	// Aggregates are allocated up front, so only raw blocks can be given back.
+	// The globally oldest goes first, whichever stream it belongs to.
+	size_t byteSize = GetByteSize();
+
+	while (byteSize > m_settings.maxBytes)
+	{
+		SensorHistoryStream *oldest = nullptr;
+		for (std::unique_ptr<SensorHistoryStream> &stream : m_streams)
+		{
+			if (oldest == nullptr || stream->GetOldestBlockTime() < oldest->GetOldestBlockTime())
+			{
+				oldest = stream.get();
+			}
+		}
+
+		const size_t before = (oldest != nullptr) ? oldest->GetByteSize() : 0;
+		if (oldest == nullptr || !oldest->EvictOldestBlock())
+		{
+			break;
+		}
+
+		byteSize -= before - oldest->GetByteSize();
+	}
+}
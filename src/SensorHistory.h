@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_HISTORY_H
+#define SENSOR_HISTORY_H
+
+#include "SensorFrameBatch.h"
+#include "SensorSource.h"
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+enum SensorHistoryResolution
+{
+	SensorHistoryResolution_Raw,
+	SensorHistoryResolution_Second,
+	SensorHistoryResolution_Minute,
+
+	SensorHistoryResolution_COUNT
+};
+
+struct SensorHistorySettings
+{
+	SensorHistorySettings();
+
+	double rawSeconds;    // How long raw frames are kept
+	size_t secondBuckets; // Per second aggregates kept, one hour by default
+	size_t minuteBuckets; // Per minute aggregates kept, one day by default
+	size_t maxBytes;      // Budget for everything the store holds, oldest raw blocks go first
+};
+
+// Aggregates of one time bucket width for every channel of a stream, in a fixed size ring
+// allocated up front. Bucket start times are whole multiples of the width, so they only
+// ever increase and a range is found with a binary search.
+class SensorHistoryAggregates
+{
+public:
+	SensorHistoryAggregates(double bucket_seconds, size_t capacity, int channel_count);
+
+	double GetBucketSeconds() const { return m_bucketSeconds; }
+	int GetChannelCount() const { return m_channelCount; }
+	size_t GetBucketCount() const { return m_count + (m_openCount > 0 ? 1 : 0); }
+	size_t GetByteSize() const;
+	double GetOldestTime() const; // Start of the oldest bucket, 0 if there is none
+
+	// values holds one value per channel
+	void AddSample(double time, const float *values);
+	void Clear();
+
+	// Buckets overlapping [start_time, end_time), including the one still open.
+	// Channel columns are planar: out_mean[channel * bucket_count + bucket].
+	size_t GetRange(
+		double start_time,
+		double end_time,
+		std::vector<double> &out_start_times,
+		std::vector<uint32_t> &out_counts,
+		std::vector<float> &out_mean,
+		std::vector<float> &out_min,
+		std::vector<float> &out_max) const;
+
+private:
+	void CloseOpenBucket();
+	size_t GetSlot(size_t age_index) const { return (m_head + m_startTimes.size() - m_count + age_index) % m_startTimes.size(); }
+
+	const double m_bucketSeconds;
+	const int m_channelCount;
+
+	std::vector<double> m_startTimes;
+	std::vector<uint32_t> m_counts;
+	std::vector<float> m_mean; // [slot * channel_count + channel]
+	std::vector<float> m_min;
+	std::vector<float> m_max;
+	size_t m_head; // Next slot to write
+	size_t m_count;
+
+	double m_openStartTime;
+	uint32_t m_openCount;
+	std::vector<double> m_openSum;
+	std::vector<float> m_openMin;
+	std::vector<float> m_openMax;
+};
+
+// History of one sensor stream: raw frames for the recent window, packed into blocks
+// indexed by time, plus per second and per minute aggregates reaching further back
+class SensorHistoryStream
+{
+public:
+	SensorHistoryStream(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter,
+		const SensorHistorySettings &settings);
+
+	HSLSensorID GetSensorID() const { return m_watcher.GetSensorID(); }
+	HSLSensorBufferType GetBufferType() const { return m_watcher.GetBufferType(); }
+	HSLHeartRateVariabityFilterType GetHrvFilter() const { return m_watcher.GetHrvFilter(); }
+	const SensorHistoryAggregates &GetAggregates(SensorHistoryResolution resolution) const;
+
+	void Update(SensorSource &source);
+	void Clear();
+
+	double GetOldestTime() const;
+	double GetOldestRawTime() const;
+	double GetLatestTime() const { return m_clock.GetFrameTime(); }
+	size_t GetRawFrameCount() const;
+	size_t GetByteSize() const;
+
+	// Start time of the oldest sealed raw block, or infinity if there is none
+	double GetOldestBlockTime() const;
+	// Drops the oldest sealed raw block, returns false if there is none
+	bool EvictOldestBlock();
+
+	// Frames with a time in [start_time, end_time) as a packed block
+	bool GetRawRange(
+		double start_time,
+		double end_time,
+		SensorFrameLayout &out_layout,
+		std::vector<uint8_t> &out_data,
+		bool planar_samples = false) const;
+
+private:
+	struct Block
+	{
+		double startTime; // Time of the first frame
+		double endTime;   // Time of the last frame
+		SensorFrameLayout layout;
+		std::vector<uint8_t> data;
+	};
+
+	void AddFrames(const std::vector<const void *> &frames);
+	void SealPendingFrames();
+	void EvictExpiredBlocks();
+
+	const SensorHistorySettings m_settings;
+	SensorBufferWatcher m_watcher;
+	const size_t m_frameSize;
+
+	std::deque<Block> m_blocks;
+	size_t m_blockBytes;
+
+	// Frames copied since the last sealed block, as HSL frame structs
+	std::vector<uint8_t> m_pendingFrames;
+	size_t m_pendingCount;
+
+	SensorHistoryAggregates m_seconds;
+	SensorHistoryAggregates m_minutes;
+
+	SensorSampleClock m_clock;
+
+	// Scratch
+	std::vector<const void *> m_newFrames;
+	std::vector<uint8_t> m_packed;
+	std::vector<float> m_channelValues;
+};
+
+// Rolling history of any number of sensor streams under one memory budget.
+// Attached as a SensorSourceListener; it watches the buffers without flushing them.
+class SensorHistoryStore : public SensorSourceListener
+{
+public:
+	SensorHistoryStore(const SensorHistorySettings &settings);
+
+	const SensorHistorySettings &GetSettings() const { return m_settings; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	// Starts recording a stream, returns false if it has no packed format
+	bool Track(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, HSLHeartRateVariabityFilterType hrv_filter);
+	bool Untrack(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, HSLHeartRateVariabityFilterType hrv_filter);
+	void Clear();
+
+	const SensorHistoryStream *FindStream(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) const;
+	const std::vector<std::unique_ptr<SensorHistoryStream>> &GetStreams() const { return m_streams; }
+
+	size_t GetByteSize() const;
+
+private:
+	void EnforceBudget();
+
+	const SensorHistorySettings m_settings;
+	std::vector<std::unique_ptr<SensorHistoryStream>> m_streams;
+};
+
+#endif // SENSOR_HISTORY_H
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorPoller.h"
+#include "HSLLock.h"
+#include "SensorAlertEngine.h"
+#include "SensorSource.h"
+#include "SensorStreamRing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+// HRV buffers are drained per filter type instead, see hrvFilterMask
+static const HSLSensorBufferType k_polledBufferTypes[] = {
+	HSLBufferType_HRData,
+	HSLBufferType_ECGData,
+	HSLBufferType_PPGData,
+	HSLBufferType_PPIData,
+	HSLBufferType_AccData
+};
+
+SensorPollerSettings::SensorPollerSettings()
+	: updateIntervalMs(10)
+	, idleIntervalMs(250)
+	, bufferTypeMask(
+		(1 << HSLBufferType_HRData) |
+		(1 << HSLBufferType_ECGData) |
+		(1 << HSLBufferType_PPGData) |
+		(1 << HSLBufferType_PPIData) |
+		(1 << HSLBufferType_AccData))
+	, hrvFilterMask(0)
+	, bPlanarSamples(false)
+{
+}
+
+SensorPoller::SensorPoller()
+	: m_bStopRequested(false)
+	, m_bResultsNotified(false)
+	, m_alertSequence(0)
+{
+	memset(&m_sensorList, 0, sizeof(m_sensorList));
+}
+
+SensorPoller::~SensorPoller()
+{
+	Stop();
+}
+
+bool SensorPoller::Start(const SensorPollerSettings &settings, ResultsPendingCallback callback)
+{
+	if (IsRunning())
+	{
+		return false;
+	}
+
+	m_settings = settings;
+	m_resultsPendingCallback = callback;
+	m_bStopRequested = false;
+
+	// Results a previous run left untaken go out with the first tick, which always notifies
+	{
+		std::lock_guard<std::mutex> lock(m_resultsMutex);
+		m_bResultsNotified = false;
+	}
+
+	m_alertSequence = GetSensorAlertSequence();
+	m_thread = std::thread(&SensorPoller::ThreadFunc, this);
+
+	return true;
+}
+
+void SensorPoller::Stop()
+{
+	if (!IsRunning())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		m_bStopRequested = true;
+	}
+	m_wakeCondition.notify_all();
+	m_thread.join();
+
+	// Held batches were already flushed out of HSL, so they are handed over rather than dropped
+	bool bNotify = false;
+	{
+		std::lock_guard<std::mutex> lock(m_resultsMutex);
+
+		for (auto &entry : m_heldStreams)
+		{
+			for (SensorFrameBatch &batch : entry.second.batches)
+			{
+				m_pendingResults.batches.push_back(std::move(batch));
+			}
+			entry.second.batches.clear();
+		}
+
+		bNotify = !m_pendingResults.batches.empty() && !m_bResultsNotified;
+		m_bResultsNotified |= bNotify;
+	}
+
+	if (bNotify && m_resultsPendingCallback)
+	{
+		m_resultsPendingCallback();
+	}
+
+	m_resultsPendingCallback = nullptr;
+}
+
+void SensorPoller::TakeResults(SensorPollerResults &out_results)
+{
+	std::lock_guard<std::mutex> lock(m_resultsMutex);
+
+	out_results = std::move(m_pendingResults);
+	m_pendingResults = SensorPollerResults();
+	m_bResultsNotified = false;
+}
+
+void SensorPoller::ThreadFunc()
+{
+	// Always report the sensor list on the first tick
+	bool bSensorListChanged = true;
+
+	std::unique_lock<std::mutex> threadLock(m_threadMutex);
+	while (!m_bStopRequested)
+	{
+		const auto tickStart = std::chrono::steady_clock::now();
+		threadLock.unlock();
+
+		std::vector<SensorFrameBatch> drained;
+		PollSensors(drained, bSensorListChanged);
+
+		// A sensor list change is worth a wakeup anyway, so everything held goes along with it
+		std::vector<SensorFrameBatch> batches;
+		HoldBatches(drained, bSensorListChanged, batches);
+
+		// Alerts are rare and wanted right away, so any new one is worth a wakeup too
+		const uint64_t alertSequence = GetSensorAlertSequence();
+		const bool bAlertsQueued = (alertSequence != m_alertSequence);
+		m_alertSequence = alertSequence;
+
+		if (!batches.empty() || bSensorListChanged || bAlertsQueued)
+		{
+			bool bNotify = false;
+
+			{
+				std::lock_guard<std::mutex> lock(m_resultsMutex);
+
+				for (SensorFrameBatch &batch : batches)
+				{
+					m_pendingResults.batches.push_back(std::move(batch));
+				}
+				m_pendingResults.bSensorListChanged |= bSensorListChanged;
+				m_pendingResults.bAlertsQueued |= bAlertsQueued;
+
+				bNotify = !m_bResultsNotified;
+				m_bResultsNotified = true;
+			}
+
+			if (bNotify && m_resultsPendingCallback)
+			{
+				m_resultsPendingCallback();
+			}
+
+			bSensorListChanged = false;
+		}
+
+		const int intervalMs = (m_sensorList.count > 0) ? m_settings.updateIntervalMs : m_settings.idleIntervalMs;
+
+		threadLock.lock();
+		m_wakeCondition.wait_until(
+			threadLock,
+			tickStart + std::chrono::milliseconds(intervalMs),
+			[this] { return m_bStopRequested; });
+	}
+}
+
+void SensorPoller::PollSensors(std::vector<SensorFrameBatch> &out_batches, bool &out_sensor_list_changed)
+{
+	HSLScopedLock hsl_lock;
+
+	UpdateSensorSource(true);
+
+	SensorSource &source = GetSensorSource();
+	if (HasSensorSourceListChanged() || out_sensor_list_changed)
+	{
+		source.GetSensorList(&m_sensorList);
+		out_sensor_list_changed = true;
+	}
+
+	// Streams with a StreamRing attached are flushed into their ring first,
+	// so they never show up in the polled batches
+	GetSensorStreamRingRegistry().IngestAll();
+
+	for (int list_index = 0; list_index < m_sensorList.count; ++list_index)
+	{
+		const HSLSensorID sensor_id = m_sensorList.sensors[list_index].sensorID;
+
+		for (HSLSensorBufferType buffer_type : k_polledBufferTypes)
+		{
+			if ((m_settings.bufferTypeMask & (1 << buffer_type)) == 0)
+				continue;
+
+			SensorFrameBatch batch;
+			if (batch.Drain(sensor_id, buffer_type, m_settings.bPlanarSamples))
+			{
+				out_batches.push_back(std::move(batch));
+			}
+		}
+
+		for (int filter_type = 0; filter_type < HRVFilter_COUNT; ++filter_type)
+		{
+			if (!HSL_BITMASK_GET_FLAG(m_settings.hrvFilterMask, filter_type))
+				continue;
+
+			SensorFrameBatch batch;
+			if (batch.Drain(sensor_id, HSLBufferType_HRVData, false, (HSLHeartRateVariabityFilterType)filter_type))
+			{
+				out_batches.push_back(std::move(batch));
+			}
+		}
+	}
+}
+
+void SensorPoller::HoldBatches(
+	std::vector<SensorFrameBatch> &batches,
+	bool release_all,
+	std::vector<SensorFrameBatch> &out_ready)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	for (SensorFrameBatch &batch : batches)
+	{
+		const SensorFrameLayout &layout = batch.GetLayout();
+		const uint64_t key =
+			((uint64_t)(uint32_t)batch.GetSensorID() << 32) |
+			((uint64_t)layout.bufferType << 8) |
+			(uint64_t)batch.GetHrvFilter();
+		HeldStream &held = m_heldStreams[key];
+
+		if (held.batches.empty())
+		{
+			held.sampleCount = 0;
+			held.firstDrainTime = now;
+		}
+
+		held.sampleCount += (layout.bufferType == HSLBufferType_HRData) ? layout.frameCount : layout.sampleCount;
+		held.batches.push_back(std::move(batch));
+	}
+
+	for (auto &entry : m_heldStreams)
+	{
+		HeldStream &held = entry.second;
+		if (held.batches.empty())
+			continue;
+
+		const SensorPollerThreshold &threshold = m_settings.thresholds[held.batches.front().GetLayout().bufferType];
+		const bool bReady =
+			release_all ||
+			held.sampleCount >= (size_t)std::max(threshold.minSamples, 0) ||
+			(threshold.maxAgeMs > 0 && now - held.firstDrainTime >= std::chrono::milliseconds(threshold.maxAgeMs));
+
+		if (bReady)
+		{
+			for (SensorFrameBatch &batch : held.batches)
+			{
+				out_ready.push_back(std::move(batch));
+			}
+			held.batches.clear();
+		}
+	}
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_POLLER_H
+#define SENSOR_POLLER_H
+
+#include "HSLClient_CAPI.h"
+#include "SensorFrameBatch.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// When a stream's drained batches are handed to the JS thread. Until then they are held
+// natively, so bulk streams can coalesce into fewer wakeups while latency sensitive ones
+// go out on the tick they arrive.
+struct SensorPollerThreshold
+{
+	int minSamples; // Hand over once this many samples are held (frames for HR streams)
+	int maxAgeMs;   // ... or once the oldest held batch is this old, 0 for no age limit
+
+	SensorPollerThreshold() : minSamples(1), maxAgeMs(0) {}
+};
+
+struct SensorPollerSettings
+{
+	int updateIntervalMs;
+	int idleIntervalMs; // Used instead while no sensors are connected
+	unsigned int bufferTypeMask; // One bit per HSLSensorBufferType to drain (HRV excluded)
+	t_hrv_filter_bitmask hrvFilterMask; // One bit per HRV filter buffer to drain
+	bool bPlanarSamples;
+	SensorPollerThreshold thresholds[HSLBufferType_COUNT];
+
+	SensorPollerSettings();
+};
+
+// Everything the poller thread has drained since the JS thread last took results
+struct SensorPollerResults
+{
+	std::vector<SensorFrameBatch> batches;
+	bool bSensorListChanged;
+	bool bAlertsQueued; // Some SensorAlertEngine queued events, see GetSensorAlertSequence
+
+	SensorPollerResults() : bSensorListChanged(false), bAlertsQueued(false) {}
+};
+
+// Owns the HSL_Update() loop on a background thread and stages drained sensor
+// buffers in native memory until the JS thread collects them with TakeResults().
+// The JS thread is only woken when a stream crosses its threshold, the sensor list changes
+// or an alert is raised or cleared.
+class SensorPoller
+{
+public:
+	// Called on the poller thread when results become pending. It is not called
+	// again until TakeResults() has collected them, so the JS side sees one
+	// notification per batch of results no matter how far behind it falls.
+	typedef std::function<void()> ResultsPendingCallback;
+
+	SensorPoller();
+	~SensorPoller();
+
+	bool Start(const SensorPollerSettings &settings, ResultsPendingCallback callback);
+
+	// Moves every batch still held below its threshold into the pending results and notifies
+	// one last time, so nothing drained from HSL is lost
+	void Stop();
+	bool IsRunning() const { return m_thread.joinable(); }
+
+	void TakeResults(SensorPollerResults &out_results);
+
+private:
+	// Batches of one sensor stream drained but not yet handed over
+	struct HeldStream
+	{
+		std::vector<SensorFrameBatch> batches;
+		size_t sampleCount;
+		std::chrono::steady_clock::time_point firstDrainTime;
+	};
+
+	void ThreadFunc();
+	void PollSensors(std::vector<SensorFrameBatch> &out_batches, bool &out_sensor_list_changed);
+
+	// Holds the new batches and moves every stream past its threshold into out_ready
+	void HoldBatches(
+		std::vector<SensorFrameBatch> &batches,
+		bool release_all,
+		std::vector<SensorFrameBatch> &out_ready);
+
+	SensorPollerSettings m_settings;
+	ResultsPendingCallback m_resultsPendingCallback;
+
+	std::thread m_thread;
+	std::mutex m_threadMutex;
+	std::condition_variable m_wakeCondition;
+	bool m_bStopRequested;
+
+	std::mutex m_resultsMutex;
+	SensorPollerResults m_pendingResults;
+	bool m_bResultsNotified;
+
+	// Only touched by the poller thread
+	HSLSensorList m_sensorList;
+	uint64_t m_alertSequence;
+	std::map<uint64_t, HeldStream> m_heldStreams; // Keyed by sensor id, buffer type and HRV filter
+};
+
+#endif // SENSOR_POLLER_H
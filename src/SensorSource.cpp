@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorSource.h"
+#include "SensorFrameBatch.h"
+#include "PipelineStats.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+//-- SensorBufferIterator -----
+bool IsSensorBufferIteratorValid(SensorBufferIterator &iterator)
+{
+	if (iterator.bSourceFrames)
+	{
+		return iterator.frameIndex < iterator.frameCount;
+	}
+
+	return HSL_IsBufferIteratorValid(&iterator.hslIterator);
+}
+
+bool SensorBufferIteratorNext(SensorBufferIterator &iterator)
+{
+	if (iterator.bSourceFrames)
+	{
+		if (iterator.frameIndex < iterator.frameCount)
+		{
+			iterator.frameIndex++;
+		}
+
+		return iterator.frameIndex < iterator.frameCount;
+	}
+
+	return HSL_BufferIteratorNext(&iterator.hslIterator);
+}
+
+const void *GetSensorBufferFrame(SensorBufferIterator &iterator)
+{
+	if (iterator.bSourceFrames)
+	{
+		if (iterator.frameIndex >= iterator.frameCount)
+		{
+			return nullptr;
+		}
+
+		return iterator.frames + iterator.frameIndex * GetSensorFrameSize(iterator.bufferType);
+	}
+
+	HSLBufferIterator &hslIterator = iterator.hslIterator;
+	switch (iterator.bufferType)
+	{
+	case HSLBufferType_HRData:
+		return HSL_BufferIteratorGetHRData(&hslIterator);
+	case HSLBufferType_ECGData:
+		return HSL_BufferIteratorGetECGData(&hslIterator);
+	case HSLBufferType_PPGData:
+		return HSL_BufferIteratorGetPPGData(&hslIterator);
+	case HSLBufferType_PPIData:
+		return HSL_BufferIteratorGetPPIData(&hslIterator);
+	case HSLBufferType_AccData:
+		return HSL_BufferIteratorGetAccData(&hslIterator);
+	case HSLBufferType_HRVData:
+		return HSL_BufferIteratorGetHRVData(&hslIterator);
+	default:
+		return nullptr;
+	}
+}
+
+const void *GetSensorBufferFrame(SensorBufferIterator &iterator, HSLSensorBufferType buffer_type)
+{
+	return (iterator.bufferType == buffer_type) ? GetSensorBufferFrame(iterator) : nullptr;
+}
+
+//-- HSLSensorSource -----
+bool HSLSensorSource::Update(bool poll_events)
+{
+	return poll_events ? HSL_Update() : HSL_UpdateNoPollEvents();
+}
+
+bool HSLSensorSource::HasSensorListChanged()
+{
+	return HSL_HasSensorListChanged();
+}
+
+bool HSLSensorSource::PollNextMessage(HSLEventMessage *out_message)
+{
+	return HSL_PollNextMessage(out_message);
+}
+
+bool HSLSensorSource::GetSensorList(HSLSensorList *out_sensor_list)
+{
+	return HSL_GetSensorList(out_sensor_list);
+}
+
+HSLSensor *HSLSensorSource::GetSensor(HSLSensorID sensor_id)
+{
+	return HSL_GetSensor(sensor_id);
+}
+
+bool HSLSensorSource::SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags)
+{
+	return HSL_SetActiveSensorDataStreams(sensor_id, data_stream_flags);
+}
+
+bool HSLSensorSource::SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask)
+{
+	return HSL_SetActiveSensorFilterStreams(sensor_id, filter_stream_bitmask);
+}
+
+bool HSLSensorSource::StopAllSensorStreams(HSLSensorID sensor_id)
+{
+	return HSL_StopAllSensorStreams(sensor_id);
+}
+
+SensorBufferIterator HSLSensorSource::GetSensorBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	SensorBufferIterator iterator;
+	memset(&iterator, 0, sizeof(iterator));
+	iterator.bufferType = buffer_type;
+
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		iterator.hslIterator = HSL_GetHeartRateBuffer(sensor_id);
+		break;
+	case HSLBufferType_ECGData:
+		iterator.hslIterator = HSL_GetHeartECGBuffer(sensor_id);
+		break;
+	case HSLBufferType_PPGData:
+		iterator.hslIterator = HSL_GetHeartPPGBuffer(sensor_id);
+		break;
+	case HSLBufferType_PPIData:
+		iterator.hslIterator = HSL_GetHeartPPIBuffer(sensor_id);
+		break;
+	case HSLBufferType_AccData:
+		iterator.hslIterator = HSL_GetHeartAccBuffer(sensor_id);
+		break;
+	case HSLBufferType_HRVData:
+		iterator.hslIterator = HSL_GetHeartHrvBuffer(sensor_id, hrv_filter);
+		break;
+	default:
+		// Nothing to iterate
+		iterator.bSourceFrames = true;
+		break;
+	}
+
+	return iterator;
+}
+
+bool HSLSensorSource::FlushSensorBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	switch (buffer_type)
+	{
+	case HSLBufferType_HRData:
+		return HSL_FlushHeartRateBuffer(sensor_id);
+	case HSLBufferType_ECGData:
+		return HSL_FlushHeartECGBuffer(sensor_id);
+	case HSLBufferType_PPGData:
+		return HSL_FlushHeartPPGBuffer(sensor_id);
+	case HSLBufferType_PPIData:
+		return HSL_FlushHeartPPIBuffer(sensor_id);
+	case HSLBufferType_AccData:
+		return HSL_FlushHeartAccBuffer(sensor_id);
+	case HSLBufferType_HRVData:
+		return HSL_FlushHeartHrvBuffer(sensor_id, hrv_filter);
+	default:
+		return false;
+	}
+}
+
+//-- SensorBufferWatcher -----
+SensorBufferWatcher::SensorBufferWatcher(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+	: m_sensorID(sensor_id)
+	, m_bufferType(buffer_type)
+	, m_hrvFilter(hrv_filter)
+{
+}
+
+size_t SensorBufferWatcher::CollectNewFrames(SensorSource &source, std::vector<const void *> &out_frames)
+{
+	const size_t frameSize = GetSensorFrameSize(m_bufferType);
+
+	out_frames.clear();
+	m_bufferFrames.clear();
+
+	SensorBufferIterator iter = source.GetSensorBuffer(m_sensorID, m_bufferType, m_hrvFilter);
+	for (; IsSensorBufferIteratorValid(iter); SensorBufferIteratorNext(iter))
+	{
+		const void *frame = GetSensorBufferFrame(iter);
+		if (frame != nullptr)
+		{
+			m_bufferFrames.push_back(frame);
+		}
+	}
+
+	if (m_bufferFrames.empty() || frameSize == 0)
+	{
+		return 0;
+	}
+
+	// Buffers keep their frames until someone flushes them, so skip everything up to
+	// and including the newest frame seen last time. If it is gone the buffer was
+	// flushed (or wrapped) since, and every frame in it is new.
+	size_t firstNewFrame = 0;
+	if (!m_lastFrame.empty())
+	{
+		for (size_t index = m_bufferFrames.size(); index-- > 0;)
+		{
+			if (memcmp(m_bufferFrames[index], m_lastFrame.data(), frameSize) == 0)
+			{
+				firstNewFrame = index + 1;
+				break;
+			}
+		}
+	}
+
+	out_frames.assign(m_bufferFrames.begin() + firstNewFrame, m_bufferFrames.end());
+
+	if (!out_frames.empty())
+	{
+		const uint8_t *newestFrame = static_cast<const uint8_t *>(out_frames.back());
+		m_lastFrame.assign(newestFrame, newestFrame + frameSize);
+	}
+
+	return out_frames.size();
+}
+
+void SensorBufferWatcher::Reset()
+{
+	m_lastFrame.clear();
+}
+
+//-- Active source -----
+static HSLSensorSource g_hslSensorSource;
+static std::shared_ptr<SensorSource> g_activeSensorSource;
+static std::vector<std::shared_ptr<SensorSourceListener>> g_sensorSourceListeners;
+static bool g_bSensorSourceSwitched = false;
+static bool g_bSensorListChangedBySwitch = false;
+static uint64_t g_sensorSourceGeneration = 0;
+
+SensorSource &GetSensorSource()
+{
+	if (g_activeSensorSource)
+	{
+		return *g_activeSensorSource;
+	}
+
+	return g_hslSensorSource;
+}
+
+void SetSensorSource(std::shared_ptr<SensorSource> source)
+{
+	if (source != g_activeSensorSource)
+	{
+		g_activeSensorSource = source;
+		g_bSensorSourceSwitched = true;
+		++g_sensorSourceGeneration;
+	}
+}
+
+uint64_t GetSensorSourceGeneration()
+{
+	return g_sensorSourceGeneration;
+}
+
+bool IsUsingHSLSensorSource()
+{
+	return !g_activeSensorSource;
+}
+
+void AddSensorSourceListener(std::shared_ptr<SensorSourceListener> listener)
+{
+	if (std::find(g_sensorSourceListeners.begin(), g_sensorSourceListeners.end(), listener) == g_sensorSourceListeners.end())
+	{
+		g_sensorSourceListeners.push_back(listener);
+	}
+}
+
+void RemoveSensorSourceListener(std::shared_ptr<SensorSourceListener> listener)
+{
+	g_sensorSourceListeners.erase(
+		std::remove(g_sensorSourceListeners.begin(), g_sensorSourceListeners.end(), listener),
+		g_sensorSourceListeners.end());
+}
+
+bool UpdateSensorSource(bool poll_events)
+{
+	SensorSource &source = GetSensorSource();
+	bool bSuccess;
+	{
+		PipelineScopedTimer timer(PipelineTiming_SourceUpdate);
+		bSuccess = source.Update(poll_events);
+	}
+
+	// Everyone holding on to sensor ids from the previous source needs to refresh
+	g_bSensorListChangedBySwitch = g_bSensorSourceSwitched;
+	g_bSensorSourceSwitched = false;
+
+	PipelineScopedTimer timer(PipelineTiming_Listeners);
+
+	// Copy in case a listener removes itself
+	std::vector<std::shared_ptr<SensorSourceListener>> listeners = g_sensorSourceListeners;
+	for (const std::shared_ptr<SensorSourceListener> &listener : listeners)
+	{
+		listener->OnSensorSourceUpdated(source);
+	}
+
+	return bSuccess;
+}
+
+bool HasSensorSourceListChanged()
+{
+	return GetSensorSource().HasSensorListChanged() || g_bSensorListChangedBySwitch;
+}
+
+SensorBufferIterator GetSensorBufferIterator(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	return GetSensorSource().GetSensorBuffer(sensor_id, buffer_type, hrv_filter);
+}
+
+bool FlushSensorBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	return GetSensorSource().FlushSensorBuffer(sensor_id, buffer_type, hrv_filter);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_SOURCE_H
+#define SENSOR_SOURCE_H
+
+#include "HSLClient_CAPI.h"
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Iterator over one sensor buffer of whichever SensorSource is active.
+// Live HSL buffers are walked with the HSL iterator, other sources hand out
+// frames they have already copied into memory as contiguous HSL frame structs.
+struct SensorBufferIterator
+{
+	HSLSensorBufferType bufferType;
+	HSLBufferIterator hslIterator;
+	bool bSourceFrames;
+	const uint8_t *frames; // frameCount frames of GetSensorFrameSize(bufferType) bytes
+	size_t frameCount;
+	size_t frameIndex;
+};
+
+bool IsSensorBufferIteratorValid(SensorBufferIterator &iterator);
+bool SensorBufferIteratorNext(SensorBufferIterator &iterator);
+
+// The HSL frame struct the iterator currently points at, or nullptr
+const void *GetSensorBufferFrame(SensorBufferIterator &iterator);
+
+// Same as above, but also nullptr unless the iterator walks a buffer of the given type
+const void *GetSensorBufferFrame(SensorBufferIterator &iterator, HSLSensorBufferType buffer_type);
+
+// Where sensor lists, sensor state and sensor buffers come from: the HSL service by
+// default, or a stand in such as a recorded session being replayed.
+// Everything is called with the HSL lock held.
+class SensorSource
+{
+public:
+	virtual ~SensorSource() {}
+
+	virtual bool Update(bool poll_events) = 0;
+	virtual bool HasSensorListChanged() = 0;
+	virtual bool PollNextMessage(HSLEventMessage *out_message) = 0;
+
+	virtual bool GetSensorList(HSLSensorList *out_sensor_list) = 0;
+	virtual HSLSensor *GetSensor(HSLSensorID sensor_id) = 0;
+	virtual bool SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags) = 0;
+	virtual bool SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask) = 0;
+	virtual bool StopAllSensorStreams(HSLSensorID sensor_id) = 0;
+
+	virtual SensorBufferIterator GetSensorBuffer(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) = 0;
+	virtual bool FlushSensorBuffer(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) = 0;
+};
+
+// Straight pass through to the HSL client API
+class HSLSensorSource : public SensorSource
+{
+public:
+	bool Update(bool poll_events) override;
+	bool HasSensorListChanged() override;
+	bool PollNextMessage(HSLEventMessage *out_message) override;
+
+	bool GetSensorList(HSLSensorList *out_sensor_list) override;
+	HSLSensor *GetSensor(HSLSensorID sensor_id) override;
+	bool SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags) override;
+	bool SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask) override;
+	bool StopAllSensorStreams(HSLSensorID sensor_id) override;
+
+	SensorBufferIterator GetSensorBuffer(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) override;
+	bool FlushSensorBuffer(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) override;
+};
+
+// Told about every update of the active source, right after new frames land in its buffers
+class SensorSourceListener
+{
+public:
+	virtual ~SensorSourceListener() {}
+
+	virtual void OnSensorSourceUpdated(SensorSource &source) = 0;
+};
+
+// Finds the frames that landed in one sensor buffer since the last look, without flushing it.
+// Meant to be called from a SensorSourceListener, before anything else drains the buffer.
+class SensorBufferWatcher
+{
+public:
+	SensorBufferWatcher(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN);
+
+	HSLSensorID GetSensorID() const { return m_sensorID; }
+	HSLSensorBufferType GetBufferType() const { return m_bufferType; }
+	HSLHeartRateVariabityFilterType GetHrvFilter() const { return m_hrvFilter; }
+
+	// Fills out_frames with the new frames, oldest first. The pointers stay valid
+	// until the source is updated or the buffer is flushed.
+	size_t CollectNewFrames(SensorSource &source, std::vector<const void *> &out_frames);
+
+	// Forget the last frame seen, everything in the buffer counts as new again
+	void Reset();
+
+private:
+	HSLSensorID m_sensorID;
+	HSLSensorBufferType m_bufferType;
+	HSLHeartRateVariabityFilterType m_hrvFilter;
+	std::vector<uint8_t> m_lastFrame; // Copy of the newest frame seen last time
+	std::vector<const void *> m_bufferFrames;
+};
+
+// The active source. Switching sources reports a sensor list change on the next update.
+SensorSource &GetSensorSource();
+void SetSensorSource(std::shared_ptr<SensorSource> source); // nullptr switches back to HSL
+bool IsUsingHSLSensorSource();
+
+// Bumped on every source switch. Sensor ids of one source say nothing about the sensors of another.
+uint64_t GetSensorSourceGeneration();
+
+void AddSensorSourceListener(std::shared_ptr<SensorSourceListener> listener);
+void RemoveSensorSourceListener(std::shared_ptr<SensorSourceListener> listener);
+
+// Updates the active source and then notifies the listeners
+bool UpdateSensorSource(bool poll_events);
+bool HasSensorSourceListChanged();
+
+SensorBufferIterator GetSensorBufferIterator(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN);
+bool FlushSensorBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN);
+
+#endif // SENSOR_SOURCE_H
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorStreamConfig.h"
+
+#include <algorithm>
+
+SensorStreamConfig::SensorStreamConfig()
+	: mode(SensorStreamConfigMode_Set)
+	, bHasDataStreams(false)
+	, dataStreams(0)
+	, bHasFilterStreams(false)
+	, filterStreams(0)
+{
+}
+
+static unsigned int ApplyStreamMask(SensorStreamConfigMode mode, unsigned int active, unsigned int mask)
+{
+	switch (mode)
+	{
+	case SensorStreamConfigMode_Enable:
+		return active | mask;
+	case SensorStreamConfigMode_Disable:
+		return active & ~mask;
+	default:
+		return mask;
+	}
+}
+
+void ApplySensorStreamConfigMasks(
+	const SensorStreamConfig &config,
+	t_hsl_stream_bitmask &in_out_data_streams,
+	t_hrv_filter_bitmask &in_out_filter_streams)
+{
+	if (config.bHasDataStreams)
+	{
+		in_out_data_streams = ApplyStreamMask(config.mode, in_out_data_streams, config.dataStreams);
+	}
+
+	if (config.bHasFilterStreams)
+	{
+		in_out_filter_streams = ApplyStreamMask(config.mode, in_out_filter_streams, config.filterStreams);
+	}
+}
+
+bool ApplySensorStreamConfig(
+	SensorSource &source,
+	HSLSensorID sensor_id,
+	const SensorStreamConfig &config,
+	SensorStreamConfigResult &out_result)
+{
+	out_result.sensorID = sensor_id;
+	out_result.dataStreams = 0;
+	out_result.filterStreams = 0;
+	out_result.bDataStreamsSet = false;
+	out_result.bFilterStreamsSet = false;
+	out_result.bSuccess = false;
+
+	HSLSensor *sensor = source.GetSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	// Read both up front, a source may clear the filter streams along with the data streams
+	const t_hsl_stream_bitmask activeDataStreams = sensor->activeDataStreams;
+	const t_hrv_filter_bitmask activeFilterStreams = sensor->activeFilterStreams;
+	bool bSuccess = true;
+
+	t_hsl_stream_bitmask dataStreams = activeDataStreams;
+	t_hrv_filter_bitmask filterStreams = activeFilterStreams;
+	ApplySensorStreamConfigMasks(config, dataStreams, filterStreams);
+	dataStreams &= sensor->deviceInformation.capabilities;
+
+	if (config.bHasDataStreams && dataStreams != activeDataStreams)
+	{
+		bSuccess &= source.SetActiveSensorDataStreams(sensor_id, dataStreams);
+		out_result.bDataStreamsSet = true;
+	}
+
+	if (config.bHasFilterStreams && filterStreams != activeFilterStreams)
+	{
+		bSuccess &= source.SetActiveSensorFilterStreams(sensor_id, filterStreams);
+		out_result.bFilterStreamsSet = true;
+	}
+
+	out_result.dataStreams = config.bHasDataStreams ? dataStreams : activeDataStreams;
+	out_result.filterStreams = filterStreams;
+	out_result.bSuccess = bSuccess;
+
+	return bSuccess;
+}
+
+SensorStreamPolicy::SensorStreamPolicy(SensorSource &source, const SensorStreamConfig &config)
+	: m_config(config)
+	, m_appliedCount(0)
+{
+	GetConnectedSensors(source, m_knownSensors);
+}
+
+void SensorStreamPolicy::OnSensorSourceUpdated(SensorSource &source)
+{
+	if (!HasSensorSourceListChanged())
+	{
+		return;
+	}
+
+	GetConnectedSensors(source, m_connectedSensors);
+
+	for (HSLSensorID sensor_id : m_connectedSensors)
+	{
+		if (std::find(m_knownSensors.begin(), m_knownSensors.end(), sensor_id) == m_knownSensors.end())
+		{
+			SensorStreamConfigResult result;
+
+			ApplySensorStreamConfig(source, sensor_id, m_config, result);
+			++m_appliedCount;
+		}
+	}
+
+	// Sensors that went away are new again when they come back
+	m_knownSensors.swap(m_connectedSensors);
+}
+
+void SensorStreamPolicy::GetConnectedSensors(SensorSource &source, std::vector<HSLSensorID> &out_sensor_ids) const
+{
+	out_sensor_ids.clear();
+
+	HSLSensorList sensorList;
+	if (!source.GetSensorList(&sensorList))
+	{
+		return;
+	}
+
+	for (int list_index = 0; list_index < sensorList.count; ++list_index)
+	{
+		out_sensor_ids.push_back(sensorList.sensors[list_index].sensorID);
+	}
+}
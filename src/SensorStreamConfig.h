@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_STREAM_CONFIG_H
+#define SENSOR_STREAM_CONFIG_H
+
+#include "SensorSource.h"
+
+#include <stdint.h>
+#include <vector>
+
+enum SensorStreamConfigMode
+{
+	SensorStreamConfigMode_Set,     // Exactly the streams in the masks
+	SensorStreamConfigMode_Enable,  // The active streams plus the ones in the masks
+	SensorStreamConfigMode_Disable, // The active streams minus the ones in the masks
+};
+
+// The streams one sensor should have active. Masks that aren't given are left as they are.
+struct SensorStreamConfig
+{
+	SensorStreamConfig();
+
+	SensorStreamConfigMode mode;
+	bool bHasDataStreams;
+	t_hsl_stream_bitmask dataStreams;
+	bool bHasFilterStreams;
+	t_hrv_filter_bitmask filterStreams;
+};
+
+struct SensorStreamConfigResult
+{
+	HSLSensorID sensorID;
+	t_hsl_stream_bitmask dataStreams;   // As requested from the source
+	t_hrv_filter_bitmask filterStreams;
+	bool bDataStreamsSet;   // Whether the data streams took a source call
+	bool bFilterStreamsSet; // Whether the filter streams took a source call
+	bool bSuccess;
+};
+
+// The masks config asks for, given the ones active now. Neither is checked against capabilities.
+void ApplySensorStreamConfigMasks(
+	const SensorStreamConfig &config,
+	t_hsl_stream_bitmask &in_out_data_streams,
+	t_hrv_filter_bitmask &in_out_filter_streams);
+
+// Works out the streams the sensor should have from its active ones and brings it there with at
+// most one SetActiveSensorDataStreams and one SetActiveSensorFilterStreams call, and none for a
+// mask that doesn't change. Data streams the sensor isn't capable of are left out.
+// Returns false if the sensor isn't connected or the source refused a call.
+bool ApplySensorStreamConfig(
+	SensorSource &source,
+	HSLSensorID sensor_id,
+	const SensorStreamConfig &config,
+	SensorStreamConfigResult &out_result);
+
+// Applies a config to every sensor that connects while it is attached, on the update that
+// reports the new sensor list. Sensors connected when it is created don't count as new.
+// Attached as a SensorSourceListener.
+class SensorStreamPolicy : public SensorSourceListener
+{
+public:
+	SensorStreamPolicy(SensorSource &source, const SensorStreamConfig &config);
+
+	const SensorStreamConfig &GetConfig() const { return m_config; }
+	uint64_t GetAppliedCount() const { return m_appliedCount; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+private:
+	void GetConnectedSensors(SensorSource &source, std::vector<HSLSensorID> &out_sensor_ids) const;
+
+	const SensorStreamConfig m_config;
+	std::vector<HSLSensorID> m_knownSensors; // Connected as of the last sensor list change
+	std::vector<HSLSensorID> m_connectedSensors;
+	uint64_t m_appliedCount;
+};
+
+#endif // SENSOR_STREAM_CONFIG_H
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorStreamEncoding.h"
+
+#include <cmath>
+#include <string.h>
+
+// Largest LEB128 encoding of a 64 bit value
+static const size_t k_maxVarintBytes = 10;
+
+// Powers of two, so the scale itself is exact in the header's float
+static const float k_accSampleScale = 1.f / 4096.f; // g
+static const float k_hrvSampleScale = 1.f / 1024.f;
+
+static float GetSampleScale(HSLSensorBufferType buffer_type)
+{
+	switch (buffer_type)
+	{
+	case HSLBufferType_AccData:
+		return k_accSampleScale;
+	case HSLBufferType_HRVData:
+		return k_hrvSampleScale;
+	default:
+		return 1.f;
+	}
+}
+
+static inline uint8_t *WriteVarint(uint8_t *dest, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		*dest++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*dest++ = (uint8_t)value;
+
+	return dest;
+}
+
+static inline uint8_t *WriteZigzag(uint8_t *dest, int64_t value)
+{
+	return WriteVarint(dest, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+bool EncodeSensorStreamMessage(
+	const SensorFrameLayout &layout,
+	const uint8_t *data,
+	HSLSensorID sensor_id,
+	HSLHeartRateVariabityFilterType hrv_filter,
+	std::vector<uint8_t> &out_message)
+{
+	if (layout.sampleWidth <= 0)
+	{
+		return false;
+	}
+
+	const size_t frameCount = layout.frameCount;
+	const size_t sampleCount = layout.sampleCount;
+	const size_t sampleWidth = layout.sampleWidth;
+	const size_t frameValueWidth = layout.frameValueWidth;
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	const int32_t *frameValues = reinterpret_cast<const int32_t *>(data + layout.frameValuesOffset);
+	const int32_t *intSamples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	const float *floatSamples = reinterpret_cast<const float *>(data + layout.samplesOffset);
+
+	// Distance between consecutive samples and between the channels of one sample
+	const size_t sampleStride = layout.bPlanarSamples ? 1 : sampleWidth;
+	const size_t channelStride = layout.bPlanarSamples ? sampleCount : 1;
+
+	// Size for the worst case up front so the loops below write through a plain pointer
+	const size_t maxValues = frameCount * (2 + frameValueWidth) + sampleCount * sampleWidth;
+	out_message.resize(sizeof(SensorStreamMessageHeader) + maxValues * k_maxVarintBytes);
+
+	SensorStreamMessageHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic[0] = HSL_STREAM_MAGIC0;
+	header.magic[1] = HSL_STREAM_MAGIC1;
+	header.version = HSL_STREAM_VERSION;
+	header.bufferType = (uint8_t)layout.bufferType;
+	header.sensorID = sensor_id;
+	header.sampleWidth = (uint8_t)sampleWidth;
+	header.frameValueWidth = (uint8_t)frameValueWidth;
+	header.hrvFilter = (layout.bufferType == HSLBufferType_HRVData) ? (uint8_t)hrv_filter : 0;
+	header.flags = layout.bFloatSamples ? SensorStreamMessageFlag_FloatSamples : 0;
+	header.sampleScale = layout.bFloatSamples ? GetSampleScale(layout.bufferType) : 1.f;
+	header.baseTime = (frameCount > 0) ? frameTimes[0] : 0.0;
+	header.frameCount = (uint32_t)frameCount;
+	header.sampleCount = (uint32_t)sampleCount;
+	memcpy(out_message.data(), &header, sizeof(header));
+
+	uint8_t *dest = out_message.data() + sizeof(header);
+
+	// Frame times are rounded to whole microseconds relative to the first frame,
+	// then delta coded so rounding never accumulates
+	int64_t previousMicros = 0;
+	for (size_t frame = 0; frame < frameCount; ++frame)
+	{
+		const int64_t micros = std::llround((frameTimes[frame] - header.baseTime) * 1e6);
+
+		dest = WriteZigzag(dest, micros - previousMicros);
+		previousMicros = micros;
+	}
+
+	for (size_t frame = 0; frame < frameCount; ++frame)
+	{
+		dest = WriteVarint(dest, frameOffsets[frame + 1] - frameOffsets[frame]);
+	}
+
+	for (size_t column = 0; column < frameValueWidth; ++column)
+	{
+		const int32_t *values = frameValues + column * frameCount;
+		int64_t previous = 0;
+
+		for (size_t frame = 0; frame < frameCount; ++frame)
+		{
+			dest = WriteZigzag(dest, (int64_t)values[frame] - previous);
+			previous = values[frame];
+		}
+	}
+
+	for (size_t channel = 0; channel < sampleWidth; ++channel)
+	{
+		int64_t previous = 0;
+
+		if (layout.bFloatSamples)
+		{
+			const float *samples = floatSamples + channel * channelStride;
+			const double inverseScale = 1.0 / header.sampleScale;
+
+			for (size_t sample = 0; sample < sampleCount; ++sample)
+			{
+				const int64_t value = std::llround(samples[sample * sampleStride] * inverseScale);
+
+				dest = WriteZigzag(dest, value - previous);
+				previous = value;
+			}
+		}
+		else
+		{
+			const int32_t *samples = intSamples + channel * channelStride;
+
+			for (size_t sample = 0; sample < sampleCount; ++sample)
+			{
+				const int64_t value = samples[sample * sampleStride];
+
+				dest = WriteZigzag(dest, value - previous);
+				previous = value;
+			}
+		}
+	}
+
+	out_message.resize(dest - out_message.data());
+
+	return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_STREAM_ENCODING_H
+#define SENSOR_STREAM_ENCODING_H
+
+#include "HSLClient_CAPI.h"
+#include "SensorFrameBatch.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Wire format of one batch of a sensor stream, as sent over the binary /stream endpoint.
+// Little endian:
+//
+//   SensorStreamMessageHeader
+//   varint frameTimeDeltas[frameCount]       zigzag, microseconds since the previous frame (baseTime for the first)
+//   varint frameSampleCounts[frameCount]
+//   varint frameValues[frameValueWidth][frameCount]   zigzag delta down each column (HR: bpm, contact, energy)
+//   varint samples[sampleWidth][sampleCount]          zigzag delta down each channel
+//
+// Varints are unsigned LEB128; zigzag maps 0, -1, 1, -2... to 0, 1, 2, 3...
+// Channels are always sent planar whatever the layout of the batch. Float streams (Acc, HRV)
+// are quantized to integer multiples of sampleScale before delta coding, integer streams have
+// a sampleScale of 1 and round trip exactly.
+
+#define HSL_STREAM_MAGIC0 'H'
+#define HSL_STREAM_MAGIC1 'S'
+#define HSL_STREAM_VERSION 1
+
+enum SensorStreamMessageFlags
+{
+	SensorStreamMessageFlag_FloatSamples = 1 << 0, // Decoded samples are multiplied by sampleScale
+};
+
+struct SensorStreamMessageHeader
+{
+	uint8_t magic[2];
+	uint8_t version;
+	uint8_t bufferType;      // HSLSensorBufferType
+	int32_t sensorID;
+	uint8_t sampleWidth;     // Channels per sample
+	uint8_t frameValueWidth; // Per frame values
+	uint8_t hrvFilter;       // HSLHeartRateVariabityFilterType, HRV streams only
+	uint8_t flags;           // SensorStreamMessageFlags
+	float sampleScale;
+	double baseTime;         // timeInSeconds of the first frame
+	uint32_t frameCount;
+	uint32_t sampleCount;
+};
+
+static_assert(sizeof(SensorStreamMessageHeader) == 32, "SensorStreamMessageHeader layout changed");
+
+// Encodes a packed block (see SensorFrameLayout, interleaved or planar) into out_message,
+// replacing its contents. Returns false if the buffer type has no packed format.
+bool EncodeSensorStreamMessage(
+	const SensorFrameLayout &layout,
+	const uint8_t *data,
+	HSLSensorID sensor_id,
+	HSLHeartRateVariabityFilterType hrv_filter,
+	std::vector<uint8_t> &out_message);
+
+#endif // SENSOR_STREAM_ENCODING_H
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SensorStreamRing.h"
+#include "SensorFrameBatch.h"
+
+#include <algorithm>
+#include <limits>
+#include <string.h>
+
+static size_t RoundUpToPowerOfTwo(size_t value)
+{
+	size_t result = 1;
+
+	while (result < value)
+	{
+		result <<= 1;
+	}
+
+	return result;
+}
+
+// Read barrier while no cursor is open: nothing is unread, so the producer never counts a lap
+static const uint64_t k_noReadBarrier = std::numeric_limits<uint64_t>::max();
+
+// A slot holding frame n is stamped 2n+1 while being written and 2n+2 once complete
+static inline uint64_t WritingStamp(uint64_t sequence) { return 2 * sequence + 1; }
+static inline uint64_t CompleteStamp(uint64_t sequence) { return 2 * sequence + 2; }
+
+SensorStreamRing::SensorStreamRing(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter,
+	size_t capacity,
+	StreamRingOverflowPolicy overflow_policy)
+	: m_sensorID(sensor_id)
+	, m_bufferType(buffer_type)
+	, m_hrvFilter(hrv_filter)
+	, m_capacity(RoundUpToPowerOfTwo(std::max(capacity, (size_t)1)))
+	, m_frameSize(GetSensorFrameSize(buffer_type))
+	, m_overflowPolicy(overflow_policy)
+	, m_frameData(new uint8_t[m_capacity * m_frameSize])
+	, m_slotStamps(new std::atomic<uint64_t>[m_capacity])
+	, m_writeSequence(0)
+	, m_readBarrier(k_noReadBarrier)
+	, m_framesDropped(0)
+	, m_framesOverwritten(0)
+	, m_nextCursorId(1)
+{
+	for (size_t i = 0; i < m_capacity; ++i)
+	{
+		m_slotStamps[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+StreamRingStats SensorStreamRing::GetStats() const
+{
+	StreamRingStats stats;
+
+	stats.writeSequence = m_writeSequence.load(std::memory_order_acquire);
+	stats.framesDropped = m_framesDropped.load(std::memory_order_relaxed);
+	stats.framesOverwritten = m_framesOverwritten.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+size_t SensorStreamRing::IngestSensorBuffer()
+{
+	SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, m_bufferType, m_hrvFilter);
+	size_t frameCount = 0;
+
+	while (IsSensorBufferIteratorValid(iter))
+	{
+		const void *frame = GetSensorBufferFrame(iter);
+
+		if (frame != nullptr && Push(frame))
+		{
+			++frameCount;
+		}
+
+		SensorBufferIteratorNext(iter);
+	}
+
+	FlushSensorBuffer(m_sensorID, m_bufferType, m_hrvFilter);
+
+	return frameCount;
+}
+
+bool SensorStreamRing::Push(const void *frame)
+{
+	const uint64_t sequence = m_writeSequence.load(std::memory_order_relaxed);
+	const uint64_t readBarrier = m_readBarrier.load(std::memory_order_acquire);
+	const bool bSlowestCursorLapped = readBarrier != k_noReadBarrier && sequence >= readBarrier + m_capacity;
+
+	if (bSlowestCursorLapped)
+	{
+		if (m_overflowPolicy == StreamRingOverflow_DropNewest)
+		{
+			m_framesDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		m_framesOverwritten.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const size_t slot = (size_t)(sequence & (m_capacity - 1));
+	std::atomic<uint64_t> &stamp = m_slotStamps[slot];
+
+	stamp.store(WritingStamp(sequence), std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(m_frameData.get() + slot * m_frameSize, frame, m_frameSize);
+	stamp.store(CompleteStamp(sequence), std::memory_order_release);
+
+	m_writeSequence.store(sequence + 1, std::memory_order_release);
+
+	return true;
+}
+
+uint64_t SensorStreamRing::GetOldestSequence(uint64_t write_sequence) const
+{
+	return (write_sequence > m_capacity) ? write_sequence - m_capacity : 0;
+}
+
+int SensorStreamRing::OpenCursor(bool from_oldest)
+{
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+
+	const uint64_t writeSequence = m_writeSequence.load(std::memory_order_acquire);
+	const int cursorId = m_nextCursorId++;
+
+	// The start is set explicitly from the write position, never from the barrier, which
+	// means nothing while no other cursor is open
+	Cursor cursor;
+	cursor.sequence = from_oldest ? GetOldestSequence(writeSequence) : writeSequence;
+	cursor.lostFrames = 0;
+	m_cursors[cursorId] = cursor;
+
+	UpdateReadBarrier();
+
+	return cursorId;
+}
+
+void SensorStreamRing::CloseCursor(int cursor_id)
+{
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+
+	m_cursors.erase(cursor_id);
+
+	UpdateReadBarrier();
+}
+
+uint64_t SensorStreamRing::GetCursorPosition(int cursor_id) const
+{
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+
+	auto it = m_cursors.find(cursor_id);
+
+	return (it != m_cursors.end()) ? it->second.sequence : 0;
+}
+
+uint64_t SensorStreamRing::GetCursorAvailable(int cursor_id) const
+{
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+
+	auto it = m_cursors.find(cursor_id);
+	if (it == m_cursors.end())
+	{
+		return 0;
+	}
+
+	const uint64_t writeSequence = m_writeSequence.load(std::memory_order_acquire);
+	const uint64_t readSequence = std::max(it->second.sequence, GetOldestSequence(writeSequence));
+
+	return writeSequence - readSequence;
+}
+
+uint64_t SensorStreamRing::GetCursorLostFrames(int cursor_id) const
+{
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+
+	auto it = m_cursors.find(cursor_id);
+
+	return (it != m_cursors.end()) ? it->second.lostFrames : 0;
+}
+
+size_t SensorStreamRing::ReadCursor(int cursor_id, size_t max_frames, std::vector<uint8_t> &out_frames)
+{
+	std::lock_guard<std::mutex> lock(m_cursorMutex);
+
+	auto it = m_cursors.find(cursor_id);
+	if (it == m_cursors.end())
+	{
+		return 0;
+	}
+
+	Cursor &cursor = it->second;
+	const uint64_t writeSequence = m_writeSequence.load(std::memory_order_acquire);
+	const uint64_t oldestSequence = GetOldestSequence(writeSequence);
+
+	// Skip over anything the producer already overwrote
+	if (cursor.sequence < oldestSequence)
+	{
+		cursor.lostFrames += oldestSequence - cursor.sequence;
+		cursor.sequence = oldestSequence;
+	}
+
+	const uint64_t readCount = std::min((uint64_t)max_frames, writeSequence - cursor.sequence);
+	const size_t startOffset = out_frames.size();
+	size_t framesRead = 0;
+
+	out_frames.resize(startOffset + readCount * m_frameSize);
+
+	for (uint64_t sequence = cursor.sequence; sequence < cursor.sequence + readCount; ++sequence)
+	{
+		const size_t slot = (size_t)(sequence & (m_capacity - 1));
+		const std::atomic<uint64_t> &stamp = m_slotStamps[slot];
+		uint8_t *dest = out_frames.data() + startOffset + framesRead * m_frameSize;
+
+		const uint64_t stampBefore = stamp.load(std::memory_order_acquire);
+		if (stampBefore != CompleteStamp(sequence))
+		{
+			cursor.lostFrames++;
+			continue;
+		}
+
+		memcpy(dest, m_frameData.get() + slot * m_frameSize, m_frameSize);
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// The producer lapped us while copying, throw the torn frame away
+		if (stamp.load(std::memory_order_relaxed) != stampBefore)
+		{
+			cursor.lostFrames++;
+			continue;
+		}
+
+		framesRead++;
+	}
+
+	cursor.sequence += readCount;
+	out_frames.resize(startOffset + framesRead * m_frameSize);
+
+	UpdateReadBarrier();
+
+	return framesRead;
+}
+
+// The cursor lock must be held
+void SensorStreamRing::UpdateReadBarrier()
+{
+	if (m_cursors.empty())
+	{
+		m_readBarrier.store(k_noReadBarrier, std::memory_order_release);
+		return;
+	}
+
+	uint64_t slowestSequence = std::numeric_limits<uint64_t>::max();
+	for (const auto &entry : m_cursors)
+	{
+		slowestSequence = std::min(slowestSequence, entry.second.sequence);
+	}
+
+	m_readBarrier.store(slowestSequence, std::memory_order_release);
+}
+
+std::shared_ptr<SensorStreamRing> SensorStreamRingRegistry::FindRing(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return FindRingLocked(sensor_id, buffer_type, hrv_filter);
+}
+
+bool SensorStreamRingRegistry::AddRing(const std::shared_ptr<SensorStreamRing> &ring)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Checked under the same lock so two envs can't both attach a ring to one stream
+	if (FindRingLocked(ring->GetSensorID(), ring->GetBufferType(), ring->GetHrvFilter()))
+	{
+		return false;
+	}
+
+	m_rings.push_back(ring);
+
+	return true;
+}
+
+void SensorStreamRingRegistry::RemoveRing(const std::shared_ptr<SensorStreamRing> &ring)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_rings.erase(std::remove(m_rings.begin(), m_rings.end(), ring), m_rings.end());
+}
+
+std::shared_ptr<SensorStreamRing> SensorStreamRingRegistry::FindRingLocked(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter) const
+{
+	for (const std::shared_ptr<SensorStreamRing> &ring : m_rings)
+	{
+		if (ring->GetSensorID() == sensor_id &&
+			ring->GetBufferType() == buffer_type &&
+			(buffer_type != HSLBufferType_HRVData || ring->GetHrvFilter() == hrv_filter))
+		{
+			return ring;
+		}
+	}
+
+	return nullptr;
+}
+
+size_t SensorStreamRingRegistry::IngestAll()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t frameCount = 0;
+
+	for (const std::shared_ptr<SensorStreamRing> &ring : m_rings)
+	{
+		frameCount += ring->IngestSensorBuffer();
+	}
+
+	return frameCount;
+}
+
+SensorStreamRingRegistry &GetSensorStreamRingRegistry()
+{
+	static SensorStreamRingRegistry s_registry;
+
+	return s_registry;
+}
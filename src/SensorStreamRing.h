@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SENSOR_STREAM_RING_H
+#define SENSOR_STREAM_RING_H
+
+#include "HSLClient_CAPI.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+enum StreamRingOverflowPolicy
+{
+	StreamRingOverflow_DropOldest,
+	StreamRingOverflow_DropNewest,
+};
+
+struct StreamRingStats
+{
+	uint64_t writeSequence;     // Total frames ever written into the ring
+	uint64_t framesDropped;     // Drop-newest: incoming frames refused because the slowest cursor was a full ring behind
+	uint64_t framesOverwritten; // Drop-oldest: frames overwritten before the slowest cursor read them. Never counted without cursors
+};
+
+// Fixed capacity ring of raw HSL frame structs for one (sensor, buffer type).
+//
+// There is a single producer (whoever holds the HSL lock and calls IngestSensorBuffer)
+// and any number of read cursors, which may belong to different JS threads when the ring
+// is attached from worker threads. The cursor table has its own lock, which only readers
+// ever take. Reads never remove data from the ring, so each cursor consumes at its own pace.
+// Every slot carries a sequence stamp that is written before and after the frame
+// is copied in, which lets a reader detect a frame the producer lapped mid-read
+// without either side taking a lock.
+class SensorStreamRing
+{
+public:
+	SensorStreamRing(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter,
+		size_t capacity,
+		StreamRingOverflowPolicy overflow_policy);
+
+	HSLSensorID GetSensorID() const { return m_sensorID; }
+	HSLSensorBufferType GetBufferType() const { return m_bufferType; }
+	HSLHeartRateVariabityFilterType GetHrvFilter() const { return m_hrvFilter; }
+	size_t GetCapacity() const { return m_capacity; }
+	size_t GetFrameSize() const { return m_frameSize; }
+	StreamRingOverflowPolicy GetOverflowPolicy() const { return m_overflowPolicy; }
+	StreamRingStats GetStats() const;
+
+	// Producer side. Copies every frame in the sensor's HSL buffer into the ring and
+	// flushes the HSL buffer. The caller must hold the HSL lock.
+	size_t IngestSensorBuffer();
+	bool Push(const void *frame);
+
+	// Consumer side, safe to call from any thread but a cursor should only be used by one
+	int OpenCursor(bool from_oldest);
+	void CloseCursor(int cursor_id);
+	uint64_t GetCursorPosition(int cursor_id) const;
+	uint64_t GetCursorAvailable(int cursor_id) const;
+	uint64_t GetCursorLostFrames(int cursor_id) const;
+
+	// Appends up to max_frames frame structs (GetFrameSize() bytes each) to out_frames
+	// and advances the cursor. Returns the number of frames read.
+	size_t ReadCursor(int cursor_id, size_t max_frames, std::vector<uint8_t> &out_frames);
+
+private:
+	struct Cursor
+	{
+		uint64_t sequence;
+		uint64_t lostFrames;
+	};
+
+	uint64_t GetOldestSequence(uint64_t write_sequence) const;
+	void UpdateReadBarrier();
+
+	const HSLSensorID m_sensorID;
+	const HSLSensorBufferType m_bufferType;
+	const HSLHeartRateVariabityFilterType m_hrvFilter;
+	const size_t m_capacity; // Always a power of two
+	const size_t m_frameSize;
+	const StreamRingOverflowPolicy m_overflowPolicy;
+
+	std::unique_ptr<uint8_t[]> m_frameData;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_slotStamps;
+
+	std::atomic<uint64_t> m_writeSequence;
+	std::atomic<uint64_t> m_readBarrier; // Sequence of the slowest cursor, published by the consumer. Max while there is none
+	std::atomic<uint64_t> m_framesDropped;
+	std::atomic<uint64_t> m_framesOverwritten;
+
+	// Consumer side, guarded by m_cursorMutex
+	mutable std::mutex m_cursorMutex;
+	std::map<int, Cursor> m_cursors;
+	int m_nextCursorId;
+};
+
+// Every ring currently attached to an HSL sensor buffer
+class SensorStreamRingRegistry
+{
+public:
+	std::shared_ptr<SensorStreamRing> FindRing(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter);
+	// Returns false without adding it if a ring already exists for the same stream
+	bool AddRing(const std::shared_ptr<SensorStreamRing> &ring);
+	void RemoveRing(const std::shared_ptr<SensorStreamRing> &ring);
+
+	// Feeds every ring from its HSL buffer. The caller must hold the HSL lock.
+	size_t IngestAll();
+
+private:
+	std::shared_ptr<SensorStreamRing> FindRingLocked(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) const;
+
+	std::mutex m_mutex;
+	std::vector<std::shared_ptr<SensorStreamRing>> m_rings;
+};
+
+SensorStreamRingRegistry &GetSensorStreamRingRegistry();
+
+#endif // SENSOR_STREAM_RING_H
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SESSION_FORMAT_H
+#define SESSION_FORMAT_H
+
+#include <stdint.h>
+
+// On disk layout of a recorded sensor session (.hslsession), little endian:
+//
+//   SessionFileHeader
+//   chunk*            SessionChunkHeader + payload, padded to 8 bytes
+//   index chunk       SessionIndexEntry[] covering every chunk above
+//   SessionFileFooter
+//
+// Chunks are only ever appended, so a recording cut short by a crash is still
+// readable: without a footer the reader rebuilds the index by walking the chunks.
+// Frame chunks hold one sensor stream in the same packed layout Sensor.drain*()
+// returns (see SensorFrameLayout), with samples interleaved.
+
+#define HSL_SESSION_MAGIC "HSLSESS"
+#define HSL_SESSION_FOOTER_MAGIC "HSLI"
+#define HSL_SESSION_VERSION 1
+
+enum SessionChunkType
+{
+	SessionChunk_Sensor = 1, // SessionSensorInfo
+	SessionChunk_Frames = 2, // SessionFramesHeader + packed frames
+	SessionChunk_Index = 3,  // SessionIndexEntry[]
+};
+
+struct SessionFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	double recordStartTime; // Wall clock time the recording started, seconds since the unix epoch
+	uint64_t reserved;
+};
+
+struct SessionChunkHeader
+{
+	uint32_t chunkType;
+	uint32_t reserved;
+	uint64_t payloadSize; // Unpadded
+};
+
+// Device information of one sensor, written the first time the sensor shows up
+struct SessionSensorInfo
+{
+	int32_t sensorID;
+	uint32_t capabilities;
+	char bodyLocation[64];
+	char deviceFriendlyName[128];
+	char devicePath[256];
+	char firmwareRevisionString[64];
+	char hardwareRevisionString[64];
+	char manufacturerNameString[64];
+	char modelNumberString[64];
+	char serialNumberString[64];
+	char softwareRevisionString[64];
+	char systemID[64];
+};
+
+struct SessionFramesHeader
+{
+	int32_t sensorID;
+	uint32_t bufferType;
+	uint32_t hrvFilter;
+	uint32_t frameCount;
+	uint64_t sampleCount;
+	double firstFrameTime;
+	double lastFrameTime;
+	uint64_t packedByteLength;
+};
+
+struct SessionIndexEntry
+{
+	uint64_t chunkOffset; // File offset of the SessionChunkHeader
+	double firstFrameTime;
+	double lastFrameTime;
+	int32_t sensorID;
+	uint16_t chunkType;
+	uint16_t bufferType;
+	uint16_t hrvFilter;
+	uint16_t reserved;
+	uint32_t frameCount;
+};
+
+struct SessionFileFooter
+{
+	uint64_t indexOffset; // File offset of the index chunk's SessionChunkHeader
+	uint32_t indexEntryCount;
+	char magic[4];
+};
+
+static_assert(sizeof(SessionFileHeader) == 32, "SessionFileHeader layout changed");
+static_assert(sizeof(SessionChunkHeader) == 16, "SessionChunkHeader layout changed");
+static_assert(sizeof(SessionSensorInfo) % 8 == 0, "SessionSensorInfo must keep chunks 8 byte aligned");
+static_assert(sizeof(SessionFramesHeader) == 48, "SessionFramesHeader layout changed");
+static_assert(sizeof(SessionIndexEntry) == 40, "SessionIndexEntry layout changed");
+static_assert(sizeof(SessionFileFooter) == 16, "SessionFileFooter layout changed");
+
+#endif // SESSION_FORMAT_H
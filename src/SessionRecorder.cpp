@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SessionRecorder.h"
+#include "SensorFrameBatch.h"
+
+#include <chrono>
+#include <string.h>
+
+// A stream's pending frames are written out as a chunk once there are this many,
+// or once they span more than k_maxChunkSeconds, so slow streams like HR still
+// reach the disk regularly. Small chunks keep replay seeks short.
+static const size_t k_framesPerChunk = 64;
+static const double k_maxChunkSeconds = 5.0;
+
+static const HSLSensorBufferType k_recordedBufferTypes[] = {
+	HSLBufferType_HRData,
+	HSLBufferType_ECGData,
+	HSLBufferType_PPGData,
+	HSLBufferType_PPIData,
+	HSLBufferType_AccData
+};
+
+static uint64_t MakeStreamKey(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, HSLHeartRateVariabityFilterType hrv_filter)
+{
+	return ((uint64_t)(uint32_t)sensor_id << 32) | ((uint64_t)buffer_type << 16) | (uint64_t)hrv_filter;
+}
+
+static void CopySessionString(char *dest, size_t dest_size, const char *src)
+{
+	// Zero fills the rest like strncpy so nothing uninitialized reaches the file
+	const size_t length = strnlen(src, dest_size - 1);
+	memcpy(dest, src, length);
+	memset(dest + length, 0, dest_size - length);
+}
+
+SessionRecorder::SessionRecorder()
+	: m_file(nullptr)
+	, m_fileOffset(0)
+	, m_bWriteFailed(false)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+SessionRecorder::~SessionRecorder()
+{
+	Close();
+}
+
+bool SessionRecorder::Open(const std::string &path)
+{
+	Close();
+
+	m_file = fopen(path.c_str(), "wb");
+	if (m_file == nullptr)
+	{
+		return false;
+	}
+
+	// Chunks are small, let stdio batch them into large writes
+	setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+
+	m_fileOffset = 0;
+	m_bWriteFailed = false;
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_streams.clear();
+	m_recordedSensors.clear();
+	m_index.clear();
+
+	SessionFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HSL_SESSION_MAGIC, sizeof(header.magic));
+	header.version = HSL_SESSION_VERSION;
+	header.headerSize = sizeof(SessionFileHeader);
+	header.recordStartTime =
+		std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+	WriteChunkData(&header, sizeof(header));
+
+	return !m_bWriteFailed;
+}
+
+bool SessionRecorder::Close()
+{
+	if (m_file == nullptr)
+	{
+		return true;
+	}
+
+	for (auto &entry : m_streams)
+	{
+		WriteFramesChunk(entry.second);
+	}
+
+	SessionFileFooter footer;
+	memset(&footer, 0, sizeof(footer));
+	footer.indexOffset = m_fileOffset;
+	footer.indexEntryCount = (uint32_t)m_index.size();
+	memcpy(footer.magic, HSL_SESSION_FOOTER_MAGIC, sizeof(footer.magic));
+
+	SessionChunkHeader indexHeader;
+	memset(&indexHeader, 0, sizeof(indexHeader));
+	indexHeader.chunkType = SessionChunk_Index;
+	indexHeader.payloadSize = m_index.size() * sizeof(SessionIndexEntry);
+	WriteChunkData(&indexHeader, sizeof(indexHeader));
+	if (!m_index.empty())
+	{
+		WriteChunkData(m_index.data(), m_index.size() * sizeof(SessionIndexEntry));
+	}
+	WriteChunkData(&footer, sizeof(footer));
+
+	const bool bSuccess = (fclose(m_file) == 0) && !m_bWriteFailed;
+	m_file = nullptr;
+
+	return bSuccess;
+}
+
+void SessionRecorder::OnSensorSourceUpdated(SensorSource &source)
+{
+	if (m_file == nullptr)
+	{
+		return;
+	}
+
+	HSLSensorList sensorList;
+	if (!source.GetSensorList(&sensorList))
+	{
+		return;
+	}
+
+	for (int list_index = 0; list_index < sensorList.count; ++list_index)
+	{
+		const HSLSensorID sensor_id = sensorList.sensors[list_index].sensorID;
+		HSLSensor *sensor = source.GetSensor(sensor_id);
+		if (sensor == nullptr)
+			continue;
+
+		RecordSensorInfo(source, sensor_id);
+
+		for (HSLSensorBufferType buffer_type : k_recordedBufferTypes)
+		{
+			RecordSensorBuffer(source, sensor_id, buffer_type, HRVFilter_SDNN);
+		}
+
+		for (int filter_type = 0; filter_type < HRVFilter_COUNT; ++filter_type)
+		{
+			if (HSL_BITMASK_GET_FLAG(sensor->activeFilterStreams, filter_type))
+			{
+				RecordSensorBuffer(source, sensor_id, HSLBufferType_HRVData, (HSLHeartRateVariabityFilterType)filter_type);
+			}
+		}
+	}
+}
+
+void SessionRecorder::RecordSensorInfo(SensorSource &source, HSLSensorID sensor_id)
+{
+	if (m_recordedSensors.count(sensor_id) > 0)
+	{
+		return;
+	}
+
+	HSLSensor *sensor = source.GetSensor(sensor_id);
+	const HSLDeviceInformation &deviceInfo = sensor->deviceInformation;
+
+	SessionSensorInfo info;
+	memset(&info, 0, sizeof(info));
+	info.sensorID = sensor_id;
+	info.capabilities = deviceInfo.capabilities;
+	CopySessionString(info.bodyLocation, sizeof(info.bodyLocation), deviceInfo.bodyLocation);
+	CopySessionString(info.deviceFriendlyName, sizeof(info.deviceFriendlyName), deviceInfo.deviceFriendlyName);
+	CopySessionString(info.devicePath, sizeof(info.devicePath), deviceInfo.devicePath);
+	CopySessionString(info.firmwareRevisionString, sizeof(info.firmwareRevisionString), deviceInfo.firmwareRevisionString);
+	CopySessionString(info.hardwareRevisionString, sizeof(info.hardwareRevisionString), deviceInfo.hardwareRevisionString);
+	CopySessionString(info.manufacturerNameString, sizeof(info.manufacturerNameString), deviceInfo.manufacturerNameString);
+	CopySessionString(info.modelNumberString, sizeof(info.modelNumberString), deviceInfo.modelNumberString);
+	CopySessionString(info.serialNumberString, sizeof(info.serialNumberString), deviceInfo.serialNumberString);
+	CopySessionString(info.softwareRevisionString, sizeof(info.softwareRevisionString), deviceInfo.softwareRevisionString);
+	CopySessionString(info.systemID, sizeof(info.systemID), deviceInfo.systemID);
+
+	SessionIndexEntry indexEntry;
+	memset(&indexEntry, 0, sizeof(indexEntry));
+	indexEntry.sensorID = sensor_id;
+
+	WriteChunk(SessionChunk_Sensor, &info, sizeof(info), indexEntry);
+	m_recordedSensors.insert(sensor_id);
+}
+
+void SessionRecorder::RecordSensorBuffer(
+	SensorSource &source,
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	const size_t frameSize = GetSensorFrameSize(buffer_type);
+	const uint64_t key = MakeStreamKey(sensor_id, buffer_type, hrv_filter);
+
+	auto it = m_streams.find(key);
+	if (it == m_streams.end())
+	{
+		it = m_streams.insert(std::make_pair(key, StreamState(sensor_id, buffer_type, hrv_filter))).first;
+	}
+	StreamState &stream = it->second;
+
+	stream.watcher.CollectNewFrames(source, m_newFrames);
+	for (const void *newFrame : m_newFrames)
+	{
+		const uint8_t *frame = static_cast<const uint8_t *>(newFrame);
+
+		stream.pendingFrames.insert(stream.pendingFrames.end(), frame, frame + frameSize);
+		stream.pendingFrameCount++;
+
+		const double pendingSeconds =
+			GetSensorFrameTime(buffer_type, frame) -
+			GetSensorFrameTime(buffer_type, stream.pendingFrames.data());
+		if (stream.pendingFrameCount >= k_framesPerChunk || pendingSeconds >= k_maxChunkSeconds)
+		{
+			WriteFramesChunk(stream);
+		}
+	}
+}
+
+void SessionRecorder::WriteFramesChunk(StreamState &stream)
+{
+	if (stream.pendingFrameCount == 0)
+	{
+		return;
+	}
+
+	const SensorBufferWatcher &watcher = stream.watcher;
+	const HSLSensorBufferType bufferType = watcher.GetBufferType();
+	const size_t frameSize = GetSensorFrameSize(bufferType);
+	m_chunkFramePointers.resize(stream.pendingFrameCount);
+	for (size_t i = 0; i < stream.pendingFrameCount; ++i)
+	{
+		m_chunkFramePointers[i] = stream.pendingFrames.data() + i * frameSize;
+	}
+
+	SensorFrameLayout layout;
+	MeasureSensorFrames(bufferType, m_chunkFramePointers.data(), stream.pendingFrameCount, layout);
+
+	// Frames header followed by the packed block, which stays 8 byte aligned
+	std::vector<uint8_t> payload(sizeof(SessionFramesHeader) + layout.byteLength);
+	PackSensorFrames(m_chunkFramePointers.data(), layout, payload.data() + sizeof(SessionFramesHeader));
+
+	SessionFramesHeader framesHeader;
+	memset(&framesHeader, 0, sizeof(framesHeader));
+	framesHeader.sensorID = watcher.GetSensorID();
+	framesHeader.bufferType = bufferType;
+	framesHeader.hrvFilter = watcher.GetHrvFilter();
+	framesHeader.frameCount = (uint32_t)layout.frameCount;
+	framesHeader.sampleCount = layout.sampleCount;
+	framesHeader.firstFrameTime = GetSensorFrameTime(bufferType, m_chunkFramePointers.front());
+	framesHeader.lastFrameTime = GetSensorFrameTime(bufferType, m_chunkFramePointers.back());
+	framesHeader.packedByteLength = layout.byteLength;
+	memcpy(payload.data(), &framesHeader, sizeof(framesHeader));
+
+	SessionIndexEntry indexEntry;
+	memset(&indexEntry, 0, sizeof(indexEntry));
+	indexEntry.firstFrameTime = framesHeader.firstFrameTime;
+	indexEntry.lastFrameTime = framesHeader.lastFrameTime;
+	indexEntry.sensorID = watcher.GetSensorID();
+	indexEntry.bufferType = (uint16_t)bufferType;
+	indexEntry.hrvFilter = (uint16_t)watcher.GetHrvFilter();
+	indexEntry.frameCount = framesHeader.frameCount;
+
+	WriteChunk(SessionChunk_Frames, payload.data(), payload.size(), indexEntry);
+
+	m_stats.framesRecorded += stream.pendingFrameCount;
+	stream.pendingFrames.clear();
+	stream.pendingFrameCount = 0;
+}
+
+void SessionRecorder::WriteChunk(
+	SessionChunkType chunk_type,
+	const void *payload,
+	size_t payload_size,
+	const SessionIndexEntry &index_entry)
+{
+	static const uint8_t k_padding[8] = {0};
+
+	SessionIndexEntry indexEntry = index_entry;
+	indexEntry.chunkOffset = m_fileOffset;
+	indexEntry.chunkType = (uint16_t)chunk_type;
+	m_index.push_back(indexEntry);
+
+	SessionChunkHeader chunkHeader;
+	memset(&chunkHeader, 0, sizeof(chunkHeader));
+	chunkHeader.chunkType = chunk_type;
+	chunkHeader.payloadSize = payload_size;
+
+	WriteChunkData(&chunkHeader, sizeof(chunkHeader));
+	WriteChunkData(payload, payload_size);
+	if (payload_size % 8 != 0)
+	{
+		WriteChunkData(k_padding, 8 - payload_size % 8);
+	}
+
+	m_stats.chunksWritten++;
+}
+
+void SessionRecorder::WriteChunkData(const void *data, size_t size)
+{
+	if (fwrite(data, 1, size, m_file) != size)
+	{
+		m_bWriteFailed = true;
+	}
+
+	m_fileOffset += size;
+	m_stats.bytesWritten += size;
+}
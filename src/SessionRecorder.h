@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include "SensorSource.h"
+#include "SessionFormat.h"
+
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+struct SessionRecorderStats
+{
+	uint64_t framesRecorded;
+	uint64_t chunksWritten;
+	uint64_t bytesWritten;
+};
+
+// Appends every frame that lands in any sensor buffer of the active source to a
+// session file (see SessionFormat.h). Attached as a SensorSourceListener so it
+// sees each update before anything has a chance to flush the buffers.
+class SessionRecorder : public SensorSourceListener
+{
+public:
+	SessionRecorder();
+	~SessionRecorder();
+
+	bool Open(const std::string &path);
+	// Writes out the remaining frames plus the index. Returns false on a write error.
+	bool Close();
+	bool IsOpen() const { return m_file != nullptr; }
+
+	SessionRecorderStats GetStats() const { return m_stats; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+private:
+	struct StreamState
+	{
+		StreamState(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, HSLHeartRateVariabityFilterType hrv_filter)
+			: watcher(sensor_id, buffer_type, hrv_filter)
+			, pendingFrameCount(0)
+		{}
+
+		SensorBufferWatcher watcher;
+		std::vector<uint8_t> pendingFrames; // Raw frame structs waiting for a full chunk
+		size_t pendingFrameCount;
+	};
+
+	void RecordSensorInfo(SensorSource &source, HSLSensorID sensor_id);
+	void RecordSensorBuffer(
+		SensorSource &source,
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter);
+	void WriteFramesChunk(StreamState &stream);
+	void WriteChunk(SessionChunkType chunk_type, const void *payload, size_t payload_size, const SessionIndexEntry &index_entry);
+	void WriteChunkData(const void *data, size_t size);
+
+	FILE *m_file;
+	uint64_t m_fileOffset;
+	bool m_bWriteFailed;
+	SessionRecorderStats m_stats;
+
+	std::map<uint64_t, StreamState> m_streams;
+	std::set<HSLSensorID> m_recordedSensors;
+	std::vector<SessionIndexEntry> m_index;
+	std::vector<const void *> m_newFrames; // Frames of the buffer being recorded
+	std::vector<const void *> m_chunkFramePointers; // Frames of the chunk being written
+};
+
+#endif // SESSION_RECORDER_H
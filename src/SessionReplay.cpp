@@ -0,0 +1,814 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SessionReplay.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string.h>
+#include <tuple>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Played back frames a stream holds on to before the oldest are dropped,
+// the same thing an HSL sensor buffer does when nobody drains it
+static const size_t k_maxStagedFrames = 1024;
+
+static uint64_t GetPaddedPayloadSize(uint64_t payload_size)
+{
+	return (payload_size + 7) & ~(uint64_t)7;
+}
+
+static void CopySessionString(char *dest, size_t dest_size, const char *src, size_t src_size)
+{
+	const size_t length = std::min(strnlen(src, src_size), dest_size - 1);
+
+	memcpy(dest, src, length);
+	dest[length] = '\0';
+}
+
+//-- SessionFileReader -----
+SessionFileReader::SessionFileReader()
+	: m_data(nullptr)
+	, m_size(0)
+#ifdef _WIN32
+	, m_fileHandle(INVALID_HANDLE_VALUE)
+	, m_mappingHandle(nullptr)
+#else
+	, m_fileDescriptor(-1)
+#endif
+{
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+SessionFileReader::~SessionFileReader()
+{
+	Close();
+}
+
+bool SessionFileReader::Open(const std::string &path, std::string &out_error)
+{
+	Close();
+
+	if (!MapFile(path))
+	{
+		out_error = "Failed to open session file " + path;
+		return false;
+	}
+
+	if (m_size < sizeof(SessionFileHeader))
+	{
+		out_error = "Session file is truncated";
+		Close();
+		return false;
+	}
+
+	memcpy(&m_header, m_data, sizeof(m_header));
+	if (memcmp(m_header.magic, HSL_SESSION_MAGIC, sizeof(m_header.magic)) != 0)
+	{
+		out_error = "Not a session file";
+		Close();
+		return false;
+	}
+
+	if (m_header.version > HSL_SESSION_VERSION ||
+		m_header.headerSize < sizeof(SessionFileHeader) ||
+		m_header.headerSize > m_size)
+	{
+		out_error = "Unsupported session file version";
+		Close();
+		return false;
+	}
+
+	// A recording that was never closed has no index, walk the chunks instead
+	if (!ReadFooterIndex())
+	{
+		ScanChunks();
+	}
+
+	for (const SessionIndexEntry &entry : m_index)
+	{
+		if (entry.chunkType != SessionChunk_Sensor)
+			continue;
+
+		const SessionChunkHeader *chunkHeader = GetChunkHeader(entry.chunkOffset);
+		if (chunkHeader == nullptr || chunkHeader->chunkType != SessionChunk_Sensor)
+			continue;
+
+		SessionSensorInfo sensorInfo;
+		memset(&sensorInfo, 0, sizeof(sensorInfo));
+		memcpy(
+			&sensorInfo,
+			reinterpret_cast<const uint8_t *>(chunkHeader) + sizeof(SessionChunkHeader),
+			(size_t)std::min(chunkHeader->payloadSize, (uint64_t)sizeof(sensorInfo)));
+		m_sensors.push_back(sensorInfo);
+	}
+
+	return true;
+}
+
+void SessionFileReader::Close()
+{
+	UnmapFile();
+
+	memset(&m_header, 0, sizeof(m_header));
+	m_sensors.clear();
+	m_index.clear();
+}
+
+bool SessionFileReader::GetFramesChunk(
+	const SessionIndexEntry &entry,
+	SessionFramesHeader &out_header,
+	SensorFrameLayout &out_layout,
+	const uint8_t *&out_data) const
+{
+	const SessionChunkHeader *chunkHeader = GetChunkHeader(entry.chunkOffset);
+	if (chunkHeader == nullptr ||
+		chunkHeader->chunkType != SessionChunk_Frames ||
+		chunkHeader->payloadSize < sizeof(SessionFramesHeader))
+	{
+		return false;
+	}
+
+	const uint8_t *payload = reinterpret_cast<const uint8_t *>(chunkHeader) + sizeof(SessionChunkHeader);
+	memcpy(&out_header, payload, sizeof(out_header));
+
+	// A damaged or hostile file can claim any counts, bound them by the bytes actually there
+	const uint64_t packedBytes = chunkHeader->payloadSize - sizeof(SessionFramesHeader);
+	if (out_header.frameCount > packedBytes / sizeof(double) ||
+		out_header.sampleCount > packedBytes / sizeof(int32_t))
+	{
+		return false;
+	}
+
+	if (out_header.bufferType >= HSLBufferType_COUNT ||
+		!ComputeSensorFrameLayout(
+			(HSLSensorBufferType)out_header.bufferType,
+			out_header.frameCount,
+			(size_t)out_header.sampleCount,
+			out_layout) ||
+		out_layout.byteLength != out_header.packedByteLength ||
+		out_layout.byteLength > packedBytes)
+	{
+		return false;
+	}
+
+	out_data = payload + sizeof(SessionFramesHeader);
+
+	return true;
+}
+
+bool SessionFileReader::MapFile(const std::string &path)
+{
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(
+		path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	m_fileHandle = fileHandle;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		UnmapFile();
+		return false;
+	}
+
+	m_mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mappingHandle == nullptr)
+	{
+		UnmapFile();
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t *>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr)
+	{
+		UnmapFile();
+		return false;
+	}
+	m_size = (size_t)fileSize.QuadPart;
+#else
+	m_fileDescriptor = open(path.c_str(), O_RDONLY);
+	if (m_fileDescriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(m_fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		UnmapFile();
+		return false;
+	}
+
+	void *mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, m_fileDescriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		UnmapFile();
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t *>(mapping);
+	m_size = (size_t)fileStat.st_size;
+#endif
+
+	return true;
+}
+
+void SessionFileReader::UnmapFile()
+{
+#ifdef _WIN32
+	if (m_data != nullptr)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mappingHandle != nullptr)
+	{
+		CloseHandle(m_mappingHandle);
+		m_mappingHandle = nullptr;
+	}
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_fileHandle);
+		m_fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_data != nullptr)
+	{
+		munmap(const_cast<uint8_t *>(m_data), m_size);
+	}
+	if (m_fileDescriptor >= 0)
+	{
+		close(m_fileDescriptor);
+		m_fileDescriptor = -1;
+	}
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+}
+
+bool SessionFileReader::ReadFooterIndex()
+{
+	if (m_size < m_header.headerSize + sizeof(SessionChunkHeader) + sizeof(SessionFileFooter))
+	{
+		return false;
+	}
+
+	SessionFileFooter footer;
+	memcpy(&footer, m_data + m_size - sizeof(SessionFileFooter), sizeof(footer));
+	if (memcmp(footer.magic, HSL_SESSION_FOOTER_MAGIC, sizeof(footer.magic)) != 0)
+	{
+		return false;
+	}
+
+	const SessionChunkHeader *indexHeader = GetChunkHeader(footer.indexOffset);
+	const uint64_t indexSize = (uint64_t)footer.indexEntryCount * sizeof(SessionIndexEntry);
+	if (indexHeader == nullptr ||
+		indexHeader->chunkType != SessionChunk_Index ||
+		indexHeader->payloadSize != indexSize ||
+		footer.indexOffset + sizeof(SessionChunkHeader) + indexSize > m_size - sizeof(SessionFileFooter))
+	{
+		return false;
+	}
+
+	m_index.resize(footer.indexEntryCount);
+	if (indexSize > 0)
+	{
+		memcpy(m_index.data(), m_data + footer.indexOffset + sizeof(SessionChunkHeader), (size_t)indexSize);
+	}
+
+	return true;
+}
+
+bool SessionFileReader::ScanChunks()
+{
+	uint64_t offset = m_header.headerSize;
+
+	m_index.clear();
+	while (offset + sizeof(SessionChunkHeader) <= m_size)
+	{
+		SessionChunkHeader chunkHeader;
+		memcpy(&chunkHeader, m_data + offset, sizeof(chunkHeader));
+
+		const uint64_t payloadOffset = offset + sizeof(SessionChunkHeader);
+		if (chunkHeader.chunkType == SessionChunk_Index ||
+			chunkHeader.payloadSize > m_size - payloadOffset)
+		{
+			// Reached the index or a chunk the recorder never finished writing
+			break;
+		}
+
+		SessionIndexEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.chunkOffset = offset;
+		entry.chunkType = (uint16_t)chunkHeader.chunkType;
+
+		if (chunkHeader.chunkType == SessionChunk_Sensor && chunkHeader.payloadSize >= sizeof(int32_t))
+		{
+			memcpy(&entry.sensorID, m_data + payloadOffset, sizeof(entry.sensorID));
+			m_index.push_back(entry);
+		}
+		else if (chunkHeader.chunkType == SessionChunk_Frames && chunkHeader.payloadSize >= sizeof(SessionFramesHeader))
+		{
+			SessionFramesHeader framesHeader;
+			memcpy(&framesHeader, m_data + payloadOffset, sizeof(framesHeader));
+
+			entry.firstFrameTime = framesHeader.firstFrameTime;
+			entry.lastFrameTime = framesHeader.lastFrameTime;
+			entry.sensorID = framesHeader.sensorID;
+			entry.bufferType = (uint16_t)framesHeader.bufferType;
+			entry.hrvFilter = (uint16_t)framesHeader.hrvFilter;
+			entry.frameCount = framesHeader.frameCount;
+			m_index.push_back(entry);
+		}
+
+		offset = payloadOffset + GetPaddedPayloadSize(chunkHeader.payloadSize);
+	}
+
+	return !m_index.empty();
+}
+
+const SessionChunkHeader *SessionFileReader::GetChunkHeader(uint64_t offset) const
+{
+	if (offset < m_header.headerSize ||
+		offset % 8 != 0 ||
+		offset + sizeof(SessionChunkHeader) > m_size)
+	{
+		return nullptr;
+	}
+
+	const SessionChunkHeader *chunkHeader = reinterpret_cast<const SessionChunkHeader *>(m_data + offset);
+	if (chunkHeader->payloadSize > m_size - offset - sizeof(SessionChunkHeader))
+	{
+		return nullptr;
+	}
+
+	return chunkHeader;
+}
+
+//-- SessionReplaySource -----
+SessionReplaySettings::SessionReplaySettings()
+	: bRealtime(true)
+	, speed(1.0)
+	, stepSeconds(0.1)
+{
+}
+
+SessionReplaySource::SessionReplaySource()
+	: m_bSensorListPending(false)
+	, m_bSensorListChanged(false)
+	, m_startTime(0.0)
+	, m_endTime(0.0)
+	, m_playbackTime(0.0)
+	, m_frameCount(0)
+	, m_clockBaseTime(0.0)
+	, m_bClockStarted(false)
+{
+}
+
+bool SessionReplaySource::Open(const std::string &path, const SessionReplaySettings &settings, std::string &out_error)
+{
+	if (!m_file.Open(path, out_error))
+	{
+		return false;
+	}
+
+	m_settings = settings;
+	m_settings.speed = std::max(m_settings.speed, 0.0);
+	m_settings.stepSeconds = std::max(m_settings.stepSeconds, 0.0);
+
+	for (const SessionSensorInfo &sensorInfo : m_file.GetSensors())
+	{
+		if (m_sensors.size() >= HSL_SENSOR_LIST_MAX)
+			break;
+
+		HSLSensor sensor;
+		memset(&sensor, 0, sizeof(sensor));
+		sensor.sensorID = sensorInfo.sensorID;
+
+		HSLDeviceInformation &deviceInfo = sensor.deviceInformation;
+		deviceInfo.capabilities = sensorInfo.capabilities;
+		CopySessionString(deviceInfo.bodyLocation, sizeof(deviceInfo.bodyLocation), sensorInfo.bodyLocation, sizeof(sensorInfo.bodyLocation));
+		CopySessionString(deviceInfo.deviceFriendlyName, sizeof(deviceInfo.deviceFriendlyName), sensorInfo.deviceFriendlyName, sizeof(sensorInfo.deviceFriendlyName));
+		CopySessionString(deviceInfo.devicePath, sizeof(deviceInfo.devicePath), sensorInfo.devicePath, sizeof(sensorInfo.devicePath));
+		CopySessionString(deviceInfo.firmwareRevisionString, sizeof(deviceInfo.firmwareRevisionString), sensorInfo.firmwareRevisionString, sizeof(sensorInfo.firmwareRevisionString));
+		CopySessionString(deviceInfo.hardwareRevisionString, sizeof(deviceInfo.hardwareRevisionString), sensorInfo.hardwareRevisionString, sizeof(sensorInfo.hardwareRevisionString));
+		CopySessionString(deviceInfo.manufacturerNameString, sizeof(deviceInfo.manufacturerNameString), sensorInfo.manufacturerNameString, sizeof(sensorInfo.manufacturerNameString));
+		CopySessionString(deviceInfo.modelNumberString, sizeof(deviceInfo.modelNumberString), sensorInfo.modelNumberString, sizeof(sensorInfo.modelNumberString));
+		CopySessionString(deviceInfo.serialNumberString, sizeof(deviceInfo.serialNumberString), sensorInfo.serialNumberString, sizeof(sensorInfo.serialNumberString));
+		CopySessionString(deviceInfo.softwareRevisionString, sizeof(deviceInfo.softwareRevisionString), sensorInfo.softwareRevisionString, sizeof(sensorInfo.softwareRevisionString));
+		CopySessionString(deviceInfo.systemID, sizeof(deviceInfo.systemID), sensorInfo.systemID, sizeof(sensorInfo.systemID));
+
+		m_sensors.push_back(sensor);
+	}
+
+	// One stream per recorded (sensor, buffer type, hrv filter)
+	typedef std::tuple<HSLSensorID, int, int> StreamKey;
+	std::map<StreamKey, size_t> streamIndices;
+
+	m_startTime = std::numeric_limits<double>::max();
+	m_endTime = std::numeric_limits<double>::lowest();
+	for (const SessionIndexEntry &entry : m_file.GetIndex())
+	{
+		if (entry.chunkType != SessionChunk_Frames || entry.frameCount == 0 || entry.bufferType >= HSLBufferType_COUNT)
+			continue;
+
+		const HSLSensorBufferType bufferType = (HSLSensorBufferType)entry.bufferType;
+		const StreamKey key(entry.sensorID, entry.bufferType, (bufferType == HSLBufferType_HRVData) ? entry.hrvFilter : 0);
+
+		auto it = streamIndices.find(key);
+		if (it == streamIndices.end())
+		{
+			ReplayStream stream;
+			stream.sensorID = entry.sensorID;
+			stream.bufferType = bufferType;
+			stream.hrvFilter = (HSLHeartRateVariabityFilterType)std::get<2>(key);
+			stream.frameSize = GetSensorFrameSize(bufferType);
+			stream.chunkIndex = 0;
+			stream.frameIndex = 0;
+			stream.stagedFrameStart = 0;
+			stream.stagedFrameCount = 0;
+
+			it = streamIndices.insert(std::make_pair(key, m_streams.size())).first;
+			m_streams.push_back(stream);
+		}
+
+		m_streams[it->second].chunks.push_back(&entry);
+		m_startTime = std::min(m_startTime, entry.firstFrameTime);
+		m_endTime = std::max(m_endTime, entry.lastFrameTime);
+		m_frameCount += entry.frameCount;
+	}
+
+	if (m_streams.empty())
+	{
+		m_startTime = 0.0;
+		m_endTime = 0.0;
+	}
+
+	for (ReplayStream &stream : m_streams)
+	{
+		std::stable_sort(
+			stream.chunks.begin(), stream.chunks.end(),
+			[](const SessionIndexEntry *a, const SessionIndexEntry *b) {
+				return a->firstFrameTime < b->firstFrameTime;
+			});
+	}
+
+	m_playbackTime = m_startTime;
+	m_bSensorListPending = true;
+
+	return true;
+}
+
+void SessionReplaySource::Seek(double session_time)
+{
+	m_playbackTime = std::min(std::max(session_time, m_startTime), m_endTime);
+	m_clockBaseTime = m_playbackTime;
+	m_clockBaseWallTime = std::chrono::steady_clock::now();
+
+	for (ReplayStream &stream : m_streams)
+	{
+		SeekStream(stream, m_playbackTime);
+	}
+}
+
+bool SessionReplaySource::Update(bool poll_events)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	if (!m_bClockStarted)
+	{
+		// The first update only announces the sensors. Playback starts on the next one,
+		// once there has been a chance to turn streams on.
+		m_clockBaseTime = m_playbackTime;
+		m_clockBaseWallTime = now;
+		m_bClockStarted = true;
+	}
+	else
+	{
+		if (m_settings.bRealtime)
+		{
+			const double elapsed = std::chrono::duration<double>(now - m_clockBaseWallTime).count();
+
+			m_playbackTime = std::min(m_clockBaseTime + elapsed * m_settings.speed, m_endTime);
+		}
+		else
+		{
+			m_playbackTime = std::min(m_playbackTime + m_settings.stepSeconds, m_endTime);
+		}
+
+		for (ReplayStream &stream : m_streams)
+		{
+			AdvanceStream(stream, m_playbackTime);
+		}
+	}
+
+	if (m_bSensorListPending)
+	{
+		HSLEventMessage message;
+		memset(&message, 0, sizeof(message));
+		message.event_type = HSLEvent_SensorListUpdated;
+		m_messageQueue.push_back(message);
+
+		m_bSensorListPending = false;
+	}
+
+	// Same event handling as HSL_Update: a full update consumes the queued events
+	m_bSensorListChanged = false;
+	if (poll_events)
+	{
+		while (!m_messageQueue.empty())
+		{
+			if (m_messageQueue.front().event_type == HSLEvent_SensorListUpdated)
+			{
+				m_bSensorListChanged = true;
+			}
+
+			m_messageQueue.pop_front();
+		}
+	}
+
+	return true;
+}
+
+bool SessionReplaySource::HasSensorListChanged()
+{
+	return m_bSensorListChanged;
+}
+
+bool SessionReplaySource::PollNextMessage(HSLEventMessage *out_message)
+{
+	if (m_messageQueue.empty())
+	{
+		return false;
+	}
+
+	*out_message = m_messageQueue.front();
+	m_messageQueue.pop_front();
+
+	return true;
+}
+
+bool SessionReplaySource::GetSensorList(HSLSensorList *out_sensor_list)
+{
+	if (out_sensor_list == nullptr)
+	{
+		return false;
+	}
+
+	memset(out_sensor_list, 0, sizeof(HSLSensorList));
+	for (const HSLSensor &sensor : m_sensors)
+	{
+		out_sensor_list->sensors[out_sensor_list->count].sensorID = sensor.sensorID;
+		out_sensor_list->count++;
+	}
+
+	return true;
+}
+
+HSLSensor *SessionReplaySource::GetSensor(HSLSensorID sensor_id)
+{
+	for (HSLSensor &sensor : m_sensors)
+	{
+		if (sensor.sensorID == sensor_id)
+		{
+			return &sensor;
+		}
+	}
+
+	return nullptr;
+}
+
+bool SessionReplaySource::SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags)
+{
+	HSLSensor *sensor = GetSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	sensor->activeDataStreams = data_stream_flags & sensor->deviceInformation.capabilities;
+
+	return true;
+}
+
+bool SessionReplaySource::SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask)
+{
+	HSLSensor *sensor = GetSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	sensor->activeFilterStreams = filter_stream_bitmask;
+
+	return true;
+}
+
+bool SessionReplaySource::StopAllSensorStreams(HSLSensorID sensor_id)
+{
+	HSLSensor *sensor = GetSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	sensor->activeDataStreams = 0;
+	sensor->activeFilterStreams = 0;
+
+	return true;
+}
+
+SensorBufferIterator SessionReplaySource::GetSensorBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	SensorBufferIterator iterator;
+	memset(&iterator, 0, sizeof(iterator));
+	iterator.bufferType = buffer_type;
+	iterator.bSourceFrames = true;
+
+	ReplayStream *stream = FindStream(sensor_id, buffer_type, hrv_filter);
+	if (stream != nullptr)
+	{
+		iterator.frames = stream->stagedFrames.data() + stream->stagedFrameStart * stream->frameSize;
+		iterator.frameCount = stream->stagedFrameCount;
+	}
+
+	return iterator;
+}
+
+bool SessionReplaySource::FlushSensorBuffer(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	ReplayStream *stream = FindStream(sensor_id, buffer_type, hrv_filter);
+	if (stream != nullptr)
+	{
+		stream->stagedFrames.clear();
+		stream->stagedFrameStart = 0;
+		stream->stagedFrameCount = 0;
+	}
+
+	return GetSensor(sensor_id) != nullptr;
+}
+
+SessionReplaySource::ReplayStream *SessionReplaySource::FindStream(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter)
+{
+	for (ReplayStream &stream : m_streams)
+	{
+		if (stream.sensorID == sensor_id &&
+			stream.bufferType == buffer_type &&
+			(buffer_type != HSLBufferType_HRVData || stream.hrvFilter == hrv_filter))
+		{
+			return &stream;
+		}
+	}
+
+	return nullptr;
+}
+
+bool SessionReplaySource::IsStreamActive(const ReplayStream &stream)
+{
+	const HSLSensor *sensor = GetSensor(stream.sensorID);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	if (stream.bufferType == HSLBufferType_HRVData)
+	{
+		return HSL_BITMASK_GET_FLAG(sensor->activeFilterStreams, stream.hrvFilter);
+	}
+
+	// The first HSLStreamFlags line up with the buffer types
+	return HSL_BITMASK_GET_FLAG(sensor->activeDataStreams, stream.bufferType);
+}
+
+void SessionReplaySource::AdvanceStream(ReplayStream &stream, double until_time)
+{
+	// Frames of streams nobody has turned on are skipped, same as a sensor not sending them
+	const bool bActive = IsStreamActive(stream);
+
+	while (stream.chunkIndex < stream.chunks.size())
+	{
+		SessionFramesHeader framesHeader;
+		SensorFrameLayout layout;
+		const uint8_t *data = nullptr;
+
+		if (!m_file.GetFramesChunk(*stream.chunks[stream.chunkIndex], framesHeader, layout, data))
+		{
+			stream.chunkIndex++;
+			stream.frameIndex = 0;
+			continue;
+		}
+
+		const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+		while (stream.frameIndex < layout.frameCount && frameTimes[stream.frameIndex] <= until_time)
+		{
+			if (bActive)
+			{
+				m_unpackedFrame.resize(stream.frameSize);
+				if (UnpackSensorFrame(layout, data, stream.frameIndex, m_unpackedFrame.data()))
+				{
+					StageFrame(stream, m_unpackedFrame.data());
+				}
+			}
+
+			stream.frameIndex++;
+		}
+
+		if (stream.frameIndex < layout.frameCount)
+		{
+			break;
+		}
+
+		stream.chunkIndex++;
+		stream.frameIndex = 0;
+	}
+}
+
+void SessionReplaySource::SeekStream(ReplayStream &stream, double session_time)
+{
+	stream.stagedFrames.clear();
+	stream.stagedFrameStart = 0;
+	stream.stagedFrameCount = 0;
+
+	// First chunk that still has frames at or after the seek time
+	auto chunkIt = std::lower_bound(
+		stream.chunks.begin(), stream.chunks.end(), session_time,
+		[](const SessionIndexEntry *entry, double time) {
+			return entry->lastFrameTime < time;
+		});
+
+	stream.chunkIndex = chunkIt - stream.chunks.begin();
+	stream.frameIndex = 0;
+
+	if (chunkIt != stream.chunks.end())
+	{
+		SessionFramesHeader framesHeader;
+		SensorFrameLayout layout;
+		const uint8_t *data = nullptr;
+
+		if (m_file.GetFramesChunk(**chunkIt, framesHeader, layout, data))
+		{
+			const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+
+			stream.frameIndex = std::lower_bound(frameTimes, frameTimes + layout.frameCount, session_time) - frameTimes;
+		}
+	}
+}
+
+void SessionReplaySource::StageFrame(ReplayStream &stream, const void *frame)
+{
+	if (stream.stagedFrameCount >= k_maxStagedFrames)
+	{
+		// Drop the oldest frame by moving the head instead of erasing it
+		stream.stagedFrameStart++;
+		stream.stagedFrameCount--;
+	}
+
+	// Compact once a full buffer's worth of dead frames has built up,
+	// so the memmove is paid once per k_maxStagedFrames frames
+	if (stream.stagedFrameStart >= k_maxStagedFrames)
+	{
+		stream.stagedFrames.erase(
+			stream.stagedFrames.begin(),
+			stream.stagedFrames.begin() + stream.stagedFrameStart * stream.frameSize);
+		stream.stagedFrameStart = 0;
+	}
+
+	const uint8_t *frameBytes = static_cast<const uint8_t *>(frame);
+	stream.stagedFrames.insert(stream.stagedFrames.end(), frameBytes, frameBytes + stream.frameSize);
+	stream.stagedFrameCount++;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SESSION_REPLAY_H
+#define SESSION_REPLAY_H
+
+#include "SensorSource.h"
+#include "SensorFrameBatch.h"
+#include "SessionFormat.h"
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Read only, memory mapped view of a recorded session file
+class SessionFileReader
+{
+public:
+	SessionFileReader();
+	~SessionFileReader();
+
+	bool Open(const std::string &path, std::string &out_error);
+	void Close();
+
+	const SessionFileHeader &GetHeader() const { return m_header; }
+	const std::vector<SessionSensorInfo> &GetSensors() const { return m_sensors; }
+	const std::vector<SessionIndexEntry> &GetIndex() const { return m_index; }
+
+	// Resolves an index entry of a frames chunk to its header and packed frame block
+	bool GetFramesChunk(
+		const SessionIndexEntry &entry,
+		SessionFramesHeader &out_header,
+		SensorFrameLayout &out_layout,
+		const uint8_t *&out_data) const;
+
+private:
+	SessionFileReader(const SessionFileReader &) = delete;
+	SessionFileReader &operator=(const SessionFileReader &) = delete;
+
+	bool MapFile(const std::string &path);
+	void UnmapFile();
+	bool ReadFooterIndex();
+	bool ScanChunks();
+	const SessionChunkHeader *GetChunkHeader(uint64_t offset) const;
+
+	const uint8_t *m_data;
+	size_t m_size;
+#ifdef _WIN32
+	void *m_fileHandle;
+	void *m_mappingHandle;
+#else
+	int m_fileDescriptor;
+#endif
+
+	SessionFileHeader m_header;
+	std::vector<SessionSensorInfo> m_sensors;
+	std::vector<SessionIndexEntry> m_index;
+};
+
+struct SessionReplaySettings
+{
+	SessionReplaySettings();
+
+	bool bRealtime;     // Follow the wall clock, otherwise advance stepSeconds per update
+	double speed;       // Realtime playback rate, 2.0 plays twice as fast
+	double stepSeconds; // Session time covered by each update when not realtime
+};
+
+// Feeds a recorded session back through the SensorSource interface, so the rest of the
+// addon (and JS) sees the recorded sensors as if they were connected.
+// Frames are handed out in recorded order once the playback clock passes their timestamp.
+class SessionReplaySource : public SensorSource
+{
+public:
+	SessionReplaySource();
+
+	bool Open(const std::string &path, const SessionReplaySettings &settings, std::string &out_error);
+
+	double GetStartTime() const { return m_startTime; }
+	double GetEndTime() const { return m_endTime; }
+	double GetPlaybackTime() const { return m_playbackTime; }
+	uint64_t GetFrameCount() const { return m_frameCount; }
+	size_t GetSensorCount() const { return m_sensors.size(); }
+	bool IsFinished() const { return m_playbackTime >= m_endTime; }
+
+	// Moves the playback clock and drops every staged frame
+	void Seek(double session_time);
+
+	bool Update(bool poll_events) override;
+	bool HasSensorListChanged() override;
+	bool PollNextMessage(HSLEventMessage *out_message) override;
+
+	bool GetSensorList(HSLSensorList *out_sensor_list) override;
+	HSLSensor *GetSensor(HSLSensorID sensor_id) override;
+	bool SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags) override;
+	bool SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask) override;
+	bool StopAllSensorStreams(HSLSensorID sensor_id) override;
+
+	SensorBufferIterator GetSensorBuffer(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) override;
+	bool FlushSensorBuffer(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter) override;
+
+private:
+	struct ReplayStream
+	{
+		HSLSensorID sensorID;
+		HSLSensorBufferType bufferType;
+		HSLHeartRateVariabityFilterType hrvFilter;
+		size_t frameSize;
+		std::vector<const SessionIndexEntry *> chunks; // Sorted by time
+
+		// Next frame to play back
+		size_t chunkIndex;
+		size_t frameIndex;
+
+		// Frames played back but not flushed yet, like an HSL sensor buffer.
+		// Live frames start at stagedFrameStart so evicting the oldest one
+		// doesn't shift the rest; the dead prefix is compacted in bulk.
+		std::vector<uint8_t> stagedFrames;
+		size_t stagedFrameStart;
+		size_t stagedFrameCount;
+	};
+
+	ReplayStream *FindStream(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter);
+	bool IsStreamActive(const ReplayStream &stream);
+	void AdvanceStream(ReplayStream &stream, double until_time);
+	void SeekStream(ReplayStream &stream, double session_time);
+	void StageFrame(ReplayStream &stream, const void *frame);
+
+	SessionFileReader m_file;
+	SessionReplaySettings m_settings;
+
+	std::vector<HSLSensor> m_sensors;
+	std::vector<ReplayStream> m_streams;
+	std::deque<HSLEventMessage> m_messageQueue;
+	bool m_bSensorListPending;
+	bool m_bSensorListChanged;
+
+	double m_startTime;
+	double m_endTime;
+	double m_playbackTime;
+	uint64_t m_frameCount;
+
+	// Realtime playback: session time at the last seek and when that happened
+	double m_clockBaseTime;
+	std::chrono::steady_clock::time_point m_clockBaseWallTime;
+	bool m_bClockStarted;
+
+	std::vector<uint8_t> m_unpackedFrame;
+};
+
+#endif // SESSION_REPLAY_H
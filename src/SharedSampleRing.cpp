@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "SharedSampleRing.h"
+
+#include <algorithm>
+#include <string.h>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Shared ring header fields must be plain 32 bit integers");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared ring header fields must be lock free to work with JS Atomics");
+
+static const size_t k_headerBytes = SharedSampleRingField_COUNT * sizeof(uint32_t);
+
+SharedSampleRing::SharedSampleRing(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	HSLHeartRateVariabityFilterType hrv_filter,
+	size_t capacity,
+	StreamRingOverflowPolicy overflow_policy,
+	uint8_t *memory)
+	: m_capacity(RoundUpCapacity(capacity))
+	, m_channelCount(GetChannelCount(buffer_type))
+	, m_overflowPolicy(overflow_policy)
+	, m_watcher(sensor_id, buffer_type, hrv_filter)
+	, m_header(reinterpret_cast<std::atomic<uint32_t> *>(memory))
+	, m_times(reinterpret_cast<double *>(memory + k_headerBytes))
+	, m_values(reinterpret_cast<float *>(memory + k_headerBytes + m_capacity * sizeof(double)))
+	, m_writeHead(0)
+	, m_writeRoom(0)
+	, m_channelValues(m_channelCount)
+{
+	for (int field = 0; field < SharedSampleRingField_COUNT; ++field)
+	{
+		Field(field).store(0, std::memory_order_relaxed);
+	}
+
+	Field(SharedSampleRingField_Capacity).store((uint32_t)m_capacity, std::memory_order_relaxed);
+	Field(SharedSampleRingField_ChannelCount).store((uint32_t)m_channelCount, std::memory_order_relaxed);
+	Field(SharedSampleRingField_BufferType).store((uint32_t)buffer_type, std::memory_order_relaxed);
+	Field(SharedSampleRingField_SensorID).store((uint32_t)sensor_id, std::memory_order_relaxed);
+	Field(SharedSampleRingField_Overflow).store((uint32_t)overflow_policy, std::memory_order_relaxed);
+	Field(SharedSampleRingField_TimesOffset).store((uint32_t)k_headerBytes, std::memory_order_relaxed);
+	Field(SharedSampleRingField_ValuesOffset).store((uint32_t)(k_headerBytes + m_capacity * sizeof(double)), std::memory_order_relaxed);
+	Field(SharedSampleRingField_MaxReaders).store((uint32_t)k_maxReaders, std::memory_order_release);
+}
+
+size_t SharedSampleRing::RoundUpCapacity(size_t capacity)
+{
+	size_t result = 1;
+
+	while (result < capacity)
+	{
+		result <<= 1;
+	}
+
+	return result;
+}
+
+// HR streams carry beats per minute, everything else its sample channels
+int SharedSampleRing::GetChannelCount(HSLSensorBufferType buffer_type)
+{
+	int sampleWidth = 0;
+	int frameValueWidth = 0;
+	bool floatSamples = false;
+
+	if (buffer_type == HSLBufferType_HRData ||
+		!GetSensorBufferFormat(buffer_type, sampleWidth, frameValueWidth, floatSamples))
+	{
+		return 1;
+	}
+
+	return sampleWidth;
+}
+
+size_t SharedSampleRing::GetByteLength(HSLSensorBufferType buffer_type, size_t capacity)
+{
+	const size_t rows = RoundUpCapacity(capacity);
+
+	return k_headerBytes + rows * sizeof(double) + rows * GetChannelCount(buffer_type) * sizeof(float);
+}
+
+uint32_t SharedSampleRing::GetHead() const
+{
+	return Field(SharedSampleRingField_Head).load(std::memory_order_acquire);
+}
+
+uint32_t SharedSampleRing::GetDropped() const
+{
+	return Field(SharedSampleRingField_Dropped).load(std::memory_order_relaxed);
+}
+
+int SharedSampleRing::GetActiveReaderCount() const
+{
+	int count = 0;
+
+	for (int reader = 0; reader < k_maxReaders; ++reader)
+	{
+		if (Field(SharedSampleRingField_ReaderStates + reader).load(std::memory_order_acquire) == SharedSampleReaderState_Active)
+		{
+			++count;
+		}
+	}
+
+	return count;
+}
+
+void SharedSampleRing::Close()
+{
+	Field(SharedSampleRingField_Closed).store(1, std::memory_order_release);
+}
+
+uint32_t SharedSampleRing::GetUnreadCount(uint32_t head) const
+{
+	uint32_t unread = 0;
+
+	for (int reader = 0; reader < k_maxReaders; ++reader)
+	{
+		if (Field(SharedSampleRingField_ReaderStates + reader).load(std::memory_order_acquire) == SharedSampleReaderState_Active)
+		{
+			const uint32_t tail = Field(SharedSampleRingField_ReaderTails + reader).load(std::memory_order_acquire);
+
+			// Unsigned differences stay correct across the 2^32 wrap
+			unread = std::max(unread, head - tail);
+		}
+	}
+
+	return unread;
+}
+
+void SharedSampleRing::WriteSample(double time, const float *values)
+{
+	if (m_writeRoom == 0)
+	{
+		Field(SharedSampleRingField_Dropped).fetch_add(1, std::memory_order_relaxed);
+
+		if (m_overflowPolicy == StreamRingOverflow_DropNewest)
+		{
+			return;
+		}
+	}
+	else
+	{
+		--m_writeRoom;
+	}
+
+	const size_t slot = m_writeHead & (m_capacity - 1);
+
+	m_times[slot] = time;
+	memcpy(m_values + slot * m_channelCount, values, m_channelCount * sizeof(float));
+	++m_writeHead;
+}
+
+void SharedSampleRing::OnSensorSourceUpdated(SensorSource &source)
+{
+	if (m_watcher.CollectNewFrames(source, m_newFrames) == 0)
+	{
+		return;
+	}
+
+	// Readers only ever make more room while we write, so this is a safe lower bound
+	m_writeRoom = (uint32_t)m_capacity - std::min(GetUnreadCount(m_writeHead), (uint32_t)m_capacity);
+
+	AddFrames(m_newFrames);
+
+	// Readers see the new samples all at once
+	Field(SharedSampleRingField_Head).store(m_writeHead, std::memory_order_release);
+}
+
+void SharedSampleRing::AddFrames(const std::vector<const void *> &frames)
+{
+	const HSLSensorBufferType bufferType = GetBufferType();
+
+	SensorFrameLayout layout;
+	if (!MeasureSensorFrames(bufferType, frames.data(), frames.size(), layout))
+	{
+		return;
+	}
+	m_packed.resize(layout.byteLength);
+	PackSensorFrames(frames.data(), layout, m_packed.data());
+
+	const size_t rowCount = (bufferType == HSLBufferType_HRData) ? layout.frameCount : layout.sampleCount;
+	Field(SharedSampleRingField_Reserved).store(m_writeHead + (uint32_t)rowCount, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const uint8_t *data = m_packed.data();
+	const double *frameTimes = reinterpret_cast<const double *>(data + layout.frameTimesOffset);
+	const uint32_t *frameOffsets = reinterpret_cast<const uint32_t *>(data + layout.frameOffsetsOffset);
+	const int32_t *frameValues = reinterpret_cast<const int32_t *>(data + layout.frameValuesOffset);
+	const int32_t *intSamples = reinterpret_cast<const int32_t *>(data + layout.samplesOffset);
+	const float *floatSamples = reinterpret_cast<const float *>(data + layout.samplesOffset);
+	float *values = m_channelValues.data();
+
+	for (size_t frame = 0; frame < layout.frameCount; ++frame)
+	{
+		const double frameTime = frameTimes[frame];
+
+		if (bufferType == HSLBufferType_HRData)
+		{
+			m_clock.AddFrame(frameTime, 0);
+
+			values[0] = (float)frameValues[HRFrameValue_BeatsPerMinute * layout.frameCount + frame];
+			WriteSample(frameTime, values);
+			continue;
+		}
+
+		const size_t firstSample = frameOffsets[frame];
+		const size_t sampleCount = frameOffsets[frame + 1] - firstSample;
+
+		m_clock.AddFrame(frameTime, sampleCount);
+
+		for (size_t sample = 0; sample < sampleCount; ++sample)
+		{
+			const size_t base = (firstSample + sample) * layout.sampleWidth;
+
+			for (int channel = 0; channel < m_channelCount; ++channel)
+			{
+				values[channel] = layout.bFloatSamples
+					? floatSamples[base + channel]
+					: (float)intSamples[base + channel];
+			}
+
+			WriteSample(m_clock.GetSampleTime(sample), values);
+		}
+	}
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef SHARED_SAMPLE_RING_H
+#define SHARED_SAMPLE_RING_H
+
+#include "SensorFrameBatch.h"
+#include "SensorSource.h"
+#include "SensorStreamRing.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Header fields of a shared sample ring, as 32 bit integers at the start of the memory.
+// JS readers index an Int32Array with these, so the values can never change.
+enum SharedSampleRingField
+{
+	SharedSampleRingField_Head,          // Samples ever written, wraps at 2^32. Published after the samples.
+	SharedSampleRingField_Capacity,      // Samples the ring holds, a power of two
+	SharedSampleRingField_ChannelCount,  // Values per sample
+	SharedSampleRingField_BufferType,
+	SharedSampleRingField_SensorID,
+	SharedSampleRingField_Overflow,      // StreamRingOverflowPolicy
+	SharedSampleRingField_Dropped,       // Drop-newest: samples refused, drop-oldest: samples overwritten unread
+	SharedSampleRingField_TimesOffset,   // Byte offset of double timeInSeconds[capacity]
+	SharedSampleRingField_ValuesOffset,  // Byte offset of float values[capacity * channelCount], interleaved
+	SharedSampleRingField_MaxReaders,
+	SharedSampleRingField_Closed,        // Set once the writer stops for good
+	SharedSampleRingField_Reserved,      // Head plus the samples being written. Stored before writing them,
+	                                     // readers compare it with their tail to find out if they were lapped.
+
+	SharedSampleRingField_ReaderTails = 16,  // Next sample each reader will read
+	SharedSampleRingField_ReaderStates = 24, // SharedSampleReaderState per reader slot
+
+	SharedSampleRingField_COUNT = 32
+};
+
+enum SharedSampleReaderState
+{
+	SharedSampleReaderState_Free,
+	SharedSampleReaderState_Active,
+	SharedSampleReaderState_Claiming, // Claimed, tail not published yet
+};
+
+// Sensor samples written into memory that JS maps as a SharedArrayBuffer, so any number of
+// worker threads read the same samples without copying or posting messages.
+//
+// Every sample is one row: its time plus one float per channel (HR streams store beats per
+// minute, once per frame). The single writer is this listener, running wherever HSL is
+// updated. Readers claim one of the reader slots and move their own tail with Atomics.
+// With drop-newest the writer never passes the slowest tail, so a reader can use the samples
+// in place until it moves its tail on. With drop-oldest the writer never waits, and readers
+// check the head afterwards to find out whether they were lapped.
+class SharedSampleRing : public SensorSourceListener
+{
+public:
+	static const int k_maxReaders = 8;
+
+	// memory must hold GetByteLength(buffer_type, capacity) bytes and stay valid until the
+	// ring is removed as a listener. capacity is rounded up to a power of two.
+	SharedSampleRing(
+		HSLSensorID sensor_id,
+		HSLSensorBufferType buffer_type,
+		HSLHeartRateVariabityFilterType hrv_filter,
+		size_t capacity,
+		StreamRingOverflowPolicy overflow_policy,
+		uint8_t *memory);
+
+	static size_t RoundUpCapacity(size_t capacity);
+	static int GetChannelCount(HSLSensorBufferType buffer_type);
+	static size_t GetByteLength(HSLSensorBufferType buffer_type, size_t capacity);
+
+	HSLSensorID GetSensorID() const { return m_watcher.GetSensorID(); }
+	HSLSensorBufferType GetBufferType() const { return m_watcher.GetBufferType(); }
+	size_t GetCapacity() const { return m_capacity; }
+	uint32_t GetHead() const;
+	uint32_t GetDropped() const;
+	int GetActiveReaderCount() const;
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	// Tells readers no more samples are coming
+	void Close();
+
+private:
+	std::atomic<uint32_t> &Field(int field) const { return m_header[field]; }
+
+	// Samples the slowest active reader still has to read, the caller is the writer
+	uint32_t GetUnreadCount(uint32_t head) const;
+	void WriteSample(double time, const float *values);
+	void AddFrames(const std::vector<const void *> &frames);
+
+	const size_t m_capacity;
+	const int m_channelCount;
+	const StreamRingOverflowPolicy m_overflowPolicy;
+	SensorBufferWatcher m_watcher;
+	SensorSampleClock m_clock;
+
+	std::atomic<uint32_t> *m_header;
+	double *m_times;
+	float *m_values;
+	uint32_t m_writeHead; // Head including samples not published yet
+	uint32_t m_writeRoom; // Samples that fit before the slowest reader is lapped
+
+	// Scratch
+	std::vector<const void *> m_newFrames;
+	std::vector<uint8_t> m_packed;
+	std::vector<float> m_channelValues;
+};
+
+#endif // SHARED_SAMPLE_RING_H
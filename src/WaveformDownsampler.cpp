@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "WaveformDownsampler.h"
+#include "SensorFrameBatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Each bucket of a level summarizes this many buckets of the level below
+static const uint32_t k_levelFactor = 8;
+static const int k_levelShift = 3;
+
+// Levels with fewer buckets than this aren't worth keeping
+static const size_t k_minLevelCapacity = 16;
+
+static const size_t k_minRawCapacity = 1024;
+
+// Frames further than this from where the previous frame ended start a new run of buckets
+static const double k_maxTimeGap = 0.5;
+
+// Weight of each new frame in the measured sample period
+static const double k_periodSmoothing = 0.1;
+
+static size_t RoundUpToPowerOfTwo(size_t value)
+{
+	size_t result = 1;
+	while (result < value)
+	{
+		result <<= 1;
+	}
+
+	return result;
+}
+
+WaveformDownsamplerSettings::WaveformDownsamplerSettings()
+	: channel(0)
+	, historySeconds(60.0)
+	, nominalSampleRate(0.0)
+{
+}
+
+WaveformDownsampler::WaveformDownsampler(
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	const WaveformDownsamplerSettings &settings)
+	: m_settings(settings)
+	, m_watcher(sensor_id, buffer_type)
+{
+	const double nominalRate = (settings.nominalSampleRate > 0.0) ? settings.nominalSampleRate : GetSensorNominalSampleRate(buffer_type);
+	const size_t rawCapacity = RoundUpToPowerOfTwo(
+		std::max((size_t)std::ceil(settings.historySeconds * nominalRate * 1.5), k_minRawCapacity));
+
+	m_rawTimes.resize(rawCapacity);
+	m_rawValues.resize(rawCapacity);
+
+	for (size_t capacity = rawCapacity >> k_levelShift; capacity >= k_minLevelCapacity; capacity >>= k_levelShift)
+	{
+		Level level = {};
+		level.buckets.resize(capacity);
+		m_levels.push_back(level);
+	}
+
+	m_samplePeriod = 1.0 / nominalRate;
+	ClearHistory();
+}
+
+void WaveformDownsampler::Reset()
+{
+	ClearHistory();
+	m_watcher.Reset();
+}
+
+void WaveformDownsampler::ClearHistory()
+{
+	m_rawHead = 0;
+	m_rawCount = 0;
+	m_lastSampleTime = 0.0;
+
+	for (Level &level : m_levels)
+	{
+		level.head = 0;
+		level.count = 0;
+		level.open.count = 0;
+		level.open.children = 0;
+	}
+}
+
+double WaveformDownsampler::GetOldestTime() const
+{
+	if (m_rawCount == 0)
+	{
+		return 0.0;
+	}
+
+	return m_rawTimes[(m_rawHead - m_rawCount) & (m_rawTimes.size() - 1)];
+}
+
+void WaveformDownsampler::OnSensorSourceUpdated(SensorSource &source)
+{
+	m_watcher.CollectNewFrames(source, m_newFrames);
+
+	const int channel = m_settings.channel;
+	for (const void *frame_ptr : m_newFrames)
+	{
+		double lastSampleTime = 0.0;
+		int count = 0;
+
+		switch (GetBufferType())
+		{
+		case HSLBufferType_ECGData:
+			{
+				const HSLHeartECGFrame *frame = static_cast<const HSLHeartECGFrame *>(frame_ptr);
+
+				count = std::min(frame->ecgValueCount, (int)MAX_HSL_ECG_SAMPLES);
+				m_frameValues.resize(std::max(count, 0));
+				for (int i = 0; i < count; ++i)
+				{
+					m_frameValues[i] = (float)frame->ecgValues[i];
+				}
+				lastSampleTime = frame->timeInSeconds;
+			} break;
+		case HSLBufferType_PPGData:
+			{
+				const HSLHeartPPGFrame *frame = static_cast<const HSLHeartPPGFrame *>(frame_ptr);
+
+				count = std::min(frame->ppgSampleCount, (int)MAX_HSL_PPG_SAMPLES);
+				m_frameValues.resize(std::max(count, 0));
+				for (int i = 0; i < count; ++i)
+				{
+					const HSLHeartPPGSample &sample = frame->ppgSamples[i];
+					const int value =
+						(channel == 1) ? sample.ppgValue1 :
+						(channel == 2) ? sample.ppgValue2 :
+						(channel == 3) ? sample.ambient :
+						sample.ppgValue0;
+
+					m_frameValues[i] = (float)value;
+				}
+				lastSampleTime = frame->timeInSeconds;
+			} break;
+		case HSLBufferType_AccData:
+			{
+				const HSLAccelerometerFrame *frame = static_cast<const HSLAccelerometerFrame *>(frame_ptr);
+
+				count = std::min(frame->accSampleCount, (int)MAX_HSL_ACC_SAMPLES);
+				m_frameValues.resize(std::max(count, 0));
+				for (int i = 0; i < count; ++i)
+				{
+					const HSLVector3f &sample = frame->accSamples[i];
+
+					m_frameValues[i] = (channel == 1) ? sample.y : (channel == 2) ? sample.z : sample.x;
+				}
+				lastSampleTime = frame->timeInSeconds;
+			} break;
+		default:
+			break;
+		}
+
+		AddSamples(m_frameValues.data(), count, lastSampleTime);
+	}
+}
+
+void WaveformDownsampler::AddSamples(const float *values, int count, double last_sample_time)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	// Frames only carry the time of their last sample, the rest are spread back from it
+	// at the measured sample period
+	if (m_rawCount > 0)
+	{
+		const double elapsed = last_sample_time - m_lastSampleTime;
+
+		if (elapsed <= 0.0)
+		{
+			// Time went backwards, e.g. a replay seek; the old history no longer lines up
+			ClearHistory();
+		}
+		else if (elapsed - count * m_samplePeriod > k_maxTimeGap)
+		{
+			// Don't let a bucket straddle the gap
+			CloseOpenBuckets();
+		}
+		else
+		{
+			m_samplePeriod += k_periodSmoothing * (elapsed / count - m_samplePeriod);
+		}
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		AppendSample(last_sample_time - (count - 1 - i) * m_samplePeriod, values[i]);
+	}
+	m_lastSampleTime = last_sample_time;
+}
+
+void WaveformDownsampler::AppendSample(double time, float value)
+{
+	const size_t mask = m_rawTimes.size() - 1;
+
+	m_rawTimes[m_rawHead] = time;
+	m_rawValues[m_rawHead] = value;
+	m_rawHead = (m_rawHead + 1) & mask;
+	m_rawCount = std::min(m_rawCount + 1, m_rawTimes.size());
+
+	Bucket sample;
+	sample.startTime = time;
+	sample.endTime = time;
+	sample.minValue = value;
+	sample.maxValue = value;
+	sample.sum = value;
+	sample.count = 1;
+	sample.children = 0;
+	FoldIntoLevel(0, sample);
+}
+
+void WaveformDownsampler::FoldIntoLevel(size_t level_index, const Bucket &child)
+{
+	if (level_index >= m_levels.size())
+	{
+		return;
+	}
+
+	Level &level = m_levels[level_index];
+	Bucket &open = level.open;
+
+	if (open.count == 0)
+	{
+		open = child;
+		open.children = 1;
+	}
+	else
+	{
+		open.endTime = child.endTime;
+		open.minValue = std::min(open.minValue, child.minValue);
+		open.maxValue = std::max(open.maxValue, child.maxValue);
+		open.sum += child.sum;
+		open.count += child.count;
+		open.children++;
+	}
+
+	if (open.children >= k_levelFactor)
+	{
+		const Bucket closed = open;
+
+		level.buckets[level.head] = closed;
+		level.head = (level.head + 1) & (level.buckets.size() - 1);
+		level.count = std::min(level.count + 1, level.buckets.size());
+		open.count = 0;
+		open.children = 0;
+
+		FoldIntoLevel(level_index + 1, closed);
+	}
+}
+
+void WaveformDownsampler::CloseOpenBuckets()
+{
+	for (size_t level_index = 0; level_index < m_levels.size(); ++level_index)
+	{
+		Level &level = m_levels[level_index];
+
+		if (level.open.count > 0)
+		{
+			const Bucket closed = level.open;
+
+			level.buckets[level.head] = closed;
+			level.head = (level.head + 1) & (level.buckets.size() - 1);
+			level.count = std::min(level.count + 1, level.buckets.size());
+			level.open.count = 0;
+			level.open.children = 0;
+
+			FoldIntoLevel(level_index + 1, closed);
+		}
+	}
+}
+
+size_t WaveformDownsampler::ChooseLevel(double samples_per_point) const
+{
+	size_t level = 0;
+	double bucketSamples = k_levelFactor;
+
+	while (level < m_levels.size() && bucketSamples <= samples_per_point)
+	{
+		level++;
+		bucketSamples *= k_levelFactor;
+	}
+
+	return level;
+}
+
+template <typename F>
+void WaveformDownsampler::VisitLevel(size_t level_index, double start_time, double end_time, F visit) const
+{
+	if (level_index == 0)
+	{
+		const size_t mask = m_rawTimes.size() - 1;
+		const size_t oldest = m_rawHead - m_rawCount;
+
+		// First sample at or after start_time
+		size_t low = 0;
+		size_t high = m_rawCount;
+		while (low < high)
+		{
+			const size_t mid = (low + high) / 2;
+
+			if (m_rawTimes[(oldest + mid) & mask] < start_time)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		Bucket sample;
+		sample.count = 1;
+		sample.children = 0;
+		for (size_t i = low; i < m_rawCount; ++i)
+		{
+			const size_t slot = (oldest + i) & mask;
+			if (m_rawTimes[slot] >= end_time)
+			{
+				break;
+			}
+
+			sample.startTime = m_rawTimes[slot];
+			sample.endTime = m_rawTimes[slot];
+			sample.minValue = m_rawValues[slot];
+			sample.maxValue = m_rawValues[slot];
+			sample.sum = m_rawValues[slot];
+			visit(sample);
+		}
+
+		return;
+	}
+
+	const Level &level = m_levels[level_index - 1];
+	const size_t mask = level.buckets.size() - 1;
+	const size_t oldest = level.head - level.count;
+
+	// First bucket ending at or after start_time
+	size_t low = 0;
+	size_t high = level.count;
+	while (low < high)
+	{
+		const size_t mid = (low + high) / 2;
+
+		if (level.buckets[(oldest + mid) & mask].endTime < start_time)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (size_t i = low; i < level.count; ++i)
+	{
+		const Bucket &bucket = level.buckets[(oldest + i) & mask];
+		if (bucket.startTime >= end_time)
+		{
+			return;
+		}
+
+		visit(bucket);
+	}
+
+	// The newest samples are still in partial buckets, coarsest (and oldest) first
+	for (size_t open_index = level_index; open_index-- > 0;)
+	{
+		const Bucket &open = m_levels[open_index].open;
+
+		if (open.count > 0 && open.endTime >= start_time && open.startTime < end_time)
+		{
+			visit(open);
+		}
+	}
+}
+
+void WaveformDownsampler::GetEnvelope(double start_time, double end_time, int width, float *out_min, float *out_max) const
+{
+	if (width <= 0)
+	{
+		return;
+	}
+
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	std::fill(out_min, out_min + width, nan);
+	std::fill(out_max, out_max + width, nan);
+
+	if (m_rawCount == 0 || end_time <= start_time)
+	{
+		return;
+	}
+
+	const double pointSeconds = (end_time - start_time) / width;
+	const size_t levelIndex = ChooseLevel(pointSeconds / m_samplePeriod);
+
+	VisitLevel(levelIndex, start_time, end_time, [&](const Bucket &bucket) {
+		const double midTime = 0.5 * (bucket.startTime + bucket.endTime);
+		const int point = std::min(std::max((int)std::floor((midTime - start_time) / pointSeconds), 0), width - 1);
+
+		if (std::isnan(out_min[point]))
+		{
+			out_min[point] = bucket.minValue;
+			out_max[point] = bucket.maxValue;
+		}
+		else
+		{
+			out_min[point] = std::min(out_min[point], bucket.minValue);
+			out_max[point] = std::max(out_max[point], bucket.maxValue);
+		}
+	});
+}
+
+void WaveformDownsampler::GetLTTB(
+	double start_time,
+	double end_time,
+	int point_count,
+	std::vector<double> &out_times,
+	std::vector<float> &out_values) const
+{
+	out_times.clear();
+	out_values.clear();
+
+	if (m_rawCount == 0 || end_time <= start_time || point_count <= 0)
+	{
+		return;
+	}
+
+	// Give every output point a handful of candidates to pick from
+	const double pointSeconds = (end_time - start_time) / point_count;
+	const size_t levelIndex = ChooseLevel(pointSeconds / m_samplePeriod / 4.0);
+
+	VisitLevel(levelIndex, start_time, end_time, [&](const Bucket &bucket) {
+		out_times.push_back(0.5 * (bucket.startTime + bucket.endTime));
+		out_values.push_back((float)(bucket.sum / bucket.count));
+	});
+
+	const size_t inputCount = out_times.size();
+	const size_t outputCount = (size_t)point_count;
+	if (inputCount <= outputCount || outputCount < 3)
+	{
+		if (inputCount > outputCount)
+		{
+			// Too few points for triangles, keep the ends
+			out_times[outputCount - 1] = out_times[inputCount - 1];
+			out_values[outputCount - 1] = out_values[inputCount - 1];
+			out_times.resize(outputCount);
+			out_values.resize(outputCount);
+		}
+		return;
+	}
+
+	// Selected points are written over the input in place: output i always comes
+	// from input i or later, and nothing before the current bucket is read again
+	const double every = (double)(inputCount - 2) / (double)(outputCount - 2);
+	const double lastTime = out_times[inputCount - 1];
+	const float lastValue = out_values[inputCount - 1];
+	double aTime = out_times[0];
+	double aValue = out_values[0];
+
+	for (size_t i = 0; i < outputCount - 2; ++i)
+	{
+		// Average of the next bucket is the third corner of the triangle
+		const size_t nextStart = (size_t)std::floor((i + 1) * every) + 1;
+		const size_t nextEnd = std::min((size_t)std::floor((i + 2) * every) + 1, inputCount);
+		double nextTime = 0.0;
+		double nextValue = 0.0;
+		for (size_t j = nextStart; j < nextEnd; ++j)
+		{
+			nextTime += out_times[j];
+			nextValue += out_values[j];
+		}
+		nextTime /= (double)(nextEnd - nextStart);
+		nextValue /= (double)(nextEnd - nextStart);
+
+		const size_t rangeStart = (size_t)std::floor(i * every) + 1;
+		const size_t rangeEnd = (size_t)std::floor((i + 1) * every) + 1;
+		double maxArea = -1.0;
+		size_t maxIndex = rangeStart;
+		for (size_t j = rangeStart; j < rangeEnd; ++j)
+		{
+			const double area = std::fabs(
+				(aTime - nextTime) * (out_values[j] - aValue) -
+				(aTime - out_times[j]) * (nextValue - aValue));
+
+			if (area > maxArea)
+			{
+				maxArea = area;
+				maxIndex = j;
+			}
+		}
+
+		aTime = out_times[maxIndex];
+		aValue = out_values[maxIndex];
+		out_times[i + 1] = aTime;
+		out_values[i + 1] = (float)aValue;
+	}
+
+	out_times[outputCount - 1] = lastTime;
+	out_values[outputCount - 1] = lastValue;
+	out_times.resize(outputCount);
+	out_values.resize(outputCount);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef WAVEFORM_DOWNSAMPLER_H
+#define WAVEFORM_DOWNSAMPLER_H
+
+#include "SensorSource.h"
+
+#include <stdint.h>
+#include <vector>
+
+struct WaveformDownsamplerSettings
+{
+	WaveformDownsamplerSettings();
+
+	int channel;              // Sample channel to follow, e.g. 0 for ppgValue0 or x
+	double historySeconds;    // How far back queries can reach
+	double nominalSampleRate; // Used until the rate can be measured from frame times, 0 picks one for the stream
+};
+
+// Keeps the recent history of one channel of an ECG, PPG or Acc stream and serves it
+// downsampled for charts.
+//
+// Samples are kept raw, and also summarized into coarser levels (min, max, mean) where
+// each bucket covers 8 buckets of the level below. A query picks the coarsest level that
+// still has at least one bucket per output point, so its cost depends on the requested
+// width and not on the sample rate or time span.
+//
+// Attached as a SensorSourceListener; it watches the stream's buffer without flushing it.
+class WaveformDownsampler : public SensorSourceListener
+{
+public:
+	WaveformDownsampler(HSLSensorID sensor_id, HSLSensorBufferType buffer_type, const WaveformDownsamplerSettings &settings);
+
+	HSLSensorID GetSensorID() const { return m_watcher.GetSensorID(); }
+	HSLSensorBufferType GetBufferType() const { return m_watcher.GetBufferType(); }
+	const WaveformDownsamplerSettings &GetSettings() const { return m_settings; }
+
+	void OnSensorSourceUpdated(SensorSource &source) override;
+
+	// Appends count samples. last_sample_time is the time of values[count - 1].
+	void AddSamples(const float *values, int count, double last_sample_time);
+	void Reset();
+
+	bool HasSamples() const { return m_rawCount > 0; }
+	size_t GetSampleCount() const { return m_rawCount; }
+	size_t GetLevelCount() const { return m_levels.size() + 1; }
+	double GetOldestTime() const;
+	double GetLatestTime() const { return m_lastSampleTime; }
+	double GetSampleRate() const { return 1.0 / m_samplePeriod; }
+
+	// Min and max of the samples in each of width equal buckets between start_time and end_time.
+	// Buckets without samples are NaN.
+	void GetEnvelope(double start_time, double end_time, int width, float *out_min, float *out_max) const;
+
+	// Largest-Triangle-Three-Buckets reduction of the samples between start_time and end_time
+	// to at most point_count points
+	void GetLTTB(
+		double start_time,
+		double end_time,
+		int point_count,
+		std::vector<double> &out_times,
+		std::vector<float> &out_values) const;
+
+private:
+	struct Bucket
+	{
+		double startTime;
+		double endTime;
+		float minValue;
+		float maxValue;
+		double sum;
+		uint32_t count;    // Samples summarized
+		uint32_t children; // Buckets of the level below folded in so far
+	};
+
+	struct Level
+	{
+		std::vector<Bucket> buckets;
+		size_t head;   // Next slot to write
+		size_t count;
+		Bucket open;   // Still collecting children
+	};
+
+	void ClearHistory();
+	void AppendSample(double time, float value);
+	void FoldIntoLevel(size_t level_index, const Bucket &child);
+	void CloseOpenBuckets();
+
+	// Coarsest level with at most samples_per_point raw samples per bucket, 0 for raw samples
+	size_t ChooseLevel(double samples_per_point) const;
+
+	// Calls visit(Bucket) for every sample or bucket of the level overlapping [start_time, end_time),
+	// oldest first, including the partial buckets at the end of the coarser levels
+	template <typename F>
+	void VisitLevel(size_t level_index, double start_time, double end_time, F visit) const;
+
+	const WaveformDownsamplerSettings m_settings;
+	SensorBufferWatcher m_watcher;
+	std::vector<const void *> m_newFrames;
+	std::vector<float> m_frameValues;
+
+	// Raw samples, a power of two sized ring
+	std::vector<double> m_rawTimes;
+	std::vector<float> m_rawValues;
+	size_t m_rawHead;
+	size_t m_rawCount;
+
+	// m_levels[i] is level i + 1, buckets of 8^(i + 1) samples
+	std::vector<Level> m_levels;
+
+	double m_samplePeriod;
+	double m_lastSampleTime;
+};
+
+#endif // WAVEFORM_DOWNSAMPLER_H
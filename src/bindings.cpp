@@ -18,6 +18,40 @@
 #include "HSLClient_CAPI.h"
 #include "ClientConstants.h"
 
+#include "ECGBeatDetector.h"
+#include "HRVAnalyzer.h"
+#include "HSLLock.h"
+#include "PipelineStats.h"
+#include "SensorAlertEngine.h"
+#include "SensorAligner.h"
+#include "SensorFilterGraph.h"
+#include "SensorFrameBatch.h"
+#include "SensorHistory.h"
+#include "SensorPoller.h"
+#include "SensorSource.h"
+#include "SensorStreamConfig.h"
+#include "SensorStreamEncoding.h"
+#include "SensorStreamRing.h"
+#include "SessionRecorder.h"
+#include "SessionReplay.h"
+#include "SharedSampleRing.h"
+#include "WaveformDownsampler.h"
+
+#ifdef HSL_SIMULATOR
+#include "HSLSimulator.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
 #define REQ_ARGS(N)                                                     \
   if (info.Length() < (N)) {                                            \
     Napi::Error::New(info.Env(),                                        \
@@ -36,6 +70,18 @@
   }                                                                     \
   VAR = info[I].ToNumber();
 
+#define OPT_BOOL_ARG(I, VAR, DEFAULT)                                   \
+  bool VAR = (DEFAULT);                                                 \
+  if (info.Length() > (I) && !info[I].IsUndefined()) {                  \
+    if (!info[I].IsBoolean()) {                                         \
+      Napi::TypeError::New(info.Env(),                                  \
+        "Argument " #I " must be an boolean")                           \
+        .ThrowAsJavaScriptException();                                  \
+      return info.Env().Null();                                         \
+    }                                                                   \
+    VAR = info[I].ToBoolean();                                          \
+  }
+
 #define REQ_BOOL_ARG(I, VAR)                                            \
   bool VAR;                                                             \
   if (info.Length() <= (I) || !info[I].IsBoolean()) {                   \
@@ -46,19 +92,182 @@
   }                                                                     \
   VAR = info[I].ToBoolean();
 
+// Sensor wrappers kept across sensor list changes, so a connected sensor keeps one JS object,
+// and whatever the app attached to it, however often the list is read or rebuilt
+struct SensorCacheEntry
+{
+	Napi::ObjectReference wrapper;
+	HSLDeviceInformation deviceInformation; // As of the last getSensorChanges()
+	bool bReported;                         // getSensorChanges() has listed it as added
+};
+
+// Everything that belongs to one env: the main thread and every worker thread that loads
+// the addon get their own, stored as the env's instance data. The HSL core, its sensors
+// and the stream rings are shared by all of them.
+struct AddonData
+{
+	// Class constructors used to create wrappers from native code
+	Napi::FunctionReference bufferIteratorConstructor;
+	Napi::FunctionReference sensorConstructor;
+	Napi::FunctionReference sensorListConstructor;
+	Napi::FunctionReference streamRingConstructor;
+	Napi::FunctionReference streamRingCursorConstructor;
+	Napi::FunctionReference eventMessageConstructor;
+
+	std::map<HSLSensorID, SensorCacheEntry> sensorCache;
+
+	// Reused between calls so steady state polling and encoding don't allocate
+	std::vector<HSLEventMessage> eventMessageScratch;
+	std::vector<uint8_t> streamMessageScratch;
+};
+
+static AddonData &GetAddonData(Napi::Env env)
+{
+	return *env.GetInstanceData<AddonData>();
+}
+
+// HSL is initialized by the first env to load the addon and shut down when the last one
+// unloads. Only one env at a time runs the update loop, through update(), startPolling()
+// or ingestStreamRings(): the first to call one of them claims it until it unloads.
+// Both are guarded by the HSL lock.
+static int g_hslCoreRefCount = 0;
+static AddonData *g_updateOwner = nullptr;
+
+// Claims the update loop for the env if nobody owns it yet, the HSL lock must be held
+static bool ClaimUpdateLoop(AddonData &addon)
+{
+	if (g_updateOwner == nullptr)
+	{
+		g_updateOwner = &addon;
+	}
+
+	return g_updateOwner == &addon;
+}
+
+// Events belong to the update loop owner, or to anyone while there is none
+static bool CanPollEvents(AddonData &addon)
+{
+	return g_updateOwner == nullptr || g_updateOwner == &addon;
+}
+
+// While running, the background poller is the only caller of HSL_Update().
+// It is only ever started, stopped or queried from the update loop owner's thread.
+static SensorPoller g_sensorPoller;
+
+// Drains every pending event into plain {type, sensorId, timestamp} records, the HSL lock must be held.
+// HSL events don't name a sensor, so sensorId is -1. timestamp is when the event was drained, in
+// milliseconds since the epoch like Date.now(). With include_list_change a sensor list change that
+// didn't come with an event (e.g. switching to a replayed session) is reported as one too.
+static Napi::Array PollEventRecords(Napi::Env env, bool include_list_change)
+{
+	PipelineScopedTimer timer(PipelineTiming_PollEvents);
+	std::vector<HSLEventMessage> &messages = GetAddonData(env).eventMessageScratch;
+
+	SensorSource &source = GetSensorSource();
+	HSLEventMessage mesg;
+	bool bListUpdateSeen = false;
+
+	messages.clear();
+	while (source.PollNextMessage(&mesg))
+	{
+		bListUpdateSeen |= (mesg.event_type == HSLEvent_SensorListUpdated);
+		messages.push_back(mesg);
+	}
+
+	if (include_list_change && !bListUpdateSeen && HasSensorSourceListChanged())
+	{
+		mesg.event_type = HSLEvent_SensorListUpdated;
+		messages.push_back(mesg);
+	}
+
+	const double timestamp = (double)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	Napi::Array records = Napi::Array::New(env, messages.size());
+	for (size_t i = 0; i < messages.size(); ++i)
+	{
+		Napi::Object record = Napi::Object::New(env);
+		record.Set("type", (int)messages[i].event_type);
+		record.Set("sensorId", -1);
+		record.Set("timestamp", timestamp);
+
+		records.Set((uint32_t)i, record);
+	}
+
+	return records;
+}
+
+// update() returns whether HSL updated. update(true) also drains the event queue and returns
+// the events instead (see pollAllMessages), including sensor list changes, so a whole tick is
+// one call. Returns false, or null with events, while the background poller or another env
+// owns the update loop.
 Napi::Value Update(const Napi::CallbackInfo& info)
 {
-	return Napi::Boolean::New(info.Env(), HSL_Update());
+	Napi::Env env = info.Env();
+	const bool bReturnEvents = info.Length() >= 1 && info[0].ToBoolean();
+
+	HSLScopedLock hsl_lock;
+
+	if (!ClaimUpdateLoop(GetAddonData(env)) || g_sensorPoller.IsRunning())
+	{
+		return bReturnEvents ? env.Null() : Napi::Boolean::New(env, false);
+	}
+
+	// Like the poller, streams with a StreamRing attached go into their ring before anything drains them
+	const bool bUpdated = UpdateSensorSource(true);
+	GetSensorStreamRingRegistry().IngestAll();
+
+	if (bReturnEvents)
+	{
+		return PollEventRecords(env, true);
+	}
+
+	return Napi::Boolean::New(env, bUpdated);
+}
+
+// Every pending event as an array of plain records, see PollEventRecords
+Napi::Value PollAllMessages(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	HSLScopedLock hsl_lock;
+
+	if (!CanPollEvents(GetAddonData(env)))
+	{
+		return Napi::Array::New(env);
+	}
+
+	return PollEventRecords(env, false);
 }
 
 Napi::Value UpdateNoPollEvents(const Napi::CallbackInfo& info)
 {
-	return Napi::Boolean::New(info.Env(), HSL_UpdateNoPollEvents());
+	HSLScopedLock hsl_lock;
+
+	if (!ClaimUpdateLoop(GetAddonData(info.Env())) || g_sensorPoller.IsRunning())
+	{
+		return Napi::Boolean::New(info.Env(), false);
+	}
+
+	const bool bUpdated = UpdateSensorSource(false);
+	GetSensorStreamRingRegistry().IngestAll();
+
+	return Napi::Boolean::New(info.Env(), bUpdated);
+}
+
+// Whether this env runs the update loop. False in a worker while another env does, or before
+// this env has called update(), startPolling() or ingestStreamRings() for the first time.
+Napi::Value IsUpdateOwner(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	return Napi::Boolean::New(info.Env(), g_updateOwner == &GetAddonData(info.Env()));
 }
 
 Napi::Value HasSensorListChanged(const Napi::CallbackInfo& info)
 {
-	return Napi::Boolean::New(info.Env(), HSL_HasSensorListChanged());
+	HSLScopedLock hsl_lock;
+
+	return Napi::Boolean::New(info.Env(), HasSensorSourceListChanged());
 }
 
 Napi::Value GetVersionString(const Napi::CallbackInfo& info)
@@ -71,6 +280,75 @@ Napi::Value GetVersionString(const Napi::CallbackInfo& info)
 	return Napi::String::From(info.Env(), version_string);
 }
 
+#ifdef HSL_SIMULATOR
+Napi::Value GetSimulatorSettings(const Napi::CallbackInfo& info)
+{
+	HSLSimulatorSettings settings;
+
+	{
+		HSLScopedLock hsl_lock;
+		HSLSim_GetSettings(settings);
+	}
+
+	Napi::Object obj = Napi::Object::New(info.Env());
+	obj.Set("sensorCount", settings.sensorCount);
+	obj.Set("capabilities", settings.capabilities);
+	obj.Set("ecgSampleRate", settings.ecgSampleRate);
+	obj.Set("ppgSampleRate", settings.ppgSampleRate);
+	obj.Set("accSampleRate", settings.accSampleRate);
+	obj.Set("hrFrameRate", settings.hrFrameRate);
+	obj.Set("ppiSamplesPerFrame", settings.ppiSamplesPerFrame);
+	obj.Set("heartRate", settings.heartRate);
+	obj.Set("frameJitterMs", settings.frameJitterMs);
+	obj.Set("randomSeed", settings.randomSeed);
+
+	return obj;
+}
+
+// setSimulatorSettings({...}) only changes the fields that are given
+Napi::Value SetSimulatorSettings(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+
+	if (info.Length() < 1 || !info[0].IsObject())
+	{
+		Napi::TypeError::New(env, "Expected a settings object").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Napi::Object options = info[0].As<Napi::Object>();
+	HSLScopedLock hsl_lock;
+
+	HSLSimulatorSettings settings;
+	HSLSim_GetSettings(settings);
+
+	if (options.Has("sensorCount"))
+		settings.sensorCount = options.Get("sensorCount").ToNumber().Int32Value();
+	if (options.Has("capabilities"))
+		settings.capabilities = options.Get("capabilities").ToNumber().Uint32Value();
+	if (options.Has("ecgSampleRate"))
+		settings.ecgSampleRate = options.Get("ecgSampleRate").ToNumber().FloatValue();
+	if (options.Has("ppgSampleRate"))
+		settings.ppgSampleRate = options.Get("ppgSampleRate").ToNumber().FloatValue();
+	if (options.Has("accSampleRate"))
+		settings.accSampleRate = options.Get("accSampleRate").ToNumber().FloatValue();
+	if (options.Has("hrFrameRate"))
+		settings.hrFrameRate = options.Get("hrFrameRate").ToNumber().FloatValue();
+	if (options.Has("ppiSamplesPerFrame"))
+		settings.ppiSamplesPerFrame = options.Get("ppiSamplesPerFrame").ToNumber().Int32Value();
+	if (options.Has("heartRate"))
+		settings.heartRate = options.Get("heartRate").ToNumber().FloatValue();
+	if (options.Has("frameJitterMs"))
+		settings.frameJitterMs = options.Get("frameJitterMs").ToNumber().FloatValue();
+	if (options.Has("randomSeed"))
+		settings.randomSeed = options.Get("randomSeed").ToNumber().Uint32Value();
+
+	HSLSim_SetSettings(settings);
+
+	return env.Undefined();
+}
+#endif // HSL_SIMULATOR
+
 class BufferIterator : public Napi::ObjectWrap<BufferIterator>
 {
 public:
@@ -79,7 +357,7 @@ public:
 	{
 		if (info.Length() >= 1 && info[0].IsExternal())
 		{
-			Napi::External<HSLBufferIterator> inBufferIter = info[0].As<Napi::External<HSLBufferIterator>>();
+			Napi::External<SensorBufferIterator> inBufferIter = info[0].As<Napi::External<SensorBufferIterator>>();
 
 			m_iterator = *inBufferIter.Data();
 		}
@@ -90,21 +368,25 @@ public:
 	}
 
 	// Create a new item using the constructor stored during Init.
-	static Napi::Value CreateNewIterator(const Napi::CallbackInfo& info, HSLBufferIterator &iter)
+	static Napi::Value CreateNewIterator(const Napi::CallbackInfo& info, SensorBufferIterator &iter)
 	{
-		return constructor.New({Napi::External<HSLBufferIterator>::New(info.Env(), &iter)});
+		return GetAddonData(info.Env()).bufferIteratorConstructor.New({Napi::External<SensorBufferIterator>::New(info.Env(), &iter)});
 	}
 
 	Napi::Value IsValid(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		return Napi::Boolean::New(env, HSL_IsBufferIteratorValid(&m_iterator));
+		return Napi::Boolean::New(env, IsSensorBufferIteratorValid(m_iterator));
 	}
 
 	Napi::Value Next(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		return Napi::Boolean::New(env, HSL_BufferIteratorNext(&m_iterator));
+		return Napi::Boolean::New(env, SensorBufferIteratorNext(m_iterator));
 	}
 
 	Napi::Value GetDataType(const Napi::CallbackInfo& info) // HSLSensorBufferType
@@ -115,8 +397,10 @@ public:
 
 	Napi::Value GetHRData(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		HSLHeartRateFrame *frame= HSL_BufferIteratorGetHRData(&m_iterator);
+		const HSLHeartRateFrame *frame= static_cast<const HSLHeartRateFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_HRData));
 		if (frame == nullptr)
 		{
 			Napi::TypeError::New(env, "BufferIterator data is not valid HRData").ThrowAsJavaScriptException();                                    
@@ -141,8 +425,10 @@ public:
 
 	Napi::Value GetECGData(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		HSLHeartECGFrame *frame= HSL_BufferIteratorGetECGData(&m_iterator);
+		const HSLHeartECGFrame *frame= static_cast<const HSLHeartECGFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_ECGData));
 		if (frame == nullptr)
 		{
 			Napi::TypeError::New(info.Env(), "BufferIterator data is not valid ECGData").ThrowAsJavaScriptException();
@@ -164,8 +450,10 @@ public:
 
 	Napi::Value GetPPGData(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		HSLHeartPPGFrame *frame= HSL_BufferIteratorGetPPGData(&m_iterator);
+		const HSLHeartPPGFrame *frame= static_cast<const HSLHeartPPGFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_PPGData));
 		if (frame == nullptr)
 		{
 			Napi::TypeError::New(info.Env(), "BufferIterator data is not valid PPGData").ThrowAsJavaScriptException();
@@ -193,10 +481,55 @@ public:
 		return obj;
 	}
 
+	// Columnar alternative to GetPPGData: one Int32Array per PPG channel,
+	// all views over a single ArrayBuffer
+	Napi::Value GetPPGColumns(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		Napi::Env env = info.Env();
+		const HSLHeartPPGFrame *frame= static_cast<const HSLHeartPPGFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_PPGData));
+		if (frame == nullptr)
+		{
+			Napi::TypeError::New(info.Env(), "BufferIterator data is not valid PPGData").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		const size_t sampleCount = frame->ppgSampleCount;
+		Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, 4 * sampleCount * sizeof(int32_t));
+		int32_t *ppgValue0 = static_cast<int32_t *>(buffer.Data());
+		int32_t *ppgValue1 = ppgValue0 + sampleCount;
+		int32_t *ppgValue2 = ppgValue1 + sampleCount;
+		int32_t *ambient = ppgValue2 + sampleCount;
+
+		for (size_t i = 0; i < sampleCount; ++i)
+		{
+			const HSLHeartPPGSample &ppgSample= frame->ppgSamples[i];
+
+			ppgValue0[i] = ppgSample.ppgValue0;
+			ppgValue1[i] = ppgSample.ppgValue1;
+			ppgValue2[i] = ppgSample.ppgValue2;
+			ambient[i] = ppgSample.ambient;
+		}
+
+		const size_t columnBytes = sampleCount * sizeof(int32_t);
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("ppgValue0", Napi::Int32Array::New(env, sampleCount, buffer, 0, napi_int32_array));
+		obj.Set("ppgValue1", Napi::Int32Array::New(env, sampleCount, buffer, columnBytes, napi_int32_array));
+		obj.Set("ppgValue2", Napi::Int32Array::New(env, sampleCount, buffer, 2 * columnBytes, napi_int32_array));
+		obj.Set("ambient", Napi::Int32Array::New(env, sampleCount, buffer, 3 * columnBytes, napi_int32_array));
+		obj.Set("timeInSeconds", frame->timeInSeconds);
+
+		return obj;
+	}
+
 	Napi::Value GetPPIData(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		HSLHeartPPIFrame *frame= HSL_BufferIteratorGetPPIData(&m_iterator);
+		const HSLHeartPPIFrame *frame= static_cast<const HSLHeartPPIFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_PPIData));
 		if (frame == nullptr)
 		{
 			Napi::TypeError::New(info.Env(), "BufferIterator data is not valid PPIData").ThrowAsJavaScriptException();
@@ -228,8 +561,10 @@ public:
 
 	Napi::Value GetAccData(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		HSLAccelerometerFrame *frame= HSL_BufferIteratorGetAccData(&m_iterator);
+		const HSLAccelerometerFrame *frame= static_cast<const HSLAccelerometerFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_AccData));
 		if (frame == nullptr)
 		{
 			Napi::TypeError::New(env, "BufferIterator data is not valid AccData").ThrowAsJavaScriptException();
@@ -256,10 +591,63 @@ public:
 		return obj;
 	}
 
+	// Columnar alternative to GetAccData: x/y/z Float32Array columns, or with
+	// `interleaved` set a single Float32Array copied straight from the HSLVector3f samples
+	Napi::Value GetAccColumns(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		OPT_BOOL_ARG(0, interleaved, false);
+
+		Napi::Env env = info.Env();
+		const HSLAccelerometerFrame *frame= static_cast<const HSLAccelerometerFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_AccData));
+		if (frame == nullptr)
+		{
+			Napi::TypeError::New(env, "BufferIterator data is not valid AccData").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		const size_t sampleCount = frame->accSampleCount;
+		Napi::Object obj = Napi::Object::New(env);
+
+		if (interleaved)
+		{
+			auto accSamples = Napi::Float32Array::New(env, 3 * sampleCount, napi_float32_array);
+			memcpy(accSamples.Data(), frame->accSamples, sampleCount * sizeof(HSLVector3f));
+
+			obj.Set("accSamples", accSamples);
+		}
+		else
+		{
+			Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, 3 * sampleCount * sizeof(float));
+			float *x = static_cast<float *>(buffer.Data());
+			float *y = x + sampleCount;
+			float *z = y + sampleCount;
+
+			for (size_t i = 0; i < sampleCount; ++i)
+			{
+				x[i] = frame->accSamples[i].x;
+				y[i] = frame->accSamples[i].y;
+				z[i] = frame->accSamples[i].z;
+			}
+
+			const size_t columnBytes = sampleCount * sizeof(float);
+
+			obj.Set("x", Napi::Float32Array::New(env, sampleCount, buffer, 0, napi_float32_array));
+			obj.Set("y", Napi::Float32Array::New(env, sampleCount, buffer, columnBytes, napi_float32_array));
+			obj.Set("z", Napi::Float32Array::New(env, sampleCount, buffer, 2 * columnBytes, napi_float32_array));
+		}
+		obj.Set("timeInSeconds", frame->timeInSeconds);
+
+		return obj;
+	}
+
 	Napi::Value GetHrvData(const Napi::CallbackInfo& info)
 	{
+		HSLScopedLock hsl_lock;
+
 		Napi::Env env = info.Env();
-		HSLHeartVariabilityFrame *frame= HSL_BufferIteratorGetHRVData(&m_iterator);
+		const HSLHeartVariabilityFrame *frame= static_cast<const HSLHeartVariabilityFrame *>(GetSensorBufferFrame(m_iterator, HSLBufferType_HRVData));
 		if (frame == nullptr)
 		{
 			Napi::TypeError::New(env, "BufferIterator data is not valid HrvData").ThrowAsJavaScriptException();
@@ -284,8 +672,10 @@ public:
 			InstanceMethod("getHRData", &BufferIterator::GetHRData),
 			InstanceMethod("getECGData", &BufferIterator::GetECGData),
 			InstanceMethod("getPPGData", &BufferIterator::GetPPGData),
+			InstanceMethod("getPPGColumns", &BufferIterator::GetPPGColumns),
 			InstanceMethod("getPPIData", &BufferIterator::GetPPIData),
 			InstanceMethod("getAccData", &BufferIterator::GetAccData),
+			InstanceMethod("getAccColumns", &BufferIterator::GetAccColumns),
 			InstanceMethod("getHrvData", &BufferIterator::GetHrvData),
 			// HSLContactSensorStatus
 			StaticValue("BufferType_HRData", Napi::Number::New(env, HSLBufferType_HRData)),
@@ -296,539 +686,4227 @@ public:
 			StaticValue("BufferType_HRVData", Napi::Number::New(env, HSLBufferType_HRVData)),
 		});
 
-		constructor = Napi::Persistent(ctor);
-		constructor.SuppressDestruct();
+		GetAddonData(env).bufferIteratorConstructor = Napi::Persistent(ctor);
 		exports.Set("BufferIterator", ctor);
 	}
 
 private:
-	static Napi::FunctionReference constructor;
-
-	HSLBufferIterator m_iterator;
+	SensorBufferIterator m_iterator;
 };
-Napi::FunctionReference BufferIterator::constructor;
 
-class Sensor : public Napi::ObjectWrap<Sensor>
+// Wraps a packed sensor buffer (see SensorFrameLayout) in typed array views
+// that all share the one ArrayBuffer
+Napi::Object CreateSensorFrameBatch(
+	Napi::Env env,
+	HSLSensorID sensor_id,
+	const SensorFrameLayout &layout,
+	Napi::ArrayBuffer buffer,
+	HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN)
 {
-public:
-	Sensor(const Napi::CallbackInfo& info)
-		: Napi::ObjectWrap<Sensor>(info)
-	{
-		if (info.Length() >= 1 && info[0].IsExternal())
-		{
-			m_sensor = info[0].As<Napi::External<HSLSensor>>().Data();
-		}
-		else
-		{
-			Napi::TypeError::New(info.Env(), "Argument 0 invalid").ThrowAsJavaScriptException();
-		}
-	}
-
-	// Create a new item using the constructor stored during Init.
-	static Napi::Value CreateNewSensor(const Napi::CallbackInfo& info, HSLSensorID sensor_id)
+	const size_t frameCount = layout.frameCount;
+	const size_t sampleValueCount = layout.sampleCount * layout.sampleWidth;
+
+	Napi::Object obj = Napi::Object::New(env);
+	obj.Set("sensorId", sensor_id);
+	obj.Set("bufferType", (int)layout.bufferType);
+	obj.Set("frameCount", (double)frameCount);
+	obj.Set("sampleCount", (double)layout.sampleCount);
+	obj.Set("sampleWidth", layout.sampleWidth);
+	obj.Set("timeInSeconds", Napi::Float64Array::New(env, frameCount, buffer, layout.frameTimesOffset, napi_float64_array));
+	obj.Set("frameOffsets", Napi::Uint32Array::New(env, frameCount + 1, buffer, layout.frameOffsetsOffset, napi_uint32_array));
+
+	if (layout.bufferType == HSLBufferType_HRVData)
 	{
-		// Retrieve the instance data we stored during `Init()`. We only stored the
-		// constructor there, so we retrieve it here to create a new instance of the
-		// JS class the constructor represents.
-		Napi::Env env = info.Env();
-
-		// Fetch the sensor pointer by sensor id
-		HSLSensor* sensor = HSL_GetSensor(sensor_id);
-
-		return 
-			(sensor != nullptr)
-			? constructor.New({Napi::External<HSLSensor>::New(env, sensor)})
-			: env.Null();
+		obj.Set("hrvFilter", (int)hrv_filter);
 	}
 
-	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	if (layout.bufferType == HSLBufferType_HRData)
 	{
-		return Napi::Number::New(info.Env(), GetSensor()->sensorID);
+		const size_t columnBytes = frameCount * sizeof(int32_t);
+
+		obj.Set("beatsPerMinute", Napi::Int32Array::New(
+			env, frameCount, buffer, layout.frameValuesOffset + HRFrameValue_BeatsPerMinute * columnBytes, napi_int32_array));
+		obj.Set("contactStatus", Napi::Int32Array::New(
+			env, frameCount, buffer, layout.frameValuesOffset + HRFrameValue_ContactStatus * columnBytes, napi_int32_array));
+		obj.Set("energyExpended", Napi::Int32Array::New(
+			env, frameCount, buffer, layout.frameValuesOffset + HRFrameValue_EnergyExpended * columnBytes, napi_int32_array));
 	}
 
-	Napi::Value GetHeartRateBPM(const Napi::CallbackInfo& info)
+	if (layout.bFloatSamples)
 	{
-		int BPM= GetSensor()->beatsPerMinute;
-
-		return Napi::Number::New(info.Env(), BPM);
+		obj.Set("samples", Napi::Float32Array::New(env, sampleValueCount, buffer, layout.samplesOffset, napi_float32_array));
 	}
-
-	Napi::Value GetDeviceBodyLocation(const Napi::CallbackInfo& info)
+	else
 	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.bodyLocation);
+		obj.Set("samples", Napi::Int32Array::New(env, sampleValueCount, buffer, layout.samplesOffset, napi_int32_array));
 	}
 
-	Napi::Value HasCapability(const Napi::CallbackInfo& info)
+	// Planar batches also get a named view per channel, e.g. ppgValue0 or x
+	obj.Set("planar", layout.bPlanarSamples);
+	if (layout.bPlanarSamples && layout.sampleWidth > 1)
 	{
-		REQ_ARGS(1);
-		REQ_INT_ARG(0, data_stream_type);
-		
-		bool bHasCapability = false;
+		const size_t columnBytes = layout.sampleCount * sizeof(int32_t);
 
-		if (data_stream_type >= 0 && data_stream_type < HSLStreamFlags_COUNT)
+		for (int channel = 0; channel < layout.sampleWidth; ++channel)
 		{
-			bHasCapability = HSL_BITMASK_GET_FLAG(GetSensor()->deviceInformation.capabilities, data_stream_type);
-		}
+			const char *channelName = GetSensorSampleChannelName(layout.bufferType, channel);
+			const size_t columnOffset = layout.samplesOffset + channel * columnBytes;
 
-		return Napi::Boolean::New(info.Env(), bHasCapability);
+			if (layout.bFloatSamples)
+			{
+				obj.Set(channelName, Napi::Float32Array::New(env, layout.sampleCount, buffer, columnOffset, napi_float32_array));
+			}
+			else
+			{
+				obj.Set(channelName, Napi::Int32Array::New(env, layout.sampleCount, buffer, columnOffset, napi_int32_array));
+			}
+		}
 	}
 
-	Napi::Value GetDeviceFriendlyName(const Napi::CallbackInfo& info)
-	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.deviceFriendlyName);
-	}
+	return obj;
+}
 
-	Napi::Value GetDevicePath(const Napi::CallbackInfo& info)
-	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.devicePath);
-	}
+// Copies every frame in an HSL sensor buffer into one ArrayBuffer and flushes the HSL buffer.
+// Returns null if the buffer was empty. Planar batches store one column per sample channel.
+Napi::Value DrainSensorBuffer(
+	Napi::Env env,
+	HSLSensorID sensor_id,
+	HSLSensorBufferType buffer_type,
+	bool planar_samples = false,
+	HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN)
+{
+	PipelineScopedTimer timer(PipelineTiming_Drain);
+	HSLScopedLock hsl_lock;
 
-	Napi::Value GetFirmwareRevisionString(const Napi::CallbackInfo& info)
+	// A stream with a StreamRing attached belongs to the ring, so it is fed the frames instead
+	std::shared_ptr<SensorStreamRing> ring = GetSensorStreamRingRegistry().FindRing(sensor_id, buffer_type, hrv_filter);
+	if (ring)
 	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.firmwareRevisionString);
+		ring->IngestSensorBuffer();
+		return env.Null();
 	}
 
-	Napi::Value GetHardwareRevisionString(const Napi::CallbackInfo& info)
-	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.hardwareRevisionString);
-	}
+	SensorBufferIterator iter = GetSensorBufferIterator(sensor_id, buffer_type, hrv_filter);
 
-	Napi::Value GetManufacturerNameString(const Napi::CallbackInfo& info)
+	SensorFrameLayout layout;
+	if (!MeasureSensorBuffer(iter, layout, planar_samples) || layout.frameCount == 0)
 	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.manufacturerNameString);
+		return env.Null();
 	}
 
-	Napi::Value GetModelNumberString(const Napi::CallbackInfo& info)
-	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.modelNumberString);
-	}
+	Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, layout.byteLength);
+	PackSensorBuffer(iter, layout, static_cast<uint8_t *>(buffer.Data()));
+	FlushSensorBuffer(sensor_id, buffer_type, hrv_filter);
 
-	Napi::Value GetSerialNumberString(const Napi::CallbackInfo& info)
+	const double frameAgeMs = GetPipelineStats().RecordDrain(sensor_id, layout, static_cast<const uint8_t *>(buffer.Data()));
+	const double drainedAt = (double)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	Napi::Object batch = CreateSensorFrameBatch(env, sensor_id, layout, buffer, hrv_filter);
+	batch.Set("frameAgeMs", frameAgeMs);
+	batch.Set("drainedAt", drainedAt);
+
+	return batch;
+}
+
+// Hands a natively staged batch over to JS without copying it again
+Napi::Object CreateSensorFrameBatch(Napi::Env env, SensorFrameBatch &batch)
+{
+	const SensorFrameLayout &layout = batch.GetLayout();
+	Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(
+		env,
+		batch.ReleaseData(),
+		layout.byteLength,
+		[](Napi::Env, void *data) { free(data); });
+
+	Napi::Object obj = CreateSensorFrameBatch(env, batch.GetSensorID(), layout, buffer, batch.GetHrvFilter());
+	obj.Set("frameAgeMs", batch.GetFrameAgeMs());
+	obj.Set("drainedAt", batch.GetDrainedAt());
+
+	return obj;
+}
+
+// A frame or sample count of a batch object, false unless it is an integer in [0, max_count]
+static bool ReadBatchCount(Napi::Value value, size_t max_count, size_t &out_count)
+{
+	const double count = value.ToNumber().DoubleValue();
+	if (!(count >= 0.0) || count != std::floor(count) || count > (double)max_count)
 	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.serialNumberString);
+		return false;
 	}
 
-	Napi::Value GetSoftwareRevisionString(const Napi::CallbackInfo& info)
+	out_count = (size_t)count;
+	return true;
+}
+
+// Finds the packed block behind a batch returned by any of the drain/poll/ring APIs.
+// Every view of a batch shares one ArrayBuffer that starts with the frame times.
+// Throws and returns false if the object isn't a batch or its views don't match its counts.
+static bool GetSensorFrameBatchBlock(
+	Napi::Env env,
+	Napi::Value value,
+	SensorFrameLayout &out_layout,
+	const uint8_t *&out_data,
+	HSLSensorID &out_sensor_id,
+	HSLHeartRateVariabityFilterType &out_hrv_filter)
+{
+	if (!value.IsObject())
 	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.softwareRevisionString);
+		Napi::TypeError::New(env, "Expected a sensor frame batch").ThrowAsJavaScriptException();
+		return false;
 	}
 
-	Napi::Value GetSystemIdString(const Napi::CallbackInfo& info)
+	Napi::Object batch = value.As<Napi::Object>();
+	Napi::Value times = batch.Get("timeInSeconds");
+	if (!times.IsTypedArray() ||
+		!batch.Get("bufferType").IsNumber() ||
+		!batch.Get("frameCount").IsNumber() ||
+		!batch.Get("sampleCount").IsNumber())
 	{
-		return Napi::String::New(info.Env(), GetSensor()->deviceInformation.systemID);
+		Napi::TypeError::New(env, "Expected a sensor frame batch").ThrowAsJavaScriptException();
+		return false;
 	}
 
-	Napi::Value GetHeartRateBuffer(const Napi::CallbackInfo& info)
-	{
-		HSLSensorID sensor_id= GetSensor()->sensorID;
-		HSLBufferIterator iter = HSL_GetHeartRateBuffer(sensor_id);
+	Napi::TypedArray timeView = times.As<Napi::TypedArray>();
+	Napi::ArrayBuffer buffer = timeView.ArrayBuffer();
 
-		return BufferIterator::CreateNewIterator(info, iter);
+	// Counts larger than the buffer could hold can't be right, and bounding them keeps the layout small
+	const HSLSensorBufferType bufferType = (HSLSensorBufferType)batch.Get("bufferType").ToNumber().Int32Value();
+	const bool bPlanar = batch.Get("planar").ToBoolean();
+	size_t frameCount, sampleCount;
+	if (!ReadBatchCount(batch.Get("frameCount"), buffer.ByteLength() / sizeof(double), frameCount) ||
+		!ReadBatchCount(batch.Get("sampleCount"), buffer.ByteLength() / sizeof(int32_t), sampleCount))
+	{
+		Napi::RangeError::New(env, "Batch frame and sample counts must be integers that fit its buffer").ThrowAsJavaScriptException();
+		return false;
 	}
 
-	Napi::Value GetHeartECGBuffer(const Napi::CallbackInfo& info)
+	if (!ComputeSensorFrameLayout(bufferType, frameCount, sampleCount, out_layout, bPlanar))
 	{
-		HSLSensorID sensor_id= GetSensor()->sensorID;
-		HSLBufferIterator iter = HSL_GetHeartECGBuffer(sensor_id);
-
-		return BufferIterator::CreateNewIterator(info, iter);
+		Napi::TypeError::New(env, "Batch buffer type has no packed format").ThrowAsJavaScriptException();
+		return false;
 	}
 
-	Napi::Value GetHeartPPGBuffer(const Napi::CallbackInfo& info)
+	const size_t blockOffset = timeView.ByteOffset() - out_layout.frameTimesOffset;
+	if (timeView.ByteOffset() < out_layout.frameTimesOffset || out_layout.byteLength > buffer.ByteLength() - blockOffset)
 	{
-		HSLSensorID sensor_id= GetSensor()->sensorID;
-		HSLBufferIterator iter = HSL_GetHeartPPGBuffer(sensor_id);
-
-		return BufferIterator::CreateNewIterator(info, iter);
+		Napi::TypeError::New(env, "Batch views don't match its frame and sample counts").ThrowAsJavaScriptException();
+		return false;
 	}
 
-	Napi::Value GetHeartPPIBuffer(const Napi::CallbackInfo& info)
-	{
-		HSLSensorID sensor_id= GetSensor()->sensorID;
-		HSLBufferIterator iter = HSL_GetHeartPPIBuffer(sensor_id);
+	out_data = static_cast<const uint8_t *>(buffer.Data()) + blockOffset;
+	out_sensor_id = batch.Get("sensorId").ToNumber().Int32Value();
+	out_hrv_filter = batch.Has("hrvFilter")
+		? (HSLHeartRateVariabityFilterType)batch.Get("hrvFilter").ToNumber().Int32Value()
+		: HRVFilter_SDNN;
 
-		return BufferIterator::CreateNewIterator(info, iter);
-	}
+	return true;
+}
 
-	Napi::Value GetHeartAccBuffer(const Napi::CallbackInfo& info)
-	{
-		HSLSensorID sensor_id= GetSensor()->sensorID;
-		HSLBufferIterator iter = HSL_GetHeartAccBuffer(sensor_id);
+// Delta encodes a batch into the binary stream format (see SensorStreamEncoding.h).
+// Returns a Buffer ready to send as is.
+Napi::Value EncodeSensorFrameBatch(const Napi::CallbackInfo& info)
+{
+	PipelineScopedTimer timer(PipelineTiming_Encode);
+	Napi::Env env = info.Env();
+	REQ_ARGS(1);
 
-		return BufferIterator::CreateNewIterator(info, iter);
+	SensorFrameLayout layout;
+	const uint8_t *data;
+	HSLSensorID sensorID;
+	HSLHeartRateVariabityFilterType hrvFilter;
+	if (!GetSensorFrameBatchBlock(env, info[0], layout, data, sensorID, hrvFilter))
+	{
+		return env.Null();
 	}
 
-	Napi::Value GetHeartHrvBuffer(const Napi::CallbackInfo& info)
-	{
-		REQ_ARGS(1);
-		REQ_INT_ARG(0, filter_type);
+	std::vector<uint8_t> &message = GetAddonData(env).streamMessageScratch;
+	EncodeSensorStreamMessage(layout, data, sensorID, hrvFilter, message);
 
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		HSLBufferIterator iter = HSL_GetHeartHrvBuffer(sensor_id, (HSLHeartRateVariabityFilterType)filter_type);
+	return Napi::Buffer<uint8_t>::Copy(env, message.data(), message.size());
+}
 
-		return BufferIterator::CreateNewIterator(info, iter);
+// decimateSensorFrameBatch(batch, step, phase) returns a new batch keeping every step-th
+// sample of an ECG, PPG or Acc batch, starting where (phase + i) % step == 0.
+// Pass (phase + batch.sampleCount) % step as the phase of the next batch of the same stream.
+Napi::Value DecimateSensorFrameBatch(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	REQ_ARGS(3);
+	REQ_INT_ARG(1, step);
+	REQ_INT_ARG(2, phase);
+
+	SensorFrameLayout layout;
+	const uint8_t *data;
+	HSLSensorID sensorID;
+	HSLHeartRateVariabityFilterType hrvFilter;
+	if (!GetSensorFrameBatchBlock(env, info[0], layout, data, sensorID, hrvFilter))
+	{
+		return env.Null();
 	}
 
-	Napi::Value FlushHeartRateBuffer(const Napi::CallbackInfo& info)
+	if (!IsSensorWaveformBuffer(layout.bufferType))
 	{
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		bool bSuccess= HSL_FlushHeartRateBuffer(sensor_id);
-
-		return Napi::Boolean::New(info.Env(), bSuccess);
+		Napi::TypeError::New(env, "Only ECG, PPG and Acc batches can be decimated").ThrowAsJavaScriptException();
+		return env.Null();
 	}
 
-	Napi::Value FlushHeartECGBuffer(const Napi::CallbackInfo& info)
+	if (step < 1 || phase < 0)
 	{
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		bool bSuccess= HSL_FlushHeartECGBuffer(sensor_id);
-
-		return Napi::Boolean::New(info.Env(), bSuccess);
+		Napi::RangeError::New(env, "step must be at least 1 and phase non-negative").ThrowAsJavaScriptException();
+		return env.Null();
 	}
 
-	Napi::Value FlushHeartPPGBuffer(const Napi::CallbackInfo& info)
-	{
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		bool bSuccess= HSL_FlushHeartPPGBuffer(sensor_id);
+	SensorFrameLayout decimatedLayout;
+	MeasureDecimatedSensorFrames(layout, step, phase % step, decimatedLayout);
 
-		return Napi::Boolean::New(info.Env(), bSuccess);
+	Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, decimatedLayout.byteLength);
+	DecimateSensorFrames(layout, data, step, phase % step, decimatedLayout, static_cast<uint8_t *>(buffer.Data()));
+
+	return CreateSensorFrameBatch(env, sensorID, decimatedLayout, buffer, hrvFilter);
+}
+
+class Sensor : public Napi::ObjectWrap<Sensor>
+{
+public:
+	Sensor(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<Sensor>(info)
+		, m_sensorID(-1)
+		, m_sourceGeneration(0)
+		, m_bDetached(true)
+	{
+		if (info.Length() >= 1 && info[0].IsExternal())
+		{
+			m_sensorID = info[0].As<Napi::External<HSLSensor>>().Data()->sensorID;
+			m_sourceGeneration = GetSensorSourceGeneration();
+			m_bDetached = false;
+		}
+		else
+		{
+			Napi::TypeError::New(info.Env(), "Argument 0 invalid").ThrowAsJavaScriptException();
+		}
 	}
 
-	Napi::Value FlushHeartPPIBuffer(const Napi::CallbackInfo& info)
+	// Returns the cached wrapper for the sensor (see AddonData::sensorCache), creating it on first use
+	static Napi::Value CreateNewSensor(const Napi::CallbackInfo& info, HSLSensorID sensor_id)
 	{
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		bool bSuccess= HSL_FlushHeartPPIBuffer(sensor_id);
+		HSLScopedLock hsl_lock;
 
-		return Napi::Boolean::New(info.Env(), bSuccess);
+		Napi::Env env = info.Env();
+
+		// Fetch the sensor pointer by sensor id
+		HSLSensor* sensor = GetSensorSource().GetSensor(sensor_id);
+
+		return
+			(sensor != nullptr)
+			? GetCachedSensor(env, sensor)
+			: env.Null();
 	}
 
-	Napi::Value FlushHeartAccBuffer(const Napi::CallbackInfo& info)
+	// The one wrapper kept for a sensor id while it stays connected. Call with the HSL lock held.
+	static Napi::Object GetCachedSensor(Napi::Env env, HSLSensor *sensor, bool *out_created = nullptr);
+
+	// Called once the sensor has left the cache: it disconnected, or the source it came from
+	// was replaced. From then on every getter returns null and every action fails.
+	void Detach()
 	{
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		bool bSuccess= HSL_FlushHeartAccBuffer(sensor_id);
+		m_bDetached = true;
+		m_deviceInfo.Reset();
+	}
 
-		return Napi::Boolean::New(info.Env(), bSuccess);
+	// False once detached or once the source the sensor came from was switched away.
+	// Call with the HSL lock held.
+	bool IsAttached() const
+	{
+		return !m_bDetached && m_sourceGeneration == GetSensorSourceGeneration();
 	}
 
-	Napi::Value FlushtHeartHrvBuffer(const Napi::CallbackInfo& info)
+	bool IsAttachedLocked() const
+	{
+		HSLScopedLock hsl_lock;
+
+		return IsAttached();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_sensorID);
+	}
+
+	Napi::Value GetHeartRateBPM(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		const HSLSensor *sensor = GetSensor();
+		if (sensor == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		int BPM= sensor->beatsPerMinute;
+
+		return Napi::Number::New(info.Env(), BPM);
+	}
+
+	Napi::Value GetDeviceBodyLocation(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::bodyLocation);
+	}
+
+	Napi::Value HasCapability(const Napi::CallbackInfo& info)
+	{
+		REQ_ARGS(1);
+		REQ_INT_ARG(0, data_stream_type);
+
+		HSLScopedLock hsl_lock;
+		const HSLSensor *sensor = GetSensor();
+		bool bHasCapability = false;
+
+		if (sensor != nullptr && data_stream_type >= 0 && data_stream_type < HSLStreamFlags_COUNT)
+		{
+			bHasCapability = HSL_BITMASK_GET_FLAG(sensor->deviceInformation.capabilities, data_stream_type);
+		}
+
+		return Napi::Boolean::New(info.Env(), bHasCapability);
+	}
+
+	// getDeviceInfo() returns every device information field plus the capability bitmask as one
+	// frozen object. It is built once and handed out again until the sensor list is read again,
+	// through getSensorList() or getSensorChanges(), and the sensor's device information has
+	// changed. Null once the sensor is gone.
+	Napi::Value GetDeviceInfo(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+
+		if (!m_deviceInfo.IsEmpty())
+		{
+			return m_deviceInfo.Value();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		const HSLSensor *sensor = GetSensor();
+		if (sensor == nullptr)
+		{
+			return env.Null();
+		}
+
+		const HSLDeviceInformation &deviceInformation = sensor->deviceInformation;
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("sensorId", sensor->sensorID);
+		obj.Set("capabilities", (double)deviceInformation.capabilities);
+		obj.Set("bodyLocation", deviceInformation.bodyLocation);
+		obj.Set("friendlyName", deviceInformation.deviceFriendlyName);
+		obj.Set("devicePath", deviceInformation.devicePath);
+		obj.Set("firmwareRevision", deviceInformation.firmwareRevisionString);
+		obj.Set("hardwareRevision", deviceInformation.hardwareRevisionString);
+		obj.Set("manufacturerName", deviceInformation.manufacturerNameString);
+		obj.Set("modelNumber", deviceInformation.modelNumberString);
+		obj.Set("serialNumber", deviceInformation.serialNumberString);
+		obj.Set("softwareRevision", deviceInformation.softwareRevisionString);
+		obj.Set("systemId", deviceInformation.systemID);
+
+		// napi_object_freeze needs N-API 8, so go through Object.freeze
+		Napi::Function freeze = env.Global().Get("Object").As<Napi::Object>().Get("freeze").As<Napi::Function>();
+		freeze.Call({obj});
+
+		m_deviceInfo = Napi::Persistent(obj);
+		m_deviceInfoSource = deviceInformation;
+
+		return obj;
+	}
+
+	// Drops the getDeviceInfo() object if it was built from other device information,
+	// e.g. after the sensor reconnected with new firmware. Call with the HSL lock held.
+	void RefreshDeviceInfo(const HSLDeviceInformation &deviceInformation)
+	{
+		if (!m_deviceInfo.IsEmpty() &&
+			memcmp(&m_deviceInfoSource, &deviceInformation, sizeof(HSLDeviceInformation)) != 0)
+		{
+			m_deviceInfo.Reset();
+		}
+	}
+
+	Napi::Value GetDeviceFriendlyName(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::deviceFriendlyName);
+	}
+
+	Napi::Value GetDevicePath(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::devicePath);
+	}
+
+	Napi::Value GetFirmwareRevisionString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::firmwareRevisionString);
+	}
+
+	Napi::Value GetHardwareRevisionString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::hardwareRevisionString);
+	}
+
+	Napi::Value GetManufacturerNameString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::manufacturerNameString);
+	}
+
+	Napi::Value GetModelNumberString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::modelNumberString);
+	}
+
+	Napi::Value GetSerialNumberString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::serialNumberString);
+	}
+
+	Napi::Value GetSoftwareRevisionString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::softwareRevisionString);
+	}
+
+	Napi::Value GetSystemIdString(const Napi::CallbackInfo& info)
+	{
+		return GetDeviceString(info, &HSLDeviceInformation::systemID);
+	}
+
+	Napi::Value GetHeartRateBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		if (GetSensor() == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, HSLBufferType_HRData);
+
+		return BufferIterator::CreateNewIterator(info, iter);
+	}
+
+	Napi::Value GetHeartECGBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		if (GetSensor() == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, HSLBufferType_ECGData);
+
+		return BufferIterator::CreateNewIterator(info, iter);
+	}
+
+	Napi::Value GetHeartPPGBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		if (GetSensor() == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, HSLBufferType_PPGData);
+
+		return BufferIterator::CreateNewIterator(info, iter);
+	}
+
+	Napi::Value GetHeartPPIBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		if (GetSensor() == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, HSLBufferType_PPIData);
+
+		return BufferIterator::CreateNewIterator(info, iter);
+	}
+
+	Napi::Value GetHeartAccBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		if (GetSensor() == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, HSLBufferType_AccData);
+
+		return BufferIterator::CreateNewIterator(info, iter);
+	}
+
+	Napi::Value GetHeartHrvBuffer(const Napi::CallbackInfo& info)
 	{
 		REQ_ARGS(1);
 		REQ_INT_ARG(0, filter_type);
 
-		HSLSensorID sensor_id = GetSensor()->sensorID;
-		bool bSuccess= HSL_FlushHeartHrvBuffer(sensor_id, (HSLHeartRateVariabityFilterType)filter_type);
+		HSLScopedLock hsl_lock;
 
-		return Napi::Boolean::New(info.Env(), bSuccess);
+		if (GetSensor() == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		SensorBufferIterator iter = GetSensorBufferIterator(m_sensorID, HSLBufferType_HRVData, (HSLHeartRateVariabityFilterType)filter_type);
+
+		return BufferIterator::CreateNewIterator(info, iter);
 	}
 
-	Napi::Value SetDataStreamActive(const Napi::CallbackInfo& info)
+	Napi::Value DrainHR(const Napi::CallbackInfo& info)
 	{
-		REQ_ARGS(2);
-		REQ_INT_ARG(0, data_stream_type);
-		REQ_BOOL_ARG(1, want_active);
+		if (!IsAttachedLocked())
+		{
+			return info.Env().Null();
+		}
 
-		bool bSuccess = false;
-		HSLSensor* sensor = GetSensor();
+		return DrainSensorBuffer(info.Env(), m_sensorID, HSLBufferType_HRData);
+	}
 
-		if (data_stream_type >= 0 && data_stream_type < HSLStreamFlags_COUNT)
+	Napi::Value DrainECG(const Napi::CallbackInfo& info)
+	{
+		if (!IsAttachedLocked())
 		{
-			bool isActive = HSL_BITMASK_GET_FLAG(sensor->activeDataStreams, data_stream_type);
+			return info.Env().Null();
+		}
 
-			if (isActive && !want_active)
-			{
-				t_hsl_stream_bitmask new_bitmask = HSL_BITMASK_CLEAR_FLAG(sensor->activeDataStreams, data_stream_type);
+		return DrainSensorBuffer(info.Env(), m_sensorID, HSLBufferType_ECGData);
+	}
 
-				HSL_SetActiveSensorDataStreams(sensor->sensorID, new_bitmask);
-			}
-			else if (!isActive && want_active)
-			{
-				t_hsl_stream_bitmask new_bitmask = HSL_BITMASK_SET_FLAG(sensor->activeDataStreams, data_stream_type);
+	Napi::Value DrainPPG(const Napi::CallbackInfo& info)
+	{
+		OPT_BOOL_ARG(0, planar, false);
 
-				HSL_SetActiveSensorDataStreams(sensor->sensorID, new_bitmask);
-			}
+		if (!IsAttachedLocked())
+		{
+			return info.Env().Null();
+		}
+
+		return DrainSensorBuffer(info.Env(), m_sensorID, HSLBufferType_PPGData, planar);
+	}
+
+	Napi::Value DrainPPI(const Napi::CallbackInfo& info)
+	{
+		OPT_BOOL_ARG(0, planar, false);
+
+		if (!IsAttachedLocked())
+		{
+			return info.Env().Null();
+		}
+
+		return DrainSensorBuffer(info.Env(), m_sensorID, HSLBufferType_PPIData, planar);
+	}
+
+	Napi::Value DrainAcc(const Napi::CallbackInfo& info)
+	{
+		OPT_BOOL_ARG(0, planar, false);
+
+		if (!IsAttachedLocked())
+		{
+			return info.Env().Null();
+		}
+
+		return DrainSensorBuffer(info.Env(), m_sensorID, HSLBufferType_AccData, planar);
+	}
+
+	Napi::Value DrainHrv(const Napi::CallbackInfo& info)
+	{
+		REQ_ARGS(1);
+		REQ_INT_ARG(0, filter_type);
+
+		if (!IsAttachedLocked())
+		{
+			return info.Env().Null();
+		}
+
+		return DrainSensorBuffer(
+			info.Env(), m_sensorID, HSLBufferType_HRVData, false, (HSLHeartRateVariabityFilterType)filter_type);
+	}
+
+	Napi::Value FlushHeartRateBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		bool bSuccess= GetSensor() != nullptr && FlushSensorBuffer(m_sensorID, HSLBufferType_HRData);
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value FlushHeartECGBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		bool bSuccess= GetSensor() != nullptr && FlushSensorBuffer(m_sensorID, HSLBufferType_ECGData);
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value FlushHeartPPGBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		bool bSuccess= GetSensor() != nullptr && FlushSensorBuffer(m_sensorID, HSLBufferType_PPGData);
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value FlushHeartPPIBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		bool bSuccess= GetSensor() != nullptr && FlushSensorBuffer(m_sensorID, HSLBufferType_PPIData);
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value FlushHeartAccBuffer(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		bool bSuccess= GetSensor() != nullptr && FlushSensorBuffer(m_sensorID, HSLBufferType_AccData);
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value FlushtHeartHrvBuffer(const Napi::CallbackInfo& info)
+	{
+		REQ_ARGS(1);
+		REQ_INT_ARG(0, filter_type);
+
+		HSLScopedLock hsl_lock;
+		bool bSuccess= GetSensor() != nullptr && FlushSensorBuffer(m_sensorID, HSLBufferType_HRVData, (HSLHeartRateVariabityFilterType)filter_type);
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value SetDataStreamActive(const Napi::CallbackInfo& info)
+	{
+		REQ_ARGS(2);
+		REQ_INT_ARG(0, data_stream_type);
+		REQ_BOOL_ARG(1, want_active);
+
+		HSLScopedLock hsl_lock;
+		bool bSuccess = false;
+		HSLSensor* sensor = GetSensor();
+
+		if (sensor != nullptr && data_stream_type >= 0 && data_stream_type < HSLStreamFlags_COUNT)
+		{
+			bool isActive = HSL_BITMASK_GET_FLAG(sensor->activeDataStreams, data_stream_type);
+
+			if (isActive && !want_active)
+			{
+				t_hsl_stream_bitmask new_bitmask = HSL_BITMASK_CLEAR_FLAG(sensor->activeDataStreams, data_stream_type);
+
+				GetSensorSource().SetActiveSensorDataStreams(sensor->sensorID, new_bitmask);
+			}
+			else if (!isActive && want_active)
+			{
+				t_hsl_stream_bitmask new_bitmask = HSL_BITMASK_SET_FLAG(sensor->activeDataStreams, data_stream_type);
+
+				GetSensorSource().SetActiveSensorDataStreams(sensor->sensorID, new_bitmask);
+			}
+
+			bSuccess = true;
+		}
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value SetFilterStreamActive(const Napi::CallbackInfo& info)
+	{
+		REQ_ARGS(2);
+		REQ_INT_ARG(0, filter_stream_type);
+		REQ_BOOL_ARG(1, want_active);
+
+		HSLScopedLock hsl_lock;
+		bool bSuccess = false;
+		HSLSensor* sensor = GetSensor();
+
+		if (sensor != nullptr && filter_stream_type >= 0 && filter_stream_type < HRVFilter_COUNT)
+		{
+			bool isActive = HSL_BITMASK_GET_FLAG(sensor->activeFilterStreams, filter_stream_type);
+
+			if (isActive && !want_active)
+			{
+				t_hrv_filter_bitmask new_bitmask = HSL_BITMASK_CLEAR_FLAG(sensor->activeFilterStreams, filter_stream_type);
+
+				GetSensorSource().SetActiveSensorFilterStreams(sensor->sensorID, new_bitmask);
+			}
+			else if (!isActive && want_active)
+			{
+				t_hrv_filter_bitmask new_bitmask = HSL_BITMASK_SET_FLAG(sensor->activeFilterStreams, filter_stream_type);
+
+				GetSensorSource().SetActiveSensorFilterStreams(sensor->sensorID, new_bitmask);
+			}
+
+			bSuccess = true;
+		}
+
+		return Napi::Boolean::New(info.Env(), bSuccess);
+	}
+
+	Napi::Value StopAllStreams(const Napi::CallbackInfo& info)
+	{
+		HSLScopedLock hsl_lock;
+
+		return Napi::Boolean::New(info.Env(), GetSensor() != nullptr && GetSensorSource().StopAllSensorStreams(m_sensorID));
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "Sensor", {			
+			InstanceMethod("getSensorID", &Sensor::GetSensorID),
+			InstanceMethod("getDeviceBodyLocation", &Sensor::GetDeviceBodyLocation),
+			InstanceMethod("hasCapability", &Sensor::HasCapability),
+			InstanceMethod("getDeviceInfo", &Sensor::GetDeviceInfo),
+			InstanceMethod("getDeviceFriendlyName", &Sensor::GetDeviceFriendlyName),
+			InstanceMethod("getDevicePath", &Sensor::GetDevicePath),
+			InstanceMethod("getFirmwareRevisionString", &Sensor::GetFirmwareRevisionString),
+			InstanceMethod("getHardwareRevisionString", &Sensor::GetHardwareRevisionString),
+			InstanceMethod("getManufacturerNameString", &Sensor::GetManufacturerNameString),
+			InstanceMethod("getSerialNumberString", &Sensor::GetSerialNumberString),
+			InstanceMethod("getSoftwareRevisionString", &Sensor::GetSoftwareRevisionString),
+			InstanceMethod("getSystemIdString", &Sensor::GetSystemIdString),
+			InstanceMethod("getHeartRateBPM", &Sensor::GetHeartRateBPM),
+			InstanceMethod("getHeartRateBuffer", &Sensor::GetHeartRateBuffer),
+			InstanceMethod("getHeartECGBuffer", &Sensor::GetHeartECGBuffer),
+			InstanceMethod("getHeartPPGBuffer", &Sensor::GetHeartPPGBuffer),
+			InstanceMethod("getHeartPPIBuffer", &Sensor::GetHeartPPIBuffer),
+			InstanceMethod("getHeartAccBuffer", &Sensor::GetHeartAccBuffer),
+			InstanceMethod("getHeartHrvBuffer", &Sensor::GetHeartHrvBuffer),
+			InstanceMethod("flushHeartRateBuffer", &Sensor::FlushHeartRateBuffer),
+			InstanceMethod("flushHeartECGBuffer", &Sensor::FlushHeartECGBuffer),
+			InstanceMethod("flushHeartPPGBuffer", &Sensor::FlushHeartPPGBuffer),
+			InstanceMethod("flushHeartPPIBuffer", &Sensor::FlushHeartPPIBuffer),
+			InstanceMethod("flushHeartAccBuffer", &Sensor::FlushHeartAccBuffer),
+			InstanceMethod("flushHeartHrvBuffer", &Sensor::FlushtHeartHrvBuffer),
+			InstanceMethod("drainHR", &Sensor::DrainHR),
+			InstanceMethod("drainECG", &Sensor::DrainECG),
+			InstanceMethod("drainPPG", &Sensor::DrainPPG),
+			InstanceMethod("drainPPI", &Sensor::DrainPPI),
+			InstanceMethod("drainAcc", &Sensor::DrainAcc),
+			InstanceMethod("drainHrv", &Sensor::DrainHrv),
+			InstanceMethod("setDataStreamActive", &Sensor::SetDataStreamActive),
+			InstanceMethod("setFilterStreamActive", &Sensor::SetFilterStreamActive),
+			InstanceMethod("stopAllStreams", &Sensor::StopAllStreams),
+			// HSLContactSensorStatus
+			StaticValue("ContactStatus_Invalid", Napi::Number::New(env, HSLContactStatus_Invalid)),
+			StaticValue("ContactStatus_NoContact", Napi::Number::New(env, HSLContactStatus_NoContact)),
+			StaticValue("ContactStatus_Contact", Napi::Number::New(env, HSLContactStatus_Contact)),
+			// HSLSensorDataStreamFlags
+			StaticValue("StreamFlags_HRData", Napi::Number::New(env, HSLStreamFlags_HRData)),
+			StaticValue("StreamFlags_ECGData", Napi::Number::New(env, HSLStreamFlags_ECGData)),
+			StaticValue("StreamFlags_PPGData", Napi::Number::New(env, HSLStreamFlags_PPGData)),
+			StaticValue("StreamFlags_PPIData", Napi::Number::New(env, HSLStreamFlags_PPIData)),
+			StaticValue("StreamFlags_AccData", Napi::Number::New(env, HSLStreamFlags_AccData)),
+			// HSLHeartRateVariabityFilterType
+			StaticValue("HRVFilter_SDNN", Napi::Number::New(env, HRVFilter_SDNN)),
+			StaticValue("HRVFilter_RMSSD", Napi::Number::New(env, HRVFilter_RMSSD)),
+			StaticValue("HRVFilter_SDSD", Napi::Number::New(env, HRVFilter_SDSD)),
+			StaticValue("HRVFilter_NN50", Napi::Number::New(env, HRVFilter_NN50)),
+			StaticValue("HRVFilter_pNN50", Napi::Number::New(env, HRVFilter_pNN50)),
+			StaticValue("HRVFilter_NN20", Napi::Number::New(env, HRVFilter_NN20)),
+			StaticValue("HRVFilter_pNN20", Napi::Number::New(env, HRVFilter_pNN20)),
+			// PPISampleFlags
+			StaticValue("PPIFlag_Blocker", Napi::Number::New(env, PPISampleFlag_Blocker)),
+			StaticValue("PPIFlag_SkinContact", Napi::Number::New(env, PPISampleFlag_SkinContact)),
+			StaticValue("PPIFlag_SupportsSkinContact", Napi::Number::New(env, PPISampleFlag_SupportsSkinContact)),
+		});
+
+		GetAddonData(env).sensorConstructor = Napi::Persistent(ctor);
+		exports.Set("Sensor", ctor);
+	}
+
+private:
+	// Looked up by id on every call, since the source owns the struct and may rebuild or free it.
+	// nullptr once the sensor is detached or the source no longer has it. Call with the HSL lock held.
+	HSLSensor* GetSensor() const
+	{
+		return IsAttached() ? GetSensorSource().GetSensor(m_sensorID) : nullptr;
+	}
+
+	template <size_t N>
+	Napi::Value GetDeviceString(const Napi::CallbackInfo& info, char (HSLDeviceInformation::*field)[N]) const
+	{
+		HSLScopedLock hsl_lock;
+
+		const HSLSensor *sensor = GetSensor();
+		if (sensor == nullptr)
+		{
+			return info.Env().Null();
+		}
+
+		return Napi::String::New(info.Env(), sensor->deviceInformation.*field);
+	}
+
+	HSLSensorID m_sensorID;
+	uint64_t m_sourceGeneration;
+	bool m_bDetached;
+	Napi::ObjectReference m_deviceInfo; // Built by getDeviceInfo(), empty until then
+	HSLDeviceInformation m_deviceInfoSource; // What m_deviceInfo was built from
+};
+
+class SensorList : public Napi::ObjectWrap<SensorList>
+{
+public:
+	SensorList(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<SensorList>(info)
+	{
+		HSLScopedLock hsl_lock;
+
+		GetSensorSource().GetSensorList(&m_sensorList);
+	}
+
+	// Create a new item using the constructor stored during Init.
+	static Napi::Object CreateNewSensorList(const Napi::CallbackInfo& info)
+	{
+		return GetAddonData(info.Env()).sensorListConstructor.New({});
+	}
+
+	Napi::Value GetHostSerial(const Napi::CallbackInfo& info)
+	{
+		return Napi::String::New(info.Env(), m_sensorList.hostSerial);
+	}
+
+	Napi::Value GetSensorCount(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_sensorList.count);
+	}
+
+	Napi::Value GetSensor(const Napi::CallbackInfo& info)
+	{
+		REQ_ARGS(1);
+		REQ_INT_ARG(0, list_index);
+
+		if (list_index >= 0 && list_index < m_sensorList.count)
+		{
+			HSLSensorListEntry &listEntry= m_sensorList.sensors[list_index];
+
+			return Sensor::CreateNewSensor(info, listEntry.sensorID);
+		}
+		else
+		{
+			return info.Env().Null();
+		}
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "SensorList", {
+			InstanceMethod("getHostSerial", &SensorList::GetHostSerial),
+			InstanceMethod("getSensorCount", &SensorList::GetSensorCount),
+			InstanceMethod("getSensor", &SensorList::GetSensor),
+		});
+
+		GetAddonData(env).sensorListConstructor = Napi::Persistent(ctor);
+		exports.Set("SensorList", ctor);
+	}
+
+private:
+	HSLSensorList m_sensorList;
+};
+
+Napi::Object GetSensorList(const Napi::CallbackInfo& info)
+{
+	return SensorList::CreateNewSensorList(info);
+}
+
+Napi::Object Sensor::GetCachedSensor(Napi::Env env, HSLSensor *sensor, bool *out_created)
+{
+	AddonData &addon = GetAddonData(env);
+	std::map<HSLSensorID, SensorCacheEntry> &sensorCache = addon.sensorCache;
+	auto it = sensorCache.find(sensor->sensorID);
+
+	// A wrapper left over from a source that was switched away stands for a different sensor
+	if (it != sensorCache.end() && !Sensor::Unwrap(it->second.wrapper.Value())->IsAttached())
+	{
+		Sensor::Unwrap(it->second.wrapper.Value())->Detach();
+		sensorCache.erase(it);
+		it = sensorCache.end();
+	}
+
+	if (out_created != nullptr)
+	{
+		*out_created = (it == sensorCache.end());
+	}
+
+	if (it == sensorCache.end())
+	{
+		SensorCacheEntry entry;
+		entry.wrapper = Napi::Persistent(addon.sensorConstructor.New({Napi::External<HSLSensor>::New(env, sensor)}));
+		entry.deviceInformation = sensor->deviceInformation;
+		entry.bReported = false;
+
+		it = sensorCache.emplace(sensor->sensorID, std::move(entry)).first;
+	}
+	else
+	{
+		Sensor::Unwrap(it->second.wrapper.Value())->RefreshDeviceInfo(sensor->deviceInformation);
+	}
+
+	return it->second.wrapper.Value();
+}
+
+// getSensorChanges() diffs the sensor list against the last call and returns
+// {added, removed, changed, sensors}: added and changed hold Sensor objects, removed holds sensor ids
+// and sensors the whole current list. Sensors keep the same Sensor object until they disconnect.
+// A sensor is changed when its device information differs from the last call.
+Napi::Value GetSensorChanges(const Napi::CallbackInfo& info)
+{
+	PipelineScopedTimer timer(PipelineTiming_SensorChanges);
+	Napi::Env env = info.Env();
+	HSLScopedLock hsl_lock;
+
+	std::map<HSLSensorID, SensorCacheEntry> &sensorCache = GetAddonData(env).sensorCache;
+	SensorSource &source = GetSensorSource();
+	HSLSensorList sensorList;
+	if (!source.GetSensorList(&sensorList))
+	{
+		sensorList.count = 0;
+	}
+
+	Napi::Array added = Napi::Array::New(env);
+	Napi::Array changed = Napi::Array::New(env);
+	Napi::Array removed = Napi::Array::New(env);
+	Napi::Array sensors = Napi::Array::New(env);
+	std::vector<HSLSensorID> connectedIDs;
+
+	// Wrappers of a source that was switched away are removed even if the new source reuses their ids
+	for (auto it = sensorCache.begin(); it != sensorCache.end();)
+	{
+		Sensor *wrapper = Sensor::Unwrap(it->second.wrapper.Value());
+
+		if (!wrapper->IsAttached())
+		{
+			if (it->second.bReported)
+			{
+				removed.Set(removed.Length(), it->first);
+			}
+			wrapper->Detach();
+			it = sensorCache.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	for (int list_index = 0; list_index < sensorList.count; ++list_index)
+	{
+		HSLSensor *sensor = source.GetSensor(sensorList.sensors[list_index].sensorID);
+		if (sensor == nullptr)
+			continue;
+
+		Napi::Object wrapper = Sensor::GetCachedSensor(env, sensor);
+		SensorCacheEntry &entry = sensorCache[sensor->sensorID];
+
+		if (!entry.bReported)
+		{
+			entry.bReported = true;
+			added.Set(added.Length(), wrapper);
+		}
+		else if (memcmp(&entry.deviceInformation, &sensor->deviceInformation, sizeof(HSLDeviceInformation)) != 0)
+		{
+			changed.Set(changed.Length(), wrapper);
+		}
+
+		entry.deviceInformation = sensor->deviceInformation;
+		connectedIDs.push_back(sensor->sensorID);
+		sensors.Set(sensors.Length(), wrapper);
+	}
+
+	for (auto it = sensorCache.begin(); it != sensorCache.end();)
+	{
+		if (std::find(connectedIDs.begin(), connectedIDs.end(), it->first) == connectedIDs.end())
+		{
+			if (it->second.bReported)
+			{
+				removed.Set(removed.Length(), it->first);
+			}
+			Sensor::Unwrap(it->second.wrapper.Value())->Detach();
+			it = sensorCache.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	Napi::Object obj = Napi::Object::New(env);
+	obj.Set("added", added);
+	obj.Set("removed", removed);
+	obj.Set("changed", changed);
+	obj.Set("sensors", sensors);
+
+	return obj;
+}
+
+// Addon owned ring of frames for one sensor stream, fed by ingestStreamRings() or the poller.
+// new StreamRing(sensorId, bufferType, {capacity, overflow, hrvFilter})
+// StreamRing.attach(sensorId, bufferType, {hrvFilter}) opens a ring created in another worker.
+class StreamRing : public Napi::ObjectWrap<StreamRing>
+{
+public:
+	StreamRing(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<StreamRing>(info)
+		, m_bOwner(false)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() == 1 && info[0].IsExternal())
+		{
+			m_ring = *info[0].As<Napi::External<std::shared_ptr<SensorStreamRing>>>().Data();
+			return;
+		}
+
+		if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber())
+		{
+			Napi::TypeError::New(env, "Expected sensor id and buffer type arguments").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		const HSLSensorBufferType buffer_type = (HSLSensorBufferType)info[1].ToNumber().Int32Value();
+		size_t capacity = 1024;
+		int overflow_policy = StreamRingOverflow_DropOldest;
+		HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN;
+
+		if (info.Length() >= 3 && info[2].IsObject())
+		{
+			Napi::Object options = info[2].As<Napi::Object>();
+
+			if (options.Has("capacity"))
+				capacity = (size_t)std::max(options.Get("capacity").ToNumber().Int64Value(), (int64_t)1);
+			if (options.Has("overflow"))
+				overflow_policy = options.Get("overflow").ToNumber().Int32Value();
+			if (options.Has("hrvFilter"))
+				hrv_filter = (HSLHeartRateVariabityFilterType)options.Get("hrvFilter").ToNumber().Int32Value();
+		}
+
+		if (GetSensorFrameSize(buffer_type) == 0)
+		{
+			Napi::RangeError::New(env, "Invalid buffer type").ThrowAsJavaScriptException();
+			return;
+		}
+
+		if (overflow_policy != StreamRingOverflow_DropOldest && overflow_policy != StreamRingOverflow_DropNewest)
+		{
+			Napi::RangeError::New(env, "overflow must be Overflow_DropOldest or Overflow_DropNewest").ThrowAsJavaScriptException();
+			return;
+		}
+
+		std::shared_ptr<SensorStreamRing> ring = std::make_shared<SensorStreamRing>(
+			sensor_id, buffer_type, hrv_filter, capacity, (StreamRingOverflowPolicy)overflow_policy);
+		if (!GetSensorStreamRingRegistry().AddRing(ring))
+		{
+			Napi::Error::New(env, "A StreamRing already exists for that sensor stream").ThrowAsJavaScriptException();
+			return;
+		}
+
+		m_ring = ring;
+		m_bOwner = true;
+	}
+
+	// attach(sensorId, bufferType, {hrvFilter}) wraps the ring another env created for that
+	// stream, or returns null if there is none. Frames are shared, not copied, so any number of
+	// workers can read the stream the update loop owner feeds. Closing an attached ring only
+	// detaches it; the ring keeps being fed until its creator closes it.
+	static Napi::Value Attach(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber())
+		{
+			Napi::TypeError::New(env, "Expected sensor id and buffer type arguments").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		const HSLSensorBufferType buffer_type = (HSLSensorBufferType)info[1].ToNumber().Int32Value();
+		HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN;
+
+		if (info.Length() >= 3 && info[2].IsObject())
+		{
+			Napi::Object options = info[2].As<Napi::Object>();
+
+			if (options.Has("hrvFilter"))
+				hrv_filter = (HSLHeartRateVariabityFilterType)options.Get("hrvFilter").ToNumber().Int32Value();
+		}
+
+		std::shared_ptr<SensorStreamRing> ring = GetSensorStreamRingRegistry().FindRing(sensor_id, buffer_type, hrv_filter);
+		if (!ring)
+		{
+			return env.Null();
+		}
+
+		return GetAddonData(env).streamRingConstructor.New({
+			Napi::External<std::shared_ptr<SensorStreamRing>>::New(env, &ring)});
+	}
+
+	~StreamRing()
+	{
+		CloseRing();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? m_ring->GetSensorID() : -1);
+	}
+
+	Napi::Value GetBufferType(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? m_ring->GetBufferType() : -1);
+	}
+
+	Napi::Value GetCapacity(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? (double)m_ring->GetCapacity() : 0.0);
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_ring)
+		{
+			return env.Null();
+		}
+
+		const StreamRingStats stats = m_ring->GetStats();
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("writeSequence", (double)stats.writeSequence);
+		obj.Set("framesDropped", (double)stats.framesDropped);
+		obj.Set("framesOverwritten", (double)stats.framesOverwritten);
+
+		return obj;
+	}
+
+	// openCursor(fromOldest = true)
+	Napi::Value OpenCursor(const Napi::CallbackInfo& info);
+
+	Napi::Value IsAttached(const Napi::CallbackInfo& info)
+	{
+		return Napi::Boolean::New(info.Env(), m_ring && !m_bOwner);
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseRing();
+
+		return info.Env().Undefined();
+	}
+
+	std::shared_ptr<SensorStreamRing> GetRing() const
+	{
+		return m_ring;
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "StreamRing", {
+			InstanceMethod("getSensorID", &StreamRing::GetSensorID),
+			InstanceMethod("getBufferType", &StreamRing::GetBufferType),
+			InstanceMethod("getCapacity", &StreamRing::GetCapacity),
+			InstanceMethod("getStats", &StreamRing::GetStats),
+			InstanceMethod("openCursor", &StreamRing::OpenCursor),
+			InstanceMethod("isAttached", &StreamRing::IsAttached),
+			InstanceMethod("close", &StreamRing::Close),
+			StaticMethod("attach", &StreamRing::Attach),
+			// StreamRingOverflowPolicy
+			StaticValue("Overflow_DropOldest", Napi::Number::New(env, StreamRingOverflow_DropOldest)),
+			StaticValue("Overflow_DropNewest", Napi::Number::New(env, StreamRingOverflow_DropNewest)),
+		});
+
+		GetAddonData(env).streamRingConstructor = Napi::Persistent(ctor);
+		exports.Set("StreamRing", ctor);
+	}
+
+private:
+	// Stops the ring being fed if this wrapper created it. Open cursors can still read what is left in it.
+	void CloseRing()
+	{
+		if (m_ring)
+		{
+			if (m_bOwner)
+			{
+				GetSensorStreamRingRegistry().RemoveRing(m_ring);
+			}
+			m_ring.reset();
+		}
+	}
+
+	std::shared_ptr<SensorStreamRing> m_ring;
+	bool m_bOwner; // Created the ring rather than attached to it
+};
+
+// Independent read position into a StreamRing. Reading never removes frames from the ring.
+class StreamRingCursor : public Napi::ObjectWrap<StreamRingCursor>
+{
+public:
+	StreamRingCursor(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<StreamRingCursor>(info)
+		, m_cursorId(0)
+	{
+		if (info.Length() >= 2 && info[0].IsExternal() && info[1].IsBoolean())
+		{
+			m_ring = *info[0].As<Napi::External<std::shared_ptr<SensorStreamRing>>>().Data();
+			m_cursorId = m_ring->OpenCursor(info[1].ToBoolean());
+		}
+		else
+		{
+			Napi::TypeError::New(info.Env(), "Argument 0 invalid").ThrowAsJavaScriptException();
+		}
+	}
+
+	~StreamRingCursor()
+	{
+		CloseCursor();
+	}
+
+	// Create a new item using the constructor stored during Init.
+	static Napi::Value CreateNewCursor(const Napi::CallbackInfo& info, std::shared_ptr<SensorStreamRing> &ring, bool from_oldest)
+	{
+		return GetAddonData(info.Env()).streamRingCursorConstructor.New({
+			Napi::External<std::shared_ptr<SensorStreamRing>>::New(info.Env(), &ring),
+			Napi::Boolean::New(info.Env(), from_oldest)});
+	}
+
+	// read(maxFrames, planar) returns the same packed batch as Sensor.drain*, or null if
+	// the cursor has caught up with the ring
+	Napi::Value Read(const Napi::CallbackInfo& info)
+	{
+		OPT_BOOL_ARG(1, planar, false);
+
+		Napi::Env env = info.Env();
+		if (!m_ring)
+		{
+			return env.Null();
+		}
+
+		size_t max_frames = SIZE_MAX;
+		if (info.Length() >= 1 && info[0].IsNumber() && info[0].ToNumber().Int64Value() > 0)
+		{
+			max_frames = (size_t)info[0].ToNumber().Int64Value();
+		}
+
+		m_frameScratch.clear();
+		const size_t frameCount = m_ring->ReadCursor(m_cursorId, max_frames, m_frameScratch);
+		if (frameCount == 0)
+		{
+			return env.Null();
+		}
+
+		const size_t frameSize = m_ring->GetFrameSize();
+		m_framePointers.resize(frameCount);
+		for (size_t i = 0; i < frameCount; ++i)
+		{
+			m_framePointers[i] = m_frameScratch.data() + i * frameSize;
+		}
+
+		SensorFrameLayout layout;
+		MeasureSensorFrames(m_ring->GetBufferType(), m_framePointers.data(), frameCount, layout, planar);
+
+		Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, layout.byteLength);
+		PackSensorFrames(m_framePointers.data(), layout, static_cast<uint8_t *>(buffer.Data()));
+
+		return CreateSensorFrameBatch(env, m_ring->GetSensorID(), layout, buffer, m_ring->GetHrvFilter());
+	}
+
+	Napi::Value GetPosition(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? (double)m_ring->GetCursorPosition(m_cursorId) : 0.0);
+	}
+
+	Napi::Value GetAvailable(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? (double)m_ring->GetCursorAvailable(m_cursorId) : 0.0);
+	}
+
+	Napi::Value GetLostFrames(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? (double)m_ring->GetCursorLostFrames(m_cursorId) : 0.0);
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseCursor();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "StreamRingCursor", {
+			InstanceMethod("read", &StreamRingCursor::Read),
+			InstanceMethod("getPosition", &StreamRingCursor::GetPosition),
+			InstanceMethod("getAvailable", &StreamRingCursor::GetAvailable),
+			InstanceMethod("getLostFrames", &StreamRingCursor::GetLostFrames),
+			InstanceMethod("close", &StreamRingCursor::Close),
+		});
+
+		GetAddonData(env).streamRingCursorConstructor = Napi::Persistent(ctor);
+		exports.Set("StreamRingCursor", ctor);
+	}
+
+private:
+	void CloseCursor()
+	{
+		if (m_ring)
+		{
+			m_ring->CloseCursor(m_cursorId);
+			m_ring.reset();
+		}
+	}
+
+	std::shared_ptr<SensorStreamRing> m_ring;
+	int m_cursorId;
+	std::vector<uint8_t> m_frameScratch;
+	std::vector<const void *> m_framePointers;
+};
+
+Napi::Value StreamRing::OpenCursor(const Napi::CallbackInfo& info)
+{
+	OPT_BOOL_ARG(0, from_oldest, true);
+
+	if (!m_ring)
+	{
+		return info.Env().Null();
+	}
+
+	return StreamRingCursor::CreateNewCursor(info, m_ring, from_oldest);
+}
+
+// Sensor samples written natively into a SharedArrayBuffer, see SharedSampleRing.
+// new SharedSampleRing(sensorId, bufferType, {capacity, overflow, hrvFilter})
+// Post getBuffer() to worker threads and read it there with SharedSampleReader (index.js).
+class SharedSampleRingWrap : public Napi::ObjectWrap<SharedSampleRingWrap>
+{
+public:
+	SharedSampleRingWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<SharedSampleRingWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber())
+		{
+			Napi::TypeError::New(env, "Expected sensor id and buffer type arguments").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		const HSLSensorBufferType buffer_type = (HSLSensorBufferType)info[1].ToNumber().Int32Value();
+		size_t capacity = 4096;
+		int overflow_policy = StreamRingOverflow_DropOldest;
+		HSLHeartRateVariabityFilterType hrv_filter = HRVFilter_SDNN;
+
+		if (info.Length() >= 3 && info[2].IsObject())
+		{
+			Napi::Object options = info[2].As<Napi::Object>();
+
+			if (options.Has("capacity"))
+				capacity = (size_t)std::max(options.Get("capacity").ToNumber().Int64Value(), (int64_t)1);
+			if (options.Has("overflow"))
+				overflow_policy = options.Get("overflow").ToNumber().Int32Value();
+			if (options.Has("hrvFilter"))
+				hrv_filter = (HSLHeartRateVariabityFilterType)options.Get("hrvFilter").ToNumber().Int32Value();
+		}
+
+		if (GetSensorFrameSize(buffer_type) == 0)
+		{
+			Napi::RangeError::New(env, "Invalid buffer type").ThrowAsJavaScriptException();
+			return;
+		}
+
+		if (overflow_policy != StreamRingOverflow_DropOldest && overflow_policy != StreamRingOverflow_DropNewest)
+		{
+			Napi::RangeError::New(env, "overflow must be Overflow_DropOldest or Overflow_DropNewest").ThrowAsJavaScriptException();
+			return;
+		}
+
+		// N-API can't allocate shared memory itself, so the buffer comes from the JS constructor
+		// and the ring writes through a view of it
+		Napi::Value sharedArrayBuffer = env.Global().Get("SharedArrayBuffer");
+		if (!sharedArrayBuffer.IsFunction())
+		{
+			Napi::Error::New(env, "SharedArrayBuffer is not available").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const size_t byteLength = SharedSampleRing::GetByteLength(buffer_type, capacity);
+		Napi::Object buffer = sharedArrayBuffer.As<Napi::Function>().New({Napi::Number::New(env, (double)byteLength)});
+		Napi::Uint8Array bytes = env.Global().Get("Uint8Array").As<Napi::Function>().New({buffer}).As<Napi::Uint8Array>();
+
+		m_buffer = Napi::Persistent(buffer);
+
+		HSLScopedLock hsl_lock;
+
+		m_ring = std::make_shared<SharedSampleRing>(sensor_id, buffer_type, hrv_filter, capacity, (StreamRingOverflowPolicy)overflow_policy, bytes.Data());
+		AddSensorSourceListener(m_ring);
+	}
+
+	~SharedSampleRingWrap()
+	{
+		CloseRing();
+	}
+
+	// The SharedArrayBuffer the samples are written to, it stays readable after close()
+	Napi::Value GetBuffer(const Napi::CallbackInfo& info)
+	{
+		return m_buffer.IsEmpty() ? info.Env().Null() : m_buffer.Value();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? m_ring->GetSensorID() : -1);
+	}
+
+	Napi::Value GetBufferType(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? m_ring->GetBufferType() : -1);
+	}
+
+	Napi::Value GetCapacity(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_ring ? (double)m_ring->GetCapacity() : 0.0);
+	}
+
+	// {head, dropped, readers}
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_ring)
+		{
+			return env.Null();
+		}
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("head", (double)m_ring->GetHead());
+		obj.Set("dropped", (double)m_ring->GetDropped());
+		obj.Set("readers", m_ring->GetActiveReaderCount());
+
+		return obj;
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseRing();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "SharedSampleRing", {
+			InstanceMethod("getBuffer", &SharedSampleRingWrap::GetBuffer),
+			InstanceMethod("getSensorID", &SharedSampleRingWrap::GetSensorID),
+			InstanceMethod("getBufferType", &SharedSampleRingWrap::GetBufferType),
+			InstanceMethod("getCapacity", &SharedSampleRingWrap::GetCapacity),
+			InstanceMethod("getStats", &SharedSampleRingWrap::GetStats),
+			InstanceMethod("close", &SharedSampleRingWrap::Close),
+			// StreamRingOverflowPolicy
+			StaticValue("Overflow_DropOldest", Napi::Number::New(env, StreamRingOverflow_DropOldest)),
+			StaticValue("Overflow_DropNewest", Napi::Number::New(env, StreamRingOverflow_DropNewest)),
+			// SharedSampleRingField, indexes into an Int32Array over the buffer
+			StaticValue("Field_Head", Napi::Number::New(env, SharedSampleRingField_Head)),
+			StaticValue("Field_Capacity", Napi::Number::New(env, SharedSampleRingField_Capacity)),
+			StaticValue("Field_ChannelCount", Napi::Number::New(env, SharedSampleRingField_ChannelCount)),
+			StaticValue("Field_BufferType", Napi::Number::New(env, SharedSampleRingField_BufferType)),
+			StaticValue("Field_SensorID", Napi::Number::New(env, SharedSampleRingField_SensorID)),
+			StaticValue("Field_Overflow", Napi::Number::New(env, SharedSampleRingField_Overflow)),
+			StaticValue("Field_Dropped", Napi::Number::New(env, SharedSampleRingField_Dropped)),
+			StaticValue("Field_TimesOffset", Napi::Number::New(env, SharedSampleRingField_TimesOffset)),
+			StaticValue("Field_ValuesOffset", Napi::Number::New(env, SharedSampleRingField_ValuesOffset)),
+			StaticValue("Field_MaxReaders", Napi::Number::New(env, SharedSampleRingField_MaxReaders)),
+			StaticValue("Field_Closed", Napi::Number::New(env, SharedSampleRingField_Closed)),
+			StaticValue("Field_Reserved", Napi::Number::New(env, SharedSampleRingField_Reserved)),
+			StaticValue("Field_ReaderTails", Napi::Number::New(env, SharedSampleRingField_ReaderTails)),
+			StaticValue("Field_ReaderStates", Napi::Number::New(env, SharedSampleRingField_ReaderStates)),
+			StaticValue("Field_COUNT", Napi::Number::New(env, SharedSampleRingField_COUNT)),
+			// SharedSampleReaderState
+			StaticValue("ReaderState_Free", Napi::Number::New(env, SharedSampleReaderState_Free)),
+			StaticValue("ReaderState_Active", Napi::Number::New(env, SharedSampleReaderState_Active)),
+			StaticValue("ReaderState_Claiming", Napi::Number::New(env, SharedSampleReaderState_Claiming)),
+		});
+
+		exports.Set("SharedSampleRing", ctor);
+	}
+
+private:
+	// Stops writing and tells the readers, who keep whatever is already in the buffer
+	void CloseRing()
+	{
+		if (m_ring)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_ring);
+			m_ring->Close();
+			m_ring.reset();
+		}
+	}
+
+	std::shared_ptr<SharedSampleRing> m_ring;
+	Napi::ObjectReference m_buffer; // Keeps the shared memory alive while the ring writes to it
+};
+
+// Sliding window HRV metrics for one sensor, computed natively from its HR or PPI stream.
+// new hsl.HRVAnalyzer(sensorId, {source, windowSeconds, spectrumIntervalSeconds, minRRInterval, maxRRInterval, maxRRChange})
+class HRVAnalyzerWrap : public Napi::ObjectWrap<HRVAnalyzerWrap>
+{
+public:
+	HRVAnalyzerWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<HRVAnalyzerWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 1 || !info[0].IsNumber())
+		{
+			Napi::TypeError::New(env, "Expected a sensor id argument").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		HRVAnalyzerSettings settings;
+
+		if (info.Length() >= 2 && info[1].IsObject())
+		{
+			Napi::Object options = info[1].As<Napi::Object>();
+
+			if (options.Has("source"))
+				settings.beatSource = (HRVBeatSource)options.Get("source").ToNumber().Int32Value();
+			if (options.Has("windowSeconds"))
+				settings.windowSeconds = std::max(options.Get("windowSeconds").ToNumber().DoubleValue(), 1.0);
+			if (options.Has("spectrumIntervalSeconds"))
+				settings.spectrumIntervalSeconds = std::max(options.Get("spectrumIntervalSeconds").ToNumber().DoubleValue(), 0.0);
+			if (options.Has("minRRInterval"))
+				settings.minRRInterval = options.Get("minRRInterval").ToNumber().Int32Value();
+			if (options.Has("maxRRInterval"))
+				settings.maxRRInterval = options.Get("maxRRInterval").ToNumber().Int32Value();
+			if (options.Has("maxRRChange"))
+				settings.maxRRChange = options.Get("maxRRChange").ToNumber().DoubleValue();
+		}
+
+		if (settings.beatSource != HRVBeatSource_HRData && settings.beatSource != HRVBeatSource_PPIData)
+		{
+			Napi::RangeError::New(env, "Invalid beat source").ThrowAsJavaScriptException();
+			return;
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_analyzer = std::make_shared<HRVAnalyzer>(sensor_id, settings);
+		AddSensorSourceListener(m_analyzer);
+	}
+
+	~HRVAnalyzerWrap()
+	{
+		CloseAnalyzer();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_analyzer ? m_analyzer->GetSensorID() : -1);
+	}
+
+	// getMetrics(out?) fills a Float64Array indexed by HRVAnalyzer.Metric_*.
+	// Pass the array from the previous call to reuse it.
+	Napi::Value GetMetrics(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_analyzer)
+		{
+			return env.Null();
+		}
+
+		Napi::Float64Array metrics;
+		if (info.Length() >= 1 && info[0].IsTypedArray() &&
+			info[0].As<Napi::TypedArray>().TypedArrayType() == napi_float64_array &&
+			info[0].As<Napi::Float64Array>().ElementLength() >= HRVMetric_COUNT)
+		{
+			metrics = info[0].As<Napi::Float64Array>();
+		}
+		else
+		{
+			metrics = Napi::Float64Array::New(env, HRVMetric_COUNT);
+		}
+
+		HSLScopedLock hsl_lock;
+		m_analyzer->GetMetrics(metrics.Data());
+
+		return metrics;
+	}
+
+	// {frequencies, power} from the last spectrum update, power in ms^2/Hz
+	Napi::Value GetSpectrum(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_analyzer)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		const std::vector<double> &frequencies = m_analyzer->GetSpectrumFrequencies();
+		const std::vector<double> &power = m_analyzer->GetSpectrumPower();
+		Napi::Float64Array frequencyArray = Napi::Float64Array::New(env, frequencies.size());
+		Napi::Float64Array powerArray = Napi::Float64Array::New(env, power.size());
+
+		std::copy(frequencies.begin(), frequencies.end(), frequencyArray.Data());
+		std::copy(power.begin(), power.end(), powerArray.Data());
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("frequencies", frequencyArray);
+		obj.Set("power", powerArray);
+
+		return obj;
+	}
+
+	// {timeInSeconds, rrIntervals} of the beats currently in the window
+	Napi::Value GetBeats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_analyzer)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_analyzer->GetWindowBeats(m_beatTimes, m_beatIntervals);
+
+		Napi::Float64Array timeArray = Napi::Float64Array::New(env, m_beatTimes.size());
+		Napi::Float64Array intervalArray = Napi::Float64Array::New(env, m_beatIntervals.size());
+		std::copy(m_beatTimes.begin(), m_beatTimes.end(), timeArray.Data());
+		std::copy(m_beatIntervals.begin(), m_beatIntervals.end(), intervalArray.Data());
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("timeInSeconds", timeArray);
+		obj.Set("rrIntervals", intervalArray);
+
+		return obj;
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_analyzer)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("acceptedBeats", (double)m_analyzer->GetAcceptedBeatCount());
+		obj.Set("rejectedBeats", (double)m_analyzer->GetRejectedBeatCount());
+		obj.Set("windowBeats", (double)m_analyzer->GetWindowBeatCount());
+
+		return obj;
+	}
+
+	Napi::Value Reset(const Napi::CallbackInfo& info)
+	{
+		if (m_analyzer)
+		{
+			HSLScopedLock hsl_lock;
+			m_analyzer->Reset();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseAnalyzer();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "HRVAnalyzer", {
+			InstanceMethod("getSensorID", &HRVAnalyzerWrap::GetSensorID),
+			InstanceMethod("getMetrics", &HRVAnalyzerWrap::GetMetrics),
+			InstanceMethod("getSpectrum", &HRVAnalyzerWrap::GetSpectrum),
+			InstanceMethod("getBeats", &HRVAnalyzerWrap::GetBeats),
+			InstanceMethod("getStats", &HRVAnalyzerWrap::GetStats),
+			InstanceMethod("reset", &HRVAnalyzerWrap::Reset),
+			InstanceMethod("close", &HRVAnalyzerWrap::Close),
+			// HRVBeatSource
+			StaticValue("Source_HRData", Napi::Number::New(env, HRVBeatSource_HRData)),
+			StaticValue("Source_PPIData", Napi::Number::New(env, HRVBeatSource_PPIData)),
+			// HRVMetric
+			StaticValue("Metric_MeanRR", Napi::Number::New(env, HRVMetric_MeanRR)),
+			StaticValue("Metric_SDNN", Napi::Number::New(env, HRVMetric_SDNN)),
+			StaticValue("Metric_RMSSD", Napi::Number::New(env, HRVMetric_RMSSD)),
+			StaticValue("Metric_SDSD", Napi::Number::New(env, HRVMetric_SDSD)),
+			StaticValue("Metric_NN50", Napi::Number::New(env, HRVMetric_NN50)),
+			StaticValue("Metric_pNN50", Napi::Number::New(env, HRVMetric_pNN50)),
+			StaticValue("Metric_NN20", Napi::Number::New(env, HRVMetric_NN20)),
+			StaticValue("Metric_pNN20", Napi::Number::New(env, HRVMetric_pNN20)),
+			StaticValue("Metric_MeanHR", Napi::Number::New(env, HRVMetric_MeanHR)),
+			StaticValue("Metric_BeatCount", Napi::Number::New(env, HRVMetric_BeatCount)),
+			StaticValue("Metric_WindowSeconds", Napi::Number::New(env, HRVMetric_WindowSeconds)),
+			StaticValue("Metric_VLFPower", Napi::Number::New(env, HRVMetric_VLFPower)),
+			StaticValue("Metric_LFPower", Napi::Number::New(env, HRVMetric_LFPower)),
+			StaticValue("Metric_HFPower", Napi::Number::New(env, HRVMetric_HFPower)),
+			StaticValue("Metric_LFHFRatio", Napi::Number::New(env, HRVMetric_LFHFRatio)),
+			StaticValue("Metric_TotalPower", Napi::Number::New(env, HRVMetric_TotalPower)),
+			StaticValue("Metric_SpectrumTime", Napi::Number::New(env, HRVMetric_SpectrumTime)),
+			StaticValue("Metric_COUNT", Napi::Number::New(env, HRVMetric_COUNT)),
+		});
+
+		exports.Set("HRVAnalyzer", ctor);
+	}
+
+private:
+	void CloseAnalyzer()
+	{
+		if (m_analyzer)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_analyzer);
+			m_analyzer.reset();
+		}
+	}
+
+	std::shared_ptr<HRVAnalyzer> m_analyzer;
+	std::vector<double> m_beatTimes;
+	std::vector<double> m_beatIntervals;
+};
+
+// Packs beats into one ArrayBuffer: double timeInSeconds[n], then int32 rrIntervals[n],
+// amplitudes[n] and flags[n]
+Napi::Object CreateECGBeatBatch(Napi::Env env, HSLSensorID sensor_id, const std::deque<ECGBeat> &beats)
+{
+	const size_t beatCount = beats.size();
+	const size_t columnBytes = beatCount * sizeof(int32_t);
+	const size_t timesBytes = beatCount * sizeof(double);
+
+	Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, timesBytes + 3 * columnBytes);
+	double *times = static_cast<double *>(buffer.Data());
+	int32_t *rrIntervals = reinterpret_cast<int32_t *>(times + beatCount);
+	int32_t *amplitudes = rrIntervals + beatCount;
+	int32_t *flags = amplitudes + beatCount;
+
+	for (size_t i = 0; i < beatCount; ++i)
+	{
+		const ECGBeat &beat = beats[i];
+
+		times[i] = beat.timeInSeconds;
+		rrIntervals[i] = beat.rrInterval;
+		amplitudes[i] = beat.amplitude;
+		flags[i] = beat.flags;
+	}
+
+	Napi::Object obj = Napi::Object::New(env);
+	obj.Set("sensorId", sensor_id);
+	obj.Set("beatCount", (double)beatCount);
+	obj.Set("timeInSeconds", Napi::Float64Array::New(env, beatCount, buffer, 0, napi_float64_array));
+	obj.Set("rrIntervals", Napi::Int32Array::New(env, beatCount, buffer, timesBytes, napi_int32_array));
+	obj.Set("amplitudes", Napi::Int32Array::New(env, beatCount, buffer, timesBytes + columnBytes, napi_int32_array));
+	obj.Set("flags", Napi::Int32Array::New(env, beatCount, buffer, timesBytes + 2 * columnBytes, napi_int32_array));
+
+	return obj;
+}
+
+// R peaks and beat to beat intervals detected natively in one sensor's ECG stream.
+// new hsl.ECGBeatDetector(sensorId, {sampleRate, lowCutoffHz, highCutoffHz, integrationSeconds, refractorySeconds, capacity})
+class ECGBeatDetectorWrap : public Napi::ObjectWrap<ECGBeatDetectorWrap>
+{
+public:
+	ECGBeatDetectorWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<ECGBeatDetectorWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 1 || !info[0].IsNumber())
+		{
+			Napi::TypeError::New(env, "Expected a sensor id argument").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		ECGBeatDetectorSettings settings;
+
+		if (info.Length() >= 2 && info[1].IsObject())
+		{
+			Napi::Object options = info[1].As<Napi::Object>();
+
+			if (options.Has("sampleRate"))
+				settings.sampleRate = options.Get("sampleRate").ToNumber().DoubleValue();
+			if (options.Has("lowCutoffHz"))
+				settings.lowCutoffHz = options.Get("lowCutoffHz").ToNumber().DoubleValue();
+			if (options.Has("highCutoffHz"))
+				settings.highCutoffHz = options.Get("highCutoffHz").ToNumber().DoubleValue();
+			if (options.Has("integrationSeconds"))
+				settings.integrationSeconds = options.Get("integrationSeconds").ToNumber().DoubleValue();
+			if (options.Has("refractorySeconds"))
+				settings.refractorySeconds = options.Get("refractorySeconds").ToNumber().DoubleValue();
+			if (options.Has("capacity"))
+				settings.beatBufferCapacity = (size_t)std::max(options.Get("capacity").ToNumber().Int64Value(), (int64_t)1);
+		}
+
+		if (!(settings.sampleRate >= 10.0) || !(settings.lowCutoffHz > 0.0) || !(settings.highCutoffHz > settings.lowCutoffHz))
+		{
+			Napi::RangeError::New(env, "Invalid sample rate or cutoff frequencies").ThrowAsJavaScriptException();
+			return;
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_detector = std::make_shared<ECGBeatDetector>(sensor_id, settings);
+		AddSensorSourceListener(m_detector);
+	}
+
+	~ECGBeatDetectorWrap()
+	{
+		CloseDetector();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_detector ? m_detector->GetSensorID() : -1);
+	}
+
+	Napi::Value GetBeatCount(const Napi::CallbackInfo& info)
+	{
+		if (!m_detector)
+		{
+			return Napi::Number::New(info.Env(), 0);
+		}
+
+		HSLScopedLock hsl_lock;
+
+		return Napi::Number::New(info.Env(), (double)m_detector->GetBeatBuffer().size());
+	}
+
+	// Beats waiting in the buffer, without removing them
+	Napi::Value GetBeatBuffer(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_detector)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		return CreateECGBeatBatch(env, m_detector->GetSensorID(), m_detector->GetBeatBuffer());
+	}
+
+	Napi::Value FlushBeatBuffer(const Napi::CallbackInfo& info)
+	{
+		if (!m_detector)
+		{
+			return Napi::Boolean::New(info.Env(), false);
+		}
+
+		HSLScopedLock hsl_lock;
+		m_detector->FlushBeatBuffer();
+
+		return Napi::Boolean::New(info.Env(), true);
+	}
+
+	// getBeatBuffer() and flushBeatBuffer() in one call. Returns null if there were no beats.
+	Napi::Value DrainBeats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_detector)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		if (m_detector->GetBeatBuffer().empty())
+		{
+			return env.Null();
+		}
+
+		Napi::Object batch = CreateECGBeatBatch(env, m_detector->GetSensorID(), m_detector->GetBeatBuffer());
+		m_detector->FlushBeatBuffer();
+
+		return batch;
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_detector)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+		const ECGBeatDetectorStats stats = m_detector->GetStats();
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("beatsDetected", (double)stats.beatsDetected);
+		obj.Set("searchbackBeats", (double)stats.searchbackBeats);
+		obj.Set("beatsDropped", (double)stats.beatsDropped);
+		obj.Set("samplesProcessed", (double)stats.samplesProcessed);
+		obj.Set("resets", (double)stats.resets);
+		obj.Set("signalLevel", stats.signalLevel);
+		obj.Set("noiseLevel", stats.noiseLevel);
+		obj.Set("threshold", stats.threshold);
+
+		return obj;
+	}
+
+	Napi::Value Reset(const Napi::CallbackInfo& info)
+	{
+		if (m_detector)
+		{
+			HSLScopedLock hsl_lock;
+			m_detector->Reset();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseDetector();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "ECGBeatDetector", {
+			InstanceMethod("getSensorID", &ECGBeatDetectorWrap::GetSensorID),
+			InstanceMethod("getBeatCount", &ECGBeatDetectorWrap::GetBeatCount),
+			InstanceMethod("getBeatBuffer", &ECGBeatDetectorWrap::GetBeatBuffer),
+			InstanceMethod("flushBeatBuffer", &ECGBeatDetectorWrap::FlushBeatBuffer),
+			InstanceMethod("drainBeats", &ECGBeatDetectorWrap::DrainBeats),
+			InstanceMethod("getStats", &ECGBeatDetectorWrap::GetStats),
+			InstanceMethod("reset", &ECGBeatDetectorWrap::Reset),
+			InstanceMethod("close", &ECGBeatDetectorWrap::Close),
+			// ECGBeatFlags
+			StaticValue("BeatFlag_Searchback", Napi::Number::New(env, ECGBeatFlag_Searchback)),
+			StaticValue("BeatFlag_AfterGap", Napi::Number::New(env, ECGBeatFlag_AfterGap)),
+		});
+
+		exports.Set("ECGBeatDetector", ctor);
+	}
+
+private:
+	void CloseDetector()
+	{
+		if (m_detector)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_detector);
+			m_detector.reset();
+		}
+	}
+
+	std::shared_ptr<ECGBeatDetector> m_detector;
+};
+
+class WaveformDownsamplerWrap : public Napi::ObjectWrap<WaveformDownsamplerWrap>
+{
+public:
+	WaveformDownsamplerWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<WaveformDownsamplerWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber())
+		{
+			Napi::TypeError::New(env, "Expected sensor id and buffer type arguments").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		const HSLSensorBufferType buffer_type = (HSLSensorBufferType)info[1].ToNumber().Int32Value();
+		WaveformDownsamplerSettings settings;
+
+		if (info.Length() >= 3 && info[2].IsObject())
+		{
+			Napi::Object options = info[2].As<Napi::Object>();
+
+			if (options.Has("channel"))
+				settings.channel = options.Get("channel").ToNumber().Int32Value();
+			if (options.Has("historySeconds"))
+				settings.historySeconds = std::max(options.Get("historySeconds").ToNumber().DoubleValue(), 1.0);
+			if (options.Has("sampleRate"))
+				settings.nominalSampleRate = options.Get("sampleRate").ToNumber().DoubleValue();
+		}
+
+		int sampleWidth, frameValueWidth;
+		bool bFloatSamples;
+		if (!IsSensorWaveformBuffer(buffer_type) ||
+			!GetSensorBufferFormat(buffer_type, sampleWidth, frameValueWidth, bFloatSamples) ||
+			settings.channel < 0 || settings.channel >= sampleWidth)
+		{
+			Napi::RangeError::New(env, "Expected an ECG, PPG or Acc buffer type and one of its channels").ThrowAsJavaScriptException();
+			return;
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_downsampler = std::make_shared<WaveformDownsampler>(sensor_id, buffer_type, settings);
+		AddSensorSourceListener(m_downsampler);
+	}
+
+	~WaveformDownsamplerWrap()
+	{
+		CloseDownsampler();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_downsampler ? m_downsampler->GetSensorID() : -1);
+	}
+
+	Napi::Value GetBufferType(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_downsampler ? (int)m_downsampler->GetBufferType() : -1);
+	}
+
+	// getEnvelope(width, spanSeconds, endTime?) returns {startTime, endTime, pointSeconds, min, max}.
+	// min and max are Float32Arrays of width points sharing one ArrayBuffer, NaN where there were no samples.
+	// endTime defaults to the newest sample. Returns null until samples arrive.
+	Napi::Value GetEnvelope(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		REQ_ARGS(2);
+		REQ_INT_ARG(0, width);
+
+		const double spanSeconds = info[1].ToNumber().DoubleValue();
+		if (width <= 0 || !(spanSeconds > 0.0))
+		{
+			Napi::RangeError::New(env, "width and spanSeconds must be positive").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		if (!m_downsampler || !m_downsampler->HasSamples())
+		{
+			return env.Null();
+		}
+
+		double startTime, endTime;
+		GetQueryRange(info, 2, spanSeconds, startTime, endTime);
+
+		Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, 2 * width * sizeof(float));
+		float *values = static_cast<float *>(buffer.Data());
+		m_downsampler->GetEnvelope(startTime, endTime, width, values, values + width);
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("startTime", startTime);
+		obj.Set("endTime", endTime);
+		obj.Set("pointSeconds", (endTime - startTime) / width);
+		obj.Set("min", Napi::Float32Array::New(env, width, buffer, 0, napi_float32_array));
+		obj.Set("max", Napi::Float32Array::New(env, width, buffer, width * sizeof(float), napi_float32_array));
+
+		return obj;
+	}
+
+	// getLTTB(pointCount, spanSeconds, endTime?) returns {timeInSeconds, values} holding
+	// at most pointCount points picked by Largest-Triangle-Three-Buckets
+	Napi::Value GetLTTB(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		REQ_ARGS(2);
+		REQ_INT_ARG(0, pointCount);
+
+		const double spanSeconds = info[1].ToNumber().DoubleValue();
+		if (pointCount <= 0 || !(spanSeconds > 0.0))
+		{
+			Napi::RangeError::New(env, "pointCount and spanSeconds must be positive").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		if (!m_downsampler || !m_downsampler->HasSamples())
+		{
+			return env.Null();
+		}
+
+		double startTime, endTime;
+		GetQueryRange(info, 2, spanSeconds, startTime, endTime);
+		m_downsampler->GetLTTB(startTime, endTime, pointCount, m_pointTimes, m_pointValues);
+
+		Napi::Float64Array timeArray = Napi::Float64Array::New(env, m_pointTimes.size());
+		Napi::Float32Array valueArray = Napi::Float32Array::New(env, m_pointValues.size());
+		std::copy(m_pointTimes.begin(), m_pointTimes.end(), timeArray.Data());
+		std::copy(m_pointValues.begin(), m_pointValues.end(), valueArray.Data());
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("startTime", startTime);
+		obj.Set("endTime", endTime);
+		obj.Set("timeInSeconds", timeArray);
+		obj.Set("values", valueArray);
+
+		return obj;
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_downsampler)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("sampleCount", (double)m_downsampler->GetSampleCount());
+		obj.Set("levels", (double)m_downsampler->GetLevelCount());
+		obj.Set("oldestTime", m_downsampler->GetOldestTime());
+		obj.Set("latestTime", m_downsampler->GetLatestTime());
+		obj.Set("sampleRate", m_downsampler->GetSampleRate());
+
+		return obj;
+	}
+
+	Napi::Value Reset(const Napi::CallbackInfo& info)
+	{
+		if (m_downsampler)
+		{
+			HSLScopedLock hsl_lock;
+			m_downsampler->Reset();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseDownsampler();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "WaveformDownsampler", {
+			InstanceMethod("getSensorID", &WaveformDownsamplerWrap::GetSensorID),
+			InstanceMethod("getBufferType", &WaveformDownsamplerWrap::GetBufferType),
+			InstanceMethod("getEnvelope", &WaveformDownsamplerWrap::GetEnvelope),
+			InstanceMethod("getLTTB", &WaveformDownsamplerWrap::GetLTTB),
+			InstanceMethod("getStats", &WaveformDownsamplerWrap::GetStats),
+			InstanceMethod("reset", &WaveformDownsamplerWrap::Reset),
+			InstanceMethod("close", &WaveformDownsamplerWrap::Close),
+		});
+
+		exports.Set("WaveformDownsampler", ctor);
+	}
+
+private:
+	// [endTime - spanSeconds, endTime), where endTime is argument end_time_arg or just past the newest sample
+	void GetQueryRange(const Napi::CallbackInfo& info, size_t end_time_arg, double span_seconds, double &out_start, double &out_end) const
+	{
+		if (info.Length() > end_time_arg && info[end_time_arg].IsNumber())
+		{
+			out_end = info[end_time_arg].ToNumber().DoubleValue();
+		}
+		else
+		{
+			out_end = m_downsampler->GetLatestTime() + 0.5 / m_downsampler->GetSampleRate();
+		}
+		out_start = out_end - span_seconds;
+	}
+
+	void CloseDownsampler()
+	{
+		if (m_downsampler)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_downsampler);
+			m_downsampler.reset();
+		}
+	}
+
+	std::shared_ptr<WaveformDownsampler> m_downsampler;
+	std::vector<double> m_pointTimes;
+	std::vector<float> m_pointValues;
+};
+
+// new SensorAligner([{sensorId, bufferType}, ...], {sampleRate, clockWindowSeconds, maxGapSeconds, maxWaitSeconds, maxBufferedSeconds})
+// resamples the streams onto one timeline in the clock of the first stream
+class SensorAlignerWrap : public Napi::ObjectWrap<SensorAlignerWrap>
+{
+public:
+	SensorAlignerWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<SensorAlignerWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 1 || !info[0].IsArray() || info[0].As<Napi::Array>().Length() == 0)
+		{
+			Napi::TypeError::New(env, "Expected an array of {sensorId, bufferType} streams").ThrowAsJavaScriptException();
+			return;
+		}
+
+		Napi::Array streamArray = info[0].As<Napi::Array>();
+		std::vector<std::pair<HSLSensorID, HSLSensorBufferType>> streams;
+
+		for (uint32_t i = 0; i < streamArray.Length(); ++i)
+		{
+			Napi::Value entry = streamArray.Get(i);
+			if (!entry.IsObject())
+			{
+				Napi::TypeError::New(env, "Expected an array of {sensorId, bufferType} streams").ThrowAsJavaScriptException();
+				return;
+			}
+
+			Napi::Object stream = entry.As<Napi::Object>();
+			const HSLSensorID sensor_id = stream.Get("sensorId").ToNumber().Int32Value();
+			const HSLSensorBufferType buffer_type = (HSLSensorBufferType)stream.Get("bufferType").ToNumber().Int32Value();
+
+			if (GetSensorFrameSize(buffer_type) == 0)
+			{
+				Napi::RangeError::New(env, "Invalid buffer type").ThrowAsJavaScriptException();
+				return;
+			}
+
+			streams.push_back(std::make_pair(sensor_id, buffer_type));
+		}
+
+		SensorAlignerSettings settings;
+
+		if (info.Length() >= 2 && info[1].IsObject())
+		{
+			Napi::Object options = info[1].As<Napi::Object>();
+
+			if (options.Has("sampleRate"))
+				settings.sampleRate = options.Get("sampleRate").ToNumber().DoubleValue();
+			if (options.Has("clockWindowSeconds"))
+				settings.clockWindowSeconds = std::max(options.Get("clockWindowSeconds").ToNumber().DoubleValue(), 1.0);
+			if (options.Has("maxGapSeconds"))
+				settings.maxGapSeconds = std::max(options.Get("maxGapSeconds").ToNumber().DoubleValue(), 0.0);
+			if (options.Has("maxWaitSeconds"))
+				settings.maxWaitSeconds = std::max(options.Get("maxWaitSeconds").ToNumber().DoubleValue(), 0.0);
+			if (options.Has("maxBufferedSeconds"))
+				settings.maxBufferedSeconds = std::max(options.Get("maxBufferedSeconds").ToNumber().DoubleValue(), 1.0);
+		}
+
+		if (!(settings.sampleRate > 0.0 && settings.sampleRate <= 100000.0))
+		{
+			Napi::RangeError::New(env, "sampleRate must be positive").ThrowAsJavaScriptException();
+			return;
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_aligner = std::make_shared<SensorAligner>(streams, settings);
+		AddSensorSourceListener(m_aligner);
+	}
+
+	~SensorAlignerWrap()
+	{
+		CloseAligner();
+	}
+
+	// read(maxSamples?) returns {timeInSeconds, values, sampleCount, channelCount} for the aligned
+	// samples not read yet, or null if there are none. values is planar, one column per channel:
+	// values[channel * sampleCount + sample]. Both arrays share one ArrayBuffer.
+	Napi::Value Read(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		HSLScopedLock hsl_lock;
+
+		if (!m_aligner || m_aligner->GetPendingCount() == 0)
+		{
+			return env.Null();
+		}
+
+		size_t count = m_aligner->GetPendingCount();
+		if (info.Length() >= 1 && info[0].IsNumber())
+		{
+			count = std::min(count, (size_t)std::max(info[0].ToNumber().Int64Value(), (int64_t)1));
+		}
+
+		const size_t channelCount = m_aligner->GetChannelCount();
+		Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, count * (sizeof(double) + channelCount * sizeof(float)));
+		double *times = static_cast<double *>(buffer.Data());
+		float *values = reinterpret_cast<float *>(times + count);
+
+		m_aligner->Read(count, times, values);
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("timeInSeconds", Napi::Float64Array::New(env, count, buffer, 0, napi_float64_array));
+		obj.Set("values", Napi::Float32Array::New(env, count * channelCount, buffer, count * sizeof(double), napi_float32_array));
+		obj.Set("sampleCount", (double)count);
+		obj.Set("channelCount", (double)channelCount);
+
+		return obj;
+	}
+
+	// [{sensorId, bufferType, firstChannel, channelCount}], where each stream's columns are in read()
+	Napi::Value GetStreams(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_aligner)
+		{
+			return Napi::Array::New(env);
+		}
+
+		Napi::Array streams = Napi::Array::New(env, m_aligner->GetStreamCount());
+		for (size_t i = 0; i < m_aligner->GetStreamCount(); ++i)
+		{
+			const SensorAlignerStreamInfo streamInfo = m_aligner->GetStreamInfo(i);
+
+			Napi::Object obj = Napi::Object::New(env);
+			obj.Set("sensorId", streamInfo.sensorID);
+			obj.Set("bufferType", (int)streamInfo.bufferType);
+			obj.Set("firstChannel", streamInfo.firstChannel);
+			obj.Set("channelCount", streamInfo.channelCount);
+			streams.Set((uint32_t)i, obj);
+		}
+
+		return streams;
+	}
+
+	// [{offsetSeconds, driftPpm, hostDriftPpm, fitPoints, stalled}] per stream, see SensorAlignerClock
+	Napi::Value GetClocks(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_aligner)
+		{
+			return Napi::Array::New(env);
+		}
+
+		HSLScopedLock hsl_lock;
+
+		Napi::Array clocks = Napi::Array::New(env, m_aligner->GetStreamCount());
+		for (size_t i = 0; i < m_aligner->GetStreamCount(); ++i)
+		{
+			const SensorAlignerClock clock = m_aligner->GetClock(i);
+
+			Napi::Object obj = Napi::Object::New(env);
+			obj.Set("offsetSeconds", clock.offsetSeconds);
+			obj.Set("driftPpm", clock.driftPpm);
+			obj.Set("hostDriftPpm", clock.hostDriftPpm);
+			obj.Set("fitPoints", (double)clock.fitPoints);
+			obj.Set("stalled", clock.bStalled);
+			clocks.Set((uint32_t)i, obj);
+		}
+
+		return clocks;
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_aligner)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("pendingSamples", (double)m_aligner->GetPendingCount());
+		obj.Set("droppedSamples", (double)m_aligner->GetDroppedCount());
+		obj.Set("nextTime", m_aligner->GetNextTime());
+		obj.Set("sampleRate", m_aligner->GetSettings().sampleRate);
+
+		return obj;
+	}
+
+	Napi::Value Reset(const Napi::CallbackInfo& info)
+	{
+		if (m_aligner)
+		{
+			HSLScopedLock hsl_lock;
+			m_aligner->Reset();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseAligner();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "SensorAligner", {
+			InstanceMethod("read", &SensorAlignerWrap::Read),
+			InstanceMethod("getStreams", &SensorAlignerWrap::GetStreams),
+			InstanceMethod("getClocks", &SensorAlignerWrap::GetClocks),
+			InstanceMethod("getStats", &SensorAlignerWrap::GetStats),
+			InstanceMethod("reset", &SensorAlignerWrap::Reset),
+			InstanceMethod("close", &SensorAlignerWrap::Close),
+		});
+
+		exports.Set("SensorAligner", ctor);
+	}
+
+private:
+	void CloseAligner()
+	{
+		if (m_aligner)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_aligner);
+			m_aligner.reset();
+		}
+	}
+
+	std::shared_ptr<SensorAligner> m_aligner;
+};
+
+// new AlertEngine([rule, ...], {maxQueuedEvents}) evaluates threshold rules natively as frames land and
+// queues an event only when an alert is raised or clears. A rule is
+// {name, sensorId, metric, above | below, clear, forSeconds, hrvFilter, bufferType, timeoutMs}:
+// - metric is "heartRate", "rrInterval", "pulseInterval", "hrv" (of hrvFilter), "contact" (1 or 0),
+//   "contactLost" or "noData" (ms since a frame arrived in bufferType, raised after timeoutMs)
+// - sensorId is a sensor id, or "all" (the default) for every connected sensor
+// - clear is where a raised alert clears again, the threshold itself by default
+class AlertEngineWrap : public Napi::ObjectWrap<AlertEngineWrap>
+{
+public:
+	AlertEngineWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<AlertEngineWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 1 || !info[0].IsArray())
+		{
+			Napi::TypeError::New(env, "Expected an array of rules").ThrowAsJavaScriptException();
+			return;
+		}
+
+		Napi::Array ruleArray = info[0].As<Napi::Array>();
+		std::vector<SensorAlertRule> rules;
+		SensorAlertEngineSettings settings;
+
+		for (uint32_t i = 0; i < ruleArray.Length(); ++i)
+		{
+			SensorAlertRule rule;
+
+			if (!ReadAlertRule(ruleArray.Get(i), rule) || !IsSensorAlertRuleValid(rule))
+			{
+				Napi::RangeError::New(env, "Invalid alert rule " + std::to_string(i)).ThrowAsJavaScriptException();
+				return;
+			}
+
+			rules.push_back(rule);
+		}
+
+		if (info.Length() >= 2 && info[1].IsObject())
+		{
+			Napi::Object options = info[1].As<Napi::Object>();
+
+			if (options.Has("maxQueuedEvents"))
+				settings.maxQueuedEvents = (size_t)std::max(options.Get("maxQueuedEvents").ToNumber().Int64Value(), (int64_t)1);
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_engine = std::make_shared<SensorAlertEngine>(GetSensorSource(), rules, settings);
+		AddSensorSourceListener(m_engine);
+	}
+
+	~AlertEngineWrap()
+	{
+		CloseEngine();
+	}
+
+	// read(maxEvents?) returns the queued {rule, name, sensorId, raised, value, timeInSeconds, timestamp}
+	// events, oldest first, or null if there are none. raised is false when the alert cleared.
+	Napi::Value Read(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		HSLScopedLock hsl_lock;
+
+		if (!m_engine || m_engine->GetQueuedEventCount() == 0)
+		{
+			return env.Null();
+		}
+
+		size_t maxEvents = m_engine->GetQueuedEventCount();
+		if (info.Length() >= 1 && info[0].IsNumber())
+		{
+			maxEvents = (size_t)std::max(info[0].ToNumber().Int64Value(), (int64_t)1);
+		}
+
+		m_engine->Read(maxEvents, m_events);
+
+		return CreateAlertEvents(env, m_events);
+	}
+
+	// The alerts raised now, as the events that raised them
+	Napi::Value GetActive(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		HSLScopedLock hsl_lock;
+
+		m_events.clear();
+		if (m_engine)
+		{
+			m_engine->GetActiveAlerts(m_events);
+		}
+
+		return CreateAlertEvents(env, m_events);
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_engine)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("ruleCount", (double)m_engine->GetRules().size());
+		obj.Set("queuedEvents", (double)m_engine->GetQueuedEventCount());
+		obj.Set("evaluatedValues", (double)m_engine->GetEvaluatedCount());
+		obj.Set("raised", (double)m_engine->GetRaisedCount());
+		obj.Set("cleared", (double)m_engine->GetClearedCount());
+		obj.Set("droppedEvents", (double)m_engine->GetDroppedCount());
+
+		return obj;
+	}
+
+	Napi::Value Reset(const Napi::CallbackInfo& info)
+	{
+		if (m_engine)
+		{
+			HSLScopedLock hsl_lock;
+			m_engine->Reset();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseEngine();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "AlertEngine", {
+			InstanceMethod("read", &AlertEngineWrap::Read),
+			InstanceMethod("getActive", &AlertEngineWrap::GetActive),
+			InstanceMethod("getStats", &AlertEngineWrap::GetStats),
+			InstanceMethod("reset", &AlertEngineWrap::Reset),
+			InstanceMethod("close", &AlertEngineWrap::Close),
+		});
+
+		exports.Set("AlertEngine", ctor);
+	}
+
+private:
+	static bool ReadAlertRule(Napi::Value value, SensorAlertRule &out_rule)
+	{
+		if (!value.IsObject())
+		{
+			return false;
+		}
+
+		Napi::Object rule = value.As<Napi::Object>();
+		const std::string metric = rule.Get("metric").ToString().Utf8Value();
+		bool bHasThreshold = false;
+
+		if (rule.Has("name"))
+			out_rule.name = rule.Get("name").ToString().Utf8Value();
+
+		if (rule.Has("sensorId") && rule.Get("sensorId").IsNumber())
+			out_rule.sensorID = rule.Get("sensorId").ToNumber().Int32Value();
+		else if (rule.Has("sensorId") && rule.Get("sensorId").ToString().Utf8Value() != "all")
+			return false;
+
+		if (rule.Has("above"))
+		{
+			out_rule.comparison = SensorAlertComparison_Above;
+			out_rule.threshold = rule.Get("above").ToNumber().DoubleValue();
+			bHasThreshold = true;
+		}
+		else if (rule.Has("below"))
+		{
+			out_rule.comparison = SensorAlertComparison_Below;
+			out_rule.threshold = rule.Get("below").ToNumber().DoubleValue();
+			bHasThreshold = true;
+		}
+
+		if (metric == "heartRate")
+			out_rule.metric = SensorAlertMetric_HeartRate;
+		else if (metric == "rrInterval")
+			out_rule.metric = SensorAlertMetric_RRInterval;
+		else if (metric == "pulseInterval")
+			out_rule.metric = SensorAlertMetric_PulseInterval;
+		else if (metric == "hrv")
+			out_rule.metric = SensorAlertMetric_HRV;
+		else if (metric == "contact")
+			out_rule.metric = SensorAlertMetric_Contact;
+		else if (metric == "contactLost")
+		{
+			out_rule.metric = SensorAlertMetric_Contact;
+			out_rule.comparison = SensorAlertComparison_Below;
+			out_rule.threshold = 0.5;
+			bHasThreshold = true;
+		}
+		else if (metric == "noData")
+		{
+			out_rule.metric = SensorAlertMetric_NoData;
+			out_rule.comparison = SensorAlertComparison_Above;
+			out_rule.threshold = 0.0;
+			bHasThreshold = true;
+		}
+		else
+			return false;
+
+		if (!bHasThreshold)
+			return false;
+
+		out_rule.clearThreshold = out_rule.threshold;
+		if (rule.Has("clear"))
+			out_rule.clearThreshold = rule.Get("clear").ToNumber().DoubleValue();
+		if (rule.Has("forSeconds"))
+			out_rule.forSeconds = rule.Get("forSeconds").ToNumber().DoubleValue();
+		if (rule.Has("hrvFilter"))
+			out_rule.hrvFilter = (HSLHeartRateVariabityFilterType)rule.Get("hrvFilter").ToNumber().Int32Value();
+		if (rule.Has("bufferType"))
+			out_rule.bufferType = (HSLSensorBufferType)rule.Get("bufferType").ToNumber().Int32Value();
+		if (rule.Has("timeoutMs"))
+			out_rule.timeoutMs = rule.Get("timeoutMs").ToNumber().DoubleValue();
+
+		return true;
+	}
+
+	Napi::Value CreateAlertEvents(Napi::Env env, const std::vector<SensorAlertEvent> &events) const
+	{
+		Napi::Array records = Napi::Array::New(env, events.size());
+
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const SensorAlertEvent &event = events[i];
+			Napi::Object record = Napi::Object::New(env);
+
+			record.Set("rule", (double)event.ruleIndex);
+			record.Set("name", m_engine->GetRules()[event.ruleIndex].name);
+			record.Set("sensorId", (double)event.sensorID);
+			record.Set("raised", event.bRaised);
+			record.Set("value", event.value);
+			record.Set("timeInSeconds", event.timeInSeconds);
+			record.Set("timestamp", event.timestamp);
+			records.Set((uint32_t)i, record);
+		}
+
+		return records;
+	}
+
+	void CloseEngine()
+	{
+		if (m_engine)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_engine);
+			m_engine.reset();
+		}
+	}
+
+	std::shared_ptr<SensorAlertEngine> m_engine;
+	std::vector<SensorAlertEvent> m_events; // Scratch
+};
+
+// new SensorFilterGraph(sensorId, bufferType, [stage, ...], {sampleRate, maxBufferedSeconds}) runs a
+// chain of filters over an ECG, PPG or Acc stream as it lands. Each stage is one of
+// {type: "dcBlock", frequency}, {type: "lowpass" | "highpass" | "bandpass" | "notch", frequency, q},
+// {type: "fir", taps}, {type: "movingAverage", length}, {type: "magnitude"} or {type: "select", channels}
+class SensorFilterGraphWrap : public Napi::ObjectWrap<SensorFilterGraphWrap>
+{
+public:
+	SensorFilterGraphWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<SensorFilterGraphWrap>(info)
+	{
+		Napi::Env env = info.Env();
+
+		if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsNumber() || !info[2].IsArray())
+		{
+			Napi::TypeError::New(env, "Expected sensor id, buffer type and stage array arguments").ThrowAsJavaScriptException();
+			return;
+		}
+
+		const HSLSensorID sensor_id = info[0].ToNumber().Int32Value();
+		const HSLSensorBufferType buffer_type = (HSLSensorBufferType)info[1].ToNumber().Int32Value();
+		SensorFilterGraphSettings settings;
+
+		if (info.Length() >= 4 && info[3].IsObject())
+		{
+			Napi::Object options = info[3].As<Napi::Object>();
+
+			if (options.Has("sampleRate"))
+				settings.sampleRate = std::max(options.Get("sampleRate").ToNumber().DoubleValue(), 0.0);
+			if (options.Has("maxBufferedSeconds"))
+				settings.maxBufferedSeconds = std::max(options.Get("maxBufferedSeconds").ToNumber().DoubleValue(), 1.0);
+		}
+
+		if (!IsSensorWaveformBuffer(buffer_type))
+		{
+			Napi::RangeError::New(env, "Expected an ECG, PPG or Acc buffer type").ThrowAsJavaScriptException();
+			return;
+		}
+
+		std::shared_ptr<SensorFilterGraph> graph = std::make_shared<SensorFilterGraph>(sensor_id, buffer_type, settings);
+		Napi::Array stages = info[2].As<Napi::Array>();
+
+		for (uint32_t i = 0; i < stages.Length(); ++i)
+		{
+			SensorFilterStageDesc desc;
+
+			if (!ReadStageDesc(stages.Get(i), desc) || !graph->AddStage(desc))
+			{
+				Napi::RangeError::New(env, "Invalid filter stage " + std::to_string(i)).ThrowAsJavaScriptException();
+				return;
+			}
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_graph = graph;
+		AddSensorSourceListener(m_graph);
+	}
+
+	~SensorFilterGraphWrap()
+	{
+		CloseGraph();
+	}
+
+	Napi::Value GetSensorID(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_graph ? m_graph->GetSensorID() : -1);
+	}
+
+	Napi::Value GetBufferType(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_graph ? (int)m_graph->GetBufferType() : -1);
+	}
+
+	// Channels of the filtered output, e.g. 1 after a magnitude stage
+	Napi::Value GetChannelCount(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_graph ? m_graph->GetOutputChannelCount() : 0);
+	}
+
+	// read(maxSamples?) returns {timeInSeconds, raw, values, sampleCount, rawChannelCount, channelCount}
+	// for the samples not read yet, or null if there are none. raw holds the samples as they came in
+	// and values the output of the chain, both planar: values[channel * sampleCount + sample].
+	// All three arrays share one ArrayBuffer.
+	Napi::Value Read(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		HSLScopedLock hsl_lock;
+
+		if (!m_graph || m_graph->GetPendingCount() == 0)
+		{
+			return env.Null();
+		}
+
+		size_t count = m_graph->GetPendingCount();
+		if (info.Length() >= 1 && info[0].IsNumber())
+		{
+			count = std::min(count, (size_t)std::max(info[0].ToNumber().Int64Value(), (int64_t)1));
+		}
+
+		const size_t rawChannelCount = m_graph->GetInputChannelCount();
+		const size_t channelCount = m_graph->GetOutputChannelCount();
+		const size_t rawOffset = count * sizeof(double);
+		const size_t valuesOffset = rawOffset + count * rawChannelCount * sizeof(float);
+
+		Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, valuesOffset + count * channelCount * sizeof(float));
+		uint8_t *data = static_cast<uint8_t *>(buffer.Data());
+
+		m_graph->Read(
+			count,
+			reinterpret_cast<double *>(data),
+			reinterpret_cast<float *>(data + rawOffset),
+			reinterpret_cast<float *>(data + valuesOffset));
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("timeInSeconds", Napi::Float64Array::New(env, count, buffer, 0, napi_float64_array));
+		obj.Set("raw", Napi::Float32Array::New(env, count * rawChannelCount, buffer, rawOffset, napi_float32_array));
+		obj.Set("values", Napi::Float32Array::New(env, count * channelCount, buffer, valuesOffset, napi_float32_array));
+		obj.Set("sampleCount", (double)count);
+		obj.Set("rawChannelCount", (double)rawChannelCount);
+		obj.Set("channelCount", (double)channelCount);
+
+		return obj;
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_graph)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("pendingSamples", (double)m_graph->GetPendingCount());
+		obj.Set("processedSamples", (double)m_graph->GetProcessedCount());
+		obj.Set("droppedSamples", (double)m_graph->GetDroppedCount());
+		obj.Set("sampleRate", m_graph->GetSampleRate());
+		obj.Set("stageCount", (double)m_graph->GetStageCount());
+
+		return obj;
+	}
+
+	Napi::Value Reset(const Napi::CallbackInfo& info)
+	{
+		if (m_graph)
+		{
+			HSLScopedLock hsl_lock;
+			m_graph->Reset();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseGraph();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "SensorFilterGraph", {
+			InstanceMethod("getSensorID", &SensorFilterGraphWrap::GetSensorID),
+			InstanceMethod("getBufferType", &SensorFilterGraphWrap::GetBufferType),
+			InstanceMethod("getChannelCount", &SensorFilterGraphWrap::GetChannelCount),
+			InstanceMethod("read", &SensorFilterGraphWrap::Read),
+			InstanceMethod("getStats", &SensorFilterGraphWrap::GetStats),
+			InstanceMethod("reset", &SensorFilterGraphWrap::Reset),
+			InstanceMethod("close", &SensorFilterGraphWrap::Close),
+		});
+
+		exports.Set("SensorFilterGraph", ctor);
+	}
+
+private:
+	static bool ReadStageDesc(Napi::Value value, SensorFilterStageDesc &out_desc)
+	{
+		if (!value.IsObject())
+		{
+			return false;
+		}
+
+		Napi::Object stage = value.As<Napi::Object>();
+		const std::string type = stage.Get("type").ToString().Utf8Value();
+
+		if (type == "dcBlock")
+			out_desc.type = SensorFilterStage_DCBlock;
+		else if (type == "lowpass")
+			out_desc.type = SensorFilterStage_Lowpass;
+		else if (type == "highpass")
+			out_desc.type = SensorFilterStage_Highpass;
+		else if (type == "bandpass")
+			out_desc.type = SensorFilterStage_Bandpass;
+		else if (type == "notch")
+			out_desc.type = SensorFilterStage_Notch;
+		else if (type == "fir")
+			out_desc.type = SensorFilterStage_FIR;
+		else if (type == "movingAverage")
+			out_desc.type = SensorFilterStage_MovingAverage;
+		else if (type == "magnitude")
+			out_desc.type = SensorFilterStage_Magnitude;
+		else if (type == "select")
+			out_desc.type = SensorFilterStage_Select;
+		else
+			return false;
+
+		// The DC blocker only needs to get under the slowest signal worth keeping
+		if (out_desc.type == SensorFilterStage_DCBlock)
+			out_desc.frequency = 0.5;
+
+		if (stage.Has("frequency"))
+			out_desc.frequency = stage.Get("frequency").ToNumber().DoubleValue();
+		if (stage.Has("q"))
+			out_desc.q = stage.Get("q").ToNumber().DoubleValue();
+		if (stage.Has("length"))
+			out_desc.length = stage.Get("length").ToNumber().Int32Value();
+
+		if (stage.Has("taps"))
+		{
+			Napi::Value taps = stage.Get("taps");
+			if (!taps.IsArray() && !taps.IsTypedArray())
+				return false;
+
+			Napi::Object tapArray = taps.As<Napi::Object>();
+			const uint32_t tapCount = tapArray.Get("length").ToNumber().Uint32Value();
+			for (uint32_t i = 0; i < tapCount; ++i)
+			{
+				out_desc.taps.push_back(tapArray.Get(i).ToNumber().FloatValue());
+			}
+		}
+
+		if (stage.Has("channels"))
+		{
+			Napi::Value channels = stage.Get("channels");
+			if (!channels.IsArray())
+				return false;
+
+			Napi::Array channelArray = channels.As<Napi::Array>();
+			for (uint32_t i = 0; i < channelArray.Length(); ++i)
+			{
+				out_desc.channels.push_back(channelArray.Get(i).ToNumber().Int32Value());
+			}
+		}
+
+		return true;
+	}
+
+	void CloseGraph()
+	{
+		if (m_graph)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_graph);
+			m_graph.reset();
+		}
+	}
+
+	std::shared_ptr<SensorFilterGraph> m_graph;
+};
+
+// new HistoryStore({rawSeconds, secondBuckets, minuteBuckets, maxBytes})
+class HistoryStoreWrap : public Napi::ObjectWrap<HistoryStoreWrap>
+{
+public:
+	HistoryStoreWrap(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<HistoryStoreWrap>(info)
+	{
+		SensorHistorySettings settings;
+
+		if (info.Length() >= 1 && info[0].IsObject())
+		{
+			Napi::Object options = info[0].As<Napi::Object>();
+
+			if (options.Has("rawSeconds"))
+				settings.rawSeconds = std::max(options.Get("rawSeconds").ToNumber().DoubleValue(), 0.0);
+			if (options.Has("secondBuckets"))
+				settings.secondBuckets = (size_t)std::max(options.Get("secondBuckets").ToNumber().Int64Value(), (int64_t)1);
+			if (options.Has("minuteBuckets"))
+				settings.minuteBuckets = (size_t)std::max(options.Get("minuteBuckets").ToNumber().Int64Value(), (int64_t)1);
+			if (options.Has("maxBytes"))
+				settings.maxBytes = (size_t)std::max(options.Get("maxBytes").ToNumber().Int64Value(), (int64_t)0);
+		}
+
+		HSLScopedLock hsl_lock;
+
+		m_store = std::make_shared<SensorHistoryStore>(settings);
+		AddSensorSourceListener(m_store);
+	}
+
+	~HistoryStoreWrap()
+	{
+		CloseStore();
+	}
+
+	// track(sensorId, bufferType, hrvFilter?) starts recording a stream, returns false if it can't be recorded
+	Napi::Value Track(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		REQ_ARGS(2);
+		REQ_INT_ARG(0, sensorID);
+		REQ_INT_ARG(1, bufferType);
+
+		if (!m_store)
+		{
+			return Napi::Boolean::New(env, false);
+		}
+
+		HSLScopedLock hsl_lock;
+
+		return Napi::Boolean::New(env, m_store->Track(sensorID, (HSLSensorBufferType)bufferType, GetHrvFilterArg(info, 2)));
+	}
+
+	// untrack(sensorId, bufferType, hrvFilter?) stops recording a stream and drops its history
+	Napi::Value Untrack(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		REQ_ARGS(2);
+		REQ_INT_ARG(0, sensorID);
+		REQ_INT_ARG(1, bufferType);
+
+		if (!m_store)
+		{
+			return Napi::Boolean::New(env, false);
+		}
+
+		HSLScopedLock hsl_lock;
+
+		return Napi::Boolean::New(env, m_store->Untrack(sensorID, (HSLSensorBufferType)bufferType, GetHrvFilterArg(info, 2)));
+	}
+
+	// getRange(sensorId, bufferType, startTime, endTime, resolution?, hrvFilter?)
+	// Resolution_Raw returns a batch shaped like the drain APIs' with the frames in [startTime, endTime).
+	// Resolution_Second and Resolution_Minute return {resolution, bucketSeconds, channels, timeInSeconds,
+	// count, mean, min, max} for the buckets overlapping the range, one planar column per channel:
+	// mean[channel * count.length + bucket]. Resolution_Auto (the default) picks the finest resolution
+	// whose history still reaches back to startTime. Returns null for streams that aren't tracked.
+	Napi::Value GetRange(const Napi::CallbackInfo& info)
+	{
+		PipelineScopedTimer timer(PipelineTiming_HistoryRange);
+		Napi::Env env = info.Env();
+		REQ_ARGS(4);
+		REQ_INT_ARG(0, sensorID);
+		REQ_INT_ARG(1, bufferType);
+
+		const double startTime = info[2].ToNumber().DoubleValue();
+		const double endTime = info[3].ToNumber().DoubleValue();
+		int resolution = (info.Length() > 4 && info[4].IsNumber()) ? info[4].ToNumber().Int32Value() : k_resolutionAuto;
+		const HSLHeartRateVariabityFilterType hrvFilter = GetHrvFilterArg(info, 5);
+
+		if (resolution != k_resolutionAuto && (resolution < 0 || resolution >= SensorHistoryResolution_COUNT))
+		{
+			Napi::RangeError::New(env, "Unknown resolution").ThrowAsJavaScriptException();
+			return env.Null();
+		}
+
+		if (!m_store)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		const SensorHistoryStream *stream = m_store->FindStream(sensorID, (HSLSensorBufferType)bufferType, hrvFilter);
+		if (stream == nullptr)
+		{
+			return env.Null();
+		}
+
+		if (resolution == k_resolutionAuto)
+		{
+			const double oldestRaw = stream->GetOldestRawTime();
+			const double oldestSecond = stream->GetAggregates(SensorHistoryResolution_Second).GetOldestTime();
+
+			resolution =
+				(oldestRaw > 0.0 && startTime >= oldestRaw) ? SensorHistoryResolution_Raw :
+				(oldestSecond > 0.0 && startTime >= oldestSecond) ? SensorHistoryResolution_Second :
+				SensorHistoryResolution_Minute;
+		}
+
+		if (resolution == SensorHistoryResolution_Raw)
+		{
+			SensorFrameLayout layout;
+			if (!stream->GetRawRange(startTime, endTime, layout, m_rawScratch))
+			{
+				return env.Null();
+			}
+
+			Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, layout.byteLength);
+			memcpy(buffer.Data(), m_rawScratch.data(), layout.byteLength);
+
+			Napi::Object batch = CreateSensorFrameBatch(env, sensorID, layout, buffer, hrvFilter);
+			batch.Set("resolution", resolution);
+
+			return batch;
+		}
+
+		const SensorHistoryAggregates &aggregates = stream->GetAggregates((SensorHistoryResolution)resolution);
+		const size_t bucketCount = aggregates.GetRange(
+			startTime, endTime,
+			m_bucketTimes, m_bucketCounts, m_bucketMean, m_bucketMin, m_bucketMax);
+		const int channelCount = aggregates.GetChannelCount();
+		const size_t valueCount = bucketCount * channelCount;
+
+		Napi::Array channels = Napi::Array::New(env, channelCount);
+		for (int channel = 0; channel < channelCount; ++channel)
+		{
+			channels.Set(
+				(uint32_t)channel,
+				(bufferType == HSLBufferType_HRData)
+					? "beatsPerMinute"
+					: GetSensorSampleChannelName((HSLSensorBufferType)bufferType, channel));
+		}
+
+		// Times, counts and the three value columns share one ArrayBuffer, times first to keep them aligned
+		const size_t timesBytes = bucketCount * sizeof(double);
+		const size_t countsBytes = bucketCount * sizeof(uint32_t);
+		const size_t valuesBytes = valueCount * sizeof(float);
+		Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, timesBytes + countsBytes + 3 * valuesBytes);
+		uint8_t *data = static_cast<uint8_t *>(buffer.Data());
+
+		std::copy(m_bucketTimes.begin(), m_bucketTimes.end(), reinterpret_cast<double *>(data));
+		std::copy(m_bucketCounts.begin(), m_bucketCounts.end(), reinterpret_cast<uint32_t *>(data + timesBytes));
+		std::copy(m_bucketMean.begin(), m_bucketMean.end(), reinterpret_cast<float *>(data + timesBytes + countsBytes));
+		std::copy(m_bucketMin.begin(), m_bucketMin.end(), reinterpret_cast<float *>(data + timesBytes + countsBytes + valuesBytes));
+		std::copy(m_bucketMax.begin(), m_bucketMax.end(), reinterpret_cast<float *>(data + timesBytes + countsBytes + 2 * valuesBytes));
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("sensorId", sensorID);
+		obj.Set("bufferType", bufferType);
+		obj.Set("resolution", resolution);
+		obj.Set("bucketSeconds", aggregates.GetBucketSeconds());
+		obj.Set("channels", channels);
+		obj.Set("timeInSeconds", Napi::Float64Array::New(env, bucketCount, buffer, 0, napi_float64_array));
+		obj.Set("count", Napi::Uint32Array::New(env, bucketCount, buffer, timesBytes, napi_uint32_array));
+		obj.Set("mean", Napi::Float32Array::New(env, valueCount, buffer, timesBytes + countsBytes, napi_float32_array));
+		obj.Set("min", Napi::Float32Array::New(env, valueCount, buffer, timesBytes + countsBytes + valuesBytes, napi_float32_array));
+		obj.Set("max", Napi::Float32Array::New(env, valueCount, buffer, timesBytes + countsBytes + 2 * valuesBytes, napi_float32_array));
+
+		return obj;
+	}
+
+	Napi::Value GetStats(const Napi::CallbackInfo& info)
+	{
+		Napi::Env env = info.Env();
+		if (!m_store)
+		{
+			return env.Null();
+		}
+
+		HSLScopedLock hsl_lock;
+
+		const std::vector<std::unique_ptr<SensorHistoryStream>> &streams = m_store->GetStreams();
+		Napi::Array streamArray = Napi::Array::New(env, streams.size());
+		for (size_t i = 0; i < streams.size(); ++i)
+		{
+			const SensorHistoryStream &stream = *streams[i];
+
+			Napi::Object streamObj = Napi::Object::New(env);
+			streamObj.Set("sensorId", stream.GetSensorID());
+			streamObj.Set("bufferType", (int)stream.GetBufferType());
+			streamObj.Set("rawFrameCount", (double)stream.GetRawFrameCount());
+			streamObj.Set("secondBuckets", (double)stream.GetAggregates(SensorHistoryResolution_Second).GetBucketCount());
+			streamObj.Set("minuteBuckets", (double)stream.GetAggregates(SensorHistoryResolution_Minute).GetBucketCount());
+			streamObj.Set("oldestTime", stream.GetOldestTime());
+			streamObj.Set("oldestRawTime", stream.GetOldestRawTime());
+			streamObj.Set("latestTime", stream.GetLatestTime());
+			streamObj.Set("byteSize", (double)stream.GetByteSize());
+			if (stream.GetBufferType() == HSLBufferType_HRVData)
+				streamObj.Set("hrvFilter", (int)stream.GetHrvFilter());
+
+			streamArray.Set((uint32_t)i, streamObj);
+		}
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("byteSize", (double)m_store->GetByteSize());
+		obj.Set("maxBytes", (double)m_store->GetSettings().maxBytes);
+		obj.Set("streams", streamArray);
+
+		return obj;
+	}
+
+	Napi::Value Clear(const Napi::CallbackInfo& info)
+	{
+		if (m_store)
+		{
+			HSLScopedLock hsl_lock;
+			m_store->Clear();
+		}
+
+		return info.Env().Undefined();
+	}
+
+	Napi::Value Close(const Napi::CallbackInfo& info)
+	{
+		CloseStore();
+
+		return info.Env().Undefined();
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		Napi::Function ctor = DefineClass(env, "HistoryStore", {
+			InstanceMethod("track", &HistoryStoreWrap::Track),
+			InstanceMethod("untrack", &HistoryStoreWrap::Untrack),
+			InstanceMethod("getRange", &HistoryStoreWrap::GetRange),
+			InstanceMethod("getStats", &HistoryStoreWrap::GetStats),
+			InstanceMethod("clear", &HistoryStoreWrap::Clear),
+			InstanceMethod("close", &HistoryStoreWrap::Close),
+
+			StaticValue("Resolution_Auto", Napi::Number::New(env, k_resolutionAuto)),
+			StaticValue("Resolution_Raw", Napi::Number::New(env, SensorHistoryResolution_Raw)),
+			StaticValue("Resolution_Second", Napi::Number::New(env, SensorHistoryResolution_Second)),
+			StaticValue("Resolution_Minute", Napi::Number::New(env, SensorHistoryResolution_Minute)),
+		});
+
+		exports.Set("HistoryStore", ctor);
+	}
+
+private:
+	static const int k_resolutionAuto = -1;
+
+	static HSLHeartRateVariabityFilterType GetHrvFilterArg(const Napi::CallbackInfo& info, size_t arg)
+	{
+		return (info.Length() > arg && info[arg].IsNumber())
+			? (HSLHeartRateVariabityFilterType)info[arg].ToNumber().Int32Value()
+			: HRVFilter_SDNN;
+	}
+
+	void CloseStore()
+	{
+		if (m_store)
+		{
+			HSLScopedLock hsl_lock;
+
+			RemoveSensorSourceListener(m_store);
+			m_store.reset();
+		}
+	}
+
+	std::shared_ptr<SensorHistoryStore> m_store;
+	std::vector<uint8_t> m_rawScratch;
+	std::vector<double> m_bucketTimes;
+	std::vector<uint32_t> m_bucketCounts;
+	std::vector<float> m_bucketMean;
+	std::vector<float> m_bucketMin;
+	std::vector<float> m_bucketMax;
+};
+
+// Feeds every StreamRing from its HSL buffer, flushing those buffers.
+// The background poller does this itself on every tick.
+Napi::Value IngestStreamRings(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	if (!ClaimUpdateLoop(GetAddonData(info.Env())))
+	{
+		return Napi::Number::New(info.Env(), 0);
+	}
+
+	return Napi::Number::New(info.Env(), (double)GetSensorStreamRingRegistry().IngestAll());
+}
+
+class EventMessage : public Napi::ObjectWrap<EventMessage>
+{
+public:
+	EventMessage(const Napi::CallbackInfo& info)
+		: Napi::ObjectWrap<EventMessage>(info)
+	{
+		if (info.Length() >= 1 && info[0].IsExternal())
+		{
+			Napi::External<HSLEventMessage> inEventMessage = info[0].As<Napi::External<HSLEventMessage>>();
+
+			m_eventMessage = *inEventMessage.Data();
+		}
+		else
+		{
+			Napi::TypeError::New(info.Env(), "Argument 0 invalid").ThrowAsJavaScriptException();
+		}
+	}
+
+	// Create a new item using the constructor stored during Init.
+	static Napi::Object CreateNewEventMessage(const Napi::CallbackInfo& info, HSLEventMessage &event_message)
+	{
+		return GetAddonData(info.Env()).eventMessageConstructor.New({Napi::External<HSLEventMessage>::New(info.Env(), &event_message)});
+	}
+
+	Napi::Value GetEventType(const Napi::CallbackInfo& info)
+	{
+		return Napi::Number::New(info.Env(), m_eventMessage.event_type);
+	}
+
+	static void Init(Napi::Env env, Napi::Object exports)
+	{
+		Napi::HandleScope scope(env);
+
+		/**
+		* HSLEventType
+		*/
+		Napi::PropertyDescriptor Event_SensorListUpdated = 
+			Napi::PropertyDescriptor::Value("Event_SensorListUpdated", Napi::Number::New(env, HSLEvent_SensorListUpdated));
+		exports.DefineProperties({
+			Event_SensorListUpdated
+		});
+
+		Napi::Function ctor = DefineClass(env, "EventMessage", {
+			InstanceMethod("getEventType", &EventMessage::GetEventType),
+		});
+
+		// Create a persistent reference to the class constructor. This will allow
+		// a function called on a class prototype and a function
+		// called on instance of a class to be distinguished from each other.
+		GetAddonData(env).eventMessageConstructor = Napi::Persistent(ctor);
+		exports.Set("EventMessage", ctor);
+	}
+
+private:
+	HSLEventMessage m_eventMessage;
+};
+
+Napi::Value PollNextMessage(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	Napi::Env env = info.Env();
+
+	HSLEventMessage mesg;
+	if (CanPollEvents(GetAddonData(env)) && GetSensorSource().PollNextMessage(&mesg))
+	{
+		return EventMessage::CreateNewEventMessage(info, mesg);
+	}
+	else
+	{
+		return env.Null();
+	}
+}
+
+static Napi::ThreadSafeFunction g_sensorPollerCallback;
+static bool g_bSensorPollerCallbackActive = false;
+
+// Runs on the JS thread whenever the poller has staged new results
+void DeliverSensorPollerResults(Napi::Env env, Napi::Function callback)
+{
+	SensorPollerResults results;
+	g_sensorPoller.TakeResults(results);
+
+	if (env == nullptr || callback == nullptr)
+	{
+		return;
+	}
+
+	Napi::Array batches = Napi::Array::New(env, results.batches.size());
+	{
+		PipelineScopedTimer timer(PipelineTiming_DeliverPolled);
+
+		for (size_t i = 0; i < results.batches.size(); ++i)
+		{
+			batches.Set((uint32_t)i, CreateSensorFrameBatch(env, results.batches[i]));
+		}
+	}
+
+	callback.Call({
+		batches,
+		Napi::Boolean::New(env, results.bSensorListChanged),
+		Napi::Boolean::New(env, results.bAlertsQueued)});
+}
+
+// startPolling({intervalMs, idleIntervalMs, bufferTypeMask, hrvFilterMask, planar, thresholds}, callback(batches, sensorListChanged, alertsQueued))
+// thresholds maps a buffer type to {minSamples, maxAgeMs}, see SensorPollerThreshold. The callback
+// only runs when some stream crosses its threshold, the sensor list changes or an AlertEngine
+// queued events.
+Napi::Value StartPolling(const Napi::CallbackInfo& info)
+{
+	REQ_ARGS(2);
+
+	Napi::Env env = info.Env();
+	if (!info[0].IsObject() || !info[1].IsFunction())
+	{
+		Napi::TypeError::New(env, "Expected an options object and a callback").ThrowAsJavaScriptException();
+		return env.Null();
+	}
+
+	{
+		HSLScopedLock hsl_lock;
+
+		if (!ClaimUpdateLoop(GetAddonData(env)) || g_sensorPoller.IsRunning())
+		{
+			return Napi::Boolean::New(env, false);
+		}
+	}
+
+	Napi::Object options = info[0].As<Napi::Object>();
+	SensorPollerSettings settings;
+
+	if (options.Has("intervalMs"))
+	{
+		settings.updateIntervalMs = std::max(options.Get("intervalMs").ToNumber().Int32Value(), 1);
+	}
+	if (options.Has("bufferTypeMask"))
+	{
+		settings.bufferTypeMask = options.Get("bufferTypeMask").ToNumber().Uint32Value();
+	}
+	if (options.Has("hrvFilterMask"))
+	{
+		settings.hrvFilterMask = options.Get("hrvFilterMask").ToNumber().Uint32Value();
+	}
+	if (options.Has("planar"))
+	{
+		settings.bPlanarSamples = options.Get("planar").ToBoolean();
+	}
+	if (options.Has("idleIntervalMs"))
+	{
+		settings.idleIntervalMs = std::max(options.Get("idleIntervalMs").ToNumber().Int32Value(), 1);
+	}
+	if (options.Has("thresholds") && options.Get("thresholds").IsObject())
+	{
+		Napi::Object thresholds = options.Get("thresholds").As<Napi::Object>();
+
+		for (int buffer_type = 0; buffer_type < HSLBufferType_COUNT; ++buffer_type)
+		{
+			Napi::Value value = thresholds.Get((uint32_t)buffer_type);
+			if (!value.IsObject())
+				continue;
+
+			Napi::Object threshold = value.As<Napi::Object>();
+			SensorPollerThreshold &out_threshold = settings.thresholds[buffer_type];
+
+			if (threshold.Has("minSamples"))
+				out_threshold.minSamples = std::max(threshold.Get("minSamples").ToNumber().Int32Value(), 0);
+			if (threshold.Has("maxAgeMs"))
+				out_threshold.maxAgeMs = std::max(threshold.Get("maxAgeMs").ToNumber().Int32Value(), 0);
+		}
+	}
+
+	g_sensorPollerCallback = Napi::ThreadSafeFunction::New(env, info[1].As<Napi::Function>(), "HSLSensorPoller", 0, 1);
+	g_bSensorPollerCallbackActive = true;
+
+	Napi::ThreadSafeFunction callback = g_sensorPollerCallback;
+	g_sensorPoller.Start(settings, [callback]() {
+		callback.NonBlockingCall(DeliverSensorPollerResults);
+	});
+
+	return Napi::Boolean::New(env, true);
+}
+
+void StopSensorPoller()
+{
+	g_sensorPoller.Stop();
+
+	if (g_bSensorPollerCallbackActive)
+	{
+		g_sensorPollerCallback.Release();
+		g_bSensorPollerCallbackActive = false;
+	}
+}
+
+// Whether this env owns the update loop, the poller is only touched from the owner's thread
+static bool IsUpdateLoopOwner(Napi::Env env)
+{
+	HSLScopedLock hsl_lock;
+
+	return g_updateOwner == &GetAddonData(env);
+}
+
+Napi::Value StopPolling(const Napi::CallbackInfo& info)
+{
+	if (!IsUpdateLoopOwner(info.Env()))
+	{
+		return Napi::Boolean::New(info.Env(), false);
+	}
+
+	bool bWasRunning = g_sensorPoller.IsRunning();
+
+	StopSensorPoller();
+
+	return Napi::Boolean::New(info.Env(), bWasRunning);
+}
+
+Napi::Value IsPolling(const Napi::CallbackInfo& info)
+{
+	return Napi::Boolean::New(info.Env(), IsUpdateLoopOwner(info.Env()) && g_sensorPoller.IsRunning());
+}
+
+static Napi::Object CreateLatencySummary(Napi::Env env, const LatencySummary &summary)
+{
+	Napi::Object obj = Napi::Object::New(env);
+	obj.Set("count", (double)summary.count);
+	obj.Set("sumMs", summary.sum);
+	obj.Set("meanMs", summary.mean);
+	obj.Set("p50Ms", summary.p50);
+	obj.Set("p90Ms", summary.p90);
+	obj.Set("p99Ms", summary.p99);
+	obj.Set("maxMs", summary.max);
+
+	return obj;
+}
+
+// getStats({reset}) returns the pipeline counters and latency summaries, shared by every env:
+// {uptimeSeconds, enabled, timings: {name: summary}, streams: [{sensorId, bufferType, ...}]}.
+// reset clears them once they have been read.
+Napi::Value GetStats(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	PipelineStats &stats = GetPipelineStats();
+
+	bool bReset = false;
+	if (info.Length() > 0 && info[0].IsObject())
+	{
+		Napi::Value reset = info[0].As<Napi::Object>().Get("reset");
+		bReset = reset.IsBoolean() && reset.As<Napi::Boolean>().Value();
+	}
+
+	Napi::Object result = Napi::Object::New(env);
+	result.Set("uptimeSeconds", stats.GetUptimeSeconds());
+	result.Set("enabled", stats.IsEnabled());
+
+	Napi::Object timings = Napi::Object::New(env);
+	for (int timing = 0; timing < PipelineTiming_COUNT; ++timing)
+	{
+		timings.Set(
+			GetPipelineTimingName((PipelineTiming)timing),
+			CreateLatencySummary(env, stats.GetTiming((PipelineTiming)timing).GetSummary()));
+	}
+	result.Set("timings", timings);
+
+	std::vector<PipelineStreamSnapshot> snapshots;
+	stats.GetStreams(snapshots);
+
+	Napi::Array streams = Napi::Array::New(env, snapshots.size());
+	for (size_t i = 0; i < snapshots.size(); ++i)
+	{
+		const PipelineStreamSnapshot &snapshot = snapshots[i];
+
+		Napi::Object stream = Napi::Object::New(env);
+		stream.Set("sensorId", snapshot.sensorID);
+		stream.Set("bufferType", (int)snapshot.bufferType);
+		stream.Set("drains", (double)snapshot.drains);
+		stream.Set("frames", (double)snapshot.frames);
+		stream.Set("samples", (double)snapshot.samples);
+		stream.Set("duplicateFrames", (double)snapshot.duplicateFrames);
+		stream.Set("droppedFrames", (double)snapshot.droppedFrames);
+		stream.Set("gaps", (double)snapshot.gaps);
+		stream.Set("frameAge", CreateLatencySummary(env, snapshot.frameAge));
+		stream.Set("endToEnd", CreateLatencySummary(env, snapshot.endToEnd));
+		streams.Set((uint32_t)i, stream);
+	}
+	result.Set("streams", streams);
+
+	if (bReset)
+	{
+		stats.Reset();
+	}
+
+	return result;
+}
+
+// setStatsEnabled(enabled) turns the pipeline counters and timers on or off, they start on
+Napi::Value SetStatsEnabled(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	REQ_ARGS(1);
+	REQ_BOOL_ARG(0, enabled);
+
+	GetPipelineStats().SetEnabled(enabled);
+
+	return env.Undefined();
+}
+
+// recordDelivery(sensorId, bufferType, milliseconds) adds one end to end latency, from a frame
+// reaching the host to it being written to a client
+Napi::Value RecordDelivery(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	REQ_ARGS(3);
+	REQ_INT_ARG(0, sensorID);
+	REQ_INT_ARG(1, bufferType);
+
+	if (!info[2].IsNumber())
+	{
+		Napi::TypeError::New(env, "Argument 2 must be a number").ThrowAsJavaScriptException();
+		return env.Null();
+	}
+
+	GetPipelineStats().RecordDelivery(
+		(HSLSensorID)sensorID,
+		(HSLSensorBufferType)bufferType,
+		info[2].As<Napi::Number>().DoubleValue());
+
+	return env.Undefined();
+}
+
+// Applied to sensors that connect after configureStreams({sensorId: "all", applyToNew: true})
+static std::shared_ptr<SensorStreamPolicy> g_sensorStreamPolicy;
+
+// A stream mask given either as a bitmask or as an array of flag indices
+static bool ReadStreamMask(Napi::Value value, int flag_count, unsigned int &out_mask)
+{
+	if (value.IsNumber())
+	{
+		out_mask = value.ToNumber().Uint32Value();
+		return true;
+	}
+
+	if (!value.IsArray())
+	{
+		return false;
+	}
+
+	Napi::Array flags = value.As<Napi::Array>();
+	out_mask = 0;
+
+	for (uint32_t i = 0; i < flags.Length(); ++i)
+	{
+		Napi::Value flag = flags.Get(i);
+		if (!flag.IsNumber() || flag.ToNumber().Int32Value() < 0 || flag.ToNumber().Int32Value() >= flag_count)
+		{
+			return false;
+		}
+
+		out_mask = HSL_BITMASK_SET_FLAG(out_mask, flag.ToNumber().Int32Value());
+	}
+
+	return true;
+}
+
+// {sensorId, data, filters, mode, applyToNew} into a config. sensorId is a sensor id or "all".
+static bool ReadStreamConfig(Napi::Env env, Napi::Value value, SensorStreamConfig &out_config, bool &out_all, HSLSensorID &out_sensor_id, bool &out_apply_to_new)
+{
+	if (!value.IsObject())
+	{
+		Napi::TypeError::New(env, "Expected a {sensorId, data, filters} stream config").ThrowAsJavaScriptException();
+		return false;
+	}
+
+	Napi::Object options = value.As<Napi::Object>();
+	Napi::Value sensorId = options.Get("sensorId");
+
+	out_all = sensorId.IsString() && sensorId.As<Napi::String>().Utf8Value() == "all";
+	out_sensor_id = sensorId.IsNumber() ? sensorId.ToNumber().Int32Value() : -1;
+	out_apply_to_new = options.Has("applyToNew") && options.Get("applyToNew").ToBoolean().Value();
+
+	if (!out_all && !sensorId.IsNumber())
+	{
+		Napi::TypeError::New(env, "sensorId must be a sensor id or \"all\"").ThrowAsJavaScriptException();
+		return false;
+	}
+
+	if (options.Has("mode"))
+	{
+		const std::string mode = options.Get("mode").ToString().Utf8Value();
+
+		if (mode == "set")
+			out_config.mode = SensorStreamConfigMode_Set;
+		else if (mode == "enable")
+			out_config.mode = SensorStreamConfigMode_Enable;
+		else if (mode == "disable")
+			out_config.mode = SensorStreamConfigMode_Disable;
+		else
+		{
+			Napi::RangeError::New(env, "mode must be \"set\", \"enable\" or \"disable\"").ThrowAsJavaScriptException();
+			return false;
+		}
+	}
+
+	if (options.Has("data"))
+	{
+		if (!ReadStreamMask(options.Get("data"), HSLStreamFlags_COUNT, out_config.dataStreams))
+		{
+			Napi::TypeError::New(env, "data must be a bitmask or an array of Sensor.StreamFlags_*").ThrowAsJavaScriptException();
+			return false;
+		}
+		out_config.bHasDataStreams = true;
+	}
+
+	if (options.Has("filters"))
+	{
+		if (!ReadStreamMask(options.Get("filters"), HRVFilter_COUNT, out_config.filterStreams))
+		{
+			Napi::TypeError::New(env, "filters must be a bitmask or an array of Sensor.HRVFilter_*").ThrowAsJavaScriptException();
+			return false;
+		}
+		out_config.bHasFilterStreams = true;
+	}
+
+	return true;
+}
+
+// configureStreams(config or [config, ...]) sets the active streams of many sensors at once, see
+// ApplySensorStreamConfig. Each config is {sensorId, data, filters, mode, applyToNew}: sensorId is
+// a sensor id or "all", data and filters are bitmasks or arrays of flags, mode is "set" (default),
+// "enable" or "disable". applyToNew with sensorId "all" keeps applying the config to sensors that
+// connect later, replacing any such config set before.
+// Returns [{sensorId, data, filters, dataChanged, filtersChanged, success}], one per sensor touched.
+Napi::Value ConfigureStreams(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	REQ_ARGS(1);
+
+	std::vector<Napi::Value> configValues;
+	if (info[0].IsArray())
+	{
+		Napi::Array configArray = info[0].As<Napi::Array>();
+
+		for (uint32_t i = 0; i < configArray.Length(); ++i)
+		{
+			configValues.push_back(configArray.Get(i));
+		}
+	}
+	else
+	{
+		configValues.push_back(info[0]);
+	}
+
+	// Everything is checked before any sensor is touched
+	std::vector<SensorStreamConfig> configs(configValues.size());
+	std::vector<HSLSensorID> sensorIDs(configValues.size());
+	std::vector<char> allSensors(configValues.size());
+	std::vector<char> applyToNew(configValues.size());
+
+	for (size_t i = 0; i < configValues.size(); ++i)
+	{
+		bool bAll, bApplyToNew;
 
-			bSuccess = true;
+		if (!ReadStreamConfig(env, configValues[i], configs[i], bAll, sensorIDs[i], bApplyToNew))
+		{
+			return env.Null();
 		}
-
-		return Napi::Boolean::New(info.Env(), bSuccess);
+		allSensors[i] = bAll;
+		applyToNew[i] = bAll && bApplyToNew;
 	}
 
-	Napi::Value SetFilterStreamActive(const Napi::CallbackInfo& info)
+	HSLScopedLock hsl_lock;
+
+	SensorSource &source = GetSensorSource();
+	HSLSensorList sensorList;
+	if (!source.GetSensorList(&sensorList))
 	{
-		REQ_ARGS(2);
-		REQ_INT_ARG(0, filter_stream_type);
-		REQ_BOOL_ARG(1, want_active);
+		sensorList.count = 0;
+	}
 
-		bool bSuccess = false;
-		HSLSensor* sensor = GetSensor();
+	// Configs are merged per sensor first, so a sensor named by several of them still gets one call
+	std::map<HSLSensorID, SensorStreamConfigResult> results;
+	std::vector<HSLSensorID> order;
 
-		if (filter_stream_type >= 0 && filter_stream_type < HRVFilter_COUNT)
+	auto mergeConfig = [&](HSLSensorID sensor_id, const SensorStreamConfig &config) {
+		HSLSensor *sensor = source.GetSensor(sensor_id);
+		if (sensor == nullptr)
 		{
-			bool isActive = HSL_BITMASK_GET_FLAG(sensor->activeFilterStreams, filter_stream_type);
-
-			if (isActive && !want_active)
-			{
-				t_hrv_filter_bitmask new_bitmask = HSL_BITMASK_CLEAR_FLAG(sensor->activeFilterStreams, filter_stream_type);
-
-				HSL_SetActiveSensorFilterStreams(sensor->sensorID, new_bitmask);
-			}
-			else if (!isActive && want_active)
-			{
-				t_hrv_filter_bitmask new_bitmask = HSL_BITMASK_SET_FLAG(sensor->activeFilterStreams, filter_stream_type);
+			return;
+		}
 
-				HSL_SetActiveSensorFilterStreams(sensor->sensorID, new_bitmask);
-			}
+		if (results.find(sensor_id) == results.end())
+		{
+			SensorStreamConfigResult &initial = results[sensor_id];
 
-			bSuccess = true;
+			initial.sensorID = sensor_id;
+			initial.dataStreams = sensor->activeDataStreams;
+			initial.filterStreams = sensor->activeFilterStreams;
+			order.push_back(sensor_id);
 		}
 
-		return Napi::Boolean::New(info.Env(), bSuccess);
-	}
+		SensorStreamConfigResult &wanted = results[sensor_id];
+		ApplySensorStreamConfigMasks(config, wanted.dataStreams, wanted.filterStreams);
+	};
 
-	Napi::Value StopAllStreams(const Napi::CallbackInfo& info)
+	for (size_t i = 0; i < configs.size(); ++i)
 	{
-		HSLSensorID sensor_id = GetSensor()->sensorID;
+		if (allSensors[i])
+		{
+			for (int list_index = 0; list_index < sensorList.count; ++list_index)
+			{
+				mergeConfig(sensorList.sensors[list_index].sensorID, configs[i]);
+			}
+		}
+		else
+		{
+			mergeConfig(sensorIDs[i], configs[i]);
+		}
 
-		return Napi::Boolean::New(info.Env(), HSL_StopAllSensorStreams(sensor_id));
+		if (applyToNew[i])
+		{
+			if (g_sensorStreamPolicy)
+			{
+				RemoveSensorSourceListener(g_sensorStreamPolicy);
+			}
+			g_sensorStreamPolicy = std::make_shared<SensorStreamPolicy>(source, configs[i]);
+			AddSensorSourceListener(g_sensorStreamPolicy);
+		}
 	}
 
-	static void Init(Napi::Env env, Napi::Object exports)
+	Napi::Array resultArray = Napi::Array::New(env, order.size());
+	for (size_t i = 0; i < order.size(); ++i)
 	{
-		Napi::HandleScope scope(env);
+		const SensorStreamConfigResult &wanted = results[order[i]];
 
-		Napi::Function ctor = DefineClass(env, "Sensor", {			
-			InstanceMethod("getSensorID", &Sensor::GetSensorID),
-			InstanceMethod("getDeviceBodyLocation", &Sensor::GetDeviceBodyLocation),
-			InstanceMethod("hasCapability", &Sensor::HasCapability),
-			InstanceMethod("getDeviceFriendlyName", &Sensor::GetDeviceFriendlyName),
-			InstanceMethod("getDevicePath", &Sensor::GetDevicePath),
-			InstanceMethod("getFirmwareRevisionString", &Sensor::GetFirmwareRevisionString),
-			InstanceMethod("getHardwareRevisionString", &Sensor::GetHardwareRevisionString),
-			InstanceMethod("getManufacturerNameString", &Sensor::GetManufacturerNameString),
-			InstanceMethod("getSerialNumberString", &Sensor::GetSerialNumberString),
-			InstanceMethod("getSoftwareRevisionString", &Sensor::GetSoftwareRevisionString),
-			InstanceMethod("getSystemIdString", &Sensor::GetSystemIdString),
-			InstanceMethod("getHeartRateBPM", &Sensor::GetHeartRateBPM),
-			InstanceMethod("getHeartRateBuffer", &Sensor::GetHeartRateBuffer),
-			InstanceMethod("getHeartECGBuffer", &Sensor::GetHeartECGBuffer),
-			InstanceMethod("getHeartPPGBuffer", &Sensor::GetHeartPPGBuffer),
-			InstanceMethod("getHeartPPIBuffer", &Sensor::GetHeartPPIBuffer),
-			InstanceMethod("getHeartAccBuffer", &Sensor::GetHeartAccBuffer),
-			InstanceMethod("getHeartHrvBuffer", &Sensor::GetHeartHrvBuffer),
-			InstanceMethod("flushHeartRateBuffer", &Sensor::FlushHeartRateBuffer),
-			InstanceMethod("flushHeartECGBuffer", &Sensor::FlushHeartECGBuffer),
-			InstanceMethod("flushHeartPPGBuffer", &Sensor::FlushHeartPPGBuffer),
-			InstanceMethod("flushHeartPPIBuffer", &Sensor::FlushHeartPPIBuffer),
-			InstanceMethod("flushHeartAccBuffer", &Sensor::FlushHeartAccBuffer),
-			InstanceMethod("flushHeartHrvBuffer", &Sensor::FlushtHeartHrvBuffer),
-			InstanceMethod("setDataStreamActive", &Sensor::SetDataStreamActive),
-			InstanceMethod("setFilterStreamActive", &Sensor::SetFilterStreamActive),
-			InstanceMethod("stopAllStreams", &Sensor::StopAllStreams),
-			// HSLContactSensorStatus
-			StaticValue("ContactStatus_Invalid", Napi::Number::New(env, HSLContactStatus_Invalid)),
-			StaticValue("ContactStatus_NoContact", Napi::Number::New(env, HSLContactStatus_NoContact)),
-			StaticValue("ContactStatus_Contact", Napi::Number::New(env, HSLContactStatus_Contact)),
-			// HSLSensorDataStreamFlags
-			StaticValue("StreamFlags_HRData", Napi::Number::New(env, HSLStreamFlags_HRData)),
-			StaticValue("StreamFlags_ECGData", Napi::Number::New(env, HSLStreamFlags_ECGData)),
-			StaticValue("StreamFlags_PPGData", Napi::Number::New(env, HSLStreamFlags_PPGData)),
-			StaticValue("StreamFlags_PPIData", Napi::Number::New(env, HSLStreamFlags_PPIData)),
-			StaticValue("StreamFlags_AccData", Napi::Number::New(env, HSLStreamFlags_AccData)),
-			// HSLHeartRateVariabityFilterType
-			StaticValue("HRVFilter_SDNN", Napi::Number::New(env, HRVFilter_SDNN)),
-			StaticValue("HRVFilter_RMSSD", Napi::Number::New(env, HRVFilter_RMSSD)),
-			StaticValue("HRVFilter_SDSD", Napi::Number::New(env, HRVFilter_SDSD)),
-			StaticValue("HRVFilter_NN50", Napi::Number::New(env, HRVFilter_NN50)),
-			StaticValue("HRVFilter_pNN50", Napi::Number::New(env, HRVFilter_pNN50)),
-			StaticValue("HRVFilter_NN20", Napi::Number::New(env, HRVFilter_NN20)),
-			StaticValue("HRVFilter_pNN20", Napi::Number::New(env, HRVFilter_pNN20)),
-		});
+		SensorStreamConfig merged;
+		merged.bHasDataStreams = true;
+		merged.dataStreams = wanted.dataStreams;
+		merged.bHasFilterStreams = true;
+		merged.filterStreams = wanted.filterStreams;
 
-		constructor = Napi::Persistent(ctor);
-		constructor.SuppressDestruct();
-		exports.Set("Sensor", ctor);
+		SensorStreamConfigResult result;
+		ApplySensorStreamConfig(source, order[i], merged, result);
+
+		Napi::Object obj = Napi::Object::New(env);
+		obj.Set("sensorId", result.sensorID);
+		obj.Set("data", (double)result.dataStreams);
+		obj.Set("filters", (double)result.filterStreams);
+		obj.Set("dataChanged", result.bDataStreamsSet);
+		obj.Set("filtersChanged", result.bFilterStreamsSet);
+		obj.Set("success", result.bSuccess);
+		resultArray.Set((uint32_t)i, obj);
 	}
 
-private:
-	static Napi::FunctionReference constructor;
+	return resultArray;
+}
 
-	HSLSensor* GetSensor() const
+// Stops applying the configureStreams applyToNew config to sensors that connect from now on
+Napi::Value ClearStreamPolicy(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	const bool bHadPolicy = (bool)g_sensorStreamPolicy;
+	if (g_sensorStreamPolicy)
 	{
-		return m_sensor;
+		RemoveSensorSourceListener(g_sensorStreamPolicy);
+		g_sensorStreamPolicy.reset();
 	}
 
-	HSLSensor* m_sensor;
-};
-Napi::FunctionReference Sensor::constructor;
+	return Napi::Boolean::New(info.Env(), bHadPolicy);
+}
 
-class SensorList : public Napi::ObjectWrap<SensorList>
+static std::shared_ptr<SessionRecorder> g_sessionRecorder;
+static std::shared_ptr<SessionReplaySource> g_sessionReplay;
+
+// Detaches every cached Sensor before the source owning their structs goes away. The entries stay,
+// so the next getSensorChanges() reports them removed. Other envs' wrappers see the source
+// generation change and detach on their own. Call with the HSL lock held.
+static void DetachCachedSensors(AddonData &addon)
 {
-public:
-	SensorList(const Napi::CallbackInfo& info)
-		: Napi::ObjectWrap<SensorList>(info)
+	for (auto &entry : addon.sensorCache)
 	{
-		HSL_GetSensorList(&m_sensorList);
+		Sensor::Unwrap(entry.second.wrapper.Value())->Detach();
 	}
+}
 
-	// Create a new item using the constructor stored during Init.
-	static Napi::Object CreateNewSensorList(const Napi::CallbackInfo& info)
+// startRecording(path) appends every frame of every sensor buffer to a session file
+Napi::Value StartRecording(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+
+	if (info.Length() < 1 || !info[0].IsString())
 	{
-		return constructor.New({});
+		Napi::TypeError::New(env, "Expected a file path").ThrowAsJavaScriptException();
+		return env.Null();
 	}
 
-	Napi::Value GetHostSerial(const Napi::CallbackInfo& info)
+	HSLScopedLock hsl_lock;
+
+	if (g_sessionRecorder)
 	{
-		return Napi::String::New(info.Env(), m_sensorList.hostSerial);
+		return Napi::Boolean::New(env, false);
 	}
 
-	Napi::Value GetSensorCount(const Napi::CallbackInfo& info)
+	std::shared_ptr<SessionRecorder> recorder = std::make_shared<SessionRecorder>();
+	if (!recorder->Open(info[0].As<Napi::String>().Utf8Value()))
 	{
-		return Napi::Number::New(info.Env(), m_sensorList.count);
+		return Napi::Boolean::New(env, false);
 	}
 
-	Napi::Value GetSensor(const Napi::CallbackInfo& info)
-	{
-		REQ_ARGS(1);
-		REQ_INT_ARG(0, list_index);
+	g_sessionRecorder = recorder;
+	AddSensorSourceListener(g_sessionRecorder);
 
-		if (list_index >= 0 && list_index < m_sensorList.count)
-		{
-			HSLSensorListEntry &listEntry= m_sensorList.sensors[list_index];
+	return Napi::Boolean::New(env, true);
+}
 
-			return Sensor::CreateNewSensor(info, listEntry.sensorID);
-		}
-		else
-		{
-			return info.Env().Null();
-		}
+bool StopSessionRecorder(SessionRecorderStats &out_stats)
+{
+	if (!g_sessionRecorder)
+	{
+		return false;
 	}
 
-	static void Init(Napi::Env env, Napi::Object exports)
-	{
-		Napi::HandleScope scope(env);
+	RemoveSensorSourceListener(g_sessionRecorder);
+	const bool bSuccess = g_sessionRecorder->Close();
+	out_stats = g_sessionRecorder->GetStats();
+	g_sessionRecorder.reset();
 
-		Napi::Function ctor = DefineClass(env, "SensorList", {
-			InstanceMethod("getHostSerial", &SensorList::GetHostSerial),
-			InstanceMethod("getSensorCount", &SensorList::GetSensorCount),
-			InstanceMethod("getSensor", &SensorList::GetSensor),
-		});
+	return bSuccess;
+}
 
-		constructor = Napi::Persistent(ctor);
-		constructor.SuppressDestruct();
-		exports.Set("SensorList", ctor);
+// stopRecording() finishes the session file and returns what was written, or null if not recording
+Napi::Value StopRecording(const Napi::CallbackInfo& info)
+{
+	Napi::Env env = info.Env();
+	HSLScopedLock hsl_lock;
+
+	if (!g_sessionRecorder)
+	{
+		return env.Null();
 	}
 
-private:
-	static Napi::FunctionReference constructor;
+	SessionRecorderStats stats;
+	const bool bSuccess = StopSessionRecorder(stats);
 
-	HSLSensorList m_sensorList;
-};
-Napi::FunctionReference SensorList::constructor;
+	Napi::Object obj = Napi::Object::New(env);
+	obj.Set("success", bSuccess);
+	obj.Set("frameCount", (double)stats.framesRecorded);
+	obj.Set("chunkCount", (double)stats.chunksWritten);
+	obj.Set("byteLength", (double)stats.bytesWritten);
 
-Napi::Object GetSensorList(const Napi::CallbackInfo& info)
+	return obj;
+}
+
+Napi::Value IsRecording(const Napi::CallbackInfo& info)
 {
-	return SensorList::CreateNewSensorList(info);
+	HSLScopedLock hsl_lock;
+
+	return Napi::Boolean::New(info.Env(), (bool)g_sessionRecorder);
 }
 
-class EventMessage : public Napi::ObjectWrap<EventMessage>
+// startReplay(path, {realtime, speed, stepSeconds}) swaps the live sensors for a recorded session
+Napi::Value StartReplay(const Napi::CallbackInfo& info)
 {
-public:
-	EventMessage(const Napi::CallbackInfo& info)
-		: Napi::ObjectWrap<EventMessage>(info)
-	{
-		if (info.Length() >= 1 && info[0].IsExternal())
-		{
-			Napi::External<HSLEventMessage> inEventMessage = info[0].As<Napi::External<HSLEventMessage>>();
+	Napi::Env env = info.Env();
 
-			m_eventMessage = *inEventMessage.Data();
-		}
-		else
-		{
-			Napi::TypeError::New(info.Env(), "Argument 0 invalid").ThrowAsJavaScriptException();
-		}
+	if (info.Length() < 1 || !info[0].IsString())
+	{
+		Napi::TypeError::New(env, "Expected a file path").ThrowAsJavaScriptException();
+		return env.Null();
 	}
 
-	// Create a new item using the constructor stored during Init.
-	static Napi::Object CreateNewEventMessage(const Napi::CallbackInfo& info, HSLEventMessage &event_message)
+	SessionReplaySettings settings;
+	if (info.Length() > 1 && info[1].IsObject())
 	{
-		return constructor.New({Napi::External<HSLEventMessage>::New(info.Env(), &event_message)});
+		Napi::Object options = info[1].As<Napi::Object>();
+
+		if (options.Has("realtime"))
+			settings.bRealtime = options.Get("realtime").ToBoolean();
+		if (options.Has("speed"))
+			settings.speed = options.Get("speed").ToNumber().DoubleValue();
+		if (options.Has("stepSeconds"))
+			settings.stepSeconds = options.Get("stepSeconds").ToNumber().DoubleValue();
 	}
 
-	Napi::Value GetEventType(const Napi::CallbackInfo& info)
+	std::shared_ptr<SessionReplaySource> replay = std::make_shared<SessionReplaySource>();
+	std::string error;
+	if (!replay->Open(info[0].As<Napi::String>().Utf8Value(), settings, error))
 	{
-		return Napi::Number::New(info.Env(), m_eventMessage.event_type);
+		Napi::Error::New(env, error).ThrowAsJavaScriptException();
+		return env.Null();
 	}
 
-	static void Init(Napi::Env env, Napi::Object exports)
-	{
-		Napi::HandleScope scope(env);
+	HSLScopedLock hsl_lock;
 
-		/**
-		* HSLEventType
-		*/
-		Napi::PropertyDescriptor Event_SensorListUpdated = 
-			Napi::PropertyDescriptor::Value("Event_SensorListUpdated", Napi::Number::New(env, HSLEvent_SensorListUpdated));
-		exports.DefineProperties({
-			Event_SensorListUpdated
-		});
+	DetachCachedSensors(GetAddonData(env));
+	SetSensorSource(replay);
+	g_sessionReplay = replay;
 
-		Napi::Function ctor = DefineClass(env, "EventMessage", {
-			InstanceMethod("getEventType", &EventMessage::GetEventType),
-		});
+	Napi::Object obj = Napi::Object::New(env);
+	obj.Set("startTime", replay->GetStartTime());
+	obj.Set("endTime", replay->GetEndTime());
+	obj.Set("sensorCount", (double)replay->GetSensorCount());
+	obj.Set("frameCount", (double)replay->GetFrameCount());
 
-		// Create a persistent reference to the class constructor. This will allow
-		// a function called on a class prototype and a function
-		// called on instance of a class to be distinguished from each other.
-		constructor = Napi::Persistent(ctor);
-		constructor.SuppressDestruct();
-		exports.Set("EventMessage", ctor);
+	return obj;
+}
+
+// stopReplay() switches back to the live sensors
+Napi::Value StopReplay(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	const bool bWasReplaying = (bool)g_sessionReplay;
+	if (bWasReplaying)
+	{
+		DetachCachedSensors(GetAddonData(info.Env()));
+		SetSensorSource(nullptr);
+		g_sessionReplay.reset();
 	}
 
-private:
-	static Napi::FunctionReference constructor;
+	return Napi::Boolean::New(info.Env(), bWasReplaying);
+}
 
-	HSLEventMessage m_eventMessage;
-};
-Napi::FunctionReference EventMessage::constructor;
+Napi::Value IsReplaying(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
 
-Napi::Value PollNextMessage(const Napi::CallbackInfo& info)
+	return Napi::Boolean::New(info.Env(), (bool)g_sessionReplay);
+}
+
+Napi::Value SeekReplay(const Napi::CallbackInfo& info)
 {
 	Napi::Env env = info.Env();
 
-	HSLEventMessage mesg;
-	if (HSL_PollNextMessage(&mesg))
+	if (info.Length() < 1 || !info[0].IsNumber())
 	{
-		return EventMessage::CreateNewEventMessage(info, mesg);
+		Napi::TypeError::New(env, "Expected a session time in seconds").ThrowAsJavaScriptException();
+		return env.Null();
 	}
-	else
+
+	HSLScopedLock hsl_lock;
+
+	if (!g_sessionReplay)
 	{
-		return env.Null();
+		return Napi::Boolean::New(env, false);
+	}
+
+	g_sessionReplay->Seek(info[0].ToNumber().DoubleValue());
+
+	return Napi::Boolean::New(env, true);
+}
+
+Napi::Value GetReplayTime(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	if (!g_sessionReplay)
+	{
+		return info.Env().Null();
 	}
+
+	return Napi::Number::New(info.Env(), g_sessionReplay->GetPlaybackTime());
+}
+
+Napi::Value IsReplayFinished(const Napi::CallbackInfo& info)
+{
+	HSLScopedLock hsl_lock;
+
+	return Napi::Boolean::New(info.Env(), g_sessionReplay && g_sessionReplay->IsFinished());
 }
 
+// Runs as each env unloads, before its AddonData is freed. The update loop is handed back
+// when its owner goes and the HSL core is only shut down with the last env.
 void Cleanup(void* arg)
 {
-	HSL_Shutdown();
+	AddonData *addon = static_cast<AddonData *>(arg);
+
+	bool bUpdateOwner;
+	{
+		HSLScopedLock hsl_lock;
+
+		bUpdateOwner = (g_updateOwner == addon);
+	}
+
+	// The poller thread takes the HSL lock, so it is stopped without holding it
+	if (bUpdateOwner)
+	{
+		StopSensorPoller();
+	}
+
+	addon->sensorCache.clear();
+
+	HSLScopedLock hsl_lock;
+
+	if (bUpdateOwner)
+	{
+		g_updateOwner = nullptr;
+	}
+
+	if (--g_hslCoreRefCount == 0)
+	{
+		SessionRecorderStats stats;
+
+		StopSessionRecorder(stats);
+		SetSensorSource(nullptr);
+		if (g_sensorStreamPolicy)
+		{
+			RemoveSensorSourceListener(g_sensorStreamPolicy);
+			g_sensorStreamPolicy.reset();
+		}
+		g_sessionReplay.reset();
+
+		HSL_Shutdown();
+	}
 }
 
 Napi::Object Init(Napi::Env env, Napi::Object exports)
 {
+	AddonData *addon = new AddonData();
+	env.SetInstanceData(addon);
+
 	exports.Set("getVersionString", Napi::Function::New(env, GetVersionString));
+#ifdef HSL_SIMULATOR
+	exports.Set("isSimulator", Napi::Boolean::New(env, true));
+	exports.Set("getSimulatorSettings", Napi::Function::New(env, GetSimulatorSettings));
+	exports.Set("setSimulatorSettings", Napi::Function::New(env, SetSimulatorSettings));
+#else
+	exports.Set("isSimulator", Napi::Boolean::New(env, false));
+#endif
 
 	exports.Set("update", Napi::Function::New(env, Update));
 	exports.Set("updateNoPollEvents", Napi::Function::New(env, UpdateNoPollEvents));
 	exports.Set("pollNextMessage", Napi::Function::New(env, PollNextMessage));
+	exports.Set("pollAllMessages", Napi::Function::New(env, PollAllMessages));
+	exports.Set("startPolling", Napi::Function::New(env, StartPolling));
+	exports.Set("stopPolling", Napi::Function::New(env, StopPolling));
+	exports.Set("isPolling", Napi::Function::New(env, IsPolling));
+	exports.Set("ingestStreamRings", Napi::Function::New(env, IngestStreamRings));
+	exports.Set("encodeSensorFrameBatch", Napi::Function::New(env, EncodeSensorFrameBatch));
+	exports.Set("decimateSensorFrameBatch", Napi::Function::New(env, DecimateSensorFrameBatch));
+
+	exports.Set("startRecording", Napi::Function::New(env, StartRecording));
+	exports.Set("stopRecording", Napi::Function::New(env, StopRecording));
+	exports.Set("isRecording", Napi::Function::New(env, IsRecording));
+	exports.Set("startReplay", Napi::Function::New(env, StartReplay));
+	exports.Set("stopReplay", Napi::Function::New(env, StopReplay));
+	exports.Set("isReplaying", Napi::Function::New(env, IsReplaying));
+	exports.Set("seekReplay", Napi::Function::New(env, SeekReplay));
+	exports.Set("getReplayTime", Napi::Function::New(env, GetReplayTime));
+	exports.Set("isReplayFinished", Napi::Function::New(env, IsReplayFinished));
 
 	exports.Set("hasSensorListChanged", Napi::Function::New(env, HasSensorListChanged));
 	exports.Set("getSensorList", Napi::Function::New(env, GetSensorList));
+	exports.Set("getSensorChanges", Napi::Function::New(env, GetSensorChanges));
+	exports.Set("isUpdateOwner", Napi::Function::New(env, IsUpdateOwner));
+	exports.Set("configureStreams", Napi::Function::New(env, ConfigureStreams));
+	exports.Set("clearStreamPolicy", Napi::Function::New(env, ClearStreamPolicy));
+
+	exports.Set("getStats", Napi::Function::New(env, GetStats));
+	exports.Set("setStatsEnabled", Napi::Function::New(env, SetStatsEnabled));
+	exports.Set("recordDelivery", Napi::Function::New(env, RecordDelivery));
 
 	BufferIterator::Init(env, exports);
 	EventMessage::Init(env, exports);
 	Sensor::Init(env, exports);
 	SensorList::Init(env, exports);
+	StreamRing::Init(env, exports);
+	StreamRingCursor::Init(env, exports);
+	SharedSampleRingWrap::Init(env, exports);
+	HRVAnalyzerWrap::Init(env, exports);
+	ECGBeatDetectorWrap::Init(env, exports);
+	WaveformDownsamplerWrap::Init(env, exports);
+	SensorAlignerWrap::Init(env, exports);
+	SensorFilterGraphWrap::Init(env, exports);
+	AlertEngineWrap::Init(env, exports);
+	HistoryStoreWrap::Init(env, exports);
+
+	{
+		HSLScopedLock hsl_lock;
 
-	HSL_Initialize(HSLLogSeverityLevel::HSLLogSeverityLevel_error);
+		if (g_hslCoreRefCount++ == 0)
+		{
+			HSL_Initialize(HSLLogSeverityLevel::HSLLogSeverityLevel_error);
+		}
+	}
 
-	napi_add_env_cleanup_hook(env, &Cleanup, nullptr);
+	napi_add_env_cleanup_hook(env, &Cleanup, addon);
 
 	return exports;
 }
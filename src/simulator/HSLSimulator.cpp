@@ -0,0 +1,1115 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+// Stand-in implementation of the HeartSensorLibrary C API that feeds synthetic
+// sensor data to the addon, used when building with HSL_USE_SIMULATOR=ON
+#include "HSLSimulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+//-- constants -----
+static const double k_pi = 3.14159265358979323846;
+
+// Frames each stream holds before the oldest are dropped, same as an unflushed HSL buffer
+static const int k_frameBufferCapacity = 256;
+
+// Samples per frame, roughly what a Polar H10 / OH1 packs into one BLE notification
+static const int k_ecgSamplesPerFrame = std::min(73, MAX_HSL_ECG_SAMPLES);
+static const int k_ppgSamplesPerFrame = std::min(35, MAX_HSL_PPG_SAMPLES);
+static const int k_accSamplesPerFrame = std::min(36, MAX_HSL_ACC_SAMPLES);
+
+// RR intervals used for the HRV statistics
+static const size_t k_hrvWindowSize = 32;
+
+// Delay between the R peak and the pulse arriving at the PPG sensor
+static const double k_pulseTransitTime = 0.25;
+
+//-- frame buffers -----
+class SimFrameBufferBase
+{
+public:
+	virtual ~SimFrameBufferBase() {}
+
+	virtual int GetFrameCount() const = 0;
+	virtual void *GetFrame(int index) = 0;
+	virtual void Flush() = 0;
+
+	HSLBufferIterator GetIterator(HSLSensorBufferType buffer_type)
+	{
+		HSLBufferIterator iter;
+		iter.buffer = this;
+		iter.currentIndex = 0;
+		iter.remaining = GetFrameCount();
+		iter.bufferType = buffer_type;
+
+		return iter;
+	}
+};
+
+template <typename t_frame>
+class SimFrameBuffer : public SimFrameBufferBase
+{
+public:
+	SimFrameBuffer()
+		: m_frames(k_frameBufferCapacity)
+		, m_head(0)
+		, m_count(0)
+	{
+	}
+
+	// Returns a zeroed frame at the end of the buffer, overwriting the oldest frame when full
+	t_frame &AddFrame()
+	{
+		const int tail = (m_head + m_count) % k_frameBufferCapacity;
+
+		if (m_count == k_frameBufferCapacity)
+		{
+			m_head = (m_head + 1) % k_frameBufferCapacity;
+		}
+		else
+		{
+			++m_count;
+		}
+
+		t_frame &frame = m_frames[tail];
+		memset(&frame, 0, sizeof(t_frame));
+
+		return frame;
+	}
+
+	int GetFrameCount() const override
+	{
+		return m_count;
+	}
+
+	void *GetFrame(int index) override
+	{
+		return &m_frames[(m_head + index) % k_frameBufferCapacity];
+	}
+
+	void Flush() override
+	{
+		m_head = 0;
+		m_count = 0;
+	}
+
+private:
+	std::vector<t_frame> m_frames;
+	int m_head;
+	int m_count;
+};
+
+//-- virtual sensor -----
+struct SimBeat
+{
+	double time; // R peak time
+	double rrInterval; // Seconds since the previous R peak
+	bool bReported;
+};
+
+class SimSensor
+{
+public:
+	SimSensor(HSLSensorID sensor_id, const HSLSimulatorSettings &settings, double now);
+
+	HSLSensor &GetSensor() { return m_sensor; }
+
+	void ApplySettings(const HSLSimulatorSettings &settings);
+	void SetActiveDataStreams(t_hsl_stream_bitmask data_stream_flags, double now);
+	void SetActiveFilterStreams(t_hrv_filter_bitmask filter_stream_bitmask);
+	void Advance(double now);
+
+	SimFrameBuffer<HSLHeartRateFrame> hrBuffer;
+	SimFrameBuffer<HSLHeartECGFrame> ecgBuffer;
+	SimFrameBuffer<HSLHeartPPGFrame> ppgBuffer;
+	SimFrameBuffer<HSLHeartPPIFrame> ppiBuffer;
+	SimFrameBuffer<HSLAccelerometerFrame> accBuffer;
+	SimFrameBuffer<HSLHeartVariabilityFrame> hrvBuffers[HRVFilter_COUNT];
+
+private:
+	bool IsStreamActive(HSLSensorDataStreamFlags stream) const;
+	double JitterTime(double time);
+	float Noise(float stddev);
+
+	void GenerateBeats(double until);
+	void ReportBeats(double until);
+	bool FindBeat(double time, size_t &out_beat_index) const;
+	double ECGValue(double time) const;
+	double PPGPulse(double time) const;
+
+	void GenerateHRFrames(double now);
+	void GenerateECGFrames(double now);
+	void GeneratePPGFrames(double now);
+	void GenerateAccFrames(double now);
+	float ComputeHRV(HSLHeartRateVariabityFilterType filter) const;
+
+	HSLSensor m_sensor;
+	HSLSimulatorSettings m_settings;
+	std::mt19937 m_rng;
+	float m_heartRate;
+
+	std::deque<SimBeat> m_beats;
+	std::deque<float> m_rrHistoryMs;
+	std::vector<uint16_t> m_pendingRRIntervals;
+	std::vector<HSLHeartPPISample> m_pendingPPISamples;
+	double m_energyExpended;
+
+	double m_nextHRFrameTime;
+	double m_nextECGSampleTime;
+	double m_nextPPGSampleTime;
+	double m_nextAccSampleTime;
+};
+
+SimSensor::SimSensor(HSLSensorID sensor_id, const HSLSimulatorSettings &settings, double now)
+	: m_settings(settings)
+	, m_rng(settings.randomSeed + (unsigned int)sensor_id)
+	, m_energyExpended(0.0)
+	, m_nextHRFrameTime(now)
+	, m_nextECGSampleTime(now)
+	, m_nextPPGSampleTime(now)
+	, m_nextAccSampleTime(now)
+{
+	memset(&m_sensor, 0, sizeof(m_sensor));
+	m_sensor.sensorID = sensor_id;
+
+	HSLDeviceInformation &info = m_sensor.deviceInformation;
+	snprintf(info.bodyLocation, sizeof(info.bodyLocation), "Chest");
+	snprintf(info.deviceFriendlyName, sizeof(info.deviceFriendlyName), "Simulated Sensor %d", sensor_id);
+	snprintf(info.devicePath, sizeof(info.devicePath), "sim://sensor/%d", sensor_id);
+	snprintf(info.firmwareRevisionString, sizeof(info.firmwareRevisionString), "1.0.0");
+	snprintf(info.hardwareRevisionString, sizeof(info.hardwareRevisionString), "1.0");
+	snprintf(info.manufacturerNameString, sizeof(info.manufacturerNameString), "HeartSensorLibrary");
+	snprintf(info.modelNumberString, sizeof(info.modelNumberString), "Simulator");
+	snprintf(info.serialNumberString, sizeof(info.serialNumberString), "SIM%08X", (unsigned int)sensor_id);
+	snprintf(info.softwareRevisionString, sizeof(info.softwareRevisionString), "1.0.0");
+	snprintf(info.systemID, sizeof(info.systemID), "%016X", (unsigned int)sensor_id);
+
+	ApplySettings(settings);
+
+	// Seed the beat timeline so the first frames have a full cycle behind them
+	SimBeat first_beat = { now - 60.0 / m_heartRate, 60.0 / m_heartRate, true };
+	m_beats.push_back(first_beat);
+}
+
+void SimSensor::ApplySettings(const HSLSimulatorSettings &settings)
+{
+	m_settings = settings;
+	m_sensor.deviceInformation.capabilities = settings.capabilities;
+	m_sensor.activeDataStreams &= settings.capabilities;
+
+	// Spread sensors over +/- 9 BPM so they are distinguishable
+	m_heartRate = std::max(settings.heartRate + (float)((m_sensor.sensorID % 7) - 3) * 3.f, 20.f);
+}
+
+void SimSensor::SetActiveDataStreams(t_hsl_stream_bitmask data_stream_flags, double now)
+{
+	const t_hsl_stream_bitmask newStreams = data_stream_flags & m_settings.capabilities;
+	const t_hsl_stream_bitmask startedStreams = newStreams & ~m_sensor.activeDataStreams;
+
+	// Newly started streams begin at the current time rather than back filling
+	if (HSL_BITMASK_GET_FLAG(startedStreams, HSLStreamFlags_ECGData))
+		m_nextECGSampleTime = now;
+	if (HSL_BITMASK_GET_FLAG(startedStreams, HSLStreamFlags_PPGData))
+		m_nextPPGSampleTime = now;
+	if (HSL_BITMASK_GET_FLAG(startedStreams, HSLStreamFlags_AccData))
+		m_nextAccSampleTime = now;
+	if (HSL_BITMASK_GET_FLAG(startedStreams, HSLStreamFlags_PPIData))
+		m_pendingPPISamples.clear();
+
+	m_sensor.activeDataStreams = newStreams;
+}
+
+void SimSensor::SetActiveFilterStreams(t_hrv_filter_bitmask filter_stream_bitmask)
+{
+	m_sensor.activeFilterStreams = filter_stream_bitmask & ((1 << HRVFilter_COUNT) - 1);
+}
+
+bool SimSensor::IsStreamActive(HSLSensorDataStreamFlags stream) const
+{
+	return HSL_BITMASK_GET_FLAG(m_sensor.activeDataStreams, stream);
+}
+
+double SimSensor::JitterTime(double time)
+{
+	if (m_settings.frameJitterMs <= 0.f)
+	{
+		return time;
+	}
+
+	std::uniform_real_distribution<double> jitter(-m_settings.frameJitterMs, m_settings.frameJitterMs);
+
+	return time + jitter(m_rng) / 1000.0;
+}
+
+float SimSensor::Noise(float stddev)
+{
+	std::normal_distribution<float> noise(0.f, stddev);
+
+	return noise(m_rng);
+}
+
+void SimSensor::Advance(double now)
+{
+	// Beats are generated a couple of seconds ahead so waveforms can see the next R peak
+	GenerateBeats(now + 2.0);
+
+	GenerateHRFrames(now);
+	ReportBeats(now);
+	GenerateECGFrames(now);
+	GeneratePPGFrames(now);
+	GenerateAccFrames(now);
+
+	// Only keep the beats the waveforms can still reach
+	while (m_beats.size() > 2 && m_beats[1].time < now - 5.0 && m_beats[1].bReported)
+	{
+		m_beats.pop_front();
+	}
+
+	m_sensor.beatsPerMinute =
+		m_rrHistoryMs.empty()
+		? (int)m_heartRate
+		: (int)std::lround(60000.0 / m_rrHistoryMs.back());
+}
+
+void SimSensor::GenerateBeats(double until)
+{
+	while (m_beats.back().time < until)
+	{
+		const double lastTime = m_beats.back().time;
+
+		// Respiratory sinus arrhythmia on top of a slow drift and beat to beat noise
+		const double rsa = 4.0 * sin(2.0 * k_pi * 0.25 * lastTime);
+		const double drift = 3.0 * sin(2.0 * k_pi * lastTime / 90.0);
+		const double bpm = std::max(m_heartRate + rsa + drift + Noise(1.f), 20.0);
+
+		SimBeat beat = { lastTime + 60.0 / bpm, 60.0 / bpm, false };
+		m_beats.push_back(beat);
+	}
+}
+
+void SimSensor::ReportBeats(double until)
+{
+	for (SimBeat &beat : m_beats)
+	{
+		if (beat.time > until)
+			break;
+		if (beat.bReported)
+			continue;
+
+		beat.bReported = true;
+
+		const float rrMs = (float)(beat.rrInterval * 1000.0);
+
+		m_rrHistoryMs.push_back(rrMs);
+		if (m_rrHistoryMs.size() > k_hrvWindowSize)
+		{
+			m_rrHistoryMs.pop_front();
+		}
+
+		if (m_pendingRRIntervals.size() < MAX_HSL_RR_INTERVALS)
+		{
+			m_pendingRRIntervals.push_back((uint16_t)std::lround(rrMs));
+		}
+
+		if (IsStreamActive(HSLStreamFlags_PPIData))
+		{
+			HSLHeartPPISample sample;
+			sample.beatsPerMinute = (uint16_t)std::lround(60000.0 / rrMs);
+			sample.pulseDuration = (uint16_t)std::lround(rrMs + Noise(4.f));
+			sample.pulseDurationErrorEst = (uint16_t)(5 + m_rng() % 10);
+			sample.blockerBit = 0;
+			sample.skinContactBit = 1;
+			sample.supportsSkinContactBit = 1;
+			m_pendingPPISamples.push_back(sample);
+
+			const int samplesPerFrame = std::max(std::min(m_settings.ppiSamplesPerFrame, MAX_HSL_PPI_SAMPLES), 1);
+			if ((int)m_pendingPPISamples.size() >= samplesPerFrame)
+			{
+				HSLHeartPPIFrame &frame = ppiBuffer.AddFrame();
+
+				std::copy(m_pendingPPISamples.begin(), m_pendingPPISamples.end(), frame.ppiSamples);
+				frame.ppiSampleCount = (int)m_pendingPPISamples.size();
+				frame.timeInSeconds = JitterTime(beat.time);
+				m_pendingPPISamples.clear();
+			}
+		}
+	}
+}
+
+bool SimSensor::FindBeat(double time, size_t &out_beat_index) const
+{
+	// Samples are generated in time order near the end of the timeline, so search backwards
+	for (size_t index = m_beats.size(); index-- > 0;)
+	{
+		if (m_beats[index].time <= time)
+		{
+			out_beat_index = index;
+			return index + 1 < m_beats.size();
+		}
+	}
+
+	return false;
+}
+
+static double Gaussian(double x, double center, double width)
+{
+	const double d = (x - center) / width;
+
+	return exp(-0.5 * d * d);
+}
+
+// Lead I style PQRST complex in millivolts for the beat with its R peak at t=0
+static double ECGComplex(double t, double rr_interval)
+{
+	// QT interval shortens with heart rate (Bazett)
+	const double tWaveTime = 0.24 * sqrt(rr_interval);
+
+	return
+		0.12 * Gaussian(t, -0.16, 0.025) + // P
+		-0.10 * Gaussian(t, -0.03, 0.010) + // Q
+		1.20 * Gaussian(t, 0.0, 0.011) + // R
+		-0.25 * Gaussian(t, 0.03, 0.012) + // S
+		0.30 * Gaussian(t, tWaveTime, 0.05); // T
+}
+
+double SimSensor::ECGValue(double time) const
+{
+	size_t beat_index;
+	if (!FindBeat(time, beat_index))
+	{
+		return 0.0;
+	}
+
+	const SimBeat &beat = m_beats[beat_index];
+	const SimBeat &nextBeat = m_beats[beat_index + 1];
+
+	// The next beat's P wave starts before its R peak
+	return
+		ECGComplex(time - beat.time, beat.rrInterval) +
+		ECGComplex(time - nextBeat.time, nextBeat.rrInterval);
+}
+
+// Blood volume pulse, 0 at rest and 1 at the systolic peak
+double SimSensor::PPGPulse(double time) const
+{
+	size_t beat_index;
+	if (!FindBeat(time - k_pulseTransitTime, beat_index))
+	{
+		return 0.0;
+	}
+
+	const double t = time - k_pulseTransitTime - m_beats[beat_index].time;
+
+	return Gaussian(t, 0.12, 0.05) + 0.35 * Gaussian(t, 0.34, 0.07);
+}
+
+void SimSensor::GenerateHRFrames(double now)
+{
+	const double framePeriod = 1.0 / std::max(m_settings.hrFrameRate, 0.01f);
+
+	while (m_nextHRFrameTime <= now)
+	{
+		const double frameTime = m_nextHRFrameTime;
+		m_nextHRFrameTime += framePeriod;
+
+		ReportBeats(frameTime);
+		m_energyExpended += framePeriod * m_heartRate * 0.0025;
+
+		if (IsStreamActive(HSLStreamFlags_HRData))
+		{
+			HSLHeartRateFrame &frame = hrBuffer.AddFrame();
+
+			frame.contactStatus = HSLContactStatus_Contact;
+			frame.beatsPerMinute = (uint16_t)m_sensor.beatsPerMinute;
+			if (!m_rrHistoryMs.empty())
+			{
+				frame.beatsPerMinute = (uint16_t)std::lround(60000.0 / m_rrHistoryMs.back());
+			}
+			frame.energyExpended = (uint16_t)m_energyExpended;
+			std::copy(m_pendingRRIntervals.begin(), m_pendingRRIntervals.end(), frame.RRIntervals);
+			frame.RRIntervalCount = (int)m_pendingRRIntervals.size();
+			frame.timeInSeconds = JitterTime(frameTime);
+		}
+		m_pendingRRIntervals.clear();
+
+		for (int filter = 0; filter < HRVFilter_COUNT; ++filter)
+		{
+			if (!HSL_BITMASK_GET_FLAG(m_sensor.activeFilterStreams, filter) || m_rrHistoryMs.size() < 2)
+				continue;
+
+			HSLHeartVariabilityFrame &frame = hrvBuffers[filter].AddFrame();
+			frame.hrvValue = ComputeHRV((HSLHeartRateVariabityFilterType)filter);
+			frame.timeInSeconds = JitterTime(frameTime);
+		}
+	}
+}
+
+void SimSensor::GenerateECGFrames(double now)
+{
+	const double samplePeriod = 1.0 / std::max(m_settings.ecgSampleRate, 1.f);
+	const double framePeriod = samplePeriod * k_ecgSamplesPerFrame;
+
+	if (!IsStreamActive(HSLStreamFlags_ECGData))
+	{
+		m_nextECGSampleTime = now;
+		return;
+	}
+
+	// Don't generate frames that would be pushed straight out of the buffer
+	m_nextECGSampleTime = std::max(m_nextECGSampleTime, now - framePeriod * k_frameBufferCapacity);
+
+	while (m_nextECGSampleTime + framePeriod - samplePeriod <= now)
+	{
+		HSLHeartECGFrame &frame = ecgBuffer.AddFrame();
+		double sampleTime = m_nextECGSampleTime;
+
+		for (int sample = 0; sample < k_ecgSamplesPerFrame; ++sample)
+		{
+			const double baselineWander = 0.05 * sin(2.0 * k_pi * 0.3 * sampleTime);
+			const double millivolts = ECGValue(sampleTime) + baselineWander + Noise(0.01f);
+
+			// Polar reports ECG in microvolts
+			frame.ecgValues[sample] = (int)std::lround(millivolts * 1000.0);
+			sampleTime += samplePeriod;
+		}
+
+		frame.ecgValueCount = k_ecgSamplesPerFrame;
+		frame.timeInSeconds = JitterTime(sampleTime - samplePeriod);
+		m_nextECGSampleTime = sampleTime;
+	}
+}
+
+void SimSensor::GeneratePPGFrames(double now)
+{
+	const double samplePeriod = 1.0 / std::max(m_settings.ppgSampleRate, 1.f);
+	const double framePeriod = samplePeriod * k_ppgSamplesPerFrame;
+
+	if (!IsStreamActive(HSLStreamFlags_PPGData))
+	{
+		m_nextPPGSampleTime = now;
+		return;
+	}
+
+	m_nextPPGSampleTime = std::max(m_nextPPGSampleTime, now - framePeriod * k_frameBufferCapacity);
+
+	while (m_nextPPGSampleTime + framePeriod - samplePeriod <= now)
+	{
+		HSLHeartPPGFrame &frame = ppgBuffer.AddFrame();
+		double sampleTime = m_nextPPGSampleTime;
+
+		for (int sample = 0; sample < k_ppgSamplesPerFrame; ++sample)
+		{
+			// Light reaching the photodiode drops as blood volume rises
+			const double respiration = 1.0 + 0.1 * sin(2.0 * k_pi * 0.25 * sampleTime);
+			const double pulse = PPGPulse(sampleTime) * respiration;
+			HSLHeartPPGSample &ppg = frame.ppgSamples[sample];
+
+			ppg.ppgValue0 = (int)std::lround(250000.0 - 6000.0 * pulse + Noise(150.f));
+			ppg.ppgValue1 = (int)std::lround(240000.0 - 5200.0 * pulse + Noise(150.f));
+			ppg.ppgValue2 = (int)std::lround(230000.0 - 4500.0 * pulse + Noise(150.f));
+			ppg.ambient = (int)std::lround(1500.0 + Noise(40.f));
+			sampleTime += samplePeriod;
+		}
+
+		frame.ppgSampleCount = k_ppgSamplesPerFrame;
+		frame.timeInSeconds = JitterTime(sampleTime - samplePeriod);
+		m_nextPPGSampleTime = sampleTime;
+	}
+}
+
+void SimSensor::GenerateAccFrames(double now)
+{
+	const double samplePeriod = 1.0 / std::max(m_settings.accSampleRate, 1.f);
+	const double framePeriod = samplePeriod * k_accSamplesPerFrame;
+
+	if (!IsStreamActive(HSLStreamFlags_AccData))
+	{
+		m_nextAccSampleTime = now;
+		return;
+	}
+
+	m_nextAccSampleTime = std::max(m_nextAccSampleTime, now - framePeriod * k_frameBufferCapacity);
+
+	while (m_nextAccSampleTime + framePeriod - samplePeriod <= now)
+	{
+		HSLAccelerometerFrame &frame = accBuffer.AddFrame();
+		double sampleTime = m_nextAccSampleTime;
+
+		for (int sample = 0; sample < k_accSamplesPerFrame; ++sample)
+		{
+			// Gravity on Z in milli-G, plus gentle sway and breathing
+			HSLVector3f &acc = frame.accSamples[sample];
+
+			acc.x = (float)(20.0 * sin(2.0 * k_pi * 1.1 * sampleTime)) + Noise(4.f);
+			acc.y = (float)(15.0 * sin(2.0 * k_pi * 0.8 * sampleTime + 1.0)) + Noise(4.f);
+			acc.z = (float)(1000.0 + 10.0 * sin(2.0 * k_pi * 0.25 * sampleTime)) + Noise(4.f);
+			sampleTime += samplePeriod;
+		}
+
+		frame.accSampleCount = k_accSamplesPerFrame;
+		frame.timeInSeconds = JitterTime(sampleTime - samplePeriod);
+		m_nextAccSampleTime = sampleTime;
+	}
+}
+
+float SimSensor::ComputeHRV(HSLHeartRateVariabityFilterType filter) const
+{
+	const size_t count = m_rrHistoryMs.size();
+
+	double mean = 0.0;
+	for (float rr : m_rrHistoryMs)
+		mean += rr;
+	mean /= (double)count;
+
+	double sumSquaredDeviation = 0.0;
+	for (float rr : m_rrHistoryMs)
+		sumSquaredDeviation += (rr - mean) * (rr - mean);
+
+	double sumSquaredDelta = 0.0;
+	double meanDelta = 0.0;
+	int nn50 = 0;
+	int nn20 = 0;
+	for (size_t i = 1; i < count; ++i)
+	{
+		const double delta = m_rrHistoryMs[i] - m_rrHistoryMs[i - 1];
+
+		sumSquaredDelta += delta * delta;
+		meanDelta += delta;
+		if (fabs(delta) > 50.0)
+			++nn50;
+		if (fabs(delta) > 20.0)
+			++nn20;
+	}
+	const double deltaCount = (double)(count - 1);
+	meanDelta /= deltaCount;
+
+	switch (filter)
+	{
+	case HRVFilter_SDNN:
+		return (float)sqrt(sumSquaredDeviation / (double)count);
+	case HRVFilter_RMSSD:
+		return (float)sqrt(sumSquaredDelta / deltaCount);
+	case HRVFilter_SDSD:
+		return (float)sqrt(std::max(sumSquaredDelta / deltaCount - meanDelta * meanDelta, 0.0));
+	case HRVFilter_NN50:
+		return (float)nn50;
+	case HRVFilter_pNN50:
+		return (float)(100.0 * nn50 / deltaCount);
+	case HRVFilter_NN20:
+		return (float)nn20;
+	case HRVFilter_pNN20:
+		return (float)(100.0 * nn20 / deltaCount);
+	default:
+		break;
+	}
+
+	return 0.f;
+}
+
+//-- simulator state -----
+struct HSLSimulatorState
+{
+	bool bInitialized;
+	HSLSimulatorSettings settings;
+	std::chrono::steady_clock::time_point startTime;
+	std::vector<std::unique_ptr<SimSensor>> sensors; // Boxed so HSL_GetSensor pointers survive the list growing
+	std::deque<HSLEventMessage> messageQueue;
+	bool bSensorListDirty;
+	bool bSensorListChanged;
+
+	HSLSimulatorState()
+		: bInitialized(false)
+		, bSensorListDirty(false)
+		, bSensorListChanged(false)
+	{
+	}
+};
+
+static HSLSimulatorState g_simulator;
+
+static double GetSimulatorTime()
+{
+	const auto elapsed = std::chrono::steady_clock::now() - g_simulator.startTime;
+
+	return std::chrono::duration<double>(elapsed).count();
+}
+
+static SimSensor *FindSimSensor(HSLSensorID sensor_id)
+{
+	if (!g_simulator.bInitialized || sensor_id < 0 || sensor_id >= (int)g_simulator.sensors.size())
+	{
+		return nullptr;
+	}
+
+	return g_simulator.sensors[sensor_id].get();
+}
+
+static void ResizeSensorList()
+{
+	const size_t sensorCount = (size_t)std::min(std::max(g_simulator.settings.sensorCount, 0), HSL_SENSOR_LIST_MAX);
+
+	if (sensorCount == g_simulator.sensors.size())
+	{
+		return;
+	}
+
+	const double now = GetSimulatorTime();
+	while (g_simulator.sensors.size() < sensorCount)
+	{
+		const HSLSensorID sensor_id = (HSLSensorID)g_simulator.sensors.size();
+
+		g_simulator.sensors.push_back(std::unique_ptr<SimSensor>(new SimSensor(sensor_id, g_simulator.settings, now)));
+	}
+	g_simulator.sensors.resize(sensorCount);
+
+	g_simulator.bSensorListDirty = true;
+}
+
+static bool UpdateSimulator(bool bPollEvents)
+{
+	if (!g_simulator.bInitialized)
+	{
+		return false;
+	}
+
+	if (g_simulator.bSensorListDirty)
+	{
+		HSLEventMessage message;
+		message.event_type = HSLEvent_SensorListUpdated;
+		g_simulator.messageQueue.push_back(message);
+
+		g_simulator.bSensorListDirty = false;
+	}
+
+	const double now = GetSimulatorTime();
+	for (const std::unique_ptr<SimSensor> &sensor : g_simulator.sensors)
+	{
+		sensor->Advance(now);
+	}
+
+	// A full update consumes the queued events itself, same as the SDK
+	g_simulator.bSensorListChanged = false;
+	if (bPollEvents)
+	{
+		while (!g_simulator.messageQueue.empty())
+		{
+			if (g_simulator.messageQueue.front().event_type == HSLEvent_SensorListUpdated)
+			{
+				g_simulator.bSensorListChanged = true;
+			}
+
+			g_simulator.messageQueue.pop_front();
+		}
+	}
+
+	return true;
+}
+
+//-- settings -----
+HSLSimulatorSettings::HSLSimulatorSettings()
+	: sensorCount(1)
+	, capabilities(
+		(1 << HSLStreamFlags_HRData) |
+		(1 << HSLStreamFlags_ECGData) |
+		(1 << HSLStreamFlags_PPGData) |
+		(1 << HSLStreamFlags_PPIData) |
+		(1 << HSLStreamFlags_AccData))
+	, ecgSampleRate(130.f)
+	, ppgSampleRate(135.f)
+	, accSampleRate(50.f)
+	, hrFrameRate(1.f)
+	, ppiSamplesPerFrame(5)
+	, heartRate(65.f)
+	, frameJitterMs(0.f)
+	, randomSeed(1)
+{
+}
+
+static void ReadEnvironmentSetting(const char *name, int &out_value)
+{
+	const char *value = getenv(name);
+	if (value != nullptr && value[0] != '\0')
+		out_value = atoi(value);
+}
+
+static void ReadEnvironmentSetting(const char *name, unsigned int &out_value)
+{
+	const char *value = getenv(name);
+	if (value != nullptr && value[0] != '\0')
+		out_value = (unsigned int)strtoul(value, nullptr, 0);
+}
+
+static void ReadEnvironmentSetting(const char *name, float &out_value)
+{
+	const char *value = getenv(name);
+	if (value != nullptr && value[0] != '\0')
+		out_value = (float)atof(value);
+}
+
+void HSLSim_GetDefaultSettings(HSLSimulatorSettings &out_settings)
+{
+	out_settings = HSLSimulatorSettings();
+
+	ReadEnvironmentSetting("HSL_SIM_SENSORS", out_settings.sensorCount);
+	ReadEnvironmentSetting("HSL_SIM_CAPABILITIES", out_settings.capabilities);
+	ReadEnvironmentSetting("HSL_SIM_ECG_HZ", out_settings.ecgSampleRate);
+	ReadEnvironmentSetting("HSL_SIM_PPG_HZ", out_settings.ppgSampleRate);
+	ReadEnvironmentSetting("HSL_SIM_ACC_HZ", out_settings.accSampleRate);
+	ReadEnvironmentSetting("HSL_SIM_HR_HZ", out_settings.hrFrameRate);
+	ReadEnvironmentSetting("HSL_SIM_PPI_SAMPLES", out_settings.ppiSamplesPerFrame);
+	ReadEnvironmentSetting("HSL_SIM_HEART_RATE", out_settings.heartRate);
+	ReadEnvironmentSetting("HSL_SIM_JITTER_MS", out_settings.frameJitterMs);
+	ReadEnvironmentSetting("HSL_SIM_SEED", out_settings.randomSeed);
+}
+
+void HSLSim_GetSettings(HSLSimulatorSettings &out_settings)
+{
+	out_settings = g_simulator.settings;
+}
+
+void HSLSim_SetSettings(const HSLSimulatorSettings &settings)
+{
+	g_simulator.settings = settings;
+
+	for (const std::unique_ptr<SimSensor> &sensor : g_simulator.sensors)
+	{
+		sensor->ApplySettings(settings);
+	}
+
+	if (g_simulator.bInitialized)
+	{
+		ResizeSensorList();
+	}
+}
+
+//-- HSL C API -----
+bool HSL_Initialize(HSLLogSeverityLevel log_level)
+{
+	(void)log_level; // The simulator doesn't log
+	if (g_simulator.bInitialized)
+	{
+		return true;
+	}
+
+	HSLSim_GetDefaultSettings(g_simulator.settings);
+	g_simulator.startTime = std::chrono::steady_clock::now();
+	g_simulator.bInitialized = true;
+	ResizeSensorList();
+
+	return true;
+}
+
+bool HSL_Shutdown()
+{
+	g_simulator.sensors.clear();
+	g_simulator.messageQueue.clear();
+	g_simulator.bSensorListDirty = false;
+	g_simulator.bSensorListChanged = false;
+	g_simulator.bInitialized = false;
+
+	return true;
+}
+
+bool HSL_Update()
+{
+	return UpdateSimulator(true);
+}
+
+bool HSL_UpdateNoPollEvents()
+{
+	return UpdateSimulator(false);
+}
+
+bool HSL_GetVersionString(char *out_version_string, size_t max_version_string)
+{
+	if (out_version_string == nullptr || max_version_string == 0)
+	{
+		return false;
+	}
+
+	snprintf(out_version_string, max_version_string, "Simulator 1.0");
+
+	return true;
+}
+
+bool HSL_PollNextMessage(HSLEventMessage *out_messsage)
+{
+	if (g_simulator.messageQueue.empty())
+	{
+		return false;
+	}
+
+	*out_messsage = g_simulator.messageQueue.front();
+	g_simulator.messageQueue.pop_front();
+
+	return true;
+}
+
+bool HSL_HasSensorListChanged()
+{
+	return g_simulator.bSensorListChanged;
+}
+
+bool HSL_GetSensorList(HSLSensorList *out_sensor_list)
+{
+	if (out_sensor_list == nullptr)
+	{
+		return false;
+	}
+
+	memset(out_sensor_list, 0, sizeof(HSLSensorList));
+	snprintf(out_sensor_list->hostSerial, sizeof(out_sensor_list->hostSerial), "SIMULATOR");
+
+	for (const std::unique_ptr<SimSensor> &sensor : g_simulator.sensors)
+	{
+		out_sensor_list->sensors[out_sensor_list->count].sensorID = sensor->GetSensor().sensorID;
+		out_sensor_list->count++;
+	}
+
+	return true;
+}
+
+HSLSensor *HSL_GetSensor(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	return (sensor != nullptr) ? &sensor->GetSensor() : nullptr;
+}
+
+bool HSL_SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	sensor->SetActiveDataStreams(data_stream_flags, GetSimulatorTime());
+
+	return true;
+}
+
+bool HSL_SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	sensor->SetActiveFilterStreams(filter_stream_bitmask);
+
+	return true;
+}
+
+bool HSL_StopAllSensorStreams(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+	{
+		return false;
+	}
+
+	sensor->SetActiveDataStreams(0, GetSimulatorTime());
+	sensor->SetActiveFilterStreams(0);
+
+	return true;
+}
+
+static HSLBufferIterator GetInvalidIterator(HSLSensorBufferType buffer_type)
+{
+	HSLBufferIterator iter;
+	memset(&iter, 0, sizeof(iter));
+	iter.bufferType = buffer_type;
+
+	return iter;
+}
+
+HSLBufferIterator HSL_GetHeartRateBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	return sensor ? sensor->hrBuffer.GetIterator(HSLBufferType_HRData) : GetInvalidIterator(HSLBufferType_HRData);
+}
+
+HSLBufferIterator HSL_GetHeartECGBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	return sensor ? sensor->ecgBuffer.GetIterator(HSLBufferType_ECGData) : GetInvalidIterator(HSLBufferType_ECGData);
+}
+
+HSLBufferIterator HSL_GetHeartPPGBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	return sensor ? sensor->ppgBuffer.GetIterator(HSLBufferType_PPGData) : GetInvalidIterator(HSLBufferType_PPGData);
+}
+
+HSLBufferIterator HSL_GetHeartPPIBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	return sensor ? sensor->ppiBuffer.GetIterator(HSLBufferType_PPIData) : GetInvalidIterator(HSLBufferType_PPIData);
+}
+
+HSLBufferIterator HSL_GetHeartAccBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	return sensor ? sensor->accBuffer.GetIterator(HSLBufferType_AccData) : GetInvalidIterator(HSLBufferType_AccData);
+}
+
+HSLBufferIterator HSL_GetHeartHrvBuffer(HSLSensorID sensor_id, HSLHeartRateVariabityFilterType filter)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+
+	if (sensor == nullptr || filter < 0 || filter >= HRVFilter_COUNT)
+	{
+		return GetInvalidIterator(HSLBufferType_HRVData);
+	}
+
+	return sensor->hrvBuffers[filter].GetIterator(HSLBufferType_HRVData);
+}
+
+bool HSL_FlushHeartRateBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+		return false;
+
+	sensor->hrBuffer.Flush();
+	return true;
+}
+
+bool HSL_FlushHeartECGBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+		return false;
+
+	sensor->ecgBuffer.Flush();
+	return true;
+}
+
+bool HSL_FlushHeartPPGBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+		return false;
+
+	sensor->ppgBuffer.Flush();
+	return true;
+}
+
+bool HSL_FlushHeartPPIBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+		return false;
+
+	sensor->ppiBuffer.Flush();
+	return true;
+}
+
+bool HSL_FlushHeartAccBuffer(HSLSensorID sensor_id)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr)
+		return false;
+
+	sensor->accBuffer.Flush();
+	return true;
+}
+
+bool HSL_FlushHeartHrvBuffer(HSLSensorID sensor_id, HSLHeartRateVariabityFilterType filter)
+{
+	SimSensor *sensor = FindSimSensor(sensor_id);
+	if (sensor == nullptr || filter < 0 || filter >= HRVFilter_COUNT)
+		return false;
+
+	sensor->hrvBuffers[filter].Flush();
+	return true;
+}
+
+bool HSL_IsBufferIteratorValid(HSLBufferIterator *iterator)
+{
+	return iterator != nullptr && iterator->buffer != nullptr && iterator->remaining > 0;
+}
+
+bool HSL_BufferIteratorNext(HSLBufferIterator *iterator)
+{
+	if (!HSL_IsBufferIteratorValid(iterator))
+	{
+		return false;
+	}
+
+	iterator->currentIndex++;
+	iterator->remaining--;
+
+	return iterator->remaining > 0;
+}
+
+template <typename t_frame>
+static t_frame *GetIteratorFrame(HSLBufferIterator *iterator, HSLSensorBufferType buffer_type)
+{
+	if (!HSL_IsBufferIteratorValid(iterator) || iterator->bufferType != buffer_type)
+	{
+		return nullptr;
+	}
+
+	SimFrameBufferBase *buffer = static_cast<SimFrameBufferBase *>(iterator->buffer);
+
+	return static_cast<t_frame *>(buffer->GetFrame(iterator->currentIndex));
+}
+
+HSLHeartRateFrame *HSL_BufferIteratorGetHRData(HSLBufferIterator *iterator)
+{
+	return GetIteratorFrame<HSLHeartRateFrame>(iterator, HSLBufferType_HRData);
+}
+
+HSLHeartECGFrame *HSL_BufferIteratorGetECGData(HSLBufferIterator *iterator)
+{
+	return GetIteratorFrame<HSLHeartECGFrame>(iterator, HSLBufferType_ECGData);
+}
+
+HSLHeartPPGFrame *HSL_BufferIteratorGetPPGData(HSLBufferIterator *iterator)
+{
+	return GetIteratorFrame<HSLHeartPPGFrame>(iterator, HSLBufferType_PPGData);
+}
+
+HSLHeartPPIFrame *HSL_BufferIteratorGetPPIData(HSLBufferIterator *iterator)
+{
+	return GetIteratorFrame<HSLHeartPPIFrame>(iterator, HSLBufferType_PPIData);
+}
+
+HSLAccelerometerFrame *HSL_BufferIteratorGetAccData(HSLBufferIterator *iterator)
+{
+	return GetIteratorFrame<HSLAccelerometerFrame>(iterator, HSLBufferType_AccData);
+}
+
+HSLHeartVariabilityFrame *HSL_BufferIteratorGetHRVData(HSLBufferIterator *iterator)
+{
+	return GetIteratorFrame<HSLHeartVariabilityFrame>(iterator, HSLBufferType_HRVData);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HSL_SIMULATOR_H
+#define HSL_SIMULATOR_H
+
+#include "HSLClient_CAPI.h"
+
+// Shape of the virtual sensors the simulator build of HSL generates data for
+struct HSLSimulatorSettings
+{
+	int sensorCount;
+	t_hsl_stream_bitmask capabilities; // HSLSensorDataStreamFlags every virtual sensor supports
+	float ecgSampleRate; // Hz
+	float ppgSampleRate; // Hz
+	float accSampleRate; // Hz
+	float hrFrameRate; // HR frames per second, HRV frames are produced at the same rate
+	int ppiSamplesPerFrame;
+	float heartRate; // Mean BPM, each sensor is offset a little from this
+	float frameJitterMs; // Each frame timestamp is moved by up to +/- this much
+	unsigned int randomSeed;
+
+	HSLSimulatorSettings();
+};
+
+// The built in defaults, overridden by any HSL_SIM_* environment variables that are set:
+// HSL_SIM_SENSORS, HSL_SIM_CAPABILITIES, HSL_SIM_ECG_HZ, HSL_SIM_PPG_HZ, HSL_SIM_ACC_HZ,
+// HSL_SIM_HR_HZ, HSL_SIM_PPI_SAMPLES, HSL_SIM_HEART_RATE, HSL_SIM_JITTER_MS, HSL_SIM_SEED
+void HSLSim_GetDefaultSettings(HSLSimulatorSettings &out_settings);
+
+void HSLSim_GetSettings(HSLSimulatorSettings &out_settings);
+
+// Adds or removes virtual sensors to match settings.sensorCount, raising
+// HSLEvent_SensorListUpdated on the next update if the count changed.
+// Same threading rules as the rest of the HSL API.
+void HSLSim_SetSettings(const HSLSimulatorSettings &settings);
+
+#endif // HSL_SIMULATOR_H
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+// Simulator build copy of the HeartSensorLibrary client constants
+#ifndef CLIENT_CONSTANTS_H
+#define CLIENT_CONSTANTS_H
+
+#define HSL_MAX_VERSION_STRING_LEN 32
+
+// Raised so the simulator can be load tested with 100+ sensors
+#define HSL_MAX_SENSOR_COUNT 128
+#define HSL_SENSOR_LIST_MAX HSL_MAX_SENSOR_COUNT
+
+#define MAX_HSL_DEVICE_PATH 256
+
+// Per-frame sample limits
+#define MAX_HSL_RR_INTERVALS 8
+#define MAX_HSL_ECG_SAMPLES 80
+#define MAX_HSL_PPG_SAMPLES 40
+#define MAX_HSL_PPI_SAMPLES 10
+#define MAX_HSL_ACC_SAMPLES 40
+
+#endif // CLIENT_CONSTANTS_H
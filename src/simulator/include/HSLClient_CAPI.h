@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2021, Brendan Walker <brendan@millerwalker.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+// Simulator build copy of the subset of the HeartSensorLibrary C API used by the addon.
+// Keep in sync with the SDK's HSLClient_CAPI.h.
+#ifndef HSL_CLIENT_CAPI_H
+#define HSL_CLIENT_CAPI_H
+
+#include "ClientConstants.h"
+#include "ClientMath_CAPI.h"
+#include "HSLClient_export.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int HSLSensorID;
+typedef unsigned int t_hsl_stream_bitmask;
+typedef unsigned int t_hrv_filter_bitmask;
+
+#define HSL_BITMASK_GET_FLAG(bitmask, flag) (((bitmask) & (1 << (flag))) != 0)
+#define HSL_BITMASK_SET_FLAG(bitmask, flag) ((bitmask) | (1 << (flag)))
+#define HSL_BITMASK_CLEAR_FLAG(bitmask, flag) ((bitmask) & ~(1 << (flag)))
+
+typedef enum
+{
+	HSLLogSeverityLevel_trace,
+	HSLLogSeverityLevel_debug,
+	HSLLogSeverityLevel_info,
+	HSLLogSeverityLevel_warning,
+	HSLLogSeverityLevel_error,
+	HSLLogSeverityLevel_fatal
+} HSLLogSeverityLevel;
+
+typedef enum
+{
+	HSLBufferType_HRData,
+	HSLBufferType_ECGData,
+	HSLBufferType_PPGData,
+	HSLBufferType_PPIData,
+	HSLBufferType_AccData,
+	HSLBufferType_HRVData,
+
+	HSLBufferType_COUNT
+} HSLSensorBufferType;
+
+typedef enum
+{
+	HSLStreamFlags_HRData,
+	HSLStreamFlags_ECGData,
+	HSLStreamFlags_PPGData,
+	HSLStreamFlags_PPIData,
+	HSLStreamFlags_AccData,
+
+	HSLStreamFlags_COUNT
+} HSLSensorDataStreamFlags;
+
+typedef enum
+{
+	HRVFilter_SDNN,
+	HRVFilter_RMSSD,
+	HRVFilter_SDSD,
+	HRVFilter_NN50,
+	HRVFilter_pNN50,
+	HRVFilter_NN20,
+	HRVFilter_pNN20,
+
+	HRVFilter_COUNT
+} HSLHeartRateVariabityFilterType;
+
+typedef enum
+{
+	HSLContactStatus_Invalid,
+	HSLContactStatus_NoContact,
+	HSLContactStatus_Contact
+} HSLContactSensorStatus;
+
+typedef enum
+{
+	HSLEvent_SensorListUpdated
+} HSLEventType;
+
+typedef struct
+{
+	HSLEventType event_type;
+} HSLEventMessage;
+
+typedef struct
+{
+	HSLContactSensorStatus contactStatus;
+	uint16_t beatsPerMinute;
+	uint16_t energyExpended;
+	uint16_t RRIntervals[MAX_HSL_RR_INTERVALS];
+	int RRIntervalCount;
+	double timeInSeconds;
+} HSLHeartRateFrame;
+
+typedef struct
+{
+	int ecgValues[MAX_HSL_ECG_SAMPLES];
+	int ecgValueCount;
+	double timeInSeconds;
+} HSLHeartECGFrame;
+
+typedef struct
+{
+	int ppgValue0;
+	int ppgValue1;
+	int ppgValue2;
+	int ambient;
+} HSLHeartPPGSample;
+
+typedef struct
+{
+	HSLHeartPPGSample ppgSamples[MAX_HSL_PPG_SAMPLES];
+	int ppgSampleCount;
+	double timeInSeconds;
+} HSLHeartPPGFrame;
+
+typedef struct
+{
+	uint16_t beatsPerMinute;
+	uint16_t pulseDuration;
+	uint16_t pulseDurationErrorEst;
+	uint8_t blockerBit;
+	uint8_t skinContactBit;
+	uint8_t supportsSkinContactBit;
+} HSLHeartPPISample;
+
+typedef struct
+{
+	HSLHeartPPISample ppiSamples[MAX_HSL_PPI_SAMPLES];
+	int ppiSampleCount;
+	double timeInSeconds;
+} HSLHeartPPIFrame;
+
+typedef struct
+{
+	HSLVector3f accSamples[MAX_HSL_ACC_SAMPLES];
+	int accSampleCount;
+	double timeInSeconds;
+} HSLAccelerometerFrame;
+
+typedef struct
+{
+	float hrvValue;
+	double timeInSeconds;
+} HSLHeartVariabilityFrame;
+
+typedef struct
+{
+	void *buffer;
+	int currentIndex;
+	int remaining;
+	HSLSensorBufferType bufferType;
+} HSLBufferIterator;
+
+typedef struct
+{
+	char bodyLocation[64];
+	t_hsl_stream_bitmask capabilities;
+	char deviceFriendlyName[128];
+	char devicePath[MAX_HSL_DEVICE_PATH];
+	char firmwareRevisionString[64];
+	char hardwareRevisionString[64];
+	char manufacturerNameString[64];
+	char modelNumberString[64];
+	char serialNumberString[64];
+	char softwareRevisionString[64];
+	char systemID[64];
+} HSLDeviceInformation;
+
+typedef struct
+{
+	HSLSensorID sensorID;
+	HSLDeviceInformation deviceInformation;
+	t_hsl_stream_bitmask activeDataStreams;
+	t_hrv_filter_bitmask activeFilterStreams;
+	int beatsPerMinute;
+} HSLSensor;
+
+typedef struct
+{
+	HSLSensorID sensorID;
+} HSLSensorListEntry;
+
+typedef struct
+{
+	char hostSerial[64];
+	HSLSensorListEntry sensors[HSL_SENSOR_LIST_MAX];
+	int count;
+} HSLSensorList;
+
+// Lifecycle
+HSL_PUBLIC_FUNCTION(bool) HSL_Initialize(HSLLogSeverityLevel log_level);
+HSL_PUBLIC_FUNCTION(bool) HSL_Shutdown();
+HSL_PUBLIC_FUNCTION(bool) HSL_Update();
+HSL_PUBLIC_FUNCTION(bool) HSL_UpdateNoPollEvents();
+HSL_PUBLIC_FUNCTION(bool) HSL_GetVersionString(char *out_version_string, size_t max_version_string);
+
+// Events
+HSL_PUBLIC_FUNCTION(bool) HSL_PollNextMessage(HSLEventMessage *out_messsage);
+
+// Sensors
+HSL_PUBLIC_FUNCTION(bool) HSL_HasSensorListChanged();
+HSL_PUBLIC_FUNCTION(bool) HSL_GetSensorList(HSLSensorList *out_sensor_list);
+HSL_PUBLIC_FUNCTION(HSLSensor *) HSL_GetSensor(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(bool) HSL_SetActiveSensorDataStreams(HSLSensorID sensor_id, t_hsl_stream_bitmask data_stream_flags);
+HSL_PUBLIC_FUNCTION(bool) HSL_SetActiveSensorFilterStreams(HSLSensorID sensor_id, t_hrv_filter_bitmask filter_stream_bitmask);
+HSL_PUBLIC_FUNCTION(bool) HSL_StopAllSensorStreams(HSLSensorID sensor_id);
+
+// Buffers
+HSL_PUBLIC_FUNCTION(HSLBufferIterator) HSL_GetHeartRateBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(HSLBufferIterator) HSL_GetHeartECGBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(HSLBufferIterator) HSL_GetHeartPPGBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(HSLBufferIterator) HSL_GetHeartPPIBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(HSLBufferIterator) HSL_GetHeartAccBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(HSLBufferIterator) HSL_GetHeartHrvBuffer(HSLSensorID sensor_id, HSLHeartRateVariabityFilterType filter);
+HSL_PUBLIC_FUNCTION(bool) HSL_FlushHeartRateBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(bool) HSL_FlushHeartECGBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(bool) HSL_FlushHeartPPGBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(bool) HSL_FlushHeartPPIBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(bool) HSL_FlushHeartAccBuffer(HSLSensorID sensor_id);
+HSL_PUBLIC_FUNCTION(bool) HSL_FlushHeartHrvBuffer(HSLSensorID sensor_id, HSLHeartRateVariabityFilterType filter);
+
+// Buffer iteration
+HSL_PUBLIC_FUNCTION(bool) HSL_IsBufferIteratorValid(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(bool) HSL_BufferIteratorNext(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(HSLHeartRateFrame *) HSL_BufferIteratorGetHRData(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(HSLHeartECGFrame *) HSL_BufferIteratorGetECGData(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(HSLHeartPPGFrame *) HSL_BufferIteratorGetPPGData(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(HSLHeartPPIFrame *) HSL_BufferIteratorGetPPIData(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(HSLAccelerometerFrame *) HSL_BufferIteratorGetAccData(HSLBufferIterator *iterator);
+HSL_PUBLIC_FUNCTION(HSLHeartVariabilityFrame *) HSL_BufferIteratorGetHRVData(HSLBufferIterator *iterator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HSL_CLIENT_CAPI_H
@@ -0,0 +1,80 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+sim.describeSimulator('AlertEngine transitions', function () {
+  // Simulated beats are generated a couple of seconds ahead, so a heart rate change takes a while to show
+  this.timeout(30000);
+
+  var previousSettings;
+  var sensorId;
+  var engine = null;
+
+  // Runs the update loop until the engine queues an event and returns the queued events
+  function waitForEvents() {
+    var events = null;
+    sim.updateUntil(function () {
+      events = engine.read();
+      return events != null;
+    }, 8000);
+
+    return events;
+  }
+
+  before(function () {
+    previousSettings = sim.useFastSettings({ heartRate: 170 });
+    sim.stopAllSensors();
+
+    var sensor = sim.getFirstSensor();
+    sensorId = sensor.getSensorID();
+
+    engine = new hsl.AlertEngine([
+      { name: 'tachycardia', sensorId: sensorId, metric: 'heartRate', above: 130, clear: 100 }
+    ]);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_HRData, true);
+  });
+
+  after(function () {
+    if (engine != null) engine.close();
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  it('raises an alert once the threshold is crossed', function () {
+    var events = waitForEvents();
+
+    assert.strictEqual(events.length, 1);
+    assert.strictEqual(events[0].rule, 0);
+    assert.strictEqual(events[0].name, 'tachycardia');
+    assert.strictEqual(events[0].sensorId, sensorId);
+    assert.strictEqual(events[0].raised, true);
+    assert.ok(events[0].value > 130);
+
+    var active = engine.getActive();
+    assert.strictEqual(active.length, 1);
+    assert.strictEqual(active[0].name, 'tachycardia');
+  });
+
+  it('queues nothing while the alert stays raised', function () {
+    sim.runUpdates(500);
+
+    assert.strictEqual(engine.read(), null);
+    assert.strictEqual(engine.getActive().length, 1);
+  });
+
+  it('clears the alert once the value crosses the clear threshold', function () {
+    hsl.setSimulatorSettings({ heartRate: 50 });
+
+    var events = waitForEvents();
+
+    assert.strictEqual(events.length, 1);
+    assert.strictEqual(events[0].raised, false);
+    assert.ok(events[0].value <= 100);
+    assert.strictEqual(engine.getActive().length, 0);
+
+    var stats = engine.getStats();
+    assert.strictEqual(stats.raised, 1);
+    assert.strictEqual(stats.cleared, 1);
+  });
+});
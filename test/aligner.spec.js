@@ -0,0 +1,155 @@
+var assert = require('assert');
+var fs = require('fs');
+var sim = require('./helpers/simulator');
+var session = require('./helpers/session');
+
+var hsl = sim.hsl;
+
+// 6 seconds of a 130 Hz ECG ramp and a 50 Hz Acc ramp on the same clock, in frames that end at different times
+var START_TIME = 400;
+var SESSION_SECONDS = 6;
+var ECG_RATE = 130;
+var ECG_SLOPE = 1300; // per second
+var ACC_RATE = 50;
+var ACC_SLOPE = 1000;
+var ALIGNED_RATE = 100;
+
+// The aligner fits clocks from host arrival times, and a realtime replay delivers both streams
+// within one update (10 ms) of their sensor time
+var MAX_CLOCK_ERROR = 0.02;
+
+function createECG() {
+  var values = [];
+
+  for (var i = 0; i < SESSION_SECONDS * ECG_RATE; i++) {
+    values.push(Math.round(ECG_SLOPE * i / ECG_RATE));
+  }
+
+  return values;
+}
+
+// x climbs, y falls and z stays put
+function createAcc() {
+  var values = [];
+
+  for (var i = 0; i < SESSION_SECONDS * ACC_RATE; i++) {
+    values.push(ACC_SLOPE * i / ACC_RATE, -ACC_SLOPE * i / ACC_RATE, 1);
+  }
+
+  return values;
+}
+
+sim.describeSimulator('SensorAligner', function () {
+  this.timeout(20000);
+
+  var sessionPath = session.getTempSessionPath('aligner');
+  var aligner = null;
+  var streams;
+  var clocks;
+  var aligned = { timeInSeconds: [], channels: [] };
+
+  function collect() {
+    var block = aligner.read();
+    if (block == null) return;
+
+    for (var channel = 0; channel < block.channelCount; channel++) {
+      var column = block.values.subarray(channel * block.sampleCount, (channel + 1) * block.sampleCount);
+
+      aligned.channels[channel] = (aligned.channels[channel] || []).concat(Array.from(column));
+    }
+    aligned.timeInSeconds = aligned.timeInSeconds.concat(Array.from(block.timeInSeconds));
+  }
+
+  // Aligned samples past the first second, once both sample clocks have measured their period
+  function forEachSettled(fn) {
+    aligned.timeInSeconds.forEach(function (time, index) {
+      if (time >= START_TIME + 1) fn(time, index);
+    });
+  }
+
+  before(function () {
+    session.writeSession(hsl, sessionPath, 8, [{
+      bufferType: hsl.BufferIterator.BufferType_ECGData,
+      frames: session.createWaveformFrames(START_TIME, ECG_RATE, createECG(), 13)
+    }, {
+      bufferType: hsl.BufferIterator.BufferType_AccData,
+      frames: session.createWaveformFrames(START_TIME, ACC_RATE, createAcc(), 8, 3)
+    }]);
+
+    hsl.startReplay(sessionPath, { realtime: true });
+    hsl.update();
+
+    var sensor = hsl.getSensorList().getSensor(0);
+    aligner = new hsl.SensorAligner([
+      { sensorId: sensor.getSensorID(), bufferType: hsl.BufferIterator.BufferType_ECGData },
+      { sensorId: sensor.getSensorID(), bufferType: hsl.BufferIterator.BufferType_AccData }
+    ], { sampleRate: ALIGNED_RATE });
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_AccData, true);
+
+    sim.updateUntil(function () {
+      collect();
+      return hsl.isReplayFinished();
+    }, (SESSION_SECONDS + 5) * 1000);
+    hsl.update();
+    collect();
+
+    streams = aligner.getStreams();
+    clocks = aligner.getClocks();
+  });
+
+  after(function () {
+    if (aligner != null) aligner.close();
+    hsl.stopReplay();
+    if (fs.existsSync(sessionPath)) fs.unlinkSync(sessionPath);
+  });
+
+  it('lays the streams side by side', function () {
+    assert.strictEqual(streams.length, 2);
+    assert.strictEqual(streams[0].firstChannel, 0);
+    assert.strictEqual(streams[0].channelCount, 1);
+    assert.strictEqual(streams[1].firstChannel, 1);
+    assert.strictEqual(streams[1].channelCount, 3);
+    assert.strictEqual(aligned.channels.length, 4);
+  });
+
+  it('puts the aligned samples on whole periods of the reference clock', function () {
+    var times = aligned.timeInSeconds;
+
+    // Most of the session comes out, aligned up to where both streams end
+    assert.ok(times.length >= (SESSION_SECONDS - 1) * ALIGNED_RATE, times.length + ' aligned samples');
+    assert.ok(times[0] >= START_TIME);
+    assert.ok(times[times.length - 1] <= START_TIME + SESSION_SECONDS);
+
+    times.forEach(function (time, index) {
+      assert.ok(Math.abs(time * ALIGNED_RATE - Math.round(time * ALIGNED_RATE)) < 1e-6, 'sample at ' + time);
+      if (index > 0) {
+        assert.ok(Math.abs(time - times[index - 1] - 1 / ALIGNED_RATE) < 1e-9, 'sample at ' + time);
+      }
+    });
+  });
+
+  it('interpolates the reference stream exactly', function () {
+    forEachSettled(function (time, index) {
+      var expected = ECG_SLOPE * (time - START_TIME);
+      var value = aligned.channels[0][index];
+
+      assert.ok(Math.abs(value - expected) < 1e-2, 'ECG at ' + time + ' was ' + value + ', expected ' + expected);
+    });
+  });
+
+  it('interpolates the other stream through its fitted clock', function () {
+    assert.ok(Math.abs(clocks[0].offsetSeconds) < 1e-9);
+    assert.ok(Math.abs(clocks[1].offsetSeconds) < MAX_CLOCK_ERROR, 'offset ' + clocks[1].offsetSeconds);
+    assert.strictEqual(clocks[1].driftPpm, 0);
+
+    var tolerance = ACC_SLOPE * MAX_CLOCK_ERROR;
+    forEachSettled(function (time, index) {
+      var expected = ACC_SLOPE * (time - clocks[1].offsetSeconds - START_TIME);
+
+      assert.ok(Math.abs(aligned.channels[1][index] - expected) < tolerance, 'x at ' + time + ' was ' + aligned.channels[1][index]);
+      assert.ok(Math.abs(aligned.channels[2][index] + expected) < tolerance, 'y at ' + time + ' was ' + aligned.channels[2][index]);
+      assert.strictEqual(aligned.channels[3][index], 1);
+    });
+  });
+});
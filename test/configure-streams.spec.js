@@ -0,0 +1,98 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+sim.describeSimulator('configureStreams diffing', function () {
+  var previousSettings;
+  var sensorId;
+  var ECG, PPG, ACC;
+
+  before(function () {
+    previousSettings = sim.useFastSettings({ sensorCount: 2 });
+    sim.stopAllSensors();
+
+    sensorId = sim.getFirstSensor().getSensorID();
+    ECG = hsl.Sensor.StreamFlags_ECGData;
+    PPG = hsl.Sensor.StreamFlags_PPGData;
+    ACC = hsl.Sensor.StreamFlags_AccData;
+  });
+
+  after(function () {
+    hsl.clearStreamPolicy();
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  beforeEach(function () {
+    hsl.configureStreams({ sensorId: 'all', data: 0, filters: 0 });
+  });
+
+  it('only calls into the sensor when its streams change', function () {
+    var results = hsl.configureStreams({ sensorId: sensorId, data: [ECG] });
+    assert.strictEqual(results.length, 1);
+    assert.strictEqual(results[0].sensorId, sensorId);
+    assert.strictEqual(results[0].data, sim.streamMask([ECG]));
+    assert.strictEqual(results[0].dataChanged, true);
+    assert.strictEqual(results[0].filtersChanged, false);
+    assert.strictEqual(results[0].success, true);
+
+    results = hsl.configureStreams({ sensorId: sensorId, data: sim.streamMask([ECG]) });
+    assert.strictEqual(results[0].data, sim.streamMask([ECG]));
+    assert.strictEqual(results[0].dataChanged, false);
+    assert.strictEqual(results[0].success, true);
+  });
+
+  it('applies enable and disable on top of the active streams', function () {
+    hsl.configureStreams({ sensorId: sensorId, data: [ECG] });
+
+    var results = hsl.configureStreams({ sensorId: sensorId, mode: 'enable', data: [ACC] });
+    assert.strictEqual(results[0].data, sim.streamMask([ECG, ACC]));
+    assert.strictEqual(results[0].dataChanged, true);
+
+    results = hsl.configureStreams({ sensorId: sensorId, mode: 'disable', data: [ECG] });
+    assert.strictEqual(results[0].data, sim.streamMask([ACC]));
+    assert.strictEqual(results[0].dataChanged, true);
+
+    // Disabling a stream that is already off changes nothing
+    results = hsl.configureStreams({ sensorId: sensorId, mode: 'disable', data: [PPG] });
+    assert.strictEqual(results[0].data, sim.streamMask([ACC]));
+    assert.strictEqual(results[0].dataChanged, false);
+  });
+
+  it('merges configs naming the same sensor into one call', function () {
+    var results = hsl.configureStreams([
+      { sensorId: sensorId, data: [ECG] },
+      { sensorId: sensorId, mode: 'enable', data: [PPG] },
+      { sensorId: sensorId, filters: [hsl.Sensor.HRVFilter_RMSSD] }
+    ]);
+
+    assert.strictEqual(results.length, 1);
+    assert.strictEqual(results[0].data, sim.streamMask([ECG, PPG]));
+    assert.strictEqual(results[0].filters, 1 << hsl.Sensor.HRVFilter_RMSSD);
+    assert.strictEqual(results[0].dataChanged, true);
+    assert.strictEqual(results[0].filtersChanged, true);
+  });
+
+  it('returns one result per sensor for "all"', function () {
+    var results = hsl.configureStreams({ sensorId: 'all', data: [ECG] });
+    var sensorIds = sim.getSensors().map(function (sensor) { return sensor.getSensorID(); });
+
+    assert.strictEqual(results.length, 2);
+    assert.deepStrictEqual(results.map(function (result) { return result.sensorId; }).sort(), sensorIds.sort());
+    results.forEach(function (result) {
+      assert.strictEqual(result.dataChanged, true);
+    });
+
+    results = hsl.configureStreams({ sensorId: 'all', data: [ECG] });
+    results.forEach(function (result) {
+      assert.strictEqual(result.dataChanged, false);
+    });
+  });
+
+  it('rejects unknown modes', function () {
+    assert.throws(function () {
+      hsl.configureStreams({ sensorId: sensorId, mode: 'toggle', data: [ECG] });
+    }, RangeError);
+  });
+});
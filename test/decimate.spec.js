@@ -0,0 +1,74 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+sim.describeSimulator('decimateSensorFrameBatch', function () {
+  this.timeout(10000);
+
+  var previousSettings;
+  var batch;
+
+  // A shallow copy of the batch with some of its fields replaced
+  function withFields(fields) {
+    return Object.assign({}, batch, fields);
+  }
+
+  before(function () {
+    previousSettings = sim.useFastSettings();
+    sim.stopAllSensors();
+
+    var sensor = sim.getFirstSensor();
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+    sim.runUpdates(300);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, false);
+
+    batch = sensor.drainECG();
+    assert.ok(batch != null && batch.sampleCount > 4);
+  });
+
+  after(function () {
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  it('keeps every step-th sample starting at the phase', function () {
+    var step = 3;
+    var phase = 1;
+    var decimated = hsl.decimateSensorFrameBatch(batch, step, phase);
+
+    var expected = Array.from(batch.samples).filter(function (value, index) {
+      return (phase + index) % step == 0;
+    });
+
+    assert.strictEqual(decimated.frameCount, batch.frameCount);
+    assert.strictEqual(decimated.sampleCount, expected.length);
+    assert.strictEqual(decimated.frameOffsets[decimated.frameCount], decimated.sampleCount);
+    assert.deepStrictEqual(Array.from(decimated.samples), expected);
+    assert.deepStrictEqual(Array.from(decimated.timeInSeconds), Array.from(batch.timeInSeconds));
+  });
+
+  it('rejects batches whose counts are not non-negative integers', function () {
+    [-1, 0.5, NaN].forEach(function (count) {
+      assert.throws(function () { hsl.decimateSensorFrameBatch(withFields({ frameCount: count }), 2, 0); }, RangeError);
+      assert.throws(function () { hsl.decimateSensorFrameBatch(withFields({ sampleCount: count }), 2, 0); }, RangeError);
+    });
+  });
+
+  it('rejects batches whose counts do not fit their buffer', function () {
+    // One extra sample could fit in the block's alignment padding, two never do
+    [batch.frameCount + 1, 0x7fffffff, Math.pow(2, 53)].forEach(function (count) {
+      assert.throws(function () { hsl.decimateSensorFrameBatch(withFields({ frameCount: count }), 2, 0); });
+    });
+    [batch.sampleCount + 2, 0x7fffffff, Math.pow(2, 53)].forEach(function (count) {
+      assert.throws(function () { hsl.decimateSensorFrameBatch(withFields({ sampleCount: count }), 2, 0); });
+    });
+  });
+
+  it('applies the same checks when encoding', function () {
+    assert.ok(hsl.encodeSensorFrameBatch(batch).length > 0);
+
+    assert.throws(function () { hsl.encodeSensorFrameBatch(withFields({ frameCount: -1 })); }, RangeError);
+    assert.throws(function () { hsl.encodeSensorFrameBatch(withFields({ sampleCount: Math.pow(2, 53) })); }, RangeError);
+  });
+});
@@ -0,0 +1,147 @@
+var assert = require('assert');
+var fs = require('fs');
+var sim = require('./helpers/simulator');
+var session = require('./helpers/session');
+
+var hsl = sim.hsl;
+
+// 20 seconds of a 1 Hz ECG sine with one spike up and one down
+var SAMPLE_RATE = 130;
+var START_TIME = 300;
+var SESSION_SECONDS = 20;
+var SAMPLE_COUNT = SESSION_SECONDS * SAMPLE_RATE;
+var FRAME_SAMPLES = 13;
+var MAX_SAMPLE = 1000;
+var MAX_VALUE = 2000;
+var MIN_SAMPLE = 1900;
+var MIN_VALUE = -1500;
+
+function createSignal() {
+  var values = [];
+
+  for (var i = 0; i < SAMPLE_COUNT; i++) {
+    values.push(
+      i == MAX_SAMPLE ? MAX_VALUE :
+      i == MIN_SAMPLE ? MIN_VALUE :
+      Math.round(500 * Math.sin(2 * Math.PI * i / SAMPLE_RATE)));
+  }
+
+  return values;
+}
+
+function getSampleTime(index) {
+  return START_TIME + index / SAMPLE_RATE;
+}
+
+// Index of the smallest or largest value, ignoring NaN
+function findExtreme(values, compare) {
+  var found = -1;
+
+  for (var i = 0; i < values.length; i++) {
+    if (!isNaN(values[i]) && (found < 0 || compare(values[i], values[found]))) found = i;
+  }
+
+  return found;
+}
+
+sim.describeSimulator('WaveformDownsampler', function () {
+  this.timeout(10000);
+
+  var sessionPath = session.getTempSessionPath('downsampler');
+  var downsampler = null;
+
+  before(function () {
+    session.writeSession(hsl, sessionPath, 6, [{
+      bufferType: hsl.BufferIterator.BufferType_ECGData,
+      frames: session.createWaveformFrames(START_TIME, SAMPLE_RATE, createSignal(), FRAME_SAMPLES)
+    }]);
+
+    var sensor = session.startSessionReplay(hsl, sessionPath, 1);
+    downsampler = new hsl.WaveformDownsampler(sensor.getSensorID(), hsl.BufferIterator.BufferType_ECGData, {
+      sampleRate: SAMPLE_RATE
+    });
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+
+    sim.updateUntil(function () { return hsl.isReplayFinished(); });
+    hsl.update();
+  });
+
+  after(function () {
+    if (downsampler != null) downsampler.close();
+    hsl.stopReplay();
+    if (fs.existsSync(sessionPath)) fs.unlinkSync(sessionPath);
+  });
+
+  it('keeps every sample of the session', function () {
+    var stats = downsampler.getStats();
+
+    assert.strictEqual(stats.sampleCount, SAMPLE_COUNT);
+    assert.ok(Math.abs(stats.oldestTime - START_TIME) < 1e-9);
+    assert.ok(Math.abs(stats.latestTime - getSampleTime(SAMPLE_COUNT - 1)) < 1e-9);
+    assert.ok(Math.abs(stats.sampleRate - SAMPLE_RATE) < 1e-6);
+  });
+
+  it('returns one envelope point per pixel with the extremes in place', function () {
+    [100, 1000].forEach(function (width) {
+      var envelope = downsampler.getEnvelope(width, SESSION_SECONDS);
+
+      assert.strictEqual(envelope.min.length, width);
+      assert.strictEqual(envelope.max.length, width);
+      assert.ok(Math.abs(envelope.pointSeconds - SESSION_SECONDS / width) < 1e-9);
+
+      for (var i = 0; i < width; i++) {
+        assert.ok(envelope.min[i] <= envelope.max[i], 'point ' + i);
+      }
+
+      // Each spike survives in the point covering its time
+      var maxPoint = findExtreme(envelope.max, function (a, b) { return a > b; });
+      var minPoint = findExtreme(envelope.min, function (a, b) { return a < b; });
+      assert.strictEqual(envelope.max[maxPoint], MAX_VALUE);
+      assert.strictEqual(envelope.min[minPoint], MIN_VALUE);
+      assert.strictEqual(maxPoint, Math.floor((getSampleTime(MAX_SAMPLE) - envelope.startTime) / envelope.pointSeconds));
+      assert.strictEqual(minPoint, Math.floor((getSampleTime(MIN_SAMPLE) - envelope.startTime) / envelope.pointSeconds));
+    });
+  });
+
+  it('leaves envelope points without samples as NaN', function () {
+    // Twice as many points as samples
+    var width = SAMPLE_COUNT * 2;
+    var envelope = downsampler.getEnvelope(width, SESSION_SECONDS);
+
+    var empty = Array.from(envelope.min).filter(function (value) { return isNaN(value); }).length;
+    assert.strictEqual(empty, width - SAMPLE_COUNT);
+  });
+
+  it('reduces to the requested LTTB point count and keeps the spikes', function () {
+    var pointCount = 200;
+    var lttb = downsampler.getLTTB(pointCount, SESSION_SECONDS);
+
+    assert.strictEqual(lttb.timeInSeconds.length, pointCount);
+    assert.strictEqual(lttb.values.length, pointCount);
+    for (var i = 1; i < pointCount; i++) {
+      assert.ok(lttb.timeInSeconds[i] > lttb.timeInSeconds[i - 1]);
+    }
+
+    // The ends are always kept
+    assert.ok(Math.abs(lttb.timeInSeconds[0] - START_TIME) < 1e-9);
+    assert.ok(Math.abs(lttb.timeInSeconds[pointCount - 1] - getSampleTime(SAMPLE_COUNT - 1)) < 1e-9);
+
+    var values = Array.from(lttb.values);
+    assert.strictEqual(Math.max.apply(null, values), MAX_VALUE);
+    assert.strictEqual(Math.min.apply(null, values), MIN_VALUE);
+  });
+
+  it('returns every sample when asked for more LTTB points than there are', function () {
+    var lttb = downsampler.getLTTB(SAMPLE_COUNT * 2, SESSION_SECONDS);
+
+    assert.strictEqual(lttb.values.length, SAMPLE_COUNT);
+    createSignal().forEach(function (value, index) {
+      assert.ok(lttb.values[index] == value, 'sample ' + index + ' was ' + lttb.values[index] + ', expected ' + value);
+    });
+  });
+
+  it('rejects empty queries', function () {
+    assert.throws(function () { downsampler.getEnvelope(0, SESSION_SECONDS); }, RangeError);
+    assert.throws(function () { downsampler.getLTTB(10, 0); }, RangeError);
+  });
+});
@@ -0,0 +1,136 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+// Checks the parts of the packed layout every drain* batch shares
+function assertPackedBatch(batch, buffer_type, sample_width) {
+  assert.ok(batch != null, 'expected a batch');
+  assert.strictEqual(batch.bufferType, buffer_type);
+  assert.strictEqual(batch.sampleWidth, sample_width);
+  assert.ok(batch.frameCount > 0);
+
+  // One ArrayBuffer behind every view, starting with the frame times
+  assert.ok(batch.timeInSeconds instanceof Float64Array);
+  assert.strictEqual(batch.timeInSeconds.byteOffset, 0);
+  assert.strictEqual(batch.frameOffsets.buffer, batch.timeInSeconds.buffer);
+  assert.strictEqual(batch.samples.buffer, batch.timeInSeconds.buffer);
+
+  assert.strictEqual(batch.timeInSeconds.length, batch.frameCount);
+  assert.strictEqual(batch.frameOffsets.length, batch.frameCount + 1);
+  assert.strictEqual(batch.frameOffsets[0], 0);
+  assert.strictEqual(batch.frameOffsets[batch.frameCount], batch.sampleCount);
+  assert.strictEqual(batch.samples.length, batch.sampleCount * sample_width);
+
+  for (var i = 1; i < batch.frameCount; i++) {
+    assert.ok(batch.timeInSeconds[i] >= batch.timeInSeconds[i - 1], 'frame times out of order');
+    assert.ok(batch.frameOffsets[i] >= batch.frameOffsets[i - 1], 'frame offsets out of order');
+  }
+}
+
+sim.describeSimulator('drain* packed layouts', function () {
+  this.timeout(10000);
+
+  var previousSettings;
+  var sensor;
+
+  before(function () {
+    previousSettings = sim.useFastSettings();
+    sim.stopAllSensors();
+
+    sensor = sim.getFirstSensor();
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_HRData, true);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_PPGData, true);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_AccData, true);
+  });
+
+  after(function () {
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  beforeEach(function () {
+    sim.runUpdates(300);
+  });
+
+  it('packs ECG frames in the order the buffer iterator walks them', function () {
+    var times = [];
+    var values = [];
+    for (var it = sensor.getHeartECGBuffer(); it.isValid(); it.next()) {
+      var frame = it.getECGData();
+      times.push(frame.timeInSeconds);
+      values.push(Array.from(frame.ecgValues));
+    }
+
+    var batch = sensor.drainECG();
+    assertPackedBatch(batch, hsl.BufferIterator.BufferType_ECGData, 1);
+    assert.ok(batch.samples instanceof Int32Array);
+    assert.strictEqual(batch.planar, false);
+    assert.deepStrictEqual(Array.from(batch.timeInSeconds), times);
+
+    for (var i = 0; i < batch.frameCount; i++) {
+      var frameSamples = Array.from(batch.samples.subarray(batch.frameOffsets[i], batch.frameOffsets[i + 1]));
+
+      // The iterator hands ECG values out as unsigned
+      assert.deepStrictEqual(frameSamples.map(function (value) { return value >>> 0; }), values[i]);
+    }
+  });
+
+  it('flushes the buffer it drained', function () {
+    assert.ok(sensor.drainECG() != null);
+    assert.strictEqual(sensor.drainECG(), null);
+    assert.strictEqual(sensor.getHeartECGBuffer().isValid(), false);
+  });
+
+  it('adds the per frame HR columns', function () {
+    var batch = sensor.drainHR();
+    assertPackedBatch(batch, hsl.BufferIterator.BufferType_HRData, 1);
+
+    ['beatsPerMinute', 'contactStatus', 'energyExpended'].forEach(function (column) {
+      assert.ok(batch[column] instanceof Int32Array, column);
+      assert.strictEqual(batch[column].length, batch.frameCount, column);
+      assert.strictEqual(batch[column].buffer, batch.samples.buffer, column);
+    });
+
+    for (var i = 0; i < batch.frameCount; i++) {
+      assert.ok(batch.beatsPerMinute[i] > 0);
+    }
+  });
+
+  it('interleaves PPG channels unless asked for planar columns', function () {
+    var batch = sensor.drainPPG();
+    assertPackedBatch(batch, hsl.BufferIterator.BufferType_PPGData, 4);
+    assert.strictEqual(batch.planar, false);
+    assert.strictEqual(batch.ppgValue0, undefined);
+  });
+
+  it('adds a named view per PPG channel to planar batches', function () {
+    var batch = sensor.drainPPG(true);
+    assertPackedBatch(batch, hsl.BufferIterator.BufferType_PPGData, 4);
+    assert.strictEqual(batch.planar, true);
+
+    ['ppgValue0', 'ppgValue1', 'ppgValue2', 'ambient'].forEach(function (channel, index) {
+      var column = batch[channel];
+
+      assert.ok(column instanceof Int32Array, channel);
+      assert.strictEqual(column.length, batch.sampleCount, channel);
+      assert.strictEqual(column.buffer, batch.samples.buffer, channel);
+      assert.deepStrictEqual(
+        Array.from(column),
+        Array.from(batch.samples.subarray(index * batch.sampleCount, (index + 1) * batch.sampleCount)),
+        channel);
+    });
+  });
+
+  it('packs accelerometer samples as floats', function () {
+    var batch = sensor.drainAcc(true);
+    assertPackedBatch(batch, hsl.BufferIterator.BufferType_AccData, 3);
+    assert.ok(batch.samples instanceof Float32Array);
+
+    ['x', 'y', 'z'].forEach(function (channel) {
+      assert.ok(batch[channel] instanceof Float32Array, channel);
+      assert.strictEqual(batch[channel].length, batch.sampleCount, channel);
+    });
+  });
+});
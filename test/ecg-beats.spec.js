@@ -0,0 +1,110 @@
+var assert = require('assert');
+var fs = require('fs');
+var sim = require('./helpers/simulator');
+var session = require('./helpers/session');
+
+var hsl = sim.hsl;
+
+// 30 seconds of ECG at 75 bpm, so every R peak lands on a sample at 130 Hz
+var SAMPLE_RATE = 130;
+var BEAT_SECONDS = 0.8;
+var START_TIME = 500;
+var SESSION_SECONDS = 30;
+var FRAME_SAMPLES = 73;
+
+function gaussian(t, center, width, amplitude) {
+  return amplitude * Math.exp(-0.5 * Math.pow((t - center) / width, 2));
+}
+
+// P, Q, R, S and T waves in microvolts, on a slow baseline wander
+function createECG() {
+  var ecg = { values: [], rPeaks: [] };
+
+  for (var beat = BEAT_SECONDS / 2; beat < SESSION_SECONDS; beat += BEAT_SECONDS) {
+    ecg.rPeaks.push(START_TIME + beat);
+  }
+
+  for (var i = 0; i < SESSION_SECONDS * SAMPLE_RATE; i++) {
+    var t = i / SAMPLE_RATE;
+    var phase = (t % BEAT_SECONDS) - BEAT_SECONDS / 2;
+    var value =
+      gaussian(phase, -0.16, 0.025, 100) +
+      gaussian(phase, -0.03, 0.01, -100) +
+      gaussian(phase, 0, 0.012, 1200) +
+      gaussian(phase, 0.03, 0.01, -250) +
+      gaussian(phase, 0.25, 0.04, 300) +
+      50 * Math.sin(2 * Math.PI * 0.3 * t);
+
+    ecg.values.push(Math.round(value));
+  }
+
+  return ecg;
+}
+
+sim.describeSimulator('ECGBeatDetector', function () {
+  this.timeout(10000);
+
+  var sessionPath = session.getTempSessionPath('ecg-beats');
+  var ecg = createECG();
+  var detector = null;
+  var beats = { timeInSeconds: [], rrIntervals: [], flags: [] };
+
+  function collectBeats(batch) {
+    if (batch == null) return;
+
+    beats.timeInSeconds.push.apply(beats.timeInSeconds, Array.from(batch.timeInSeconds));
+    beats.rrIntervals.push.apply(beats.rrIntervals, Array.from(batch.rrIntervals));
+    beats.flags.push.apply(beats.flags, Array.from(batch.flags));
+  }
+
+  before(function () {
+    session.writeSession(hsl, sessionPath, 3, [{
+      bufferType: hsl.BufferIterator.BufferType_ECGData,
+      frames: session.createWaveformFrames(START_TIME, SAMPLE_RATE, ecg.values, FRAME_SAMPLES)
+    }]);
+
+    var sensor = session.startSessionReplay(hsl, sessionPath, 0.5);
+    detector = new hsl.ECGBeatDetector(sensor.getSensorID(), { sampleRate: SAMPLE_RATE });
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+
+    sim.updateUntil(function () {
+      collectBeats(detector.drainBeats());
+      sensor.flushHeartECGBuffer();
+      return hsl.isReplayFinished();
+    });
+    hsl.update();
+    collectBeats(detector.drainBeats());
+  });
+
+  after(function () {
+    if (detector != null) detector.close();
+    hsl.stopReplay();
+    if (fs.existsSync(sessionPath)) fs.unlinkSync(sessionPath);
+  });
+
+  it('finds every R peak once its learning period is over', function () {
+    // The first 2 seconds only seed the thresholds
+    assert.ok(beats.timeInSeconds.length >= ecg.rPeaks.length - 3, 'found ' + beats.timeInSeconds.length + ' beats');
+    assert.ok(beats.timeInSeconds.length <= ecg.rPeaks.length);
+    assert.strictEqual(detector.getStats().searchbackBeats, 0);
+
+    beats.timeInSeconds.forEach(function (time) {
+      var nearest = ecg.rPeaks.reduce(function (best, peak) {
+        return Math.abs(peak - time) < Math.abs(best - time) ? peak : best;
+      });
+
+      assert.ok(Math.abs(nearest - time) < 0.5 / SAMPLE_RATE, 'beat at ' + time + ' is not on an R peak');
+    });
+  });
+
+  it('reports the RR interval of the heart rate', function () {
+    assert.strictEqual(beats.rrIntervals[0], 0);
+    assert.strictEqual(beats.flags[0] & hsl.ECGBeatDetector.BeatFlag_AfterGap, hsl.ECGBeatDetector.BeatFlag_AfterGap);
+
+    // One R peak after another, none missed and none doubled
+    for (var i = 1; i < beats.rrIntervals.length; i++) {
+      assert.ok(Math.abs(beats.rrIntervals[i] - BEAT_SECONDS * 1000) <= 1000 / SAMPLE_RATE, 'RR interval ' + beats.rrIntervals[i]);
+      assert.strictEqual(beats.flags[i], 0);
+    }
+  });
+});
@@ -0,0 +1,170 @@
+var assert = require('assert');
+var fs = require('fs');
+var sim = require('./helpers/simulator');
+var session = require('./helpers/session');
+
+var hsl = sim.hsl;
+
+// 8 seconds of ECG: silence, an impulse 2 seconds in, then a step from 4 seconds on
+var SAMPLE_RATE = 130;
+var START_TIME = 200;
+var SAMPLE_COUNT = 8 * SAMPLE_RATE;
+var IMPULSE_SAMPLE = 2 * SAMPLE_RATE;
+var STEP_SAMPLE = 4 * SAMPLE_RATE;
+var AMPLITUDE = 1000;
+var FRAME_SAMPLES = 13;
+
+var FIR_TAPS = [0.5, 0.3, 0.2];
+var LOWPASS_FREQUENCY = 10;
+
+function createSignal() {
+  var values = [];
+
+  for (var i = 0; i < SAMPLE_COUNT; i++) {
+    values.push(i == IMPULSE_SAMPLE || i >= STEP_SAMPLE ? AMPLITUDE : 0);
+  }
+
+  return values;
+}
+
+// RBJ cookbook lowpass in direct form I, starting from rest
+function filterLowpass(values, frequency, q) {
+  var w0 = 2 * Math.PI * frequency / SAMPLE_RATE;
+  var alpha = Math.sin(w0) / (2 * q);
+  var a0 = 1 + alpha;
+  var b0 = (1 - Math.cos(w0)) / 2 / a0;
+  var b1 = (1 - Math.cos(w0)) / a0;
+  var a1 = -2 * Math.cos(w0) / a0;
+  var a2 = (1 - alpha) / a0;
+  var x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+
+  return values.map(function (x) {
+    var y = b0 * x + b1 * x1 + b0 * x2 - a1 * y1 - a2 * y2;
+    x2 = x1; x1 = x;
+    y2 = y1; y1 = y;
+    return y;
+  });
+}
+
+function assertAllWithin(actual, expected, tolerance, name) {
+  assert.strictEqual(actual.length, expected.length, name + ' sample count');
+  actual.forEach(function (value, index) {
+    assert.ok(Math.abs(value - expected[index]) <= tolerance, name + '[' + index + '] was ' + value + ', expected ' + expected[index]);
+  });
+}
+
+sim.describeSimulator('SensorFilterGraph', function () {
+  this.timeout(10000);
+
+  var sessionPath = session.getTempSessionPath('filter-graph');
+  var signal = createSignal();
+  var sensor = null;
+  var graphs = [];
+
+  function openGraph(stages) {
+    var graph = new hsl.SensorFilterGraph(sensor.getSensorID(), hsl.BufferIterator.BufferType_ECGData, stages, {
+      sampleRate: SAMPLE_RATE
+    });
+    graphs.push(graph);
+
+    return graph;
+  }
+
+  // Everything the graph has buffered, as plain arrays
+  function readAll(graph) {
+    var output = { timeInSeconds: [], raw: [], values: [] };
+
+    for (var block = graph.read(); block != null; block = graph.read()) {
+      output.timeInSeconds.push.apply(output.timeInSeconds, Array.from(block.timeInSeconds));
+      output.raw.push.apply(output.raw, Array.from(block.raw));
+      output.values.push.apply(output.values, Array.from(block.values));
+    }
+
+    return output;
+  }
+
+  function replayToEnd() {
+    sim.updateUntil(function () { return hsl.isReplayFinished(); });
+    hsl.update();
+  }
+
+  before(function () {
+    session.writeSession(hsl, sessionPath, 5, [{
+      bufferType: hsl.BufferIterator.BufferType_ECGData,
+      frames: session.createWaveformFrames(START_TIME, SAMPLE_RATE, signal, FRAME_SAMPLES)
+    }]);
+
+    sensor = session.startSessionReplay(hsl, sessionPath, 0.5);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+  });
+
+  after(function () {
+    graphs.forEach(function (graph) { graph.close(); });
+    hsl.stopReplay();
+    if (fs.existsSync(sessionPath)) fs.unlinkSync(sessionPath);
+  });
+
+  beforeEach(function () {
+    hsl.seekReplay(START_TIME);
+  });
+
+  it('rejects invalid stages', function () {
+    assert.throws(function () { openGraph([{ type: 'lowpass', frequency: SAMPLE_RATE }]); }, RangeError);
+    assert.throws(function () { openGraph([{ type: 'fir', taps: [] }]); }, RangeError);
+  });
+
+  it('answers an impulse and a step with its FIR taps', function () {
+    var graph = openGraph([{ type: 'fir', taps: FIR_TAPS }]);
+    replayToEnd();
+
+    var output = readAll(graph);
+    assert.deepStrictEqual(output.raw, signal);
+
+    var impulse = output.values.slice(IMPULSE_SAMPLE - 1, IMPULSE_SAMPLE + FIR_TAPS.length + 1);
+    assertAllWithin(impulse, [0].concat(FIR_TAPS.map(function (tap) { return tap * AMPLITUDE; }), [0]), 1e-3, 'impulse');
+
+    var step = output.values.slice(STEP_SAMPLE, STEP_SAMPLE + FIR_TAPS.length);
+    assertAllWithin(step, [0.5, 0.8, 1].map(function (sum) { return sum * AMPLITUDE; }), 1e-3, 'step');
+    assert.ok(Math.abs(output.values[SAMPLE_COUNT - 1] - AMPLITUDE) < 1e-3);
+  });
+
+  it('matches the cookbook biquad response', function () {
+    var graph = openGraph([{ type: 'lowpass', frequency: LOWPASS_FREQUENCY }]);
+    replayToEnd();
+
+    // Float32 output of a double precision filter
+    var output = readAll(graph);
+    assertAllWithin(output.values, filterLowpass(signal, LOWPASS_FREQUENCY, Math.SQRT1_2), 1e-3, 'lowpass');
+
+    // Unity gain at DC
+    assert.ok(Math.abs(output.values[SAMPLE_COUNT - 1] - AMPLITUDE) < 1e-3);
+
+    var stats = graph.getStats();
+    assert.strictEqual(stats.processedSamples, SAMPLE_COUNT);
+    assert.strictEqual(stats.droppedSamples, 0);
+    assert.strictEqual(stats.stageCount, 1);
+  });
+
+  it('resets the filter state when time goes backwards', function () {
+    var fir = openGraph([{ type: 'fir', taps: FIR_TAPS }]);
+    var lowpass = openGraph([{ type: 'lowpass', frequency: LOWPASS_FREQUENCY }]);
+    replayToEnd();
+
+    // Both end the session settled on the step
+    var lastTime = readAll(fir).timeInSeconds.pop();
+    readAll(lowpass);
+
+    // Seeking back to the silence at the start replays it through filters that start from rest
+    hsl.seekReplay(START_TIME);
+    sim.updateUntil(function () { return fir.getStats().pendingSamples >= SAMPLE_RATE; });
+
+    [fir, lowpass].forEach(function (graph) {
+      var output = readAll(graph);
+
+      assert.ok(output.timeInSeconds[0] < lastTime - 1);
+      output.values.forEach(function (value, index) {
+        assert.strictEqual(value, 0, 'sample ' + index + ' after the rewind');
+      });
+    });
+  });
+});
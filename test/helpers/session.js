@@ -0,0 +1,168 @@
+// Writes session files (layout in src/SessionFormat.h) holding signals a spec knows exactly,
+// for replaying through hsl.startReplay where the simulator's randomized streams won't do.
+// Files have no index or footer; the reader rebuilds the index by walking the chunks.
+
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+
+var FILE_HEADER_BYTES = 32;
+var CHUNK_HEADER_BYTES = 16;
+var SENSOR_INFO_BYTES = 968;
+var FRAMES_HEADER_BYTES = 48;
+var FRIENDLY_NAME_OFFSET = 72;
+
+var Chunk_Sensor = 1;
+var Chunk_Frames = 2;
+
+function alignUp(offset, alignment) {
+  return Math.ceil(offset / alignment) * alignment;
+}
+
+// Values below 2^53 only, which covers every count and size a spec writes
+function writeUInt64(buffer, value, offset) {
+  buffer.writeUInt32LE(value % 0x100000000, offset);
+  buffer.writeUInt32LE(Math.floor(value / 0x100000000), offset + 4);
+}
+
+// Sample width, per frame value columns and sample type of a buffer type, see GetSensorBufferFormat
+function getBufferFormat(hsl, buffer_type) {
+  var BufferIterator = hsl.BufferIterator;
+
+  if (buffer_type == BufferIterator.BufferType_HRData) return { sampleWidth: 1, frameValueWidth: 3, floatSamples: false };
+  if (buffer_type == BufferIterator.BufferType_ECGData) return { sampleWidth: 1, frameValueWidth: 0, floatSamples: false };
+  if (buffer_type == BufferIterator.BufferType_PPGData) return { sampleWidth: 4, frameValueWidth: 0, floatSamples: false };
+  if (buffer_type == BufferIterator.BufferType_PPIData) return { sampleWidth: 4, frameValueWidth: 0, floatSamples: false };
+  if (buffer_type == BufferIterator.BufferType_AccData) return { sampleWidth: 3, frameValueWidth: 0, floatSamples: true };
+
+  throw new Error('No packed format for buffer type ' + buffer_type);
+}
+
+function createChunk(type, payload) {
+  var chunk = Buffer.alloc(CHUNK_HEADER_BYTES + alignUp(payload.length, 8));
+
+  chunk.writeUInt32LE(type, 0);
+  writeUInt64(chunk, payload.length, 8);
+  payload.copy(chunk, CHUNK_HEADER_BYTES);
+
+  return chunk;
+}
+
+function createSensorChunk(sensor_id, capabilities) {
+  var payload = Buffer.alloc(SENSOR_INFO_BYTES);
+
+  payload.writeInt32LE(sensor_id, 0);
+  payload.writeUInt32LE(capabilities, 4);
+  payload.write('Session Sensor ' + sensor_id, FRIENDLY_NAME_OFFSET, 127, 'latin1');
+
+  return createChunk(Chunk_Sensor, payload);
+}
+
+// frames are {timeInSeconds, samples, frameValues}; samples are interleaved and frameValues is
+// one value per column (HR: beats per minute, contact status, energy expended)
+function createFramesChunk(hsl, sensor_id, stream) {
+  var format = getBufferFormat(hsl, stream.bufferType);
+  var frames = stream.frames;
+  var frameCount = frames.length;
+  var sampleCount = frames.reduce(function (count, frame) { return count + frame.samples.length / format.sampleWidth; }, 0);
+
+  // Same block as SensorFrameLayout
+  var frameOffsetsOffset = frameCount * 8;
+  var frameValuesOffset = frameOffsetsOffset + (frameCount + 1) * 4;
+  var samplesOffset = frameValuesOffset + frameCount * format.frameValueWidth * 4;
+  var byteLength = alignUp(samplesOffset + sampleCount * format.sampleWidth * 4, 8);
+
+  var payload = Buffer.alloc(FRAMES_HEADER_BYTES + byteLength);
+  payload.writeInt32LE(sensor_id, 0);
+  payload.writeUInt32LE(stream.bufferType, 4);
+  payload.writeUInt32LE(0, 8);
+  payload.writeUInt32LE(frameCount, 12);
+  writeUInt64(payload, sampleCount, 16);
+  payload.writeDoubleLE(frames[0].timeInSeconds, 24);
+  payload.writeDoubleLE(frames[frameCount - 1].timeInSeconds, 32);
+  writeUInt64(payload, byteLength, 40);
+
+  var block = payload.subarray(FRAMES_HEADER_BYTES);
+  var sampleIndex = 0;
+
+  frames.forEach(function (frame, index) {
+    block.writeDoubleLE(frame.timeInSeconds, index * 8);
+    block.writeUInt32LE(sampleIndex / format.sampleWidth, frameOffsetsOffset + index * 4);
+
+    for (var column = 0; column < format.frameValueWidth; column++) {
+      block.writeInt32LE((frame.frameValues || [])[column] || 0, frameValuesOffset + (column * frameCount + index) * 4);
+    }
+
+    frame.samples.forEach(function (value) {
+      if (format.floatSamples) {
+        block.writeFloatLE(value, samplesOffset + sampleIndex * 4);
+      } else {
+        block.writeInt32LE(value, samplesOffset + sampleIndex * 4);
+      }
+      sampleIndex++;
+    });
+  });
+  block.writeUInt32LE(sampleCount, frameOffsetsOffset + frameCount * 4);
+
+  return createChunk(Chunk_Frames, payload);
+}
+
+// Writes one sensor's streams, [{bufferType, frames}], to file_path. The sensor can turn on
+// exactly the streams written.
+function writeSession(hsl, file_path, sensor_id, streams) {
+  var header = Buffer.alloc(FILE_HEADER_BYTES);
+  header.write('HSLSESS', 0, 'latin1');
+  header.writeUInt32LE(1, 8);
+  header.writeUInt32LE(FILE_HEADER_BYTES, 12);
+  header.writeDoubleLE(Date.now() / 1000, 16);
+
+  // The first stream flags line up with the buffer types
+  var capabilities = streams.reduce(function (mask, stream) { return mask | (1 << stream.bufferType); }, 0);
+  var chunks = [header, createSensorChunk(sensor_id, capabilities)];
+
+  streams.forEach(function (stream) {
+    chunks.push(createFramesChunk(hsl, sensor_id, stream));
+  });
+
+  fs.writeFileSync(file_path, Buffer.concat(chunks));
+}
+
+// Splits evenly spaced samples into frames of frame_size samples, each frame timed at its last sample.
+// values holds sample_width (default 1) interleaved values per sample, e.g. 3 for Acc.
+function createWaveformFrames(start_time, sample_rate, values, frame_size, sample_width) {
+  var width = sample_width || 1;
+  var frames = [];
+
+  for (var first = 0; first < values.length / width; first += frame_size) {
+    var samples = values.slice(first * width, (first + frame_size) * width);
+
+    frames.push({
+      timeInSeconds: start_time + (first + samples.length / width - 1) / sample_rate,
+      samples: samples
+    });
+  }
+
+  return frames;
+}
+
+function getTempSessionPath(name) {
+  return path.join(os.tmpdir(), 'hsl-' + name + '-' + process.pid + '.hslsession');
+}
+
+// Starts a non realtime replay of file_path and returns its only sensor
+function startSessionReplay(hsl, file_path, step_seconds) {
+  hsl.startReplay(file_path, { realtime: false, stepSeconds: step_seconds || 0.1 });
+  hsl.update();
+
+  var sensorList = hsl.getSensorList();
+  if (sensorList.getSensorCount() != 1) throw new Error('Expected one sensor in ' + file_path);
+
+  return sensorList.getSensor(0);
+}
+
+module.exports = {
+  writeSession: writeSession,
+  createWaveformFrames: createWaveformFrames,
+  getTempSessionPath: getTempSessionPath,
+  startSessionReplay: startSessionReplay
+};
@@ -0,0 +1,129 @@
+// Shared setup for the specs, which run against the simulator build (npm run build:sim).
+// A missing or non-simulator addon fails the run, so a broken build can't pass as green.
+// Set HSL_TEST_SKIP_NATIVE=1 to skip the native specs instead.
+
+var hsl = null;
+var loadError = null;
+try {
+  hsl = require('../..');
+}
+catch (e) {
+  loadError = e;
+}
+
+var isAvailable = hsl != null && hsl.isSimulator === true;
+
+if (!isAvailable && process.env.HSL_TEST_SKIP_NATIVE !== '1') {
+  throw new Error(
+    (hsl == null ? 'The addon failed to load: ' + loadError.message : 'The addon is not a simulator build') +
+    '. Run "npm run build:sim" first, or set HSL_TEST_SKIP_NATIVE=1 to skip the native specs.');
+}
+
+// Fast enough that every stream has frames within a few hundred milliseconds
+var FAST_SETTINGS = {
+  sensorCount: 1,
+  capabilities: 0x1f,
+  ecgSampleRate: 1300,
+  ppgSampleRate: 1350,
+  accSampleRate: 500,
+  hrFrameRate: 20,
+  ppiSamplesPerFrame: 5,
+  heartRate: 65,
+  frameJitterMs: 0
+};
+
+// describe() when the simulator build is loaded, describe.skip() when HSL_TEST_SKIP_NATIVE opted out
+function describeSimulator(title, fn) {
+  return isAvailable ? describe(title, fn) : describe.skip(title, fn);
+}
+
+function sleepMs(ms) {
+  Atomics.wait(new Int32Array(new SharedArrayBuffer(4)), 0, 0, ms);
+}
+
+// Runs the update loop for ms milliseconds, calling tick_fn after every update
+function runUpdates(ms, tick_fn) {
+  var end = Date.now() + ms;
+
+  while (Date.now() < end) {
+    hsl.update();
+    if (tick_fn) tick_fn();
+    sleepMs(10);
+  }
+}
+
+// Runs the update loop until predicate_fn returns true, or throws after timeout_ms
+function updateUntil(predicate_fn, timeout_ms) {
+  var end = Date.now() + (timeout_ms || 3000);
+
+  while (Date.now() < end) {
+    hsl.update();
+    if (predicate_fn()) return;
+    sleepMs(10);
+  }
+
+  throw new Error('Timed out waiting for the simulator');
+}
+
+function getSensors() {
+  var sensorList = hsl.getSensorList();
+  var sensors = [];
+
+  for (var i = 0; i < sensorList.getSensorCount(); i++) {
+    var sensor = sensorList.getSensor(i);
+    if (sensor != null) sensors.push(sensor);
+  }
+
+  return sensors;
+}
+
+function getFirstSensor() {
+  hsl.update();
+
+  var sensors = getSensors();
+  if (sensors.length == 0) throw new Error('The simulator has no sensors');
+
+  return sensors[0];
+}
+
+// Applies FAST_SETTINGS plus overrides and returns the settings to restore afterwards
+function useFastSettings(overrides) {
+  var previous = hsl.getSimulatorSettings();
+  var settings = Object.assign({}, FAST_SETTINGS, overrides || {});
+
+  hsl.setSimulatorSettings(settings);
+  hsl.update();
+
+  return previous;
+}
+
+function streamMask(flags) {
+  return flags.reduce(function (mask, flag) { return mask | (1 << flag); }, 0);
+}
+
+// Turns every stream of every sensor off and empties their buffers
+function stopAllSensors() {
+  getSensors().forEach(function (sensor) {
+    sensor.stopAllStreams();
+    sensor.flushHeartRateBuffer();
+    sensor.flushHeartECGBuffer();
+    sensor.flushHeartPPGBuffer();
+    sensor.flushHeartPPIBuffer();
+    sensor.flushHeartAccBuffer();
+    sensor.flushHeartHrvBuffer(hsl.Sensor.HRVFilter_SDNN);
+  });
+}
+
+module.exports = {
+  hsl: hsl,
+  isAvailable: isAvailable,
+  describeSimulator: describeSimulator,
+  sleepMs: sleepMs,
+  runUpdates: runUpdates,
+  updateUntil: updateUntil,
+  getSensors: getSensors,
+  getFirstSensor: getFirstSensor,
+  useFastSettings: useFastSettings,
+  streamMask: streamMask,
+  stopAllSensors: stopAllSensors
+};
@@ -0,0 +1,91 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+sim.describeSimulator('HistoryStore.getRange', function () {
+  this.timeout(10000);
+
+  var ECG = hsl.BufferIterator.BufferType_ECGData;
+  var previousSettings;
+  var sensorId;
+  var store = null;
+  var history;
+
+  before(function () {
+    previousSettings = sim.useFastSettings();
+    sim.stopAllSensors();
+
+    var sensor = sim.getFirstSensor();
+    sensorId = sensor.getSensorID();
+
+    store = new hsl.HistoryStore({ rawSeconds: 60 });
+    assert.strictEqual(store.track(sensorId, ECG), true);
+
+    // Long enough to span a second bucket boundary
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+    sim.runUpdates(1500);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, false);
+
+    history = store.getStats().streams[0];
+  });
+
+  after(function () {
+    if (store != null) store.close();
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  it('records the tracked stream', function () {
+    assert.strictEqual(history.sensorId, sensorId);
+    assert.strictEqual(history.bufferType, ECG);
+    assert.ok(history.rawFrameCount > 0);
+    assert.ok(history.latestTime > history.oldestRawTime);
+  });
+
+  it('returns the raw frames of a range as a packed batch', function () {
+    var all = store.getRange(sensorId, ECG, history.oldestRawTime, history.latestTime + 1, hsl.HistoryStore.Resolution_Raw);
+    assert.strictEqual(all.resolution, hsl.HistoryStore.Resolution_Raw);
+    assert.strictEqual(all.frameCount, history.rawFrameCount);
+    assert.strictEqual(all.frameOffsets[all.frameCount], all.sampleCount);
+
+    // [t0, t1) takes the frames from t0 up to, but not including, t1
+    var first = Math.floor(all.frameCount / 4);
+    var last = Math.floor(all.frameCount * 3 / 4);
+    var part = store.getRange(
+      sensorId, ECG, all.timeInSeconds[first], all.timeInSeconds[last], hsl.HistoryStore.Resolution_Raw);
+
+    assert.strictEqual(part.frameCount, last - first);
+    assert.deepStrictEqual(Array.from(part.timeInSeconds), Array.from(all.timeInSeconds.subarray(first, last)));
+  });
+
+  it('aggregates every sample into per second buckets', function () {
+    var raw = store.getRange(sensorId, ECG, history.oldestRawTime, history.latestTime + 1, hsl.HistoryStore.Resolution_Raw);
+    var seconds = store.getRange(sensorId, ECG, history.oldestRawTime, history.latestTime + 1, hsl.HistoryStore.Resolution_Second);
+
+    assert.strictEqual(seconds.resolution, hsl.HistoryStore.Resolution_Second);
+    assert.strictEqual(seconds.bucketSeconds, 1);
+    assert.strictEqual(seconds.channels, 1);
+    assert.ok(seconds.timeInSeconds.length >= 2);
+    assert.strictEqual(seconds.count.length, seconds.timeInSeconds.length);
+    assert.strictEqual(seconds.mean.length, seconds.timeInSeconds.length * seconds.channels);
+
+    var sampleCount = 0;
+    for (var i = 0; i < seconds.count.length; i++) {
+      sampleCount += seconds.count[i];
+
+      if (i > 0) assert.strictEqual(seconds.timeInSeconds[i] - seconds.timeInSeconds[i - 1], 1);
+      assert.ok(seconds.min[i] <= seconds.mean[i] + 1e-3 && seconds.mean[i] <= seconds.max[i] + 1e-3);
+    }
+    assert.strictEqual(sampleCount, raw.sampleCount);
+  });
+
+  it('picks the raw resolution while raw frames reach back far enough', function () {
+    var auto = store.getRange(sensorId, ECG, history.oldestRawTime, history.latestTime + 1);
+    assert.strictEqual(auto.resolution, hsl.HistoryStore.Resolution_Raw);
+  });
+
+  it('returns null for streams it does not track', function () {
+    assert.strictEqual(store.getRange(sensorId, hsl.BufferIterator.BufferType_PPGData, 0, 1e9), null);
+  });
+});
@@ -0,0 +1,111 @@
+var assert = require('assert');
+var fs = require('fs');
+var sim = require('./helpers/simulator');
+var session = require('./helpers/session');
+
+var hsl = sim.hsl;
+
+// RR intervals around 800 ms (75 bpm), modulated at 0.1 Hz in the LF band and 0.25 Hz in the HF band.
+// A sinusoid of amplitude A adds A^2 / 2 ms^2 to its band.
+var LF_AMPLITUDE = 40;
+var HF_AMPLITUDE = 20;
+var SESSION_SECONDS = 180;
+
+function createBeats() {
+  var beats = { timeInSeconds: [], rrIntervals: [] };
+  var time = 1000;
+
+  while (time < 1000 + SESSION_SECONDS) {
+    var rrInterval = Math.round(
+      800 +
+      LF_AMPLITUDE * Math.sin(2 * Math.PI * 0.1 * time) +
+      HF_AMPLITUDE * Math.sin(2 * Math.PI * 0.25 * time));
+
+    time += rrInterval / 1000;
+    beats.timeInSeconds.push(time);
+    beats.rrIntervals.push(rrInterval);
+  }
+
+  return beats;
+}
+
+function assertWithin(actual, expected, tolerance, name) {
+  assert.ok(Math.abs(actual - expected) <= tolerance, name + ' was ' + actual + ', expected ' + expected + ' +/- ' + tolerance);
+}
+
+sim.describeSimulator('HRVAnalyzer', function () {
+  this.timeout(10000);
+
+  var sessionPath = session.getTempSessionPath('hrv');
+  var beats = createBeats();
+  var analyzer = null;
+  var metrics;
+
+  before(function () {
+    // One HR frame per beat, timed at the end of its interval
+    session.writeSession(hsl, sessionPath, 7, [{
+      bufferType: hsl.BufferIterator.BufferType_HRData,
+      frames: beats.rrIntervals.map(function (rrInterval, index) {
+        return {
+          timeInSeconds: beats.timeInSeconds[index],
+          samples: [rrInterval],
+          frameValues: [Math.round(60000 / rrInterval), 0, 0]
+        };
+      })
+    }]);
+
+    var sensor = session.startSessionReplay(hsl, sessionPath, 5);
+    analyzer = new hsl.HRVAnalyzer(sensor.getSensorID(), { windowSeconds: 300 });
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_HRData, true);
+
+    sim.updateUntil(function () { return hsl.isReplayFinished(); });
+    hsl.update();
+
+    metrics = analyzer.getMetrics();
+  });
+
+  after(function () {
+    if (analyzer != null) analyzer.close();
+    hsl.stopReplay();
+    if (fs.existsSync(sessionPath)) fs.unlinkSync(sessionPath);
+  });
+
+  it('takes every beat into the window', function () {
+    var stats = analyzer.getStats();
+    assert.strictEqual(stats.acceptedBeats, beats.rrIntervals.length);
+    assert.strictEqual(stats.rejectedBeats, 0);
+    assert.strictEqual(metrics[hsl.HRVAnalyzer.Metric_BeatCount], beats.rrIntervals.length);
+
+    var windowBeats = analyzer.getBeats();
+    assert.deepStrictEqual(Array.from(windowBeats.rrIntervals), beats.rrIntervals);
+    windowBeats.timeInSeconds.forEach(function (time, index) {
+      assertWithin(time, beats.timeInSeconds[index], 1e-9, 'beat time');
+    });
+  });
+
+  it('matches the mean RR and SDNN of the intervals', function () {
+    var n = beats.rrIntervals.length;
+    var mean = beats.rrIntervals.reduce(function (sum, rr) { return sum + rr; }, 0) / n;
+    var variance = beats.rrIntervals.reduce(function (sum, rr) { return sum + (rr - mean) * (rr - mean); }, 0) / (n - 1);
+
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_MeanRR], mean, 1e-9, 'mean RR');
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_MeanHR], 60000 / mean, 1e-9, 'mean HR');
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_SDNN], Math.sqrt(variance), 1e-6, 'SDNN');
+
+    var squaredDifferences = 0;
+    for (var i = 1; i < n; i++) {
+      squaredDifferences += Math.pow(beats.rrIntervals[i] - beats.rrIntervals[i - 1], 2);
+    }
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_RMSSD], Math.sqrt(squaredDifferences / (n - 1)), 1e-6, 'RMSSD');
+  });
+
+  it('puts the modulation power in the LF and HF bands', function () {
+    var lfPower = LF_AMPLITUDE * LF_AMPLITUDE / 2;
+    var hfPower = HF_AMPLITUDE * HF_AMPLITUDE / 2;
+
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_LFPower], lfPower, lfPower * 0.1, 'LF power');
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_HFPower], hfPower, hfPower * 0.1, 'HF power');
+    assertWithin(metrics[hsl.HRVAnalyzer.Metric_LFHFRatio], lfPower / hfPower, lfPower / hfPower * 0.15, 'LF/HF');
+    assert.ok(metrics[hsl.HRVAnalyzer.Metric_VLFPower] < hfPower * 0.1);
+  });
+});
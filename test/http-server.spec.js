@@ -0,0 +1,129 @@
+var assert = require('assert');
+var http = require('http');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+var MAX_QUEUED_BYTES = 4096;
+
+// Calls done once predicate_fn returns true, checking every 10 ms without blocking the event loop
+function waitFor(predicate_fn, done) {
+  if (predicate_fn()) {
+    done();
+    return;
+  }
+
+  setTimeout(function () { waitFor(predicate_fn, done); }, 10);
+}
+
+sim.describeSimulator('HSLHttpServer', function () {
+  this.timeout(10000);
+
+  var previousSettings;
+  var server = null;
+  var port = 0;
+
+  function get(pathname, callback) {
+    return http.get({ host: '127.0.0.1', port: port, path: pathname }, callback);
+  }
+
+  function getText(pathname, done) {
+    get(pathname, function (response) {
+      var body = '';
+
+      response.setEncoding('utf8');
+      response.on('data', function (chunk) { body += chunk; });
+      response.on('end', function () { done(response, body); });
+    });
+  }
+
+  before(function (done) {
+    previousSettings = sim.useFastSettings();
+    sim.stopAllSensors();
+    sim.getFirstSensor().setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+
+    // Port 0 picks any free port
+    server = new hsl.HSLHttpServer(0, {}, {
+      maxQueuedBytes: MAX_QUEUED_BYTES,
+      slowClientPolicy: hsl.SlowClientPolicy.Disconnect
+    });
+    server.start();
+    server.httpServer.once('listening', function () {
+      port = server.httpServer.address().port;
+      done();
+    });
+  });
+
+  after(function (done) {
+    if (server == null) {
+      done();
+      return;
+    }
+
+    // Stops the sensor client once the last connection is gone
+    server.stop();
+    waitFor(function () { return server.httpServer == null; }, function () {
+      sim.stopAllSensors();
+      hsl.setSimulatorSettings(previousSettings);
+      done();
+    });
+  });
+
+  it('serves its stats as Prometheus text on /metrics', function (done) {
+    getText('/metrics', function (response, body) {
+      assert.strictEqual(response.statusCode, 200);
+      assert.strictEqual(response.headers['content-type'], 'text/plain; version=0.0.4');
+
+      var lines = body.trim().split('\n');
+      assert.ok(lines.indexOf('# TYPE hsl_uptime_seconds gauge') >= 0);
+      assert.ok(lines.indexOf('# TYPE hsl_pipeline_duration_seconds summary') >= 0);
+
+      // Every sample is a metric name, optional labels and a number
+      lines.filter(function (line) { return line[0] != '#'; }).forEach(function (line) {
+        assert.ok(/^[a-z_]+(\{[a-z_]+="[^"]*"(,[a-z_]+="[^"]*")*\})? (-?[0-9.]+(e[-+]?[0-9]+)?|NaN)$/.test(line), line);
+      });
+
+      var uptime = lines.find(function (line) { return line.startsWith('hsl_uptime_seconds '); });
+      assert.ok(Number(uptime.split(' ')[1]) > 0);
+      done();
+    });
+  });
+
+  it('lists connected stream clients in /metrics', function (done) {
+    var request = get('/data', function (response) {
+      assert.strictEqual(response.statusCode, 200);
+
+      response.once('data', function () {
+        getText('/metrics', function (metricsResponse, body) {
+          assert.ok(body.indexOf('hsl_client_messages_sent_total{client="0",transport="sse"} ') >= 0, body);
+
+          request.destroy();
+          waitFor(function () { return server.clients.length == 0; }, done);
+        });
+      });
+    });
+  });
+
+  it('disconnects a client that falls more than maxQueuedBytes behind', function (done) {
+    get('/data', function (response) {
+      response.once('data', function () {
+        assert.strictEqual(server.clients.length, 1);
+        var client = server.clients[0];
+
+        // Filling the loopback socket buffers would take megabytes, so the connection reports
+        // them full from here on and everything sent after queues up
+        client.connection.write = function () { return false; };
+
+        response.on('close', function () {
+          var stats = client.getStats();
+
+          assert.ok(client.closed);
+          assert.ok(stats.blocked);
+          assert.strictEqual(stats.queuedBytes, 0);
+          assert.strictEqual(server.clients.length, 0);
+          done();
+        });
+      });
+    });
+  });
+});
@@ -0,0 +1,134 @@
+var assert = require('assert');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+function collectFrameTimes(batch, out_times) {
+  if (batch == null) return;
+
+  for (var i = 0; i < batch.frameCount; i++) {
+    out_times.push(batch.timeInSeconds[i]);
+  }
+}
+
+sim.describeSimulator('session recording and replay', function () {
+  this.timeout(15000);
+
+  var sessionPath = path.join(os.tmpdir(), 'hsl-session-' + process.pid + '.hslsession');
+  var previousSettings;
+  var sensorId;
+  var recordedTimes = [];
+  var recording = null;
+
+  before(function () {
+    previousSettings = sim.useFastSettings();
+    sim.stopAllSensors();
+
+    var sensor = sim.getFirstSensor();
+    sensorId = sensor.getSensorID();
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+    sim.runUpdates(50);
+    sensor.flushHeartECGBuffer();
+
+    // Draining while recording shows the recorder doesn't depend on the buffers being left alone
+    assert.strictEqual(hsl.startRecording(sessionPath), true);
+    sim.runUpdates(800, function () { collectFrameTimes(sensor.drainECG(), recordedTimes); });
+    recording = hsl.stopRecording();
+
+    sim.stopAllSensors();
+  });
+
+  after(function () {
+    hsl.stopReplay();
+    if (hsl.isRecording()) hsl.stopRecording();
+    if (fs.existsSync(sessionPath)) fs.unlinkSync(sessionPath);
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  afterEach(function () {
+    hsl.stopReplay();
+  });
+
+  it('writes every frame to the session file', function () {
+    assert.ok(recording != null);
+    assert.strictEqual(recording.success, true);
+    assert.ok(recordedTimes.length > 0);
+    assert.strictEqual(recording.frameCount, recordedTimes.length);
+    assert.strictEqual(fs.statSync(sessionPath).size, recording.byteLength);
+  });
+
+  it('replays the recorded frames with their original times', function () {
+    var liveSensor = sim.getFirstSensor();
+
+    var replay = hsl.startReplay(sessionPath, { realtime: false, stepSeconds: 0.05 });
+    assert.strictEqual(hsl.isReplaying(), true);
+    assert.strictEqual(replay.sensorCount, 1);
+    assert.strictEqual(replay.frameCount, recordedTimes.length);
+    assert.strictEqual(replay.startTime, recordedTimes[0]);
+    assert.strictEqual(replay.endTime, recordedTimes[recordedTimes.length - 1]);
+
+    // Wrappers of the live sensors are detached by the switch
+    assert.strictEqual(liveSensor.getDeviceFriendlyName(), null);
+    assert.strictEqual(liveSensor.drainECG(), null);
+
+    var sensor = sim.getFirstSensor();
+    assert.strictEqual(sensor.getSensorID(), sensorId);
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+
+    var replayedTimes = [];
+    sim.updateUntil(function () {
+      collectFrameTimes(sensor.drainECG(), replayedTimes);
+      return hsl.isReplayFinished();
+    });
+    collectFrameTimes(sensor.drainECG(), replayedTimes);
+
+    assert.deepStrictEqual(replayedTimes, recordedTimes);
+  });
+
+  it('seeks to a session time', function () {
+    var replay = hsl.startReplay(sessionPath, { realtime: false, stepSeconds: 0.05 });
+    var sensor = sim.getFirstSensor();
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_ECGData, true);
+    sim.runUpdates(50);
+
+    var seekTime = recordedTimes[Math.floor(recordedTimes.length / 2)];
+    assert.strictEqual(hsl.seekReplay(seekTime), true);
+    assert.strictEqual(hsl.getReplayTime(), seekTime);
+
+    // Frames staged before the seek are dropped, playback picks up at the seek time
+    assert.strictEqual(sensor.drainECG(), null);
+
+    var afterSeek = [];
+    sim.updateUntil(function () {
+      collectFrameTimes(sensor.drainECG(), afterSeek);
+      return afterSeek.length > 0;
+    });
+    assert.strictEqual(afterSeek[0], seekTime);
+    assert.deepStrictEqual(afterSeek, recordedTimes.slice(recordedTimes.indexOf(seekTime), recordedTimes.indexOf(seekTime) + afterSeek.length));
+
+    // Seeking back replays the session from its start
+    assert.strictEqual(hsl.seekReplay(replay.startTime - 1), true);
+    assert.strictEqual(hsl.getReplayTime(), replay.startTime);
+
+    var fromStart = [];
+    sim.updateUntil(function () {
+      collectFrameTimes(sensor.drainECG(), fromStart);
+      return fromStart.length > 0;
+    });
+    assert.strictEqual(fromStart[0], recordedTimes[0]);
+  });
+
+  it('switches back to the live sensors', function () {
+    hsl.startReplay(sessionPath, { realtime: false });
+    var replaySensor = sim.getFirstSensor();
+
+    assert.strictEqual(hsl.stopReplay(), true);
+    assert.strictEqual(hsl.isReplaying(), false);
+    assert.strictEqual(hsl.getReplayTime(), null);
+    assert.strictEqual(replaySensor.getDeviceFriendlyName(), null);
+    assert.ok(sim.getFirstSensor().getDeviceFriendlyName() != null);
+  });
+});
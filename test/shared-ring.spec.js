@@ -0,0 +1,166 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+var CAPACITY = 16;
+
+sim.describeSimulator('SharedSampleRing and SharedSampleReader', function () {
+  this.timeout(10000);
+
+  var previousSettings;
+  var sensorId;
+  var ring = null;
+  var readers = [];
+
+  function openRing(overflow) {
+    ring = new hsl.SharedSampleRing(sensorId, hsl.BufferIterator.BufferType_HRData, {
+      capacity: CAPACITY,
+      overflow: overflow
+    });
+
+    return ring;
+  }
+
+  function openReader(options) {
+    var reader = new hsl.SharedSampleReader(ring.getBuffer(), options);
+    readers.push(reader);
+
+    return reader;
+  }
+
+  // Feeds the ring until it has been offered well over its capacity, written or dropped
+  function overfill() {
+    sim.updateUntil(function () {
+      var stats = ring.getStats();
+      return stats.head + stats.dropped >= CAPACITY * 3;
+    });
+  }
+
+  before(function () {
+    // HR rows are one per frame, 200 frames a second laps a 16 sample ring within a few updates
+    previousSettings = sim.useFastSettings({ hrFrameRate: 200 });
+    sim.stopAllSensors();
+
+    var sensor = sim.getFirstSensor();
+    sensorId = sensor.getSensorID();
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_HRData, true);
+  });
+
+  after(function () {
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  afterEach(function () {
+    readers.forEach(function (reader) { reader.close(); });
+    readers = [];
+
+    if (ring != null) ring.close();
+    ring = null;
+  });
+
+  it('rejects unknown overflow policies', function () {
+    assert.throws(function () { openRing(2); }, RangeError);
+  });
+
+  it('laps a lagging reader under drop-oldest and reports the lost samples', function () {
+    openRing(hsl.SharedSampleRing.Overflow_DropOldest);
+    var reader = openReader();
+    overfill();
+
+    var stats = ring.getStats();
+    assert.strictEqual(stats.readers, 1);
+    assert.ok(stats.head > CAPACITY);
+
+    // The writer counts what it overwrote unread, the reader finds the same gap from the head
+    assert.strictEqual(reader.available(), stats.head);
+    assert.strictEqual(stats.dropped, stats.head - CAPACITY);
+
+    var read = 0;
+    var lost = 0;
+    for (var samples = reader.acquire(); samples != null; samples = reader.acquire()) {
+      read += samples.count;
+      lost += samples.lost;
+      assert.strictEqual(samples.channelCount, 1);
+      assert.strictEqual(reader.release(), true);
+    }
+
+    assert.strictEqual(read, CAPACITY);
+    assert.strictEqual(lost, stats.dropped);
+    assert.strictEqual(reader.lostSamples, lost);
+    assert.strictEqual(reader.available(), 0);
+  });
+
+  it('flags samples overwritten while they were acquired', function () {
+    openRing(hsl.SharedSampleRing.Overflow_DropOldest);
+    var reader = openReader();
+
+    sim.updateUntil(function () { return reader.available() > 0; });
+    var samples = reader.acquire();
+    assert.ok(samples != null);
+
+    overfill();
+    assert.strictEqual(reader.release(), false);
+  });
+
+  it('holds the writer back under drop-newest', function () {
+    openRing(hsl.SharedSampleRing.Overflow_DropNewest);
+    var reader = openReader();
+    overfill();
+
+    // The writer stops at the reader's tail and counts what it refused
+    var stats = ring.getStats();
+    assert.strictEqual(stats.head, CAPACITY);
+    assert.ok(stats.dropped > 0);
+
+    var samples = reader.acquire();
+    assert.strictEqual(samples.count, CAPACITY);
+    assert.strictEqual(samples.lost, 0);
+    for (var i = 1; i < samples.count; i++) {
+      assert.ok(samples.timeInSeconds[i] >= samples.timeInSeconds[i - 1]);
+    }
+    assert.strictEqual(reader.release(), true);
+
+    // Releasing makes room again
+    sim.updateUntil(function () { return ring.getStats().head > CAPACITY; });
+  });
+
+  it('only waits on readers that are active', function () {
+    openRing(hsl.SharedSampleRing.Overflow_DropNewest);
+    var Ring = hsl.SharedSampleRing;
+    var header = new Int32Array(ring.getBuffer(), 0, Ring.Field_COUNT);
+
+    // A reader that claimed its slot but never published a tail doesn't hold the writer back
+    assert.strictEqual(
+      Atomics.compareExchange(header, Ring.Field_ReaderStates, Ring.ReaderState_Free, Ring.ReaderState_Claiming),
+      Ring.ReaderState_Free);
+    overfill();
+
+    var stats = ring.getStats();
+    assert.strictEqual(stats.readers, 0);
+    assert.ok(stats.head > CAPACITY);
+    assert.strictEqual(stats.dropped, 0);
+
+    // New readers skip the claimed slot, and start at the head
+    var reader = openReader();
+    assert.strictEqual(reader.slot, 1);
+    assert.strictEqual(reader.available(), 0);
+
+    Atomics.store(header, Ring.Field_ReaderStates, Ring.ReaderState_Free);
+  });
+
+  it('hands out each reader slot once', function () {
+    openRing(hsl.SharedSampleRing.Overflow_DropOldest);
+    var maxReaders = new Int32Array(ring.getBuffer(), 0, hsl.SharedSampleRing.Field_COUNT)[hsl.SharedSampleRing.Field_MaxReaders];
+
+    for (var i = 0; i < maxReaders; i++) {
+      assert.strictEqual(openReader().slot, i);
+    }
+    assert.strictEqual(ring.getStats().readers, maxReaders);
+    assert.throws(function () { openReader(); }, /reader slot/);
+
+    readers[3].close();
+    assert.strictEqual(openReader().slot, 3);
+  });
+});
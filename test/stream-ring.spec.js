@@ -0,0 +1,129 @@
+var assert = require('assert');
+var sim = require('./helpers/simulator');
+
+var hsl = sim.hsl;
+
+var CAPACITY = 8;
+
+sim.describeSimulator('StreamRing overflow policies', function () {
+  this.timeout(10000);
+
+  var previousSettings;
+  var sensor;
+  var ring = null;
+
+  function openRing(overflow) {
+    ring = new hsl.StreamRing(sensor.getSensorID(), hsl.BufferIterator.BufferType_HRData, {
+      capacity: CAPACITY,
+      overflow: overflow
+    });
+
+    return ring;
+  }
+
+  // Feeds the ring until it has been offered well over its capacity, written or dropped
+  function overfill() {
+    sim.updateUntil(function () {
+      var stats = ring.getStats();
+      return stats.writeSequence + stats.framesDropped >= CAPACITY * 3;
+    });
+  }
+
+  before(function () {
+    // 200 HR frames a second laps an 8 frame ring within a few updates
+    previousSettings = sim.useFastSettings({ hrFrameRate: 200 });
+    sim.stopAllSensors();
+
+    sensor = sim.getFirstSensor();
+    sensor.setDataStreamActive(hsl.Sensor.StreamFlags_HRData, true);
+  });
+
+  after(function () {
+    sim.stopAllSensors();
+    hsl.setSimulatorSettings(previousSettings);
+  });
+
+  afterEach(function () {
+    if (ring != null) ring.close();
+    ring = null;
+  });
+
+  it('rejects unknown overflow policies', function () {
+    [2, -1].forEach(function (overflow) {
+      assert.throws(function () { openRing(overflow); }, RangeError);
+    });
+  });
+
+  it('allows one ring per sensor stream', function () {
+    openRing(hsl.StreamRing.Overflow_DropOldest);
+    var first = ring;
+
+    assert.throws(function () { openRing(hsl.StreamRing.Overflow_DropOldest); }, /already exists/);
+
+    first.close();
+    openRing(hsl.StreamRing.Overflow_DropOldest);
+  });
+
+  it('drops and overwrites nothing without open cursors', function () {
+    [hsl.StreamRing.Overflow_DropOldest, hsl.StreamRing.Overflow_DropNewest].forEach(function (overflow) {
+      openRing(overflow);
+      overfill();
+
+      var stats = ring.getStats();
+      assert.strictEqual(stats.framesDropped, 0);
+      assert.strictEqual(stats.framesOverwritten, 0);
+
+      ring.close();
+    });
+  });
+
+  it('owns the stream it is attached to', function () {
+    openRing(hsl.StreamRing.Overflow_DropOldest);
+    sim.runUpdates(50);
+
+    // Drains feed the ring instead of returning a batch
+    assert.strictEqual(sensor.drainHR(), null);
+    assert.ok(ring.getStats().writeSequence > 0);
+  });
+
+  it('overwrites the oldest frames under drop-oldest', function () {
+    openRing(hsl.StreamRing.Overflow_DropOldest);
+    var cursor = ring.openCursor();
+    overfill();
+
+    var stats = ring.getStats();
+    assert.ok(stats.framesOverwritten > 0);
+    assert.strictEqual(stats.framesDropped, 0);
+
+    // The lagging cursor skips ahead to the oldest frame still in the ring
+    var batch = cursor.read();
+    assert.ok(batch != null);
+    assert.ok(batch.frameCount <= CAPACITY);
+    assert.ok(cursor.getLostFrames() > 0);
+    assert.strictEqual(cursor.getLostFrames() + batch.frameCount, ring.getStats().writeSequence);
+    assert.strictEqual(cursor.read(), null);
+
+    cursor.close();
+  });
+
+  it('rejects new frames under drop-newest', function () {
+    openRing(hsl.StreamRing.Overflow_DropNewest);
+    var cursor = ring.openCursor();
+    overfill();
+
+    var stats = ring.getStats();
+    assert.ok(stats.framesDropped > 0);
+    assert.strictEqual(stats.framesOverwritten, 0);
+    assert.strictEqual(stats.writeSequence, CAPACITY);
+
+    // The cursor keeps every frame it had not read yet
+    var batch = cursor.read();
+    assert.strictEqual(batch.frameCount, CAPACITY);
+    assert.strictEqual(cursor.getLostFrames(), 0);
+
+    // Reading frees the space, so the ring accepts frames again
+    sim.updateUntil(function () { return ring.getStats().writeSequence > CAPACITY; });
+
+    cursor.close();
+  });
+});